@@ -1,7 +1,9 @@
 #include "MemoryBackend.h"
 #include "RTree.h"
+#include "RenderProfiler.h"
 
 #include <QReadWriteLock>
+#include <QVector>
 
 RenderPriority NodePri(RenderPriority::IsSingular,0., 0);
 RenderPriority SegmentPri(RenderPriority::IsLinear,0.,99);
@@ -22,6 +24,24 @@ public:
     QHash<Feature*, CoordBox> AllocFeatures;
     QHash<ILayer*, CoordTree*> theRTree;
     QList<Feature*> findResult;
+
+    /* Change log; ChangeBase is the mark of its first entry */
+    QVector<Feature*> ChangeLog;
+    int ChangeBase;
+
+    MemoryBackendPrivate()
+        : ChangeBase(0)
+    {}
+
+    void logChange(Feature* f)
+    {
+        if (ChangeLog.size() >= 16384) {
+            int Dropped = ChangeLog.size() / 2;
+            ChangeLog.remove(0, Dropped);
+            ChangeBase += Dropped;
+        }
+        ChangeLog.append(f);
+    }
 };
 
 bool indexFindCallbackList(Feature* F, void* ctxt)
@@ -36,6 +56,7 @@ bool indexFindCallback(Feature* F, void* ctxt)
 
     if (!F->isVisible())
         return true;
+    RenderProfiler::count(RenderProfiler::FeaturesQueried);
 
     if (CHECK_WAY(F)) {
         Way * R = STATIC_CAST_WAY(F);
@@ -134,6 +155,7 @@ void MemoryBackend::get(ILayer* l, const QRectF& bb, QList<Feature*>& theFeature
 void MemoryBackend::getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
                                   const QList<CoordBox>& invalidRects, Projection& theProjection)
 {
+    ProfileScope theProfileScope(RenderProfiler::FeatureQuery);
     IndexFindContext ctxt;
     ctxt.theFeatures = &theFeatures;
     ctxt.theProjection = &theProjection;
@@ -147,6 +169,7 @@ void MemoryBackend::getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*
 void MemoryBackend::getFeatureSet(ILayer* l, QMap<RenderPriority, QSet <Feature*> >& theFeatures,
                                   const CoordBox& invalidRect, Projection& theProjection)
 {
+    ProfileScope theProfileScope(RenderProfiler::FeatureQuery);
     IndexFindContext ctxt;
     ctxt.theFeatures = &theFeatures;
     ctxt.theProjection = &theProjection;
@@ -331,6 +354,7 @@ void MemoryBackend::deallocFeature(ILayer* l, Feature *f)
     p->toBeDeletedLock.lock();
     if (p->AllocFeatures.contains(f)) {
         indexRemove(l, p->AllocFeatures[f], f);
+        p->logChange(f);
         if (!p->AllocFeatures.remove(f)) {
             qWarning() << "Feature, that is not in a list is being removed.";
         } else {
@@ -377,19 +401,45 @@ void MemoryBackend::sync(Feature *f)
 {
     if (p->AllocFeatures.contains(f) && !p->AllocFeatures[f].isNull())
         indexRemove(f->layer(), p->AllocFeatures[f], f);
+    p->logChange(f);
+    if (isIndexable(f)) {
+        CoordBox bb = f->boundingBox();
+        if (!bb.isNull()) {
+            indexAdd(f->layer(), bb, f);
+        }
+    }
+}
+
+bool MemoryBackend::isIndexable(Feature *f) const
+{
+    /* Untagged way nodes are found through their ways */
     if (CHECK_NODE(f)) {
         Node* N = STATIC_CAST_NODE(f);
         if (!N->tagSize())
             for (int i=0; i<N->sizeParents(); ++i)
                 if (CHECK_WAY(N->getParent(i)))
-                    return;
-    }
-    if (!f->isDeleted() && f->layer()) {
-        CoordBox bb = f->boundingBox();
-        if (!bb.isNull()) {
-            indexAdd(f->layer(), bb, f);
-        }
+                    return false;
     }
+    return !f->isDeleted() && f->layer();
+}
+
+bool MemoryBackend::isAllocated(Feature *f) const
+{
+    return p->AllocFeatures.contains(f);
+}
+
+int MemoryBackend::changeMark() const
+{
+    return p->ChangeBase + p->ChangeLog.size();
+}
+
+bool MemoryBackend::changesSince(int mark, QList<Feature*>& changed) const
+{
+    if (mark < p->ChangeBase)
+        return false;
+    for (int i=mark - p->ChangeBase; i<p->ChangeLog.size(); ++i)
+        changed.append(p->ChangeLog[i]);
+    return true;
 }
 
 
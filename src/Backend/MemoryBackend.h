@@ -56,6 +56,14 @@ public:
     virtual void indexAdd(ILayer* l, const QRectF& bb, Feature* aFeat);
     virtual void indexRemove(ILayer* l, const QRectF& bb, Feature* aFeat);
 
+    /* Every sync or dealloc is logged, so that derived indexes can catch up
+       without a full rebuild. changesSince returns false when the log no
+       longer reaches back to mark. */
+    virtual int changeMark() const;
+    virtual bool changesSince(int mark, QList<Feature*>& changed) const;
+    virtual bool isAllocated(Feature* f) const;
+    virtual bool isIndexable(Feature* f) const;
+
 };
 
 #endif // MEMORYBACKEND_H
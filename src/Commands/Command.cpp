@@ -8,19 +8,22 @@
 #include "RelationCommands.h"
 #include "NodeCommands.h"
 #include "FeatureCommands.h"
+#include "CommandJournal.h"
 
 #include <QApplication>
 #include <QAction>
 #include <QListWidget>
 #include <QUuid>
 #include <QProgressDialog>
+#include <QTemporaryFile>
+#include <QDir>
 
 #include <algorithm>
 #include <utility>
 #include <QList>
 
 Command::Command(Feature* aF)
-    : mainFeature(aF), commandDirtyLevel(0), isUndone(false)
+    : mainFeature(aF), commandDirtyLevel(0), isUndone(false), Detached(false)
 {
     description = QApplication::translate("Command", "No description");
 }
@@ -89,11 +92,32 @@ int Command::getDirtyLevel()
     return commandDirtyLevel;
 }
 
+int Command::weight() const
+{
+    return 1;
+}
+
+void Command::detach()
+{
+    // The layers keep counting this command as dirty: it will be read back
+    // with the same level
+    commandDirtyLevel = 0;
+    Detached = true;
+}
+
+void Command::journalTouch(Feature* F)
+{
+    Layer* L = F->layer();
+    if (L && L->getDocument() && L->getDocument()->journal())
+        L->getDocument()->journal()->touch(F);
+}
+
 void Command::undo()
 {
     if (mainFeature) {
         isUndone = true;
         mainFeature->notifyChanges();
+        journalTouch(mainFeature);
     }
 }
 
@@ -102,6 +126,7 @@ void Command::redo()
     if (mainFeature) {
         isUndone = false;
         mainFeature->notifyChanges();
+        journalTouch(mainFeature);
     }
 }
 
@@ -116,7 +141,9 @@ bool Command::toXML(QXmlStreamWriter& stream) const
         stream.writeAttribute("oldCreated", oldCreated);
         if (isUndone)
             stream.writeAttribute("undone", "true");
-//        stream.writeAttribute("description", description);
+        if (commandDirtyLevel)
+            stream.writeAttribute("dirtylevel", QString::number(commandDirtyLevel));
+        stream.writeAttribute("description", description);
         stream.writeEndElement();
     }
 
@@ -134,6 +161,8 @@ void Command::fromXML(Document* d, QXmlStreamReader& stream, Command* C)
         C->oldCreated = stream.attributes().value("oldCreated").toString();
     if (stream.attributes().hasAttribute("undone"))
         C->isUndone = (stream.attributes().value("undone") == "true" ? true : false);
+    if (stream.attributes().hasAttribute("dirtylevel"))
+        C->commandDirtyLevel = stream.attributes().value("dirtylevel").toString().toInt();
     if (stream.attributes().hasAttribute("description"))
         C->description = stream.attributes().value("description").toString();
     C->mainFeature = F;
@@ -180,6 +209,21 @@ int CommandList::size()
     return Size;
 }
 
+int CommandList::weight() const
+{
+    int w = 1;
+    for (int i=0; i<Subs.size(); ++i)
+        w += Subs[i]->weight();
+    return w;
+}
+
+void CommandList::detach()
+{
+    Command::detach();
+    for (int i=0; i<Subs.size(); ++i)
+        Subs[i]->detach();
+}
+
 void CommandList::redo()
 {
     if (!isReversed) {
@@ -202,20 +246,36 @@ void CommandList::undo()
     }
 }
 
-bool CommandList::buildDirtyList(DirtyList& theList)
+/// Processed commands are moved, in order, behind the live ones in a single
+/// pass (they are kept alive, as the features may still refer to them).
+/// The commands before First are left alone.
+static int partitionProcessed(QList<Command*>& Subs, int First, int Size, DirtyList& theList)
 {
-    for (int i=0; i<Size;)
+    QList<Command*> Kept, Done;
+    Kept.reserve(Subs.size());
+    for (int i=0; i<First; ++i)
+        Kept.append(Subs[i]);
+    for (int i=First; i<Size; ++i)
     {
         if (Subs[i]->buildDirtyList(theList))
-        {
-            //delete Subs[i];
-            //Subs.erase(Subs.begin()+i);
-            std::rotate(Subs.begin()+i,Subs.begin()+i+1,Subs.end());
-            --Size;
-        }
+            Done.append(Subs[i]);
         else
-            ++i;
+            Kept.append(Subs[i]);
     }
+    if (Done.isEmpty())
+        return 0;
+
+    for (int i=Size; i<Subs.size(); ++i)
+        Kept.append(Subs[i]);
+    Kept.append(Done);
+    Subs = Kept;
+
+    return Done.size();
+}
+
+bool CommandList::buildDirtyList(DirtyList& theList)
+{
+    Size -= partitionProcessed(Subs, 0, Size, theList);
 
     return Size == 0;
 }
@@ -263,56 +323,10 @@ CommandList* CommandList::fromXML(Document* d, QXmlStreamReader& stream)
 
     stream.readNext();
     while(!stream.atEnd() && !stream.isEndElement()) {
-        if (stream.name() == "AddFeatureCommand") {
-            AddFeatureCommand* C = AddFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "MoveTrackPointCommand") {
-            MoveNodeCommand* C = MoveNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RelationAddFeatureCommand") {
-            RelationAddFeatureCommand* C = RelationAddFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RelationRemoveFeatureCommand") {
-            RelationRemoveFeatureCommand* C = RelationRemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RemoveFeatureCommand") {
-            RemoveFeatureCommand* C = RemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RoadAddTrackPointCommand") {
-            WayAddNodeCommand* C = WayAddNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "RoadRemoveTrackPointCommand") {
-            WayRemoveNodeCommand* C = WayRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "TrackSegmentAddTrackPointCommand") {
-            TrackSegmentAddNodeCommand* C = TrackSegmentAddNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "TrackSegmentRemoveTrackPointCommand") {
-            TrackSegmentRemoveNodeCommand* C = TrackSegmentRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "ClearTagCommand") {
-            ClearTagCommand* C = ClearTagCommand::fromXML(d, stream);
+        Command* C = NULL;
+        if (CommandHistory::commandFromXML(d, stream, C)) {
             if (C)
                 l->add(C);
-        } else if (stream.name() == "ClearTagsCommand") {
-            ClearTagsCommand* C = ClearTagsCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "SetTagCommand") {
-            SetTagCommand* C = SetTagCommand::fromXML(d, stream);
-            if (C)
-                l->add(C);
-        } else if (stream.name() == "CommandList") {
-            l->add(CommandList::fromXML(d, stream));
         } else if (!stream.isWhitespace()) {
                 qDebug() << "CList: logic error: " << stream.name() << " : " << stream.tokenType() << " (" << stream.lineNumber() << ")";
                 QString el = stream.readElementText(QXmlStreamReader::IncludeChildElements);
@@ -332,8 +346,33 @@ CommandList* CommandList::fromXML(Document* d, QXmlStreamReader& stream)
 
 // COMMANDHISTORY
 
+/// The oldest commands of the history, serialised to a temporary file once
+/// the history outgrows UndoHistoryLimit. They always form the head of the
+/// history: their slots in Subs are NULL.
+class CommandSpill
+{
+    public:
+        struct Record
+        {
+            qint64 Offset;
+            int Length;
+            int Weight;
+            QString Description;
+            bool HasFeature;
+            IFeature::FId Feature;
+        };
+
+        CommandSpill()
+            : File(QDir::tempPath() + "/merkaartor_undo_XXXXXX")
+        {
+        }
+
+        QTemporaryFile File;
+        QList<Record> Records;
+};
+
 CommandHistory::CommandHistory()
-: Index(0), Size(0), UndoAction(0), RedoAction(0), UploadAction(0)
+: Index(0), Size(0), theDocument(0), Spill(0), MemoryWeight(0), UndoAction(0), RedoAction(0), UploadAction(0)
 {
 }
 
@@ -347,16 +386,155 @@ void CommandHistory::cleanup()
     //FIXME Is there a point to this?
     //for (int i=Index; i<Subs.size(); ++i)
     //	Subs[i]->redo();
+    if (Spill) {
+        // Read the spilled commands back one at a time, so that their
+        // destructors still release what they hold
+        for (int i=0; i<Spill->Records.size(); ++i)
+            delete loadSpilled(i);
+        SAFE_DELETE(Spill);
+    }
     qDeleteAll(Subs);
     Subs.clear();
     Index = 0;
     Size = 0;
+    MemoryWeight = 0;
+}
+
+void CommandHistory::discardSpill()
+{
+    if (!Spill)
+        return;
+    for (int i=0; i<Spill->Records.size(); ++i)
+        Subs.removeFirst();
+    Index -= Spill->Records.size();
+    Size -= Spill->Records.size();
+    SAFE_DELETE(Spill);
+}
+
+void CommandHistory::setDocument(Document* aDoc)
+{
+    theDocument = aDoc;
+}
+
+int CommandHistory::memoryWeight() const
+{
+    return MemoryWeight;
+}
+
+int CommandHistory::spilledSize() const
+{
+    return Spill ? Spill->Records.size() : 0;
+}
+
+qint64 CommandHistory::spillFileSize() const
+{
+    return Spill ? Spill->File.size() : 0;
+}
+
+void CommandHistory::enforceMemoryLimit()
+{
+    int Limit = M_PREFS->getUndoHistoryLimit();
+    if (Limit <= 0 || !theDocument)
+        return;
+
+    // The last command always stays in memory
+    while (MemoryWeight > Limit && spilledSize() < Index-1)
+        if (!spill())
+            break;
+}
+
+bool CommandHistory::spill()
+{
+    if (!Spill) {
+        Spill = new CommandSpill;
+        if (!Spill->File.open()) {
+            qDebug() << "Undo history: cannot create spill file" << Spill->File.fileName();
+            SAFE_DELETE(Spill);
+            return false;
+        }
+    }
+
+    int i = Spill->Records.size();
+    Command* C = Subs[i];
+    if (!storeSpilled(i, C))
+        return false;
+
+    MemoryWeight -= Spill->Records[i].Weight;
+    C->detach();
+    delete C;
+    Subs[i] = NULL;
+
+    return true;
+}
+
+/* Writes C at the end of the spill file, as record i (a new one if i is the
+   number of records). */
+bool CommandHistory::storeSpilled(int i, Command* C)
+{
+    QByteArray ba;
+    QXmlStreamWriter stream(&ba);
+    if (!C->toXML(stream) || ba.isEmpty())
+        return false;
+
+    CommandSpill::Record R;
+    R.Offset = Spill->File.size();
+    R.Length = ba.size();
+    R.Weight = C->weight();
+    R.Description = C->getDescription();
+    R.HasFeature = (C->getFeature() != NULL);
+    if (R.HasFeature)
+        R.Feature = C->getFeature()->id();
+    if (!Spill->File.seek(R.Offset) || Spill->File.write(ba) != ba.size()) {
+        qDebug() << "Undo history: cannot write to spill file" << Spill->File.fileName();
+        return false;
+    }
+    if (i < Spill->Records.size())
+        Spill->Records[i] = R;
+    else
+        Spill->Records.append(R);
+
+    return true;
+}
+
+Command* CommandHistory::loadSpilled(int i) const
+{
+    const CommandSpill::Record& R = Spill->Records.at(i);
+    if (!Spill->File.seek(R.Offset))
+        return NULL;
+    QByteArray ba = Spill->File.read(R.Length);
+
+    QXmlStreamReader stream(ba);
+    Command* C = NULL;
+    if (stream.readNextStartElement())
+        commandFromXML(theDocument, stream, C);
+    if (!C)
+        qDebug() << "Undo history: cannot read back spilled command" << i;
+
+    return C;
+}
+
+bool CommandHistory::unspill()
+{
+    int i = Spill->Records.size() - 1;
+    Command* C = loadSpilled(i);
+    if (!C)
+        return false;
+
+    Subs[i] = C;
+    MemoryWeight += C->weight();
+    Spill->Records.removeLast();
+    if (Spill->Records.isEmpty())
+        SAFE_DELETE(Spill);
+
+    return true;
 }
 
 void CommandHistory::undo()
 {
     if (Index)
     {
+        if (spilledSize() >= Index && !unspill())
+            return;
         Subs[--Index]->undo();
         updateActions();
     }
@@ -381,6 +559,8 @@ void CommandHistory::add(Command* aCommand)
     Subs.insert(Subs.begin()+Index, aCommand);
     Index++;
     Size = Index;
+    MemoryWeight += aCommand->weight();
+    enforceMemoryLimit();
     updateActions();
 }
 
@@ -412,21 +592,49 @@ int CommandHistory::size() const
     return Size;
 }
 
-int CommandHistory::buildDirtyList(DirtyList& theList)
+/* The spilled commands are read back one at a time. The processed ones are
+   taken out of the spill, the others are written back in their new state. */
+void CommandHistory::buildSpilledDirtyList(DirtyList& theList, QList<Command*>& Done)
 {
-    for (int i=0; i<Subs.size();)
-        if (Subs[i]->buildDirtyList(theList))
-        {
-            //delete Subs[i];
-            //Subs.erase(Subs.begin()+i);
-            std::rotate(Subs.begin()+i,Subs.begin()+i+1,Subs.end());
+    int i = 0;
+    while (Spill && i < Spill->Records.size()) {
+        Command* C = loadSpilled(i);
+        if (!C) {
+            ++i;
+            continue;
+        }
+        if (C->buildDirtyList(theList)) {
+            Spill->Records.removeAt(i);
+            Subs.removeAt(i);
             --Index;
             --Size;
-            if (!Size)
-                cleanup();
-        }
-        else
+            MemoryWeight += C->weight();
+            Done.append(C);
+        } else {
+            if (!storeSpilled(i, C))
+                qDebug() << "Undo history: cannot write back spilled command" << i;
+            C->detach();
+            delete C;
             ++i;
+        }
+    }
+    if (Spill && Spill->Records.isEmpty())
+        SAFE_DELETE(Spill);
+}
+
+int CommandHistory::buildDirtyList(DirtyList& theList)
+{
+    QList<Command*> SpilledDone;
+    buildSpilledDirtyList(theList, SpilledDone);
+
+    // Undone commands never report themselves as processed, so whatever is
+    // taken out comes from before Index
+    int Done = partitionProcessed(Subs, spilledSize(), Size, theList);
+    Index -= Done;
+    Size -= Done;
+    Subs.append(SpilledDone);
+    if ((Done || SpilledDone.size()) && !Size)
+        cleanup();
 
     return Index;
 }
@@ -436,7 +644,12 @@ int CommandHistory::buildUndoList(QListWidget* theList)
     for (int i=0; i<Index; ++i)
         if (!(i < Subs.size()))
             qDebug() << "!!! Error: Undo Index > list size";
-        else
+        else if (!Subs[i]) {
+            const CommandSpill::Record& R = Spill->Records.at(i);
+            QListWidgetItem* it = new QListWidgetItem(R.Description, theList);
+            if (R.HasFeature)
+                it->setData(Qt::UserRole, QVariant::fromValue(R.Feature));
+        } else
             Subs[i]->buildUndoList(theList);
 
     return Index;
@@ -451,7 +664,16 @@ bool CommandHistory::toXML(QXmlStreamWriter& stream, QProgressDialog * /*progres
     stream.writeAttribute("index", QString::number(Index));
 
     for (int i=0; i<Size; ++i) {
-        OK = Subs[i]->toXML(stream);
+        if (!Subs[i]) {
+            Command* C = loadSpilled(i);
+            if (C) {
+                OK = C->toXML(stream);
+                C->detach();
+                delete C;
+            } else
+                OK = false;
+        } else
+            OK = Subs[i]->toXML(stream);
     }
     stream.writeEndElement();
 
@@ -466,80 +688,8 @@ CommandHistory* CommandHistory::fromXML(Document* d, QXmlStreamReader& stream, Q
 
     stream.readNext();
     while(!stream.atEnd() && !stream.isEndElement()) {
-        if (stream.name() == "CommandList") {
-            CommandList* l = CommandList::fromXML(d, stream);
-            if (l)
-                h->add(l);
-            else
-                OK = false;
-        } else if (stream.name() == "AddFeatureCommand") {
-            AddFeatureCommand* C = AddFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "MoveTrackPointCommand") {
-            MoveNodeCommand* C = MoveNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RelationAddFeatureCommand") {
-            RelationAddFeatureCommand* C = RelationAddFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RelationRemoveFeatureCommand") {
-            RelationRemoveFeatureCommand* C = RelationRemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RemoveFeatureCommand") {
-            RemoveFeatureCommand* C = RemoveFeatureCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RoadAddTrackPointCommand") {
-            WayAddNodeCommand* C = WayAddNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "RoadRemoveTrackPointCommand") {
-            WayRemoveNodeCommand* C = WayRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "TrackSegmentAddTrackPointCommand") {
-            TrackSegmentAddNodeCommand* C = TrackSegmentAddNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "TrackSegmentRemoveTrackPointCommand") {
-            TrackSegmentRemoveNodeCommand* C = TrackSegmentRemoveNodeCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "ClearTagCommand") {
-            ClearTagCommand* C = ClearTagCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "ClearTagsCommand") {
-            ClearTagsCommand* C = ClearTagsCommand::fromXML(d, stream);
-            if (C)
-                h->add(C);
-            else
-                OK = false;
-        } else if (stream.name() == "SetTagCommand") {
-            SetTagCommand* C = SetTagCommand::fromXML(d, stream);
+        Command* C = NULL;
+        if (commandFromXML(d, stream, C)) {
             if (C)
                 h->add(C);
             else
@@ -569,3 +719,45 @@ CommandHistory* CommandHistory::fromXML(Document* d, QXmlStreamReader& stream, Q
 }
 
 
+
+bool CommandHistory::commandFromXML(Document* d, QXmlStreamReader& stream, Command*& theCommand)
+{
+    theCommand = NULL;
+
+    if (stream.name() == "CommandList") {
+        theCommand = CommandList::fromXML(d, stream);
+    } else if (stream.name() == "AddFeatureCommand") {
+        theCommand = AddFeatureCommand::fromXML(d, stream);
+    } else if (stream.name() == "MoveTrackPointCommand") {
+        theCommand = MoveNodeCommand::fromXML(d, stream);
+    } else if (stream.name() == "MoveNodesCommand") {
+        theCommand = MoveNodesCommand::fromXML(d, stream);
+    } else if (stream.name() == "AddFeaturesCommand") {
+        theCommand = AddFeaturesCommand::fromXML(d, stream);
+    } else if (stream.name() == "RelationAddFeatureCommand") {
+        theCommand = RelationAddFeatureCommand::fromXML(d, stream);
+    } else if (stream.name() == "RelationRemoveFeatureCommand") {
+        theCommand = RelationRemoveFeatureCommand::fromXML(d, stream);
+    } else if (stream.name() == "RemoveFeatureCommand") {
+        theCommand = RemoveFeatureCommand::fromXML(d, stream);
+    } else if (stream.name() == "RoadAddTrackPointCommand") {
+        theCommand = WayAddNodeCommand::fromXML(d, stream);
+    } else if (stream.name() == "RoadRemoveTrackPointCommand") {
+        theCommand = WayRemoveNodeCommand::fromXML(d, stream);
+    } else if (stream.name() == "TrackSegmentAddTrackPointCommand") {
+        theCommand = TrackSegmentAddNodeCommand::fromXML(d, stream);
+    } else if (stream.name() == "TrackSegmentRemoveTrackPointCommand") {
+        theCommand = TrackSegmentRemoveNodeCommand::fromXML(d, stream);
+    } else if (stream.name() == "TrackSegmentSetPointsCommand") {
+        theCommand = TrackSegmentSetPointsCommand::fromXML(d, stream);
+    } else if (stream.name() == "ClearTagCommand") {
+        theCommand = ClearTagCommand::fromXML(d, stream);
+    } else if (stream.name() == "ClearTagsCommand") {
+        theCommand = ClearTagsCommand::fromXML(d, stream);
+    } else if (stream.name() == "SetTagCommand") {
+        theCommand = SetTagCommand::fromXML(d, stream);
+    } else
+        return false;
+
+    return true;
+}
@@ -12,6 +12,7 @@ class Layer;
 class Feature;
 class DirtyList;
 class CommandList;
+class CommandSpill;
 
 class QAction;
 class QListWidget;
@@ -28,6 +29,13 @@ class Command
         virtual bool buildDirtyList(DirtyList& theList) = 0;
         virtual bool buildUndoList(QListWidget* theList);
 
+        /// Rough size of the command, in elementary edits.
+        virtual int weight() const;
+        /// Called before deleting a command that still belongs to the history
+        /// (i.e. it was spilled to disk): its destructor must then leave the
+        /// document alone.
+        virtual void detach();
+
         void setId(const QString& id);
         const QString& id() const;
         virtual bool toXML(QXmlStreamWriter& stream) const;
@@ -43,6 +51,8 @@ class Command
         int getDirtyLevel();
 
     protected:
+        static void journalTouch(Feature* F);
+
         mutable QString Id;
         QString description;
         Feature* mainFeature;
@@ -50,6 +60,7 @@ class Command
         QString oldCreated;
         bool isUndone;
         bool wasUploaded;
+        bool Detached;
 };
 
 class CommandList : public Command
@@ -65,6 +76,8 @@ class CommandList : public Command
         int size();
         void add(Command* aCommand);
         virtual bool buildDirtyList(DirtyList& theList);
+        virtual int weight() const;
+        virtual void detach();
         void setReversed(bool val);
 
         virtual bool toXML(QXmlStreamWriter& stream) const;
@@ -93,13 +106,33 @@ class CommandHistory
         int index() const;
         int size() const;
 
+        /// The document the spilled commands are read back into.
+        void setDocument(Document* aDoc);
+        /// Forget the spilled commands without reading them back (the
+        /// document is going away).
+        void discardSpill();
+        int memoryWeight() const;
+        int spilledSize() const;
+        qint64 spillFileSize() const;
+
         virtual bool toXML(QXmlStreamWriter& stream, QProgressDialog * progress) const;
         static CommandHistory* fromXML(Document* d, QXmlStreamReader& stream, QProgressDialog * progress);
+        static bool commandFromXML(Document* d, QXmlStreamReader& stream, Command*& theCommand);
 
     private:
+        void enforceMemoryLimit();
+        bool spill();
+        bool storeSpilled(int i, Command* C);
+        bool unspill();
+        Command* loadSpilled(int i) const;
+        void buildSpilledDirtyList(DirtyList& theList, QList<Command*>& Done);
+
         QList<Command*> Subs;
         int Index;
         int Size;
+        Document* theDocument;
+        CommandSpill* Spill;
+        int MemoryWeight;
         QAction* UndoAction;
         QAction* RedoAction;
         QAction* UploadAction;
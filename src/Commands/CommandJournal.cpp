@@ -0,0 +1,560 @@
+#include "Global.h"
+
+#include "CommandJournal.h"
+#include "Command.h"
+#include "Document.h"
+#include "Layer.h"
+#include "Features.h"
+#include "MerkaartorPreferences.h"
+
+#include <QApplication>
+#include <QFile>
+#include <QSet>
+#include <QDataStream>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QProgressDialog>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define JOURNAL_MAGIC 0x4d4a524e
+#define JOURNAL_RECORD_MAGIC 0x4d4a5245
+#define JOURNAL_VERSION 1
+
+static void syncFile(QFile* aFile)
+{
+    aFile->flush();
+#ifdef Q_OS_WIN
+    _commit(aFile->handle());
+#else
+    fsync(aFile->handle());
+#endif
+}
+
+/* COMMANDJOURNALWRITER */
+
+class CommandJournalWriter : public QThread
+{
+public:
+    CommandJournalWriter(QFile* aFile, qint64 aSavePos)
+        : theFile(aFile), Stopping(false), Busy(false), SavePos(aSavePos)
+    {
+    }
+
+    void enqueue(const QByteArray& aRecord, bool isSavePoint)
+    {
+        QMutexLocker lock(&theMutex);
+        Pending.append(qMakePair(aRecord, isSavePoint));
+        hasWork.wakeOne();
+    }
+
+    /* Wait until every queued record is written and synced */
+    void drain()
+    {
+        QMutexLocker lock(&theMutex);
+        while (!Pending.isEmpty() || Busy)
+            isIdle.wait(&theMutex);
+    }
+
+    void stop()
+    {
+        {
+            QMutexLocker lock(&theMutex);
+            Stopping = true;
+            hasWork.wakeOne();
+        }
+        wait();
+    }
+
+    qint64 savePos()
+    {
+        QMutexLocker lock(&theMutex);
+        return SavePos;
+    }
+
+    void setSavePos(qint64 aPos)
+    {
+        QMutexLocker lock(&theMutex);
+        SavePos = aPos;
+    }
+
+protected:
+    void run()
+    {
+        QMutexLocker lock(&theMutex);
+        forever {
+            while (Pending.isEmpty() && !Stopping)
+                hasWork.wait(&theMutex);
+            if (Pending.isEmpty() && Stopping)
+                break;
+
+            QList<QPair<QByteArray, bool> > Batch;
+            Batch.swap(Pending);
+            Busy = true;
+            lock.unlock();
+
+            qint64 newSavePos = -1;
+            for (int i=0; i<Batch.size(); ++i) {
+                if (theFile->write(Batch[i].first) != Batch[i].first.size())
+                    qWarning() << "Journal: short write on" << theFile->fileName();
+                if (Batch[i].second)
+                    newSavePos = theFile->pos();
+            }
+            syncFile(theFile);
+
+            lock.relock();
+            if (newSavePos >= 0)
+                SavePos = newSavePos;
+            Busy = false;
+            isIdle.wakeAll();
+        }
+    }
+
+private:
+    QFile* theFile;
+    QMutex theMutex;
+    QWaitCondition hasWork;
+    QWaitCondition isIdle;
+    QList<QPair<QByteArray, bool> > Pending;
+    bool Stopping;
+    bool Busy;
+    qint64 SavePos;
+};
+
+/* COMMANDJOURNAL */
+
+CommandJournal::CommandJournal(Document* aDoc, const QString& aSnapshotFile)
+    : theDocument(aDoc), theSnapshotFile(aSnapshotFile), theFile(0), theWriter(0)
+    , theHeaderEnd(0), theReplayEnd(0), theSaveEnd(0), theLastSave(-1), theBroken(false), theSize(0)
+{
+}
+
+CommandJournal::~CommandJournal()
+{
+    if (theWriter) {
+        theWriter->stop();
+        delete theWriter;
+    }
+    if (theFile) {
+        theFile->close();
+        delete theFile;
+    }
+}
+
+QString CommandJournal::fileNameFor(const QString& aSnapshotFile)
+{
+    return aSnapshotFile + ".journal";
+}
+
+const QString& CommandJournal::snapshotFile() const
+{
+    return theSnapshotFile;
+}
+
+bool CommandJournal::load(int& savedRecords, int& unsavedRecords)
+{
+    savedRecords = unsavedRecords = 0;
+    theRecords.clear();
+    theRecordEnds.clear();
+    theLastSave = -1;
+    theBroken = false;
+
+    QFile f(fileNameFor(theSnapshotFile));
+    if (!f.exists() || !f.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&f);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    quint32 magic;
+    quint16 version;
+    QString docId;
+    in >> magic >> version >> docId;
+    if (in.status() != QDataStream::Ok || magic != JOURNAL_MAGIC || version != JOURNAL_VERSION) {
+        qDebug() << "Journal: invalid header in" << f.fileName();
+        return false;
+    }
+    if (docId != theDocument->id()) {
+        qDebug() << "Journal: " << f.fileName() << " belongs to another document. Ignoring.";
+        return false;
+    }
+    theSaveEnd = theHeaderEnd = f.pos();
+
+    while (!in.atEnd()) {
+        quint32 recordMagic;
+        quint8 op;
+        QByteArray payload;
+        quint16 crc;
+        in >> recordMagic >> op >> payload >> crc;
+        if (in.status() != QDataStream::Ok || recordMagic != JOURNAL_RECORD_MAGIC
+                || crc != qChecksum(payload.constData(), payload.size())) {
+            // Torn tail from a crash while writing. Everything before is valid.
+            qDebug() << "Journal: truncated record at " << theRecordEnds.value(theRecordEnds.size()-1, theHeaderEnd);
+            break;
+        }
+        if (op == BreakOp) {
+            // What follows was done on top of changes that are not in the journal
+            theBroken = true;
+            break;
+        }
+        theRecords << qMakePair((int)op, payload);
+        theRecordEnds << f.pos();
+        if (op == SaveOp) {
+            theLastSave = theRecords.size()-1;
+            theSaveEnd = f.pos();
+        }
+    }
+
+    savedRecords = theLastSave+1;
+    unsavedRecords = theRecords.size() - savedRecords;
+    return true;
+}
+
+int CommandJournal::replay(bool includeUnsaved, QProgressDialog* progress)
+{
+    int last = includeUnsaved ? theRecords.size()-1 : theLastSave;
+    int applied = 0;
+
+    theReplayEnd = theHeaderEnd;
+    if (progress) {
+        progress->setLabelText(QApplication::translate("CommandJournal", "Replaying journal..."));
+        progress->setMaximum(last+1);
+        progress->setValue(0);
+    }
+    for (int i=0; i<=last; ++i) {
+        if (!applyRecord((Operation)theRecords[i].first, theRecords[i].second)) {
+            qDebug() << "Journal: unable to replay record " << i << ". Stopping.";
+            break;
+        }
+        theReplayEnd = theRecordEnds[i];
+        ++applied;
+
+        if (progress) {
+            progress->setValue(i+1);
+            if (progress->wasCanceled())
+                break;
+        }
+    }
+
+    theRecords.clear();
+    theRecordEnds.clear();
+    return applied;
+}
+
+bool CommandJournal::applyRecord(Operation op, const QByteArray& payload)
+{
+    switch (op) {
+    case UndoOp:
+        if (!theDocument->history().index())
+            return false;
+        theDocument->history().undo();
+        return true;
+    case RedoOp:
+        if (theDocument->history().index() >= theDocument->history().size())
+            return false;
+        theDocument->history().redo();
+        return true;
+    case SaveOp:
+        return true;
+    case AddOp:
+        break;
+    default:
+        return false;
+    }
+
+    QXmlStreamReader stream(payload);
+    while (!stream.atEnd() && !stream.isStartElement())
+        stream.readNext();
+    if (stream.name() != "JournalEntry")
+        return false;
+
+    bool OK = true;
+    stream.readNext();
+    while(!stream.atEnd() && !stream.isEndElement()) {
+        if (stream.name() == "Feature") {
+            featureFromXML(stream);
+        } else if (stream.isStartElement()) {
+            Command* C = NULL;
+            if (CommandHistory::commandFromXML(theDocument, stream, C)) {
+                if (C)
+                    theDocument->history().add(C);
+                else
+                    OK = false;
+            } else {
+                qDebug() << "Journal: logic error: " << stream.name() << " : " << stream.tokenType() << " (" << stream.lineNumber() << ")";
+                stream.skipCurrentElement();
+            }
+        }
+        stream.readNext();
+    }
+
+    return OK && !stream.hasError();
+}
+
+void CommandJournal::featureFromXML(QXmlStreamReader& stream)
+{
+    QString layerId = stream.attributes().value("layer").toString();
+    Layer* L = theDocument->getLayer(layerId);
+    if (!L) {
+        // The layer was created after the snapshot
+        DrawingLayer* aLayer = new DrawingLayer(stream.attributes().value("layername").toString());
+        aLayer->setId(layerId);
+        theDocument->add(aLayer);
+        L = aLayer;
+    }
+
+    stream.readNext();
+    while(!stream.atEnd() && !stream.isEndElement()) {
+        if (stream.isStartElement()) {
+            // fromXML() merges tags into an existing feature: start from a clean slate
+            qint64 numId = stream.attributes().value("id").toString().toLongLong();
+            if (stream.name() == "node") {
+                if (Feature* F = theDocument->getFeature(IFeature::FId(IFeature::Point, numId)))
+                    F->clearTags();
+                Node::fromXML(theDocument, L, stream);
+            } else if (stream.name() == "way") {
+                if (Feature* F = theDocument->getFeature(IFeature::FId(IFeature::LineString, numId)))
+                    F->clearTags();
+                Way::fromXML(theDocument, L, stream);
+            } else if (stream.name() == "relation") {
+                if (Feature* F = theDocument->getFeature(IFeature::FId(IFeature::OsmRelation, numId)))
+                    F->clearTags();
+                Relation::fromXML(theDocument, L, stream);
+            } else {
+                stream.skipCurrentElement();
+            }
+        }
+        stream.readNext();
+    }
+}
+
+bool CommandJournal::writeHeader()
+{
+    QByteArray header;
+    QDataStream out(&header, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << (quint32)JOURNAL_MAGIC << (quint16)JOURNAL_VERSION << theDocument->id();
+
+    if (theFile->write(header) != header.size())
+        return false;
+    syncFile(theFile);
+    theHeaderEnd = theSize = theFile->pos();
+    return true;
+}
+
+bool CommandJournal::open()
+{
+    if (theFile)
+        return true;
+
+    QString fn = fileNameFor(theSnapshotFile);
+    bool fresh = (theReplayEnd <= 0);
+    if (!fresh && QFile(fn).size() > theReplayEnd) {
+        // Keep the records that were not replayed around, just in case.
+        QFile::remove(fn + ".bak");
+        QFile::copy(fn, fn + ".bak");
+    }
+
+    theFile = new QFile(fn);
+    if (!theFile->open(QIODevice::ReadWrite)) {
+        qWarning() << "Journal: unable to open" << fn;
+        SAFE_DELETE(theFile);
+        return false;
+    }
+
+    if (fresh) {
+        theFile->resize(0);
+        if (!writeHeader()) {
+            SAFE_DELETE(theFile);
+            return false;
+        }
+    } else {
+        theFile->resize(theReplayEnd);
+        theFile->seek(theReplayEnd);
+        theSize = theReplayEnd;
+    }
+    theBroken = false;
+
+    // Recovered records stay unsaved until the document is written
+    theWriter = new CommandJournalWriter(theFile, fresh ? theSize : qMin(theSaveEnd, theReplayEnd));
+    theWriter->start(QThread::LowPriority);
+    return true;
+}
+
+bool CommandJournal::reset()
+{
+    if (!theFile)
+        return open();
+
+    theWriter->drain();
+    theTouched.clear();
+    theBroken = false;
+    theFile->resize(0);
+    theFile->seek(0);
+    if (!writeHeader())
+        return false;
+    theWriter->setSavePos(theSize);
+    return true;
+}
+
+void CommandJournal::discardUnsaved()
+{
+    if (!theFile)
+        return;
+
+    theWriter->drain();
+    qint64 pos = theWriter->savePos();
+    if (theFile->size() > pos) {
+        theFile->resize(pos);
+        theFile->seek(pos);
+        syncFile(theFile);
+    }
+    theSize = pos;
+}
+
+void CommandJournal::touch(Feature* F)
+{
+    if (theWriter && !theBroken)
+        theTouched.insert(F, F->id());
+}
+
+static void collectFeature(Feature* F, QSet<Feature*>& Seen, QList<Feature*>& Nodes, QList<Feature*>& Ways, QList<Feature*>& Relations)
+{
+    if (Seen.contains(F) || F->isVirtual() || !F->layer())
+        return;
+    Seen.insert(F);
+
+    if (CHECK_NODE(F)) {
+        Nodes << F;
+    } else if (CHECK_WAY(F)) {
+        Ways << F;
+        // New nodes are journalled by their own command; dirty ones are added for safety
+        for (int i=0; i<F->size(); ++i)
+            if (F->get(i)->isDirty())
+                collectFeature(F->get(i), Seen, Nodes, Ways, Relations);
+    } else if (CHECK_RELATION(F)) {
+        Relations << F;
+        for (int i=0; i<F->size(); ++i)
+            if (F->get(i)->isDirty())
+                collectFeature(F->get(i), Seen, Nodes, Ways, Relations);
+    }
+}
+
+void CommandJournal::touchedToXML(QXmlStreamWriter& stream)
+{
+    QSet<Feature*> Seen;
+    QList<Feature*> Nodes, Ways, Relations;
+
+    QHash<Feature*, IFeature::FId>::const_iterator it = theTouched.constBegin();
+    for (; it != theTouched.constEnd(); ++it) {
+        // Only trust the pointer if the feature is still part of the document
+        Feature* F = theDocument->getFeature(it.value());
+        if (F != it.key())
+            continue;
+        collectFeature(F, Seen, Nodes, Ways, Relations);
+    }
+    theTouched.clear();
+
+    // Ordered so that references resolve when replaying
+    foreach (Feature* F, Nodes)
+        featureToXML(stream, F);
+    foreach (Feature* F, Ways)
+        featureToXML(stream, F);
+    foreach (Feature* F, Relations)
+        featureToXML(stream, F);
+}
+
+void CommandJournal::featureToXML(QXmlStreamWriter& stream, Feature* F)
+{
+    stream.writeStartElement("Feature");
+    stream.writeAttribute("layer", F->layer()->id());
+    stream.writeAttribute("layername", F->layer()->name());
+    F->toXML(stream, (QProgressDialog*)NULL, false);
+    stream.writeEndElement();
+}
+
+void CommandJournal::record(Operation op, const QByteArray& payload)
+{
+    QByteArray rec;
+    QDataStream out(&rec, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << (quint32)JOURNAL_RECORD_MAGIC << (quint8)op << payload << (quint16)qChecksum(payload.constData(), payload.size());
+
+    theSize += rec.size();
+    theWriter->enqueue(rec, op == SaveOp);
+}
+
+void CommandJournal::recordAdd(Command* aCommand)
+{
+    if (!theWriter || theBroken)
+        return;
+
+    QByteArray payload;
+    QXmlStreamWriter stream(&payload);
+    stream.writeStartElement("JournalEntry");
+    touchedToXML(stream);
+    aCommand->toXML(stream);
+    stream.writeEndElement();
+
+    record(AddOp, payload);
+}
+
+void CommandJournal::recordUndo()
+{
+    if (!theWriter || theBroken)
+        return;
+
+    // Undo is replayed by executing it again, the feature states are not needed
+    theTouched.clear();
+    record(UndoOp, QByteArray());
+}
+
+void CommandJournal::recordRedo()
+{
+    if (!theWriter || theBroken)
+        return;
+
+    theTouched.clear();
+    record(RedoOp, QByteArray());
+}
+
+void CommandJournal::recordSave()
+{
+    if (!theWriter || theBroken)
+        return;
+
+    record(SaveOp, QByteArray());
+    theWriter->drain();
+}
+
+void CommandJournal::recordBreak()
+{
+    if (!theWriter || theBroken)
+        return;
+
+    theTouched.clear();
+    record(BreakOp, QByteArray());
+    theBroken = true;
+}
+
+bool CommandJournal::isBroken() const
+{
+    return theBroken;
+}
+
+bool CommandJournal::needsCompaction() const
+{
+    return size() > (qint64)M_PREFS->getJournalCompactionSize() * 1024 * 1024;
+}
+
+qint64 CommandJournal::size() const
+{
+    return theSize;
+}
@@ -0,0 +1,95 @@
+#ifndef MERKAARTOR_COMMANDJOURNAL_H_
+#define MERKAARTOR_COMMANDJOURNAL_H_
+
+#include "IFeature.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QPair>
+
+class Document;
+class Feature;
+class Command;
+class CommandJournalWriter;
+
+class QFile;
+class QProgressDialog;
+class QXmlStreamReader;
+class QXmlStreamWriter;
+
+/// Append-only write-ahead log of the command history of a document.
+/// Every command added to the history is journalled together with the state of
+/// the features it touched, so that the last full snapshot (the .mdc file) plus
+/// the journal reproduces the document after a crash.
+/// Records are written and fsync'ed by a background thread.
+/// Changes that bypass the history (downloads, imports, layer changes, ...)
+/// can't be journalled: they only leave a break mark, and nothing is
+/// journalled after it until the next full snapshot.
+class CommandJournal
+{
+    public:
+        typedef enum { AddOp = 1, UndoOp, RedoOp, SaveOp, BreakOp } Operation;
+
+        CommandJournal(Document* aDoc, const QString& aSnapshotFile);
+        ~CommandJournal();
+
+        static QString fileNameFor(const QString& aSnapshotFile);
+        const QString& snapshotFile() const;
+
+        /// Read and validate an existing journal. Returns false if there is none
+        /// or if it doesn't belong to the loaded snapshot.
+        /// Reading stops at a break mark, see isBroken().
+        bool load(int& savedRecords, int& unsavedRecords);
+        /// Apply the loaded records on top of the snapshot.
+        int replay(bool includeUnsaved, QProgressDialog* progress=NULL);
+
+        /// Start journalling (after a replay, the journal is appended to).
+        bool open();
+        /// Truncate the journal after a full snapshot has been written.
+        bool reset();
+        /// Drop every record after the last save point.
+        void discardUnsaved();
+
+        void touch(Feature* F);
+        void recordAdd(Command* aCommand);
+        void recordUndo();
+        void recordRedo();
+        /// Mark a save point and wait until everything is on disk.
+        void recordSave();
+        /// The document was changed outside of the history.
+        void recordBreak();
+
+        /// True if the journal doesn't describe the document anymore (or, after
+        /// load(), if the session that wrote it did unjournalled changes).
+        bool isBroken() const;
+        bool needsCompaction() const;
+        qint64 size() const;
+
+    private:
+        void record(Operation op, const QByteArray& payload);
+        void touchedToXML(QXmlStreamWriter& stream);
+        void featureToXML(QXmlStreamWriter& stream, Feature* F);
+        bool applyRecord(Operation op, const QByteArray& payload);
+        void featureFromXML(QXmlStreamReader& stream);
+        bool writeHeader();
+
+        Document* theDocument;
+        QString theSnapshotFile;
+        QFile* theFile;
+        CommandJournalWriter* theWriter;
+
+        QHash<Feature*, IFeature::FId> theTouched;
+
+        QList<QPair<int, QByteArray> > theRecords;
+        QList<qint64> theRecordEnds;
+        qint64 theHeaderEnd;
+        qint64 theReplayEnd;
+        qint64 theSaveEnd;
+        int theLastSave;
+        bool theBroken;
+        qint64 theSize;
+};
+
+#endif
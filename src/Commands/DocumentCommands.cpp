@@ -112,6 +112,164 @@ AddFeatureCommand * AddFeatureCommand::fromXML(Document* d, QXmlStreamReader& st
     return a;
 }
 
+/* ADDFEATURESCOMMAND */
+
+AddFeaturesCommand::AddFeaturesCommand(Layer* aLayer, bool aUserAdded)
+: Command(0), theLayer(aLayer), UserAdded(aUserAdded)
+{
+    description = QApplication::tr("Add features");
+}
+
+AddFeaturesCommand::~AddFeaturesCommand()
+{
+    if (theLayer)
+        theLayer->decDirtyLevel(commandDirtyLevel);
+}
+
+void AddFeaturesCommand::add(Feature* aFeature)
+{
+    theFeatures.append(aFeature);
+    oldLayers.append(NULL);
+    Processed.resize(theFeatures.size());
+    if (!mainFeature)
+        mainFeature = aFeature;
+
+    addFeature(theFeatures.size()-1);
+}
+
+int AddFeaturesCommand::size() const
+{
+    return theFeatures.size();
+}
+
+int AddFeaturesCommand::weight() const
+{
+    return theFeatures.size();
+}
+
+void AddFeaturesCommand::addFeature(int i)
+{
+    Feature* F = theFeatures[i];
+    oldLayers[i] = F->layer();
+    if (theLayer && oldLayers[i] && (theLayer != oldLayers[i])) {
+        oldLayers[i]->remove(F);
+        theLayer->add(F);
+    } else {
+        if (!oldLayers[i])
+            theLayer->add(F);
+        else {
+            F->setDeleted(false);
+            oldLayers[i] = NULL;
+        }
+        incDirtyLevel(theLayer, F);
+    }
+    journalTouch(F);
+}
+
+void AddFeaturesCommand::undo()
+{
+    Command::undo();
+    for (int i=theFeatures.size()-1; i>=0; --i) {
+        Feature* F = theFeatures[i];
+        if (theLayer && oldLayers[i] && (theLayer != oldLayers[i])) {
+            theLayer->remove(F);
+            oldLayers[i]->add(F);
+        } else
+            F->setDeleted(true);
+
+        decDirtyLevel(theLayer, F);
+        journalTouch(F);
+    }
+}
+
+void AddFeaturesCommand::redo()
+{
+    for (int i=0; i<theFeatures.size(); ++i)
+        addFeature(i);
+    Command::redo();
+}
+
+bool AddFeaturesCommand::buildDirtyList(DirtyList& theList)
+{
+    if (isUndone)
+        return false;
+    if (!UserAdded)
+        return false;
+
+    bool Done = true;
+    for (int i=0; i<theFeatures.size(); ++i) {
+        if (Processed.testBit(i))
+            continue;
+        if (theFeatures[i]->isUploadable() && theList.add(theFeatures[i]))
+            Processed.setBit(i);
+        else
+            Done = false;
+    }
+    return Done;
+}
+
+bool AddFeaturesCommand::toXML(QXmlStreamWriter& stream) const
+{
+    bool OK = true;
+
+    stream.writeStartElement("AddFeaturesCommand");
+
+    stream.writeAttribute("xml:id", id());
+    stream.writeAttribute("layer", theLayer->id());
+    stream.writeAttribute("useradded", QString(UserAdded ? "true" : "false"));
+    stream.writeAttribute("description", description);
+    for (int i=0; i<theFeatures.size(); ++i) {
+        stream.writeStartElement("feature");
+        stream.writeAttribute("id", theFeatures[i]->xmlId());
+        if (oldLayers[i])
+            stream.writeAttribute("oldlayer", oldLayers[i]->id());
+        stream.writeEndElement();
+    }
+
+    Command::toXML(stream);
+    stream.writeEndElement();
+
+    return OK;
+}
+
+AddFeaturesCommand * AddFeaturesCommand::fromXML(Document* d, QXmlStreamReader& stream)
+{
+    Layer* aLayer = d->getLayer(stream.attributes().value("layer").toString());
+    if (!aLayer)
+        return NULL;
+
+    AddFeaturesCommand* a = new AddFeaturesCommand(aLayer, stream.attributes().value("useradded") == "true");
+    a->setId(stream.attributes().value("xml:id").toString());
+    if (stream.attributes().hasAttribute("description"))
+        a->description = stream.attributes().value("description").toString();
+
+    stream.readNext();
+    while(!stream.atEnd() && !stream.isEndElement()) {
+        if (stream.name() == "feature") {
+            Feature* F = d->getFeature(IFeature::FId(IFeature::All, stream.attributes().value("id").toString().toLongLong()));
+            if (F) {
+                a->theFeatures.append(F);
+                if (stream.attributes().hasAttribute("oldlayer"))
+                    a->oldLayers.append(d->getLayer(stream.attributes().value("oldlayer").toString()));
+                else
+                    a->oldLayers.append(NULL);
+            }
+            stream.readNext();
+        } else if (stream.name() == "Command") {
+            Command::fromXML(d, stream, a);
+        }
+        stream.readNext();
+    }
+
+    if (a->theFeatures.isEmpty()) {
+        delete a;
+        return NULL;
+    }
+    a->Processed.resize(a->theFeatures.size());
+
+    return a;
+}
+
 /* REMOVEFEATURECOMMAND */
 
 RemoveFeatureCommand::RemoveFeatureCommand(Feature *aFeature)
@@ -150,11 +308,23 @@ RemoveFeatureCommand::~RemoveFeatureCommand()
     if (oldLayer)
         oldLayer->decDirtyLevel(commandDirtyLevel);
     SAFE_DELETE(CascadedCleanUp);
-    if (theLayer->getDocument()->exists(theFeature) && theFeature->isDeleted()) {
+    if (!Detached && theLayer->getDocument()->exists(theFeature) && theFeature->isDeleted()) {
         theLayer->getDocument()->deleteFeature(theFeature);
     }
 }
 
+int RemoveFeatureCommand::weight() const
+{
+    return 1 + (CascadedCleanUp ? CascadedCleanUp->weight() : 0);
+}
+
+void RemoveFeatureCommand::detach()
+{
+    Command::detach();
+    if (CascadedCleanUp)
+        CascadedCleanUp->detach();
+}
+
 void RemoveFeatureCommand::redo()
 {
     if (!theFeature)
@@ -4,6 +4,8 @@
 #include "Command.h"
 
 #include <QList>
+#include <QVector>
+#include <QBitArray>
 
 class Document;
 class Layer;
@@ -30,6 +32,35 @@ class AddFeatureCommand : public Command
         bool UserAdded;
 };
 
+/// Adds any number of features to a layer as a single command.
+/// add() adds the feature right away, as creating an AddFeatureCommand would.
+class AddFeaturesCommand : public Command
+{
+    public:
+        AddFeaturesCommand(Layer* aLayer = NULL, bool aUserAdded = false);
+        virtual ~AddFeaturesCommand();
+
+        void add(Feature* aFeature);
+        int size() const;
+
+        void undo();
+        void redo();
+        bool buildDirtyList(DirtyList& theList);
+        virtual int weight() const;
+
+        virtual bool toXML(QXmlStreamWriter& stream) const;
+        static AddFeaturesCommand* fromXML(Document* d, QXmlStreamReader& stream);
+
+    private:
+        void addFeature(int i);
+
+        Layer* theLayer;
+        QVector<Feature*> theFeatures;
+        QVector<Layer*> oldLayers;
+        QBitArray Processed;
+        bool UserAdded;
+};
+
 class RemoveFeatureCommand : public Command
 {
     public:
@@ -41,6 +72,8 @@ class RemoveFeatureCommand : public Command
         void undo();
         void redo();
         bool buildDirtyList(DirtyList& theList);
+        virtual int weight() const;
+        virtual void detach();
 
         virtual bool toXML(QXmlStreamWriter& stream) const;
         static RemoveFeatureCommand* fromXML(Document* d, QXmlStreamReader& stream);
@@ -127,3 +127,178 @@ MoveNodeCommand * MoveNodeCommand::fromXML(Document * d, QXmlStreamReader& strea
 
 
 
+/* MOVENODESCOMMAND */
+
+MoveNodesCommand::MoveNodesCommand(Feature* aFeature)
+: Command(aFeature)
+{
+    description = QApplication::tr("Move nodes");
+}
+
+MoveNodesCommand::~MoveNodesCommand(void)
+{
+    for (int i=0; i<oldLayers.size(); ++i)
+        if (oldLayers[i])
+            oldLayers[i]->decDirtyLevel(commandDirtyLevel);
+}
+
+void MoveNodesCommand::add(Node* aPt, const Coord& aPos, Layer* aLayer)
+{
+    thePoints.append(aPt);
+    theLayers.append(aLayer ? aLayer : aPt->layer());
+    oldLayers.append(NULL);
+    OldPos.append(aPt->position());
+    NewPos.append(aPos);
+    Processed.resize(thePoints.size());
+    if (!mainFeature)
+        mainFeature = aPt;
+
+    move(thePoints.size()-1);
+    commandDirtyLevel = 1;
+}
+
+int MoveNodesCommand::size() const
+{
+    return thePoints.size();
+}
+
+int MoveNodesCommand::weight() const
+{
+    return thePoints.size();
+}
+
+void MoveNodesCommand::move(int i)
+{
+    Node* Pt = thePoints[i];
+    oldLayers[i] = Pt->layer();
+    Pt->setPosition(NewPos[i]);
+    Pt->setVirtual(false);
+    if (theLayers[i] && oldLayers[i] && (theLayers[i] != oldLayers[i])) {
+        oldLayers[i]->remove(Pt);
+        theLayers[i]->add(Pt);
+    }
+    Pt->incDirtyLevel();
+    if (oldLayers[i])
+        oldLayers[i]->incDirtyLevel();
+    journalTouch(Pt);
+}
+
+void MoveNodesCommand::undo()
+{
+    Command::undo();
+    for (int i=thePoints.size()-1; i>=0; --i) {
+        Node* Pt = thePoints[i];
+        Pt->setPosition(OldPos[i]);
+        if (theLayers[i] && oldLayers[i] && (theLayers[i] != oldLayers[i])) {
+            theLayers[i]->remove(Pt);
+            oldLayers[i]->add(Pt);
+        }
+        Pt->decDirtyLevel();
+        if (oldLayers[i])
+            oldLayers[i]->decDirtyLevel();
+        journalTouch(Pt);
+    }
+}
+
+void MoveNodesCommand::redo()
+{
+    for (int i=0; i<thePoints.size(); ++i)
+        move(i);
+    ++commandDirtyLevel;
+    Command::redo();
+}
+
+bool MoveNodesCommand::buildDirtyList(DirtyList &theList)
+{
+    if (isUndone)
+        return false;
+
+    // Nodes already handed over are skipped, as they would have been if
+    // they were separate commands removed from their list
+    bool Done = true;
+    for (int i=0; i<thePoints.size(); ++i) {
+        if (Processed.testBit(i))
+            continue;
+
+        Node* Pt = thePoints[i];
+        bool x;
+        if (Pt->lastUpdated() == Feature::NotYetDownloaded)
+            x = theList.noop(Pt);
+        else if (!Pt->layer() || Pt->isUploadable())
+            x = theList.update(Pt);
+        else
+            x = theList.noop(Pt);
+
+        if (x)
+            Processed.setBit(i);
+        else
+            Done = false;
+    }
+    return Done;
+}
+
+bool MoveNodesCommand::toXML(QXmlStreamWriter& stream) const
+{
+    bool OK = true;
+
+    stream.writeStartElement("MoveNodesCommand");
+
+    stream.writeAttribute("xml:id", id());
+    stream.writeAttribute("description", description);
+    for (int i=0; i<thePoints.size(); ++i) {
+        stream.writeStartElement("node");
+        stream.writeAttribute("trackpoint", thePoints[i]->xmlId());
+        if (theLayers[i])
+            stream.writeAttribute("layer", theLayers[i]->id());
+        if (oldLayers[i])
+            stream.writeAttribute("oldlayer", oldLayers[i]->id());
+        stream.writeAttribute("oldlon", COORD2STRING(OldPos[i].x()));
+        stream.writeAttribute("oldlat", COORD2STRING(OldPos[i].y()));
+        stream.writeAttribute("lon", COORD2STRING(NewPos[i].x()));
+        stream.writeAttribute("lat", COORD2STRING(NewPos[i].y()));
+        stream.writeEndElement();
+    }
+
+    Command::toXML(stream);
+    stream.writeEndElement();
+
+    return OK;
+}
+
+MoveNodesCommand * MoveNodesCommand::fromXML(Document * d, QXmlStreamReader& stream)
+{
+    MoveNodesCommand* a = new MoveNodesCommand();
+    a->setId(stream.attributes().value("xml:id").toString());
+    if (stream.attributes().hasAttribute("description"))
+        a->description = stream.attributes().value("description").toString();
+
+    stream.readNext();
+    while(!stream.atEnd() && !stream.isEndElement()) {
+        if (stream.name() == "node") {
+            Layer* aLayer = d->getLayer(stream.attributes().value("layer").toString());
+            if (aLayer) {
+                Layer* anOldLayer = NULL;
+                if (stream.attributes().hasAttribute("oldlayer"))
+                    anOldLayer = d->getLayer(stream.attributes().value("oldlayer").toString());
+
+                a->thePoints.append(Feature::getNodeOrCreatePlaceHolder(d, aLayer, IFeature::FId(IFeature::Point, stream.attributes().value("trackpoint").toString().toLongLong())));
+                a->theLayers.append(aLayer);
+                a->oldLayers.append(anOldLayer);
+                a->OldPos.append(Coord(stream.attributes().value("oldlon").toString().toDouble(), stream.attributes().value("oldlat").toString().toDouble()));
+                a->NewPos.append(Coord(stream.attributes().value("lon").toString().toDouble(), stream.attributes().value("lat").toString().toDouble()));
+            }
+            stream.readNext();
+        } else if (stream.name() == "Command") {
+            Command::fromXML(d, stream, a);
+        }
+        stream.readNext();
+    }
+
+    if (a->thePoints.isEmpty()) {
+        delete a;
+        return NULL;
+    }
+    a->Processed.resize(a->thePoints.size());
+
+    return a;
+}
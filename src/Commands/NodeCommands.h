@@ -4,6 +4,9 @@
 #include "Command.h"
 #include "Coord.h"
 
+#include <QVector>
+#include <QBitArray>
+
 class Node;
 class Layer;
 
@@ -29,6 +32,37 @@ class MoveNodeCommand : public Command
         Coord OldPos, NewPos;
 };
 
+/// Moves any number of nodes as a single command.
+/// The moves are stored as parallel arrays instead of one MoveNodeCommand
+/// per node; add() moves the node right away, as creating a MoveNodeCommand
+/// would.
+class MoveNodesCommand : public Command
+{
+    public:
+        MoveNodesCommand(Feature* aFeature = NULL);
+        virtual ~MoveNodesCommand();
+
+        void add(Node* aPt, const Coord& aPos, Layer* aLayer=NULL);
+        int size() const;
+
+        void undo();
+        void redo();
+        bool buildDirtyList(DirtyList& theList);
+        virtual int weight() const;
+
+        virtual bool toXML(QXmlStreamWriter& stream) const;
+        static MoveNodesCommand* fromXML(Document* d,QXmlStreamReader& stream);
+
+    private:
+        void move(int i);
+
+        QVector<Node*> thePoints;
+        QVector<Layer*> theLayers;
+        QVector<Layer*> oldLayers;
+        QVector<Coord> OldPos, NewPos;
+        QBitArray Processed;
+};
+
 #endif
 
 
@@ -4,6 +4,7 @@
 #include "Node.h"
 #include "Layer.h"
 #include "DirtyList.h"
+#include "Document.h"
 
 TrackSegmentAddNodeCommand::TrackSegmentAddNodeCommand(TrackSegment* R)
 : Command(R), theLayer(0), oldLayer(0), theTrackSegment(R), theNode(0), Position(0)
@@ -191,6 +192,138 @@ TrackSegmentRemoveNodeCommand * TrackSegmentRemoveNodeCommand::fromXML(Document
     return a;
 }
 
+/* TRACKSEGMENTSETPOINTSCOMMAND */
 
+TrackSegmentSetPointsCommand::TrackSegmentSetPointsCommand(TrackSegment* R)
+: Command(R), theLayer(0), oldLayer(0), theTrackSegment(R)
+{
+}
+
+TrackSegmentSetPointsCommand::TrackSegmentSetPointsCommand(TrackSegment* R, const TrackPoints& aPoints, Layer* aLayer)
+: Command(R), theLayer(aLayer), oldLayer(0), theTrackSegment(R), OldPoints(R->points()), NewPoints(aPoints)
+{
+    redo();
+}
+
+TrackSegmentSetPointsCommand::~TrackSegmentSetPointsCommand(void)
+{
+    if (oldLayer)
+        oldLayer->decDirtyLevel(commandDirtyLevel);
+}
+
+void TrackSegmentSetPointsCommand::undo()
+{
+    Command::undo();
+    theTrackSegment->setPoints(OldPoints);
+    if (theLayer && oldLayer && (theLayer != oldLayer)) {
+        theLayer->remove(theTrackSegment);
+        oldLayer->add(theTrackSegment);
+    }
+    decDirtyLevel(oldLayer, theTrackSegment);
+}
+
+void TrackSegmentSetPointsCommand::redo()
+{
+    theTrackSegment->setPoints(NewPoints);
+    oldLayer = theTrackSegment->layer();
+    if (theLayer && oldLayer && (theLayer != oldLayer)) {
+        oldLayer->remove(theTrackSegment);
+        theLayer->add(theTrackSegment);
+    }
+    incDirtyLevel(oldLayer, theTrackSegment);
+    Command::redo();
+}
+
+bool TrackSegmentSetPointsCommand::buildDirtyList(DirtyList& /* theList */)
+{
+    return false;
+}
+
+int TrackSegmentSetPointsCommand::weight() const
+{
+    return OldPoints.size() + NewPoints.size();
+}
+
+static void pointsToXML(QXmlStreamWriter& stream, const QString& aTag, const TrackPoints& thePoints)
+{
+    stream.writeStartElement(aTag);
+    foreach (const TrackPoint& Pt, thePoints) {
+        stream.writeStartElement("pt");
+        stream.writeAttribute("lon", COORD2STRING(Pt.Position.x()));
+        stream.writeAttribute("lat", COORD2STRING(Pt.Position.y()));
+        stream.writeAttribute("time", QString::number(Pt.Time));
+        stream.writeAttribute("ele", QString::number(Pt.Elevation));
+        stream.writeAttribute("speed", QString::number(Pt.Speed));
+        if (Pt.Node)
+            stream.writeAttribute("trackpoint", Pt.Node->xmlId());
+        stream.writeEndElement();
+    }
+    stream.writeEndElement();
+}
+
+static void pointsFromXML(Document* d, Layer* aLayer, QXmlStreamReader& stream, TrackPoints& thePoints)
+{
+    while (stream.readNextStartElement()) {
+        if (stream.name() == "pt") {
+            TrackPoint Pt;
+            Pt.Position = Coord(stream.attributes().value("lon").toString().toDouble(), stream.attributes().value("lat").toString().toDouble());
+            Pt.Time = stream.attributes().value("time").toString().toUInt();
+            Pt.Elevation = stream.attributes().value("ele").toString().toFloat();
+            Pt.Speed = stream.attributes().value("speed").toString().toFloat();
+            Pt.Node = NULL;
+            if (stream.attributes().hasAttribute("trackpoint"))
+                Pt.Node = Feature::getTrackNodeOrCreatePlaceHolder(d, aLayer, IFeature::FId(IFeature::Point, stream.attributes().value("trackpoint").toString().toLongLong()));
+            thePoints.append(Pt);
+        }
+        stream.skipCurrentElement();
+    }
+}
+
+bool TrackSegmentSetPointsCommand::toXML(QXmlStreamWriter& stream) const
+{
+    bool OK = true;
 
+    stream.writeStartElement("TrackSegmentSetPointsCommand");
 
+    stream.writeAttribute("xml:id", id());
+    stream.writeAttribute("tracksegment", theTrackSegment->xmlId());
+    if (theLayer)
+        stream.writeAttribute("layer", theLayer->id());
+    if (oldLayer)
+        stream.writeAttribute("oldlayer", oldLayer->id());
+    pointsToXML(stream, "oldpoints", OldPoints);
+    pointsToXML(stream, "newpoints", NewPoints);
+
+    stream.writeEndElement();
+    return OK;
+}
+
+TrackSegmentSetPointsCommand * TrackSegmentSetPointsCommand::fromXML(Document * d, QXmlStreamReader& stream)
+{
+    TrackSegmentSetPointsCommand* a = new TrackSegmentSetPointsCommand();
+    a->setId(stream.attributes().value("xml:id").toString());
+    if (stream.attributes().hasAttribute("layer"))
+        a->theLayer = d->getLayer(stream.attributes().value("layer").toString());
+    else
+        a->theLayer = NULL;
+    if (stream.attributes().hasAttribute("oldlayer"))
+        a->oldLayer = d->getLayer(stream.attributes().value("oldlayer").toString());
+    else
+        a->oldLayer = NULL;
+    a->theTrackSegment = dynamic_cast<TrackSegment*>(d->getFeature(IFeature::FId(IFeature::GpxSegment, stream.attributes().value("tracksegment").toString().toLongLong())));
+
+    while (stream.readNextStartElement()) {
+        if (stream.name() == "oldpoints")
+            pointsFromXML(d, a->theLayer, stream, a->OldPoints);
+        else if (stream.name() == "newpoints")
+            pointsFromXML(d, a->theLayer, stream, a->NewPoints);
+        else
+            stream.skipCurrentElement();
+    }
+
+    if (!a->theLayer || !a->theTrackSegment) {
+        delete a;
+        return NULL;
+    }
+    return a;
+}
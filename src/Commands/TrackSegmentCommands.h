@@ -2,6 +2,7 @@
 #define MERKAARTOR_TRACKSEGMENTCOMMANDS_H_
 
 #include "Command.h"
+#include "TrackSegment.h"
 
 class TrackSegment;
 class TrackNode;
@@ -53,6 +54,30 @@ class TrackSegmentRemoveNodeCommand : public Command
         TrackNode* theTrackPoint;
 };
 
+/// Replaces all the points of a segment at once, as done by the track processing tools
+class TrackSegmentSetPointsCommand : public Command
+{
+    public:
+        TrackSegmentSetPointsCommand(TrackSegment* R = NULL);
+        TrackSegmentSetPointsCommand(TrackSegment* R, const TrackPoints& aPoints, Layer* aLayer=NULL);
+        ~TrackSegmentSetPointsCommand(void);
+
+        virtual void undo();
+        virtual void redo();
+        virtual bool buildDirtyList(DirtyList& theList);
+        virtual int weight() const;
+
+        virtual bool toXML(QXmlStreamWriter& stream) const;
+        static TrackSegmentSetPointsCommand* fromXML(Document* d, QXmlStreamReader& stream);
+
+    private:
+        Layer* theLayer;
+        Layer* oldLayer;
+        TrackSegment* theTrackSegment;
+        TrackPoints OldPoints;
+        TrackPoints NewPoints;
+};
+
 #endif
 
 
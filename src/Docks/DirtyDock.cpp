@@ -75,6 +75,12 @@ void DirtyDock::updateList()
             break;
     }
 
+    const CommandHistory& h = Main->document()->history();
+    if (h.spilledSize())
+        ui.label->setText(ui.label->text() + "<br/>" +
+                          tr("%n undo steps kept on disk (%1 kB)", "", h.spilledSize())
+                          .arg(h.spillFileSize() / 1024));
+
     Main->document()->history().buildUndoList(ui.ChangesList);
 
     if (!M_PREFS->getAutoHistoryCleanup()) {
@@ -7,14 +7,18 @@ HEADERS += MDockAncestor.h \
     InfoDock.h \
     StyleDock.h \
     DirtyDock.h \
-    FeaturesDock.h
+    FeaturesDock.h \
+    FeaturesModel.h \
+    ProfilerDock.h
 SOURCES += MDockAncestor.cpp \
     PropertiesDock.cpp \
     InfoDock.cpp \
     LayerDock.cpp \
     DirtyDock.cpp \
     StyleDock.cpp \
-    FeaturesDock.cpp
+    FeaturesDock.cpp \
+    FeaturesModel.cpp \
+    ProfilerDock.cpp
 FORMS += DirtyDock.ui \
     StyleDock.ui \
     MinimumRelationProperties.ui \
@@ -19,6 +19,7 @@
 #include "Global.h"
 
 #include "Features.h"
+#include "FeaturesModel.h"
 
 #include "SelectionDialog.h"
 #include "TagSelector.h"
@@ -26,8 +27,7 @@
 #include <QAction>
 #include <QTimer>
 #include <QMenu>
-
-#define MAX_FEATS 100
+#include <QItemSelectionModel>
 
 FeaturesDock::FeaturesDock(MainWindow* aParent)
     : MDockAncestor(aParent),
@@ -45,7 +45,11 @@ FeaturesDock::FeaturesDock(MainWindow* aParent)
 #endif
 
     ui.cbWithin->setChecked(M_PREFS->getFeaturesWithin());
-    ui.FeaturesList->sortItems();
+
+    theModel = new FeaturesModel(this);
+    ui.FeaturesList->setModel(theModel);
+    ui.FeaturesList->setUniformItemSizes(true);
+    connect(theModel, SIGNAL(rowsRefreshed()), this, SLOT(restoreSelection()));
 
     connect(this, SIGNAL(visibilityChanged(bool)), this, SLOT(on_Viewport_changed()));
 
@@ -54,8 +58,8 @@ FeaturesDock::FeaturesDock(MainWindow* aParent)
     ui.FeaturesList->addAction(deleteAction);
     connect(deleteAction, SIGNAL(triggered()), SLOT(on_FeaturesList_delete()));
 
-    connect(ui.FeaturesList, SIGNAL(itemSelectionChanged()), this, SLOT(on_FeaturesList_itemSelectionChanged()));
-    connect(ui.FeaturesList, SIGNAL(itemDoubleClicked(QListWidgetItem*)), this, SLOT(on_FeaturesList_itemDoubleClicked(QListWidgetItem*)));
+    connect(ui.FeaturesList->selectionModel(), SIGNAL(selectionChanged(const QItemSelection&, const QItemSelection&)), this, SLOT(on_FeaturesList_itemSelectionChanged()));
+    connect(ui.FeaturesList, SIGNAL(doubleClicked(const QModelIndex&)), this, SLOT(on_FeaturesList_doubleClicked(const QModelIndex&)));
     connect(ui.FeaturesList, SIGNAL(customContextMenuRequested(const QPoint &)), this, SLOT(on_FeaturesList_customContextMenuRequested(const QPoint &)));
 
     connect(ui.cbWithin, SIGNAL(stateChanged(int)), this, SLOT(on_rbWithin_stateChanged(int)));
@@ -97,29 +101,53 @@ FeaturesDock::~FeaturesDock()
 {
 }
 
-void FeaturesDock::on_FeaturesList_itemSelectionChanged()
+QList<Feature*> FeaturesDock::selectedFeatures() const
 {
-    Highlighted.clear();
-    for (int i=0; i<ui.FeaturesList->selectedItems().count(); ++i) {
-        QListWidgetItem* item = ui.FeaturesList->selectedItems()[i];
-        Feature * F = item->data(Qt::UserRole).value<Feature*>();
-        Highlighted.push_back(F);
+    QList<Feature*> theFeatures;
+    foreach (const QModelIndex& idx, ui.FeaturesList->selectionModel()->selectedIndexes())
+        if (Feature* F = theModel->feature(idx))
+            theFeatures.push_back(F);
+    return theFeatures;
+}
+
+void FeaturesDock::restoreSelection()
+{
+    QItemSelection theSelection;
+    QList<Feature*> Kept;
+    foreach (Feature* F, Highlighted) {
+        QModelIndex idx = theModel->indexOf(F);
+        if (idx.isValid()) {
+            theSelection.select(idx, idx);
+            Kept.push_back(F);
+        }
     }
+    Highlighted = Kept;
+
+    ui.FeaturesList->selectionModel()->blockSignals(true);
+    ui.FeaturesList->selectionModel()->select(theSelection, QItemSelectionModel::ClearAndSelect);
+    ui.FeaturesList->selectionModel()->blockSignals(false);
+    ui.FeaturesList->viewport()->update();
+}
+
+void FeaturesDock::on_FeaturesList_itemSelectionChanged()
+{
+    Highlighted = selectedFeatures();
 
     Main->view()->update();
 }
 
-void FeaturesDock::on_FeaturesList_itemDoubleClicked(QListWidgetItem* item)
+void FeaturesDock::on_FeaturesList_doubleClicked(const QModelIndex& index)
 {
-    Feature * F = item->data(Qt::UserRole).value<Feature*>();
+    Feature * F = theModel->feature(index);
+    if (!F)
+        return;
     Main->properties()->setSelection(F);
     Main->view()->update();
 }
 
 void FeaturesDock::on_FeaturesList_customContextMenuRequested(const QPoint & pos)
 {
-    QListWidgetItem *it = ui.FeaturesList->itemAt(pos);
-    if (!it)
+    if (!ui.FeaturesList->indexAt(pos).isValid())
         return;
 
     QMenu menu(ui.FeaturesList);
@@ -131,9 +159,7 @@ void FeaturesDock::on_FeaturesList_customContextMenuRequested(const QPoint & pos
     menu.addSeparator();
 
     downloadAction->setEnabled(false);
-    Feature* F;
-    for (int i=0; i < ui.FeaturesList->selectedItems().count(); ++i) {
-        F = ui.FeaturesList->selectedItems()[i]->data(Qt::UserRole).value<Feature*>();
+    foreach (Feature* F, selectedFeatures()) {
         if (F->notEverythingDownloaded()) {
             downloadAction->setEnabled(true);
             break;
@@ -145,20 +171,16 @@ void FeaturesDock::on_FeaturesList_customContextMenuRequested(const QPoint & pos
 
 void FeaturesDock::on_FeaturesList_delete()
 {
-    if (!ui.FeaturesList->selectedItems().count())
+    QList<Feature*> theFeatures = selectedFeatures();
+    if (!theFeatures.count())
         return;
 
-    Feature* F;
     Main->view()->blockSignals(true);
 
     Highlighted.clear();
     Main->properties()->setSelection(0);
-    for (int i=0; i < ui.FeaturesList->selectedItems().count(); ++i) {
-        F = ui.FeaturesList->selectedItems()[i]->data(Qt::UserRole).value<Feature*>();
-        if (F) {
-            Main->properties()->addSelection(F);
-        }
-    }
+    foreach (Feature* F, theFeatures)
+        Main->properties()->addSelection(F);
 
     Main->view()->blockSignals(false);
 #ifndef _MOBILE
@@ -182,19 +204,15 @@ void FeaturesDock::on_rbSelectionFilter_stateChanged ( int state )
 
 void FeaturesDock::on_centerAction_triggered()
 {
-    Feature* F;
     CoordBox cb;
 
     Main->view()->blockSignals(true);
 
-    for (int i=0; i < ui.FeaturesList->selectedItems().count(); ++i) {
-        F = ui.FeaturesList->selectedItems()[i]->data(Qt::UserRole).value<Feature*>();
-        if (F) {
-            if (cb.isNull())
-                cb = F->boundingBox();
-            else
-                cb.merge(F->boundingBox());
-        }
+    foreach (Feature* F, selectedFeatures()) {
+        if (cb.isNull())
+            cb = F->boundingBox();
+        else
+            cb.merge(F->boundingBox());
     }
     if (!cb.isNull()) {
         Coord c = cb.center();
@@ -208,19 +226,15 @@ void FeaturesDock::on_centerAction_triggered()
 
 void FeaturesDock::on_centerZoomAction_triggered()
 {
-    Feature* F;
     CoordBox cb;
 
     Main->view()->blockSignals(true);
 
-    for (int i=0; i < ui.FeaturesList->selectedItems().count(); ++i) {
-        F = ui.FeaturesList->selectedItems()[i]->data(Qt::UserRole).value<Feature*>();
-        if (F) {
-            if (cb.isNull())
-                cb = F->boundingBox();
-            else
-                cb.merge(F->boundingBox());
-        }
+    foreach (Feature* F, selectedFeatures()) {
+        if (cb.isNull())
+            cb = F->boundingBox();
+        else
+            cb.merge(F->boundingBox());
     }
     if (!cb.isNull()) {
         CoordBox mini(cb.center()-COORD_ENLARGE, cb.center()+COORD_ENLARGE);
@@ -237,11 +251,8 @@ void FeaturesDock::on_centerZoomAction_triggered()
 void FeaturesDock::on_downloadAction_triggered()
 {
 #ifndef _MOBILE
-    Feature* F;
     QList<Feature*> toResolve;
-    for (int i=0; i < ui.FeaturesList->selectedItems().count(); ++i) {
-        F = ui.FeaturesList->selectedItems()[i]->data(Qt::UserRole).value<Feature*>();
-
+    foreach (Feature* F, selectedFeatures()) {
         if (F->notEverythingDownloaded()) {
             toResolve.push_back(F);
         }
@@ -252,15 +263,10 @@ void FeaturesDock::on_downloadAction_triggered()
 
 void FeaturesDock::on_addSelectAction_triggered()
 {
-    Feature* F;
     Main->view()->blockSignals(true);
 
-    for (int i=0; i < ui.FeaturesList->selectedItems().count(); ++i) {
-        F = ui.FeaturesList->selectedItems()[i]->data(Qt::UserRole).value<Feature*>();
-        if (F) {
-            Main->properties()->addSelection(F);
-        }
-    }
+    foreach (Feature* F, selectedFeatures())
+        Main->properties()->addSelection(F);
 
     Main->view()->blockSignals(false);
 }
@@ -306,7 +312,6 @@ void FeaturesDock::changeEvent(QEvent * event)
 void FeaturesDock::tabChanged(int idx)
 {
     curFeatType = (IFeature::FeatureType)ui.tabBar->tabData(idx).toInt();
-    ui.FeaturesList->clear();
     Highlighted.clear();
 
     if (curFeatType == IFeature::OsmRelation)
@@ -324,111 +329,32 @@ void FeaturesDock::on_Viewport_changed()
     updateList();
 }
 
-void FeaturesDock::addItem(MapFeaturePtr F)
-{
-    if (ui.FeaturesList->count() > MAX_FEATS)
-        return;
-
-    QListWidgetItem* newItem = NULL;
-
-    if (curFeatType == IFeature::OsmRelation || curFeatType == Feature::All)
-    {
-        if (Relation* R = CAST_RELATION(F)) {
-            /* Include all relations if nothing is selected, otherwisde only the
-             * intersection of selected items and relations */
-            bool includeThis;
-            if ((Main->properties()->selection().size() > 0) && (ui.cbSelectionFilter->isChecked())) {
-                includeThis = false;
-                foreach (Feature* sel, Main->properties()->selection()) {
-                    if (R->find(sel) < R->size()) {
-                        includeThis = true;
-                        break;
-                    }
-                }
-            } else includeThis = true;
-
-            if (includeThis) {
-                newItem = new QListWidgetItem(R->description(), ui.FeaturesList);
-            }
-        }
-    }
-    if (curFeatType == IFeature::LineString || curFeatType == IFeature::Polygon || curFeatType == Feature::All)
-    {
-        if (Way* R = CAST_WAY(F))
-            newItem = new QListWidgetItem(R->description(), ui.FeaturesList);
-    }
-    if (curFeatType == IFeature::Point || curFeatType == Feature::All)
-    {
-        if (Node* N = CAST_NODE(F))
-            newItem = new QListWidgetItem(N->description(), ui.FeaturesList);
-    }
-    if (newItem) {
-        newItem->setData(Qt::UserRole, QVariant::fromValue(F));
-        if (Highlighted.contains(F)) newItem->setSelected(true);
-    }
-}
-
 void FeaturesDock::invalidate()
 {
-    ui.FeaturesList->clear();
+    theModel->clear();
     Highlighted.clear();
     Found.clear();
 }
 
-void FeaturesDock::clearItems()
+void FeaturesDock::invalidateMembers()
 {
-    for(int i=ui.FeaturesList->count()-1; i>=0; --i) {
-        QListWidgetItem* item = ui.FeaturesList->item(i);
-        if (item->isSelected()) {
-            Feature * F = item->data(Qt::UserRole).value<Feature*>();
-            if (F->isDeleted()) {
-                item->setSelected(false);
-                Highlighted.removeOne(F);
-            }
-        }
-        delete item;
-    }
+    theModel->invalidateMembers();
+    updateList();
 }
 
 void FeaturesDock::updateList()
 {
-    setUpdatesEnabled(false);
-    ui.FeaturesList->blockSignals(true);
-
-    clearItems();
-
     if (!isVisible() || !Main->document())
         return;
 
-    if (findMode) {
-        foreach (MapFeaturePtr F, Found) {
-            if (ui.cbWithin->isChecked()) {
-                if (Main->view()->viewport().contains(F->boundingBox()))
-                    addItem(F);
-            } else
-                addItem(F);
-        }
-    } else {
-        for (int j=0; j<Main->document()->layerSize(); ++j) {
-            if (!Main->document()->getLayer(j)->size())
-                continue;
-            QList < Feature* > ret = g_backend.indexFind(Main->document()->getLayer(j), theViewport);
-            foreach (Feature* F, ret) {
-                if (F->isHidden())
-                    continue;
-
-                if (ui.cbWithin->isChecked()) {
-                    if (Main->view()->viewport().contains(F->boundingBox()))
-                        addItem(F);
-                } else
-                    addItem(F);
-            }
-        }
-    }
-    ui.FeaturesList->sortItems();
+    /* Only the relations of the selection are listed if asked to */
+    QList<Feature*> theSelection;
+    if (ui.cbSelectionFilter->isChecked())
+        theSelection = Main->properties()->selection();
 
-    ui.FeaturesList->blockSignals(false);
-    setUpdatesEnabled(true);
+    theModel->setFilter(curFeatType, ui.cbWithin->isChecked(), theSelection);
+    theModel->setFound(Found, findMode);
+    theModel->update(Main->document(), theViewport);
 }
 
 int FeaturesDock::highlightedSize() const
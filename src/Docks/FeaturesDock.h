@@ -20,6 +20,7 @@
 #include "ui_FeaturesDock.h"
 
 class MainWindow;
+class FeaturesModel;
 class QAction;
 
 class FeaturesDock : public MDockAncestor
@@ -39,7 +40,7 @@ public slots:
     void updateList();
 
     void on_FeaturesList_itemSelectionChanged();
-    void on_FeaturesList_itemDoubleClicked(QListWidgetItem* item);
+    void on_FeaturesList_doubleClicked(const QModelIndex& index);
     void on_FeaturesList_customContextMenuRequested(const QPoint & pos);
     void on_FeaturesList_delete();
 
@@ -59,6 +60,10 @@ public slots:
     void tabChanged(int idx);
 
     void invalidate();
+    void invalidateMembers();
+
+private slots:
+    void restoreSelection();
 
 private:
     QList<Feature*> Highlighted;
@@ -66,6 +71,7 @@ private:
 
     MainWindow* Main;
     Ui::FeaturesDockWidget ui;
+    FeaturesModel* theModel;
     QAction* centerAction;
     QAction* centerZoomAction;
     QAction* downloadAction;
@@ -75,8 +81,7 @@ private:
     CoordBox theViewport;
     IFeature::FeatureType curFeatType;
 
-    void clearItems();
-    void addItem(MapFeaturePtr F);
+    QList<Feature*> selectedFeatures() const;
 
     bool findMode;
 
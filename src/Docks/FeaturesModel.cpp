@@ -0,0 +1,334 @@
+#include "FeaturesModel.h"
+
+#include "Document.h"
+#include "Layer.h"
+#include "Features.h"
+#include "MemoryBackend.h"
+#include "Global.h"
+
+#include <QtConcurrentRun>
+
+#include <algorithm>
+
+static bool entryLessThan(const FeaturesModelEntry& a, const FeaturesModelEntry& b)
+{
+    // Named features first, by name, then by id
+    if (a.Name.isEmpty() != b.Name.isEmpty())
+        return !a.Name.isEmpty();
+    int c = a.Name.compare(b.Name, Qt::CaseInsensitive);
+    if (c)
+        return c < 0;
+    return a.Id < b.Id;
+}
+
+static QVector<FeaturesModelEntry> sortEntries(QVector<FeaturesModelEntry> theEntries)
+{
+    std::sort(theEntries.begin(), theEntries.end(), entryLessThan);
+    return theEntries;
+}
+
+FeaturesModel::FeaturesModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , theDocument(0)
+    , theType(IFeature::OsmRelation)
+    , Within(false)
+    , FindMode(false)
+    , NeedsRescan(true)
+    , BackendMark(0)
+    , MembersChanged(false)
+    , SortPending(false)
+{
+    connect(&SortWatcher, SIGNAL(finished()), SLOT(sortDone()));
+}
+
+FeaturesModel::~FeaturesModel()
+{
+    SortWatcher.waitForFinished();
+}
+
+void FeaturesModel::setFilter(IFeature::FeatureType aType, bool aWithin, const QList<Feature*>& aSelection)
+{
+    // The selection only matters to the relation filter
+    bool selectionUsed = (aType == IFeature::OsmRelation || aType == IFeature::All);
+    if (aType == theType && aWithin == Within && (!selectionUsed || aSelection == theSelection))
+        return;
+
+    theType = aType;
+    Within = aWithin;
+    theSelection = aSelection;
+    NeedsRescan = true;
+}
+
+void FeaturesModel::setFound(const QList<Feature*>& aFound, bool aFindMode)
+{
+    if (aFindMode == FindMode && aFound == Found)
+        return;
+
+    FindMode = aFindMode;
+    Found = aFound;
+    NeedsRescan = true;
+}
+
+void FeaturesModel::invalidateMembers()
+{
+    NeedsRescan = true;
+}
+
+void FeaturesModel::clear()
+{
+    beginResetModel();
+    Members.clear();
+    Rows.clear();
+    Found.clear();
+    theDocument = NULL;
+    theViewport = CoordBox();
+    NeedsRescan = true;
+    endResetModel();
+}
+
+Feature* FeaturesModel::feature(const QModelIndex& index) const
+{
+    if (!index.isValid() || index.row() >= Rows.size())
+        return NULL;
+    return Rows[index.row()];
+}
+
+QModelIndex FeaturesModel::indexOf(Feature* F) const
+{
+    int i = Rows.indexOf(F);
+    if (i == -1)
+        return QModelIndex();
+    return index(i);
+}
+
+int FeaturesModel::rowCount(const QModelIndex& parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return Rows.size();
+}
+
+QVariant FeaturesModel::data(const QModelIndex& index, int role) const
+{
+    Feature* F = feature(index);
+    if (!F)
+        return QVariant();
+
+    switch (role) {
+    case Qt::DisplayRole:
+        return F->description();
+    case Qt::UserRole:
+        return QVariant::fromValue(F);
+    }
+    return QVariant();
+}
+
+bool FeaturesModel::inExtent(Feature* F) const
+{
+    if (Within)
+        return theViewport.contains(F->boundingBox());
+    return theViewport.intersects(F->boundingBox());
+}
+
+bool FeaturesModel::accepts(Feature* F) const
+{
+    if (FindMode) {
+        if (Within && !inExtent(F))
+            return false;
+    } else {
+        if (F->isHidden() || !inExtent(F))
+            return false;
+    }
+
+    if (theType == IFeature::OsmRelation || theType == IFeature::All) {
+        if (CHECK_RELATION(F)) {
+            /* Include all relations if nothing is selected, otherwisde only the
+             * intersection of selected items and relations */
+            if (!theSelection.size())
+                return true;
+            Relation* R = STATIC_CAST_RELATION(F);
+            foreach (Feature* sel, theSelection)
+                if (R->find(sel) < R->size())
+                    return true;
+            return false;
+        }
+    }
+    if (theType == IFeature::LineString || theType == IFeature::Polygon || theType == IFeature::All)
+        if (CHECK_WAY(F))
+            return true;
+    if (theType == IFeature::Point || theType == IFeature::All)
+        if (CHECK_NODE(F))
+            return true;
+    return false;
+}
+
+void FeaturesModel::update(Document* aDocument, const CoordBox& aViewport)
+{
+    if (aDocument != theDocument) {
+        theDocument = aDocument;
+        NeedsRescan = true;
+    }
+    if (!theDocument) {
+        if (Rows.size() || Members.size())
+            clear();
+        return;
+    }
+
+    CoordBox Old = theViewport;
+    theViewport = aViewport;
+
+    if (NeedsRescan || FindMode || Old.isNull() || !Old.intersects(aViewport)) {
+        rescan();
+        return;
+    }
+
+    if (!catchUp())
+        return;
+
+    // Features that left the viewport
+    QSet<Feature*>::iterator it = Members.begin();
+    while (it != Members.end()) {
+        if (!inExtent(*it)) {
+            it = Members.erase(it);
+            MembersChanged = true;
+        } else
+            ++it;
+    }
+
+    // Look up the strips that entered it
+    qreal xmin = qMin(aViewport.left(), aViewport.right()), xmax = qMax(aViewport.left(), aViewport.right());
+    qreal ymin = qMin(aViewport.top(), aViewport.bottom()), ymax = qMax(aViewport.top(), aViewport.bottom());
+    qreal oxmin = qBound(xmin, qMin(Old.left(), Old.right()), xmax), oxmax = qBound(xmin, qMax(Old.left(), Old.right()), xmax);
+    qreal oymin = qBound(ymin, qMin(Old.top(), Old.bottom()), ymax), oymax = qBound(ymin, qMax(Old.top(), Old.bottom()), ymax);
+    if (ymin < oymin)
+        scanArea(CoordBox(Coord(xmin, ymin), Coord(xmax, oymin)));
+    if (oymax < ymax)
+        scanArea(CoordBox(Coord(xmin, oymax), Coord(xmax, ymax)));
+    if (xmin < oxmin)
+        scanArea(CoordBox(Coord(xmin, oymin), Coord(oxmin, oymax)));
+    if (oxmax < xmax)
+        scanArea(CoordBox(Coord(oxmax, oymin), Coord(xmax, oymax)));
+
+    dropRemoved();
+    if (MembersChanged)
+        startSort();
+}
+
+/* Brings Members up to date with the edits since the last update. Returns
+   false if the change log was overrun and everything had to be rescanned. */
+bool FeaturesModel::catchUp()
+{
+    QList<Feature*> Changed;
+    if (!g_backend.changesSince(BackendMark, Changed)) {
+        rescan();
+        return false;
+    }
+    BackendMark = g_backend.changeMark();
+
+    foreach (Feature* F, Changed) {
+        // Deallocated features may already be gone, don't touch them
+        if (!g_backend.isAllocated(F)) {
+            if (Members.remove(F))
+                MembersChanged = true;
+            continue;
+        }
+        // Members are resorted too, their name may have changed
+        if (g_backend.isIndexable(F) && F->layer()->getDocument() == theDocument && accepts(F)) {
+            Members.insert(F);
+            MembersChanged = true;
+        } else if (Members.remove(F))
+            MembersChanged = true;
+    }
+    return true;
+}
+
+void FeaturesModel::scanArea(const CoordBox& aBox)
+{
+    for (int j=0; j<theDocument->layerSize(); ++j) {
+        if (!theDocument->getLayer(j)->size())
+            continue;
+        QList < Feature* > ret = g_backend.indexFind(theDocument->getLayer(j), aBox);
+        foreach (Feature* F, ret)
+            if (!Members.contains(F) && accepts(F)) {
+                Members.insert(F);
+                MembersChanged = true;
+            }
+    }
+}
+
+void FeaturesModel::rescan()
+{
+    NeedsRescan = false;
+    BackendMark = g_backend.changeMark();
+    Members.clear();
+
+    if (FindMode) {
+        foreach (Feature* F, Found)
+            if (g_backend.isAllocated(F) && accepts(F))
+                Members.insert(F);
+    } else
+        scanArea(theViewport);
+
+    dropRemoved();
+    startSort();
+}
+
+/* Rows that are no longer members are removed right away, as they may be
+   deleted before the next sort is done */
+void FeaturesModel::dropRemoved()
+{
+    QVector<Feature*> Kept;
+    Kept.reserve(Rows.size());
+    foreach (Feature* F, Rows)
+        if (Members.contains(F))
+            Kept.append(F);
+    if (Kept.size() == Rows.size())
+        return;
+
+    beginResetModel();
+    Rows = Kept;
+    endResetModel();
+    emit rowsRefreshed();
+}
+
+void FeaturesModel::startSort()
+{
+    if (SortWatcher.isRunning()) {
+        SortPending = true;
+        return;
+    }
+    SortPending = false;
+    MembersChanged = false;
+
+    // Only the keys are collected here, the comparisons are done in the background
+    QVector<FeaturesModelEntry> theEntries;
+    theEntries.reserve(Members.size());
+    foreach (Feature* F, Members) {
+        FeaturesModelEntry E;
+        E.Name = F->tagValue("name", "");
+        E.Id = F->id().numId;
+        E.F = F;
+        theEntries.append(E);
+    }
+    SortWatcher.setFuture(QtConcurrent::run(sortEntries, theEntries));
+}
+
+void FeaturesModel::sortDone()
+{
+    if (SortPending) {
+        startSort();
+        return;
+    }
+
+    QVector<FeaturesModelEntry> theEntries = SortWatcher.result();
+    QVector<Feature*> Sorted;
+    Sorted.reserve(theEntries.size());
+    foreach (const FeaturesModelEntry& E, theEntries)
+        if (Members.contains(E.F))
+            Sorted.append(E.F);
+
+    beginResetModel();
+    Rows = Sorted;
+    endResetModel();
+    emit rowsRefreshed();
+}
@@ -0,0 +1,84 @@
+#ifndef FEATURESMODEL_H
+#define FEATURESMODEL_H
+
+#include "Coord.h"
+#include "IFeature.h"
+
+#include <QAbstractListModel>
+#include <QFutureWatcher>
+#include <QSet>
+#include <QVector>
+
+class Document;
+class Feature;
+
+/// Entry of the background sort; only the key is used off the gui thread
+struct FeaturesModelEntry
+{
+    QString Name;
+    qint64 Id;
+    Feature* F;
+};
+
+/// List model of the features of the viewport (or of a search result).
+/// Membership is updated incrementally: on a viewport change only the
+/// strips that entered it are looked up in the backend index, and edits
+/// are picked up from the backend change log. Rows are sorted in a
+/// background thread and their text is only built when they are shown.
+class FeaturesModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    FeaturesModel(QObject* parent = 0);
+    ~FeaturesModel();
+
+    void setFilter(IFeature::FeatureType aType, bool aWithin, const QList<Feature*>& aSelection);
+    void setFound(const QList<Feature*>& aFound, bool aFindMode);
+    /// Layer visibility and filters change which features are hidden
+    /// without going through the change log: the next update rescans.
+    void invalidateMembers();
+    void update(Document* aDocument, const CoordBox& aViewport);
+    void clear();
+
+    Feature* feature(const QModelIndex& index) const;
+    QModelIndex indexOf(Feature* F) const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+signals:
+    /// Rows have been (re)sorted, the view selection has to be restored
+    void rowsRefreshed();
+
+private slots:
+    void sortDone();
+
+private:
+    bool accepts(Feature* F) const;
+    bool inExtent(Feature* F) const;
+    void rescan();
+    bool catchUp();
+    void scanArea(const CoordBox& aBox);
+    void dropRemoved();
+    void startSort();
+
+    Document* theDocument;
+    CoordBox theViewport;
+    IFeature::FeatureType theType;
+    bool Within;
+    QList<Feature*> theSelection;
+    bool FindMode;
+    QList<Feature*> Found;
+
+    QSet<Feature*> Members;
+    QVector<Feature*> Rows;
+    bool NeedsRescan;
+    int BackendMark;
+    bool MembersChanged;
+
+    QFutureWatcher<QVector<FeaturesModelEntry> > SortWatcher;
+    bool SortPending;
+};
+
+#endif // FEATURESMODEL_H
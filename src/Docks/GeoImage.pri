@@ -1,10 +1,12 @@
 DEFINES += GEOIMAGE
 
 # Header files
-HEADERS += GeoImageDock.h
+HEADERS += GeoImageDock.h \
+    PhotoIngest.h
 
 # Source files
-SOURCES += GeoImageDock.cpp
+SOURCES += GeoImageDock.cpp \
+    PhotoIngest.cpp
 LIBS += -lexiv2
 FORMS += PhotoLoadErrorDialog.ui
 
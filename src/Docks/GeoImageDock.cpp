@@ -1,4 +1,5 @@
 #include "GeoImageDock.h"
+#include "PhotoIngest.h"
 
 #include "Node.h"
 #include "Layer.h"
@@ -20,6 +21,7 @@
 #include <QTimeEdit>
 #include <QDialogButtonBox>
 #include <QFileDialog>
+#include <QScopedPointer>
 
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
@@ -54,6 +56,44 @@
         continue; \
 }
 
+/* Puts a PhotoNode at pos. A node of theLayer close by is replaced by it,
+   also in its ways, relations and track segments; inserted tells whether
+   the photo got a node of its own. */
+static PhotoNode* addPhotoNode(Layer* theLayer, const Coord& pos, bool& inserted)
+{
+    Node* Pt = nodeNear(theLayer, pos, .002);
+    inserted = (Pt == NULL);
+
+    PhotoNode* phNode;
+    if (!Pt) {
+        phNode = g_backend.allocPhotoNode(theLayer, pos);
+        theLayer->add(phNode);
+        g_backend.sync(phNode);
+        return phNode;
+    }
+
+    if (CAST_TRACKNODE(Pt))
+        phNode = g_backend.allocPhotoNode(theLayer, *CAST_TRACKNODE(Pt));
+    else
+        phNode = g_backend.allocPhotoNode(theLayer, *Pt);
+    theLayer->add(phNode);
+    for (int i=Pt->sizeParents()-1; i>=0; --i) {
+        Feature *P = CAST_FEATURE(Pt->getParent(i));
+        int idx = P->find(Pt);
+        if (Way* W = CAST_WAY(P)) {
+            W->add(phNode, idx);
+        } else if (Relation* R = CAST_RELATION(P)) {
+            R->add(R->getRole(idx), phNode, idx);
+        } else if (TrackSegment* S = CAST_SEGMENT(P)) {
+            S->add(phNode, idx);
+        }
+        P->remove(idx+1);
+    }
+    theLayer->remove(Pt);
+    g_backend.deallocFeature(theLayer, Pt);
+    return phNode;
+}
+
 bool GeoImageDock::getWalkingPapersDetails(const QUrl& reqUrl, double &lat, double &lon, bool& positionValid) const
 {
     QNetworkAccessManager manager;
@@ -129,6 +169,7 @@ GeoImageDock::GeoImageDock(MainWindow *aMain)
     previousImageAction->setShortcut(tr("PgUp"));
     previousImageAction->setShortcutContext(Qt::WidgetWithChildrenShortcut);
     saveImageAction = new QAction(tr("Save geotagged image..."), this);
+    geotagFolderAction = new QAction(tr("Geotag folder from track..."), this);
 
     QAction* sep = new QAction(this);
     sep->setSeparator(true);
@@ -138,6 +179,7 @@ GeoImageDock::GeoImageDock(MainWindow *aMain)
     addAction(previousImageAction);
     addAction(toClipboardAction);
     addAction(saveImageAction);
+    addAction(geotagFolderAction);
     addAction(sep);
     addAction(remImagesAction);
 
@@ -147,6 +189,7 @@ GeoImageDock::GeoImageDock(MainWindow *aMain)
     connect(nextImageAction, SIGNAL(triggered()), this, SLOT(selectNext()));
     connect(previousImageAction, SIGNAL(triggered()), this, SLOT(selectPrevious()));
     connect(saveImageAction, SIGNAL(triggered()), this, SLOT(saveImage()));
+    connect(geotagFolderAction, SIGNAL(triggered()), this, SLOT(geotagFolder()));
 }
 
 GeoImageDock::~GeoImageDock(void)
@@ -402,49 +445,15 @@ void GeoImageDock::loadImage(QString file, Coord pos)
             return;
     }
 
-    Node *Pt = 0;
-    int i = 0;
-    for (; i<theLayer->size(); ++i) // use existing TrackPoint if there is one in small distance
-        if ((Pt = CAST_NODE(theLayer->get(i))) &&
-         Pt->position().distanceFrom(pos) <= .002)
-            break;
-        else
-            Pt = 0;
-
-    PhotoNode* phNode;
-    if (!Pt) {
-        phNode = g_backend.allocPhotoNode(theLayer, pos);
-        theLayer->add(Pt);
-        g_backend.sync(Pt);
-    } else {
-        if (CAST_TRACKNODE(Pt))
-            phNode = g_backend.allocPhotoNode(theLayer, *CAST_TRACKNODE(Pt));
-        else
-            phNode = g_backend.allocPhotoNode(theLayer, *Pt);
-        theLayer->add(phNode);
-        for (int i=0; i<Pt->sizeParents(); ++i) {
-            Feature *P = CAST_FEATURE(Pt->getParent(i));
-            int idx = P->find(Pt);
-            if (Way* W = CAST_WAY(P)) {
-                W->add(phNode, idx);
-            } else if (Relation* R = CAST_RELATION(P)) {
-                R->add(R->getRole(idx), phNode, idx);
-            } else if (TrackSegment* S = CAST_SEGMENT(P)) {
-                S->add(phNode, idx);
-            }
-            P->remove(idx+1);
-            g_backend.deallocFeature(theLayer, Pt);
-
-        }
-
-    }
+    bool inserted;
+    PhotoNode* phNode = addPhotoNode(theLayer, pos, inserted);
 
     QDateTime time = QFileInfo(file).created();
 
     //Pt->setTag("_waypoint_", "true");
     phNode->setTag("_picture_", "GeoTagged");
-    phNode->setPhoto(QPixmap(file));
-    addUsedTrackpoint(NodeData(phNode, file, time, i == theLayer->size()));
+    phNode->setPhoto(PhotoThumbnails().thumbnail(file));
+    addUsedTrackpoint(NodeData(phNode, file, time, inserted));
 }
 
 void GeoImageDock::loadImages(QStringList fileNames)
@@ -456,10 +465,6 @@ void GeoImageDock::loadImages(QStringList fileNames)
     Document *theDocument = Main->document();
     MapView *theView = Main->view();
 
-    Exiv2::Image::AutoPtr image;
-    Exiv2::ExifData exifData;
-    bool positionValid = false;
-
     Layer *theLayer;
     if (photoLayer == NULL) {
         photoLayer = new TrackLayer(tr("Photo layer"));
@@ -528,55 +533,47 @@ void GeoImageDock::loadImages(QStringList fileNames)
             return;
     }
 
-    QProgressDialog progress(tr("Loading Images ..."), tr("Abort loading"), 0, fileNames.size());
+    QProgressDialog progress(tr("Reading Images ..."), tr("Abort loading"), 0, fileNames.size());
     progress.setWindowFlags(progress.windowFlags() & ~Qt::WindowContextHelpButtonHint);
     progress.setWindowFlags(progress.windowFlags() | Qt::MSWindowsFixedSizeDialogHint);
     progress.setWindowModality(Qt::WindowModal);
     progress.show();
 
+    // EXIF data and thumbnails are read in parallel, before anything is asked
+    QList<PhotoInfo> theInfos;
+    if (!readPhotoInfos(fileNames, progress, theInfos)) {
+        theView->invalidate(true, true, false);
+        if (photoLayer && !photoLayer->size()) {
+            theDocument->remove(photoLayer);
+            SAFE_DELETE(photoLayer);
+        }
+        return;
+    }
+    progress.setLabelText(tr("Loading Images ..."));
+
+    // Only built when a photo has to be matched by time
+    QScopedPointer<TrackTimeIndex> theTimeIndex;
+
     int photoDlgRes = -1;
-    foreach(file, fileNames) {
-        progress.setValue(fileNames.indexOf(file));
-        double lat = 0.0, lon = 0.0;
+    for (int n=0; n<theInfos.size(); ++n) {
+        const PhotoInfo& theInfo = theInfos[n];
+        file = theInfo.Filename;
+        progress.setValue(n);
 
-        if (!QFile::exists(file)) {
+        if (!theInfo.Exists) {
             WARNING(tr("No such file"), tr("Can't find image \"%1\".").arg(file));
             continue;
         }
-
-        try {
-            image = Exiv2::ImageFactory::open(file.toStdString());
-        }
-        catch (Exiv2::Error error)
-            WARNING(tr("Exiv2"), tr("Error while opening \"%2\":\n%1").arg(error.what()).arg(file));
-        if (image.get() == 0)
+        if (!theInfo.ExifError.isEmpty())
+            WARNING(tr("Exiv2"), tr("Error while opening \"%2\":\n%1").arg(theInfo.ExifError).arg(file));
+        if (!theInfo.ExifRead)
             WARNING(tr("Exiv2"), tr("Error while loading EXIF-data from \"%1\".").arg(file));
 
-        image->readMetadata();
-        exifData = image->exifData();
-
-        time = QDateTime();
-        if (!exifData.empty()) {
-            Exiv2::Exifdatum &latV = exifData["Exif.GPSInfo.GPSLatitude"];
-            Exiv2::Exifdatum &lonV = exifData["Exif.GPSInfo.GPSLongitude"];
-            positionValid = latV.count()==3 && lonV.count()==3;
-
-            if (positionValid) {
-                lat = latV.toFloat(0) + latV.toFloat(1) / 60.0 + latV.toFloat(2) / 3600.0;
-                lon = lonV.toFloat(0) + lonV.toFloat(1) / 60.0 + lonV.toFloat(2) / 3600.0;
-                if (exifData["Exif.GPSInfo.GPSLatitudeRef"].toString() == "S")
-                    lat *= -1.0;
-                if (exifData["Exif.GPSInfo.GPSLongitudeRef"].toString() == "W")
-                    lon *= -1.0;
-            }
-
-            QString timeStamp = QString::fromStdString(exifData["Exif.Image.DateTime"].toString());
-            if (timeStamp.isEmpty())
-                timeStamp = QString::fromStdString(exifData["Exif.Photo.DateTimeOriginal"].toString());
+        bool positionValid = theInfo.PositionValid;
+        double lat = theInfo.Position.y(), lon = theInfo.Position.x();
+        QImage theThumbnail = theInfo.Thumbnail;
 
-            if (!timeStamp.isEmpty())
-                time = QDateTime::fromString(timeStamp, "yyyy:MM:dd hh:mm:ss");
-        }
+        time = theInfo.Time;
 //        if (exifData.empty() || (!positionValid && time.isNull()) ) {
 //            // this question is asked when the file timestamp is used to find out to which node the image belongs
 //            QUESTION(tr("No EXIF"), tr("No EXIF header found in image \"%1\".\nDo you want to revert to improper file timestamp?").arg(file), timeQuestion);
@@ -591,7 +588,7 @@ void GeoImageDock::loadImages(QStringList fileNames)
             QDialog* dlg = new QDialog;
             Ui::PhotoLoadErrorDialog* ui = new Ui::PhotoLoadErrorDialog;
             ui->setupUi(dlg);
-            ui->photo->setPixmap(QPixmap(file).scaledToWidth(320));
+            ui->photo->setPixmap(QPixmap::fromImage(readScaledImage(file, QSize(320, INT_MAX))));
 
             if (M_PREFS->getOfflineMode())
                 ui->pbBarcode->setVisible(false);
@@ -658,6 +655,7 @@ void GeoImageDock::loadImages(QStringList fileNames)
                                     mat.rotate(-90);
                                 img = img.transformed(mat);
                                 img.save(file);
+                                theThumbnail = PhotoThumbnails().thumbnail(file);
                             }
                         }
                         getWalkingPapersDetails(url, lat, lon, positionValid);
@@ -677,48 +675,12 @@ void GeoImageDock::loadImages(QStringList fileNames)
         }
 
         if (positionValid) {
-            Coord newPos(lon, lat);
-            Node *Pt = 0;
-            int i = 0;
-            for (; i<theLayer->size(); ++i) { // use existing TrackPoint if there is one in small distance
-                if ((Pt = CAST_NODE(theLayer->get(i))) &&
-                 Pt->position().distanceFrom(newPos) <= .002)
-                    break;
-                else
-                    Pt = 0;
-            }
-
-            PhotoNode* phNode;
-            if (!Pt) {
-                phNode = g_backend.allocPhotoNode(theLayer, newPos);
-                theLayer->add(phNode);
-                g_backend.sync(phNode);
-            } else {
-                if (CAST_TRACKNODE(Pt))
-                    phNode = g_backend.allocPhotoNode(theLayer, *CAST_TRACKNODE(Pt));
-                else
-                    phNode = g_backend.allocPhotoNode(theLayer, *Pt);
-                theLayer->add(phNode);
-                for (int i=0; i<Pt->sizeParents(); ++i) {
-                    Feature *P = CAST_FEATURE(Pt->getParent(i));
-                    int idx = P->find(Pt);
-                    if (Way* W = CAST_WAY(P)) {
-                        W->add(phNode, idx);
-                    } else if (Relation* R = CAST_RELATION(P)) {
-                        R->add(R->getRole(idx), phNode, idx);
-                    } else if (TrackSegment* S = CAST_SEGMENT(P)) {
-                        S->add(phNode, idx);
-                    }
-                    P->remove(idx+1);
-                    g_backend.deallocFeature(theLayer, Pt);
-
-                }
-
-            }
-                        //Pt->setTag("_waypoint_", "true");
+            bool inserted;
+            PhotoNode* phNode = addPhotoNode(theLayer, Coord(lon, lat), inserted);
+            //Pt->setTag("_waypoint_", "true");
             phNode->setTag("_picture_", "GeoTagged");
-            phNode->setPhoto(QPixmap(file));
-            addUsedTrackpoint(NodeData(phNode, file, time, i == theLayer->size()));
+            phNode->setPhoto(theThumbnail);
+            addUsedTrackpoint(NodeData(phNode, file, time, inserted));
         } else if (!time.isNull() && res == 2) {
 
             if (offset == -1) { // ask the user to specify an offset for the images
@@ -772,21 +734,10 @@ void GeoImageDock::loadImages(QStringList fileNames)
 
             time = time.addSecs(offset);
 
-            Feature *feature = NULL;
-            TrackNode *Pt, *bestPt = NULL;
-            int a, secondsTo = INT_MAX;
-            int u;
-
-            for (u=0; u<theLayer->size(); u++) {
-                feature = theLayer->get(u);
-                if ((Pt = dynamic_cast<TrackNode*>(feature))) {
-                    a = time.secsTo(Pt->time().toLocalTime());
-                    if (abs(a) < abs(secondsTo)) {
-                        secondsTo = a;
-                        bestPt = Pt;
-                    }
-                }
-            }
+            if (theTimeIndex.isNull())
+                theTimeIndex.reset(new TrackTimeIndex(theLayer));
+            int secondsTo;
+            TrackNode* bestPt = theTimeIndex->nearest(time, secondsTo);
 
             if (!bestPt)
                 WARNING(tr("No TrackPoints"), tr("No TrackPoints found for image \"%1\""));
@@ -932,57 +883,112 @@ Coord GeoImageDock::getGeoDataFromImage(const QString & file)
 
 void GeoImageDock::addGeoDataToImage(Coord position, const QString & file)
 {
-    Exiv2::Image::AutoPtr image;
+    QString error;
+    if (!writePhotoPosition(file, position, error))
+        QMessageBox::warning(0, tr("Exiv2"), error, QMessageBox::Ok);
+}
 
-    try {
-        image = Exiv2::ImageFactory::open(file.toStdString());
-    }
-    catch (Exiv2::Error error) {
-        QMessageBox::warning(0, tr("Exiv2"), tr("Error while opening \"%1\":\n%2").arg(file).arg(error.what()), QMessageBox::Ok);
+void GeoImageDock::geotagFolder()
+{
+    Document *theDocument = Main->document();
+
+    QString dir = QFileDialog::getExistingDirectory(this, tr("Select the folder of the images"));
+    if (dir.isEmpty())
         return;
+    QStringList fileNames;
+    QFileInfoList theFiles = QDir(dir).entryInfoList(QStringList() << "*.jpg" << "*.jpeg" << "*.JPG" << "*.JPEG", QDir::Files, QDir::Name);
+    foreach (const QFileInfo& fi, theFiles)
+        fileNames << fi.absoluteFilePath();
+    if (fileNames.isEmpty())
+        return;
+
+    QStringList layers;
+    QList<Layer*> trackLayers;
+    for (int i=0; i<theDocument->layerSize(); ++i) {
+        Layer* layer = theDocument->getLayer(i);
+        if (layer->isEnabled() && layer->classType() == Layer::TrackLayerType) {
+            layers << layer->name();
+            trackLayers << layer;
+        }
     }
-    if (image.get() == 0) {
-        QMessageBox::warning(0, tr("Exiv2"), tr("Error while loading EXIF-data from \"%1\".").arg(file), QMessageBox::Ok);
+    if (trackLayers.isEmpty()) {
+        QMessageBox::warning(this, tr("No TrackPoints"), tr("There is no track to match the images with."));
         return;
     }
+    Layer* theLayer = trackLayers[0];
+    if (trackLayers.size() > 1) {
+        bool ok;
+        QString name = QInputDialog::getItem(this, tr("Geotag images"),
+         tr("Select the track the images were taken along:"), layers, 0, false, &ok);
+        if (!ok || name.isEmpty())
+            return;
+        theLayer = trackLayers[layers.indexOf(name)];
+    }
 
-    image->readMetadata();
-    Exiv2::ExifData &exifData = image->exifData();
+    bool ok;
+    int offset = QInputDialog::getInt(this, tr("Geotag images"),
+     tr("Seconds to add to the camera time to get the track time:"), 0, INT_MIN, INT_MAX, 1, &ok);
+    if (!ok)
+        return;
 
-    double lat = fabs(position.y());
-    double lon = fabs(position.x());
-    int h, m, s;
+    QProgressDialog progress(tr("Reading Images ..."), tr("Abort loading"), 0, fileNames.size(), this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.show();
 
-    QString hourFormat("%1/1 %2/1 %3/100");
+    QList<PhotoInfo> theInfos;
+    if (!readPhotoInfos(fileNames, progress, theInfos))
+        return;
 
-    h = int(lon / 1); // translate angle to hours, minutes and seconds
-    m = int((lon - h) * 60 / 1);
-    s = int((lon - h - m/60.0) * 60 * 60 * 100 / 1); // multiply with 100 because of divider in hourFormat
-    Exiv2::ValueType<Exiv2::URational> vlon;
-    vlon.read(hourFormat.arg(h).arg(m).arg(s).toStdString()); // fil vlon with string
+    // All images are matched at once, the index is built for the whole folder
+    TrackTimeIndex theIndex(theLayer);
+    QList<PhotoMatch> theMatches = matchPhotos(theInfos, theIndex, offset, 15);
+    int matched = 0;
+    foreach (const PhotoMatch& M, theMatches)
+        if (M.Matched)
+            ++matched;
+    if (!matched) {
+        QMessageBox::warning(this, tr("Geotag images"), tr("None of the %1 images was taken along the track.").arg(theMatches.size()));
+        return;
+    }
 
-    h = int(lat / 1); // translate angle to hours, minutes and seconds
-    m = int((lat - h) * 60 / 1);
-    s = int((lat - h - m/60.0) * 60 * 60 * 100 / 1); // multiply with 100 because of divider in hourFormat
-    Exiv2::ValueType<Exiv2::URational> vlat;
-    vlat.read(hourFormat.arg(h).arg(m).arg(s).toStdString()); // fill vlat with string
+    int reply = QMessageBox::question(this, tr("Geotag images"),
+     tr("%1 of %2 images were taken along the track.\nDo you want to write their positions into the image files?").arg(matched).arg(theMatches.size()),
+     QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel, QMessageBox::Yes);
+    if (reply == QMessageBox::Cancel)
+        return;
 
-    exifData["Exif.GPSInfo.GPSVersionID"] = "2 0 0 0";
+    if (reply == QMessageBox::Yes) {
+        progress.setLabelText(tr("Writing positions ..."));
+        QStringList errors;
+        if (!writePhotoPositions(theMatches, progress, errors))
+            return;
+        if (!errors.isEmpty())
+            QMessageBox::warning(this, tr("Exiv2"), errors.join("\n"));
+    }
 
-    exifData["Exif.GPSInfo.GPSLatitude"] = vlat;
-    if (position.y() < 0)
-        exifData["Exif.GPSInfo.GPSLatitudeRef"] = "S";
-    else
-        exifData["Exif.GPSInfo.GPSLatitudeRef"] = "N";
-    exifData["Exif.GPSInfo.GPSLongitude"] = vlon;
-    if (position.x() < 0)
-        exifData["Exif.GPSInfo.GPSLongitudeRef"] = "W";
-    else
-        exifData["Exif.GPSInfo.GPSLongitudeRef"] = "E";
+    if (theLayer->isReadonly()) { // nodes from readonly layers can not be selected and therefore associated images can not be displayed
+        if (QMessageBox::question(this, tr("Layer is read-only"),
+         tr("The used layer is not writeable. Should it be made writeable?\nIf not, you can't load images that belong to it."),
+         QMessageBox::Yes | QMessageBox::Cancel, QMessageBox::Yes) == QMessageBox::Yes)
+            theLayer->getWidget()->setLayerReadonly(false);
+        else
+            return;
+    }
 
-    image->writeMetadata(); // store it
+    for (int i=0; i<theMatches.size(); ++i) {
+        const PhotoMatch& M = theMatches[i];
+        if (!M.Matched)
+            continue;
+        bool inserted;
+        PhotoNode* phNode = addPhotoNode(theLayer, M.Position, inserted);
+        phNode->setTag("_picture_", "GeoTagged");
+        phNode->setPhoto(theInfos[i].Thumbnail);
+        addUsedTrackpoint(NodeData(phNode, M.Filename, M.Time, inserted));
+    }
 
-    return;
+    qSort(usedTrackPoints); // sort them chronological
+    curImage = -1; // the sorting invalidates curImage
+    Main->view()->invalidate(true, true, false);
 }
 
 void GeoImageDock::changeEvent(QEvent * event)
@@ -1001,6 +1007,7 @@ void GeoImageDock::retranslateUi()
     nextImageAction->setText(tr("Select next image"));
     previousImageAction->setText(tr("Select previous image"));
     saveImageAction->setText(tr("Save geotagged image..."));
+    geotagFolderAction->setText(tr("Geotag folder from track..."));
 }
 
 // *** ImageView *** //
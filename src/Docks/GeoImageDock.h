@@ -37,6 +37,7 @@ private slots:
     void selectPrevious(void);
     void centerMap(void);
     void saveImage(void);
+    void geotagFolder(void);
 
 private:
 
@@ -47,6 +48,7 @@ private:
     QAction *nextImageAction;
     QAction *previousImageAction;
     QAction *saveImageAction;
+    QAction *geotagFolderAction;
 
 
     QStringList Images;
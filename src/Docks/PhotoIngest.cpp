@@ -0,0 +1,557 @@
+#include "PhotoIngest.h"
+
+#include "Layer.h"
+#include "Features.h"
+#include "MemoryBackend.h"
+#include "MerkaartorPreferences.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QImageReader>
+#include <QProgressDialog>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <QtCore/qmath.h>
+
+#include <exiv2/exiv2.hpp>
+#include <exiv2/image.hpp>
+#include <exiv2/exif.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+PhotoThumbnails::PhotoThumbnails()
+    : CacheDir(M_PREFS->getGeoPicCacheDir()), Size(M_PREFS->getMaxGeoPicWidth())
+{
+    if (!CacheDir.exists())
+        CacheDir.mkpath(CacheDir.absolutePath());
+}
+
+QString PhotoThumbnails::cachePath(const QString& file) const
+{
+    QFileInfo fi(file);
+    QString Key = QString("%1|%2|%3|%4").arg(fi.absoluteFilePath()).arg(fi.size()).arg(fi.lastModified().toTime_t()).arg(Size);
+    QString Hash = QCryptographicHash::hash(Key.toUtf8(), QCryptographicHash::Md5).toHex();
+    return CacheDir.absoluteFilePath(Hash + ".jpg");
+}
+
+QImage PhotoThumbnails::thumbnail(const QString& file) const
+{
+    QString Cached = cachePath(file);
+    QImage theThumbnail;
+    if (theThumbnail.load(Cached, "JPG"))
+        return theThumbnail;
+
+    theThumbnail = readScaledImage(file, QSize(Size, Size));
+    if (theThumbnail.isNull())
+        return theThumbnail;
+
+    // Written aside first, so that no other thread reads half a file
+    QString Temp = QString("%1.%2").arg(Cached).arg(quintptr(QThread::currentThreadId()));
+    if (theThumbnail.save(Temp, "JPG", 85) && !QFile::rename(Temp, Cached))
+        QFile::remove(Temp);
+    return theThumbnail;
+}
+
+QImage readScaledImage(const QString& file, const QSize& aBox)
+{
+    QImageReader reader(file);
+    QSize theSize = reader.size();
+    // JPEG images are decoded at the reduced size right away
+    if (theSize.isValid() && (theSize.width() > aBox.width() || theSize.height() > aBox.height()))
+        reader.setScaledSize(theSize.scaled(aBox, Qt::KeepAspectRatio));
+
+    QImage theImage = reader.read();
+    if (theImage.width() > aBox.width() || theImage.height() > aBox.height())
+        theImage = theImage.scaled(aBox, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return theImage;
+}
+
+PhotoInfo readPhotoInfo(const QString& file, const PhotoThumbnails& theThumbnails)
+{
+    PhotoInfo theInfo;
+    theInfo.Filename = file;
+    theInfo.Exists = QFile::exists(file);
+    if (!theInfo.Exists)
+        return theInfo;
+
+    try {
+        Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(file.toStdString());
+        if (image.get() != 0) {
+            image->readMetadata();
+            theInfo.ExifRead = true;
+
+            Exiv2::ExifData& exifData = image->exifData();
+            if (!exifData.empty()) {
+                Exiv2::Exifdatum &latV = exifData["Exif.GPSInfo.GPSLatitude"];
+                Exiv2::Exifdatum &lonV = exifData["Exif.GPSInfo.GPSLongitude"];
+                theInfo.PositionValid = latV.count()==3 && lonV.count()==3;
+
+                if (theInfo.PositionValid) {
+                    double lat = latV.toFloat(0) + latV.toFloat(1) / 60.0 + latV.toFloat(2) / 3600.0;
+                    double lon = lonV.toFloat(0) + lonV.toFloat(1) / 60.0 + lonV.toFloat(2) / 3600.0;
+                    if (exifData["Exif.GPSInfo.GPSLatitudeRef"].toString() == "S")
+                        lat *= -1.0;
+                    if (exifData["Exif.GPSInfo.GPSLongitudeRef"].toString() == "W")
+                        lon *= -1.0;
+                    theInfo.Position = Coord(lon, lat);
+                }
+
+                QString timeStamp = QString::fromStdString(exifData["Exif.Image.DateTime"].toString());
+                if (timeStamp.isEmpty())
+                    timeStamp = QString::fromStdString(exifData["Exif.Photo.DateTimeOriginal"].toString());
+
+                if (!timeStamp.isEmpty())
+                    theInfo.Time = QDateTime::fromString(timeStamp, "yyyy:MM:dd hh:mm:ss");
+            }
+        }
+    }
+    catch (Exiv2::Error error) {
+        // The image may still be readable without its metadata
+        theInfo.ExifError = QString::fromLocal8Bit(error.what());
+    }
+
+    theInfo.Thumbnail = theThumbnails.thumbnail(file);
+    return theInfo;
+}
+
+namespace {
+
+class PhotoReader
+{
+public:
+    typedef PhotoInfo result_type;
+
+    PhotoReader(const PhotoThumbnails& aThumbnails)
+        : theThumbnails(aThumbnails)
+    {
+    }
+
+    PhotoInfo operator()(const QString& file) const
+    {
+        return readPhotoInfo(file, theThumbnails);
+    }
+
+private:
+    PhotoThumbnails theThumbnails;
+};
+
+}
+
+/* Runs theFunctor over theInput in the thread pool, keeping progress up to
+   date and cancelling when the user asks to. The results are in the order
+   of theInput. */
+template<typename Sequence, typename Functor>
+static bool mappedWithProgress(const Sequence& theInput, const Functor& theFunctor, QProgressDialog& progress, QList<typename Functor::result_type>& theResults)
+{
+    QFutureWatcher<typename Functor::result_type> watcher;
+    QEventLoop loop;
+    QObject::connect(&watcher, SIGNAL(progressValueChanged(int)), &progress, SLOT(setValue(int)));
+    QObject::connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+    QObject::connect(&progress, SIGNAL(canceled()), &watcher, SLOT(cancel()));
+    watcher.setFuture(QtConcurrent::mapped(theInput, theFunctor));
+    loop.exec();
+
+    if (watcher.isCanceled())
+        return false;
+    theResults = watcher.future().results();
+    return true;
+}
+
+/* The XMP toolkit Exiv2 relies on must be set up by a single thread before
+   images are opened concurrently */
+static void initializeExiv2()
+{
+    Exiv2::XmpParser::initialize();
+}
+
+bool readPhotoInfos(const QStringList& fileNames, QProgressDialog& progress, QList<PhotoInfo>& theInfos)
+{
+    initializeExiv2();
+    // The cache directory is set up here, the workers only use it
+    PhotoThumbnails theThumbnails;
+    return mappedWithProgress(fileNames, PhotoReader(theThumbnails), progress, theInfos);
+}
+
+namespace {
+
+struct NearestNode
+{
+    NearestNode(const Coord& aPos, qreal maxDistance)
+        : Pos(aPos), Distance(maxDistance), Best(NULL), BestSegment(NULL), BestIdx(-1)
+    {
+    }
+
+    void consider(Node* N)
+    {
+        qreal d = N->position().distanceFrom(Pos);
+        if (d <= Distance) {
+            Distance = d;
+            Best = N;
+            BestSegment = NULL;
+        }
+    }
+
+    void consider(TrackSegment* S, int idx)
+    {
+        qreal d = S->pointPosition(idx).distanceFrom(Pos);
+        if (d <= Distance) {
+            Distance = d;
+            Best = NULL;
+            BestSegment = S;
+            BestIdx = idx;
+        }
+    }
+
+    Coord Pos;
+    qreal Distance;
+    Node* Best;
+    TrackSegment* BestSegment;
+    int BestIdx;
+};
+
+}
+
+Node* nodeNear(Layer* theLayer, const Coord& pos, qreal maxDistance)
+{
+    // A box in degrees that surely holds the circle of maxDistance km
+    qreal dLat = maxDistance / 110.;
+    qreal dLon = dLat / qMax(qCos(pos.y() * M_PI / 180.), qreal(0.01));
+    CoordBox Area(Coord(pos.x() - dLon, pos.y() - dLat), Coord(pos.x() + dLon, pos.y() + dLat));
+
+    NearestNode Nearest(pos, maxDistance);
+    QList<Feature*> theFeatures = g_backend.indexFind(theLayer, Area);
+    foreach (Feature* F, theFeatures) {
+        if (CHECK_NODE(F)) {
+            Nearest.consider(STATIC_CAST_NODE(F));
+        } else if (CHECK_WAY(F)) {
+            // Untagged way nodes are not in the index themselves
+            Way* W = STATIC_CAST_WAY(F);
+            for (int i=0; i<W->size(); ++i)
+                if (W->getNode(i)->layer() == theLayer)
+                    Nearest.consider(W->getNode(i));
+        } else if (CHECK_SEGMENT(F)) {
+            TrackSegment* S = STATIC_CAST_SEGMENT(F);
+            const QVector<CoordBox> theBlocks = S->blockBoxes();
+            for (int b=0; b<theBlocks.size(); ++b) {
+                if (!theBlocks[b].intersects(Area))
+                    continue;
+                int End = qMin((b+1) * TrackSegment::BlockSize, S->size());
+                for (int j=b * TrackSegment::BlockSize; j<End; ++j)
+                    if (!S->isMaterialised(j)) // those are found as nodes
+                        Nearest.consider(S, j);
+            }
+        }
+    }
+
+    if (Nearest.BestSegment)
+        return Nearest.BestSegment->getNode(Nearest.BestIdx);
+    return Nearest.Best;
+}
+
+namespace {
+
+class TimeOrder
+{
+public:
+    TimeOrder(const QVector<uint>& aTimes)
+        : Times(aTimes)
+    {
+    }
+
+    bool operator()(int a, int b) const
+    {
+        return Times[a] < Times[b];
+    }
+
+private:
+    const QVector<uint>& Times;
+};
+
+}
+
+TrackTimeIndex::TrackTimeIndex(Layer* theLayer)
+{
+    for (int i=0; i<theLayer->size(); ++i) {
+        Feature* F = theLayer->get(i);
+        if (TrackSegment* S = CAST_SEGMENT(F)) {
+            if (!S->size())
+                continue;
+            TrackPoints thePoints = S->points();
+            SegmentTimes E;
+            E.Segment = S;
+            E.Times.resize(thePoints.size());
+            bool Sorted = true;
+            for (int j=0; j<thePoints.size(); ++j) {
+                E.Times[j] = thePoints[j].Time;
+                if (j && E.Times[j] < E.Times[j-1])
+                    Sorted = false;
+            }
+            if (!Sorted) {
+                E.Order.resize(E.Times.size());
+                for (int j=0; j<E.Order.size(); ++j)
+                    E.Order[j] = j;
+                std::stable_sort(E.Order.begin(), E.Order.end(), TimeOrder(E.Times));
+                QVector<uint> theTimes(E.Times.size());
+                for (int j=0; j<E.Order.size(); ++j)
+                    theTimes[j] = E.Times[E.Order[j]];
+                E.Times = theTimes;
+            }
+            Segments.append(E);
+        } else if (TrackNode* N = CAST_TRACKNODE(F)) {
+            // Points of a segment have been indexed with it
+            if (N->sizeParents() && CAST_SEGMENT(N->getParent(0)))
+                continue;
+            NodeTime E = { N->time().toTime_t(), N };
+            Nodes.append(E);
+        }
+    }
+    std::stable_sort(Nodes.begin(), Nodes.end());
+
+    std::stable_sort(Segments.begin(), Segments.end(), segmentStartsBefore);
+    Starts.resize(Segments.size());
+    MaxEnds.resize(Segments.size());
+    MaxEndSegments.resize(Segments.size());
+    for (int i=0; i<Segments.size(); ++i) {
+        Starts[i] = Segments[i].Times.first();
+        MaxEnds[i] = Segments[i].Times.last();
+        MaxEndSegments[i] = i;
+        if (i && MaxEnds[i-1] >= MaxEnds[i]) {
+            MaxEnds[i] = MaxEnds[i-1];
+            MaxEndSegments[i] = MaxEndSegments[i-1];
+        }
+    }
+}
+
+bool TrackTimeIndex::segmentStartsBefore(const SegmentTimes& a, const SegmentTimes& b)
+{
+    return a.Times.first() < b.Times.first();
+}
+
+bool TrackTimeIndex::isEmpty() const
+{
+    return Segments.isEmpty() && Nodes.isEmpty();
+}
+
+/* Finds the fixes of a segment around t. When no segment spans t, Before
+   and After are both the segment end closest to it. */
+bool TrackTimeIndex::locate(uint t, int& Seg, int& Before, int& After) const
+{
+    if (Segments.isEmpty())
+        return false;
+
+    // Only the segments starting before t can span it, and the search can
+    // stop at the first one after which none ends after t
+    int k = std::upper_bound(Starts.begin(), Starts.end(), t) - Starts.begin();
+    for (int i=k-1; i>=0 && MaxEnds[i] >= t; --i) {
+        const QVector<uint>& T = Segments[i].Times;
+        if (T.last() < t)
+            continue;
+        After = std::lower_bound(T.begin(), T.end(), t) - T.begin();
+        Before = (T[After] == t) ? After : After-1;
+        Seg = i;
+        return true;
+    }
+
+    Seg = -1;
+    if (k > 0) {
+        Seg = MaxEndSegments[k-1];
+        Before = After = Segments[Seg].Times.size()-1;
+    }
+    if (k < Segments.size() && (Seg == -1 || Starts[k] - t < t - MaxEnds[k-1])) {
+        Seg = k;
+        Before = After = 0;
+    }
+    return true;
+}
+
+/* Loose nodes may have been replaced by a photo since the index was built */
+TrackNode* TrackTimeIndex::nearestNode(uint t, int& secondsTo) const
+{
+    secondsTo = INT_MAX;
+
+    NodeTime Key;
+    Key.Time = t;
+    int After = std::lower_bound(Nodes.begin(), Nodes.end(), Key) - Nodes.begin();
+    int Before = After - 1;
+    while (After < Nodes.size() && !g_backend.isAllocated(Nodes[After].Node))
+        ++After;
+    while (Before >= 0 && !g_backend.isAllocated(Nodes[Before].Node))
+        --Before;
+
+    int Best = -1;
+    if (After < Nodes.size())
+        Best = After;
+    if (Before >= 0 && (Best == -1 || t - Nodes[Before].Time < Nodes[After].Time - t))
+        Best = Before;
+    if (Best == -1)
+        return NULL;
+
+    secondsTo = int(qint64(Nodes[Best].Time) - qint64(t));
+    return Nodes[Best].Node;
+}
+
+TrackNode* TrackTimeIndex::nearest(const QDateTime& time, int& secondsTo)
+{
+    uint t = time.toTime_t();
+    TrackNode* Best = nearestNode(t, secondsTo);
+
+    int Seg, Before, After;
+    if (locate(t, Seg, Before, After)) {
+        const SegmentTimes& S = Segments[Seg];
+        int Pos = (t - S.Times[Before] <= S.Times[After] - t) ? Before : After;
+        int s = int(qint64(S.Times[Pos]) - qint64(t));
+        if (!Best || qAbs(s) < qAbs(secondsTo)) {
+            secondsTo = s;
+            Best = S.Segment->getNode(S.point(Pos));
+        }
+    }
+    return Best;
+}
+
+bool TrackTimeIndex::position(const QDateTime& time, Coord& pos, int& secondsTo) const
+{
+    uint t = time.toTime_t();
+    TrackNode* N = nearestNode(t, secondsTo);
+
+    int Seg, Before, After;
+    if (!locate(t, Seg, Before, After)) {
+        if (N)
+            pos = N->position();
+        return N != NULL;
+    }
+
+    const SegmentTimes& S = Segments[Seg];
+    Coord a = S.Segment->pointPosition(S.point(Before));
+    if (Before != After) {
+        Coord b = S.Segment->pointPosition(S.point(After));
+        qreal f = qreal(t - S.Times[Before]) / (S.Times[After] - S.Times[Before]);
+        pos = Coord(a.x() + f*(b.x() - a.x()), a.y() + f*(b.y() - a.y()));
+        secondsTo = 0;
+        return true;
+    }
+
+    int s = int(qint64(S.Times[Before]) - qint64(t));
+    if (N && qAbs(secondsTo) <= qAbs(s)) {
+        pos = N->position();
+        return true;
+    }
+    pos = a;
+    secondsTo = s;
+    return true;
+}
+
+QList<PhotoMatch> matchPhotos(const QList<PhotoInfo>& thePhotos, const TrackTimeIndex& theIndex, int offset, int maxSeconds)
+{
+    QList<PhotoMatch> theMatches;
+    foreach (const PhotoInfo& Info, thePhotos) {
+        PhotoMatch M;
+        M.Filename = Info.Filename;
+        if (!Info.Time.isNull()) {
+            M.Time = Info.Time.addSecs(offset);
+            M.Matched = theIndex.position(M.Time, M.Position, M.SecondsTo) && qAbs(M.SecondsTo) <= maxSeconds;
+        }
+        theMatches << M;
+    }
+    return theMatches;
+}
+
+bool writePhotoPosition(const QString& file, const Coord& position, QString& error)
+{
+    Exiv2::Image::AutoPtr image;
+
+    try {
+        image = Exiv2::ImageFactory::open(file.toStdString());
+    }
+    catch (Exiv2::Error e) {
+        error = QCoreApplication::translate("GeoImageDock", "Error while opening \"%1\":\n%2").arg(file).arg(e.what());
+        return false;
+    }
+    if (image.get() == 0) {
+        error = QCoreApplication::translate("GeoImageDock", "Error while loading EXIF-data from \"%1\".").arg(file);
+        return false;
+    }
+
+    try {
+        image->readMetadata();
+        Exiv2::ExifData &exifData = image->exifData();
+
+        double lat = fabs(position.y());
+        double lon = fabs(position.x());
+        int h, m, s;
+
+        QString hourFormat("%1/1 %2/1 %3/100");
+
+        h = int(lon / 1); // translate angle to hours, minutes and seconds
+        m = int((lon - h) * 60 / 1);
+        s = int((lon - h - m/60.0) * 60 * 60 * 100 / 1); // multiply with 100 because of divider in hourFormat
+        Exiv2::ValueType<Exiv2::URational> vlon;
+        vlon.read(hourFormat.arg(h).arg(m).arg(s).toStdString()); // fil vlon with string
+
+        h = int(lat / 1); // translate angle to hours, minutes and seconds
+        m = int((lat - h) * 60 / 1);
+        s = int((lat - h - m/60.0) * 60 * 60 * 100 / 1); // multiply with 100 because of divider in hourFormat
+        Exiv2::ValueType<Exiv2::URational> vlat;
+        vlat.read(hourFormat.arg(h).arg(m).arg(s).toStdString()); // fill vlat with string
+
+        exifData["Exif.GPSInfo.GPSVersionID"] = "2 0 0 0";
+
+        exifData["Exif.GPSInfo.GPSLatitude"] = vlat;
+        if (position.y() < 0)
+            exifData["Exif.GPSInfo.GPSLatitudeRef"] = "S";
+        else
+            exifData["Exif.GPSInfo.GPSLatitudeRef"] = "N";
+        exifData["Exif.GPSInfo.GPSLongitude"] = vlon;
+        if (position.x() < 0)
+            exifData["Exif.GPSInfo.GPSLongitudeRef"] = "W";
+        else
+            exifData["Exif.GPSInfo.GPSLongitudeRef"] = "E";
+
+        image->writeMetadata(); // store it
+    }
+    catch (Exiv2::Error e) {
+        error = QCoreApplication::translate("GeoImageDock", "Error while writing EXIF-data to \"%1\":\n%2").arg(file).arg(e.what());
+        return false;
+    }
+
+    return true;
+}
+
+namespace {
+
+class PositionWriter
+{
+public:
+    typedef QString result_type;
+
+    QString operator()(const PhotoMatch& aMatch) const
+    {
+        QString error;
+        writePhotoPosition(aMatch.Filename, aMatch.Position, error);
+        return error;
+    }
+};
+
+}
+
+bool writePhotoPositions(const QList<PhotoMatch>& theMatches, QProgressDialog& progress, QStringList& errors)
+{
+    QList<PhotoMatch> theMatched;
+    foreach (const PhotoMatch& M, theMatches)
+        if (M.Matched)
+            theMatched << M;
+
+    progress.setMaximum(theMatched.size());
+    initializeExiv2();
+    QStringList theResults;
+    if (!mappedWithProgress(theMatched, PositionWriter(), progress, theResults))
+        return false;
+    foreach (const QString& error, theResults)
+        if (!error.isEmpty())
+            errors << error;
+    return true;
+}
@@ -0,0 +1,146 @@
+#ifndef MERKAARTOR_PHOTOINGEST_H_
+#define MERKAARTOR_PHOTOINGEST_H_
+
+#include "Coord.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QImage>
+#include <QList>
+#include <QStringList>
+#include <QVector>
+
+class Layer;
+class Node;
+class TrackNode;
+class TrackSegment;
+class QProgressDialog;
+
+/// Downscaled copies of photos, kept on disk so that a folder is only
+/// decoded once. Thumbnails are keyed by path, size and modification time
+/// of the photo. The cache can be used from worker threads.
+class PhotoThumbnails
+{
+public:
+    PhotoThumbnails();
+
+    /// Thumbnail of file, from the cache or decoded (and cached) if needed
+    QImage thumbnail(const QString& file) const;
+
+private:
+    QString cachePath(const QString& file) const;
+
+    QDir CacheDir;
+    int Size;
+};
+
+/// What is known of a photo before it is put on the map
+struct PhotoInfo
+{
+    PhotoInfo()
+        : Exists(false), ExifRead(false), PositionValid(false)
+    {
+    }
+
+    QString Filename;
+    bool Exists;
+    /// Whether Exiv2 could read the file; ExifError holds the reason if not
+    bool ExifRead;
+    QString ExifError;
+    bool PositionValid;
+    Coord Position;
+    /// Time the photo was taken, null if it is not in the EXIF data
+    QDateTime Time;
+    QImage Thumbnail;
+};
+
+/// Reads the EXIF data and thumbnail of a photo
+PhotoInfo readPhotoInfo(const QString& file, const PhotoThumbnails& theThumbnails);
+/// Reads all photos in parallel, reporting to progress. Returns false if
+/// the user cancelled; theInfos are in the order of fileNames.
+bool readPhotoInfos(const QStringList& fileNames, QProgressDialog& progress, QList<PhotoInfo>& theInfos);
+/// The image in file, decoded at the size that fits aBox
+QImage readScaledImage(const QString& file, const QSize& aBox);
+
+/// Node of theLayer within maxDistance (km) of pos, found through the
+/// spatial index. The closest point of a GPS track is materialised.
+Node* nodeNear(Layer* theLayer, const Coord& pos, qreal maxDistance);
+
+/// Track point times of a layer, to find where a photo was taken. Each
+/// segment keeps its times in sorted order and the segments are sorted by
+/// their start, so that a lookup is a binary search.
+class TrackTimeIndex
+{
+public:
+    TrackTimeIndex(Layer* theLayer);
+
+    bool isEmpty() const;
+
+    /// Track point recorded closest to time, materialised if needed, or
+    /// NULL if the layer has no track points; secondsTo receives the time
+    /// from time to the point
+    TrackNode* nearest(const QDateTime& time, int& secondsTo);
+
+    /// Position at time, interpolated between the fixes around it. When time
+    /// falls outside all segments, the closest fix is taken and secondsTo is
+    /// the time to it (it is 0 otherwise). Returns false if there are no
+    /// track points.
+    bool position(const QDateTime& time, Coord& pos, int& secondsTo) const;
+
+private:
+    struct SegmentTimes
+    {
+        TrackSegment* Segment;
+        QVector<uint> Times;
+        /// Point of each time, empty if the segment is sorted by time
+        QVector<int> Order;
+
+        int point(int i) const { return Order.isEmpty() ? i : Order[i]; }
+    };
+    struct NodeTime
+    {
+        uint Time;
+        TrackNode* Node;
+        bool operator<(const NodeTime& other) const { return Time < other.Time; }
+    };
+
+    static bool segmentStartsBefore(const SegmentTimes& a, const SegmentTimes& b);
+    bool locate(uint t, int& Seg, int& Before, int& After) const;
+    TrackNode* nearestNode(uint t, int& secondsTo) const;
+
+    QVector<SegmentTimes> Segments;
+    /// Start of each segment, and the latest end of the segments up to it
+    QVector<uint> Starts;
+    QVector<uint> MaxEnds;
+    QVector<int> MaxEndSegments;
+    /// Track points that are not part of a segment
+    QVector<NodeTime> Nodes;
+};
+
+/// Where a photo was taken according to the tracks
+struct PhotoMatch
+{
+    PhotoMatch()
+        : Matched(false), SecondsTo(0)
+    {
+    }
+
+    QString Filename;
+    /// Time of the photo, corrected by the camera offset
+    QDateTime Time;
+    bool Matched;
+    Coord Position;
+    int SecondsTo;
+};
+
+/// Matches all photos by their time in one pass. offset (s) is added to the
+/// photo times; photos further than maxSeconds from the tracks, or without
+/// a time, are left unmatched.
+QList<PhotoMatch> matchPhotos(const QList<PhotoInfo>& thePhotos, const TrackTimeIndex& theIndex, int offset, int maxSeconds);
+/// Writes pos into the EXIF data of file; error receives the reason if it fails
+bool writePhotoPosition(const QString& file, const Coord& pos, QString& error);
+/// Writes the positions of the matched photos in parallel. Returns false if
+/// the user cancelled; errors receives a message for each failed photo.
+bool writePhotoPositions(const QList<PhotoMatch>& theMatches, QProgressDialog& progress, QStringList& errors);
+
+#endif
@@ -0,0 +1,165 @@
+#include "ProfilerDock.h"
+#include "MainWindow.h"
+
+#include <QCheckBox>
+#include <QFile>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+#include <algorithm>
+
+static QString msecs(qint64 us)
+{
+    return QString::number(us / 1000., 'f', 2);
+}
+
+static bool longerThan(const RenderProfiler::TileProfile& a, const RenderProfiler::TileProfile& b)
+{
+    return a.Duration > b.Duration;
+}
+
+ProfilerDock::ProfilerDock(MainWindow* aParent)
+    : MDockAncestor(aParent), Main(aParent)
+{
+    setMinimumSize(220,100);
+    setObjectName("profilerDock");
+
+    QWidget* w = new QWidget(this);
+    QVBoxLayout* theLayout = new QVBoxLayout(w);
+    theLayout->setContentsMargins(2, 2, 2, 2);
+
+    Enable = new QCheckBox(w);
+    theLayout->addWidget(Enable);
+
+    theTree = new QTreeWidget(w);
+    theTree->setColumnCount(3);
+    theTree->setRootIsDecorated(true);
+    theTree->setUniformRowHeights(true);
+    theLayout->addWidget(theTree);
+
+    QHBoxLayout* theButtons = new QHBoxLayout;
+    Events = new QLabel(w);
+    theButtons->addWidget(Events, 1);
+    Clear = new QPushButton(w);
+    theButtons->addWidget(Clear);
+    SaveTrace = new QPushButton(w);
+    theButtons->addWidget(SaveTrace);
+    theLayout->addLayout(theButtons);
+
+    setWidget(w);
+
+    connect(Enable, SIGNAL(toggled(bool)), this, SLOT(setProfiling(bool)));
+    connect(Clear, SIGNAL(clicked()), this, SLOT(clearProfile()));
+    connect(SaveTrace, SIGNAL(clicked()), this, SLOT(saveTrace()));
+    connect(RenderProfiler::instance(), SIGNAL(frameFinished()), this, SLOT(updateFrame()));
+
+    retranslateUi();
+}
+
+ProfilerDock::~ProfilerDock()
+{
+}
+
+void ProfilerDock::setProfiling(bool b)
+{
+    RenderProfiler::instance()->setEnabled(b);
+    updateEvents();
+}
+
+void ProfilerDock::addStats(QTreeWidgetItem* aParent, const RenderProfiler::Stats& theStats, bool withFrame)
+{
+    for (int i=RenderProfiler::Tile; i<RenderProfiler::MetricCount; ++i) {
+        RenderProfiler::Metric m = RenderProfiler::Metric(i);
+        if (m == RenderProfiler::Tile && !withFrame)
+            continue;
+        QTreeWidgetItem* it = new QTreeWidgetItem(aParent);
+        it->setText(0, RenderProfiler::metricName(m));
+        it->setText(1, QString::number(theStats.Count[m]));
+        if (RenderProfiler::isTimed(m))
+            it->setText(2, msecs(theStats.Time[m]));
+    }
+}
+
+void ProfilerDock::updateFrame()
+{
+    RenderProfiler::FrameProfile F = RenderProfiler::instance()->lastFrame();
+    theTree->clear();
+    if (!F.Number) {
+        updateEvents();
+        return;
+    }
+
+    QTreeWidgetItem* theFrame = new QTreeWidgetItem(theTree);
+    theFrame->setText(0, tr("Frame %1").arg(F.Number));
+    theFrame->setText(2, msecs(F.Duration));
+    addStats(theFrame, F.Totals, true);
+    theFrame->setExpanded(true);
+
+    // The slowest tiles first, those are the ones to look at
+    std::sort(F.Tiles.begin(), F.Tiles.end(), longerThan);
+    QTreeWidgetItem* theTiles = new QTreeWidgetItem(theTree);
+    theTiles->setText(0, tr("Tiles"));
+    theTiles->setText(1, QString::number(F.Tiles.size()));
+    foreach (const RenderProfiler::TileProfile& T, F.Tiles) {
+        QTreeWidgetItem* it = new QTreeWidgetItem(theTiles);
+        it->setText(0, tr("Tile %1, %2 (thread %3)").arg(T.Tile.x()).arg(T.Tile.y()).arg(T.Thread));
+        it->setText(2, msecs(T.Duration));
+        addStats(it, T.Totals, false);
+    }
+
+    updateEvents();
+}
+
+void ProfilerDock::updateEvents()
+{
+    RenderProfiler* theProfiler = RenderProfiler::instance();
+    int n = theProfiler->eventCount();
+    QString s = tr("%n trace events", "", n);
+    if (theProfiler->droppedEvents())
+        s += " " + tr("(full)");
+    Events->setText(s);
+    SaveTrace->setEnabled(n > 0);
+}
+
+void ProfilerDock::saveTrace()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Save render trace"), "render-trace.json", tr("Chrome trace (*.json)"));
+    if (fileName.isEmpty())
+        return;
+
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate) || !RenderProfiler::instance()->writeTrace(&f))
+        QMessageBox::warning(this, tr("Save render trace"), tr("Could not write %1: %2").arg(fileName).arg(f.errorString()));
+}
+
+void ProfilerDock::clearProfile()
+{
+    RenderProfiler::instance()->clear();
+    theTree->clear();
+    updateEvents();
+}
+
+void ProfilerDock::changeEvent(QEvent *event)
+{
+    if (event->type() == QEvent::LanguageChange)
+        retranslateUi();
+    MDockAncestor::changeEvent(event);
+}
+
+void ProfilerDock::retranslateUi()
+{
+    setWindowTitle(tr("Render profile"));
+    Enable->setText(tr("Profile rendering"));
+    Enable->setToolTip(tr("Time the rendering of the map; this slows it down a little"));
+    theTree->setHeaderLabels(QStringList() << tr("Section") << tr("Count") << tr("Time (ms)"));
+    Clear->setText(tr("Clear"));
+    SaveTrace->setText(tr("Save trace..."));
+    updateEvents();
+    updateFrame();
+}
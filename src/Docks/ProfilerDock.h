@@ -0,0 +1,45 @@
+#ifndef PROFILERDOCK_H
+#define PROFILERDOCK_H
+
+#include "MDockAncestor.h"
+#include "RenderProfiler.h"
+
+class MainWindow;
+class QCheckBox;
+class QLabel;
+class QPushButton;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+/// Shows where the last frame of the map went, in total and per tile, and
+/// saves the events of the session as a Chrome trace
+class ProfilerDock : public MDockAncestor
+{
+    Q_OBJECT
+
+public:
+    ProfilerDock(MainWindow* aParent);
+    ~ProfilerDock();
+
+    void changeEvent(QEvent*);
+    void retranslateUi();
+
+private slots:
+    void setProfiling(bool b);
+    void updateFrame();
+    void saveTrace();
+    void clearProfile();
+
+private:
+    void addStats(QTreeWidgetItem* aParent, const RenderProfiler::Stats& theStats, bool withFrame);
+    void updateEvents();
+
+    MainWindow* Main;
+    QCheckBox* Enable;
+    QPushButton* SaveTrace;
+    QPushButton* Clear;
+    QLabel* Events;
+    QTreeWidget* theTree;
+};
+
+#endif // PROFILERDOCK_H
@@ -10,10 +10,12 @@
 #include "NodeCommands.h"
 #include "Document.h"
 #include "Layer.h"
+#include "FilterEngine.h"
 #include "MasPaintStyle.h"
 #include "TagSelector.h"
 #include "MapView.h"
 #include "PropertiesDock.h"
+#include "RenderProfiler.h"
 
 #include "Utils.h"
 
@@ -25,6 +27,8 @@
 
 #include <algorithm>
 
+#define FEATURE_LOCK_STRIPES 64
+
 qint64 g_feat_rndId = 0;
 QStringList TechnicalTags = QString(TECHNICAL_TAGS).split("#");
 
@@ -84,20 +88,36 @@ void copyTags(Feature* Dest, Feature* Src)
 }
 
 
+/// Painter matching state. It is only allocated once a feature has had
+/// possible painters, plain nodes never need one.
+class FeaturePainterCache
+{
+public:
+    FeaturePainterCache()
+        : PixelPerMForPainter(-1), CurrentPainter(0)
+    {
+    }
+
+    QList<const FeaturePainter*> PossiblePainters;
+    qreal PixelPerMForPainter;
+    const FeaturePainter* CurrentPainter;
+};
+
+/// Members are ordered by size to avoid padding; this is allocated for each
+/// feature, so every byte counts.
 class FeaturePrivate
 {
 public:
     FeaturePrivate(Feature* aFeature)
-        :  LastActor(Feature::User)
-        , PossiblePaintersUpToDate(false)
-        , PixelPerMForPainter(-1), CurrentPainter(0), HasPainter(false)
-        , theFeature(aFeature), LastPartNotification(0)
-        , Deleted(false), Visible(true), Uploaded(false), FilterRevision(-1)
-        , Virtual(false), Special(false), DirtyLevel(0)
-        , parentLayer(0)
+        : theFeature(aFeature), parentLayer(0), Painters(0), FilterMask(0), Alpha(1.0)
+        , FilterRevision(-1), LastPartNotification(0), DirtyLevel(0)
     #ifndef FRISIUS_BUILD
         , Time(QDateTime::currentDateTime().toTime_t()), User(0xffffffff)
     #endif
+        , LastActor(Feature::User)
+        , PossiblePaintersUpToDate(false)
+        , Deleted(false), Visible(true), Uploaded(false)
+        , Virtual(false), Special(false)
     {
 #ifndef FRISIUS_BUILD
         initVersionNumber();
@@ -105,21 +125,35 @@ public:
 #endif
     }
     FeaturePrivate(const FeaturePrivate& other)
-        : Tags(other.Tags), LastActor(other.LastActor)
-        , PossiblePaintersUpToDate(false)
-        , PixelPerMForPainter(-1), CurrentPainter(0), HasPainter(false)
-        , theFeature(NULL), LastPartNotification(0)
-        , Deleted(false), Visible(true), Uploaded(false), FilterRevision(-1)
-        , Virtual(other.Virtual), Special(other.Special), DirtyLevel(0)
-        , parentLayer(0)
+        : Tags(other.Tags)
+        , theFeature(NULL), parentLayer(0), Painters(0), FilterMask(0), Alpha(1.0)
+        , FilterRevision(-1), LastPartNotification(0), DirtyLevel(0)
     #ifndef FRISIUS_BUILD
         , Time(other.Time), User(other.User)
     #endif
+        , LastActor(other.LastActor)
+        , PossiblePaintersUpToDate(false)
+        , Deleted(false), Visible(true), Uploaded(false)
+        , Virtual(other.Virtual), Special(other.Special)
     {
 #ifndef FRISIUS_BUILD
         initVersionNumber();
 #endif
     }
+    ~FeaturePrivate()
+    {
+        delete Painters;
+    }
+
+    qint64 memoryUsage() const
+    {
+        qint64 Bytes = sizeof(FeaturePrivate);
+        Bytes += Tags.size() * sizeof(QPair<quint32, quint32>);
+        Bytes += Parents.size() * sizeof(Feature*);
+        if (Painters)
+            Bytes += sizeof(FeaturePainterCache) + Painters->PossiblePainters.size() * sizeof(FeaturePainter*);
+        return Bytes;
+    }
 
     void updatePossiblePainters();
     void blankPainters();
@@ -133,32 +167,29 @@ public:
     }
 #endif
 
-    mutable IFeature::FId Id; // 9 (16)
-    QList<QPair<quint32, quint32> > Tags; // 4
-    Feature::ActorType LastActor; // 4
-    QList<const FeaturePainter*> PossiblePainters; // 4
-    bool PossiblePaintersUpToDate; // 1
-    qreal PixelPerMForPainter; // 8
-    const FeaturePainter* CurrentPainter; // 4
-    bool HasPainter; // 1
-    Feature* theFeature; // 4
-    QList<Feature*> Parents; // 4
+    mutable IFeature::FId Id; // 16
+    QList<QPair<quint32, quint32> > Tags; // 8
+    QList<Feature*> Parents; // 8
+    Feature* theFeature; // 8
+    Layer* parentLayer; // 8
+    FeaturePainterCache* Painters; // 8
+    quint64 FilterMask; // 8
+    float Alpha; // 4
+    int FilterRevision; // 4
     int LastPartNotification; // 4
+    int DirtyLevel; // 4
 #ifndef FRISIUS_BUILD
     uint Time; // 4
     quint32 User; // 4
     int VersionNumber; // 4
 #endif
+    quint8 LastActor; // 1
+    bool PossiblePaintersUpToDate; // 1
     bool Deleted; // 1
     bool Visible; // 1
     bool Uploaded; // 1
-    int FilterRevision; // 4
     bool Virtual; // 1
     bool Special; // 1
-    int DirtyLevel; // 4
-    QList<FilterLayer*> FilterLayers; // 4
-    qreal Alpha; // 8
-    Layer* parentLayer; // 4
 };
 
 Feature::Feature()
@@ -190,6 +221,7 @@ Feature::~Feature(void)
 void Feature::setLayer(Layer* aLayer)
 {
     p->parentLayer = aLayer;
+    p->FilterRevision = -1;
 }
 
 Layer* Feature::layer() const
@@ -208,7 +240,7 @@ Feature::ActorType Feature::lastUpdated() const
     if (L && L->classType() == Layer::DirtyLayerType)
         return Feature::User;
     else
-        return p->LastActor;
+        return Feature::ActorType(p->LastActor);
 }
 
 QString Feature::stripToOSMId(const IFeature::FId& id)
@@ -452,6 +484,7 @@ void Feature::setTag(int index, const QString& key, const QString& value)
         p->Tags.insert(p->Tags.begin() + index, pi);
     }
     invalidatePainter();
+    invalidateFilters();
     invalidateMeta();
 }
 
@@ -475,6 +508,7 @@ void Feature::setTag(const QString& key, const QString& value)
     if (i == p->Tags.size()) {
         p->Tags.push_back(pi);
     }
+    invalidateFilters();
     invalidateMeta();
     invalidatePainter();
 }
@@ -485,6 +519,7 @@ void Feature::clearTags()
         g_removeFromTagList(p->Tags[0].first, p->Tags[0].second);
         p->Tags.erase(p->Tags.begin());
     }
+    invalidateFilters();
     invalidateMeta();
     invalidatePainter();
 }
@@ -500,6 +535,7 @@ void Feature::clearTag(const QString& k)
             p->Tags.erase(p->Tags.begin()+i);
             break;
         }
+    invalidateFilters();
     invalidateMeta();
     invalidatePainter();
 }
@@ -508,6 +544,7 @@ void Feature::removeTag(int idx)
 {
     g_removeFromTagList(p->Tags[idx].first, p->Tags[idx].second);
     p->Tags.erase(p->Tags.begin()+idx);
+    invalidateFilters();
     invalidateMeta();
     invalidatePainter();
 }
@@ -551,7 +588,8 @@ void Feature::invalidateMeta()
 void Feature::invalidatePainter()
 {
     p->PossiblePaintersUpToDate = false;
-    p->PixelPerMForPainter = -1;
+    if (p->Painters)
+        p->Painters->PixelPerMForPainter = -1;
 }
 
 static QPainterPath painterPath;
@@ -563,17 +601,22 @@ const QPainterPath& Feature::getPath() const
 
 void FeaturePrivate::updatePossiblePainters()
 {
-    QMutexLocker mutlock(&theFeature->featMutex);
+    ProfileScope theProfileScope(RenderProfiler::PainterMatch);
+
+    // Asked before locking, as it may have to update the parents of a node
+    bool isPlainNode = CHECK_NODE(theFeature) && !STATIC_CAST_NODE(theFeature)->isPOI();
+
+    QMutexLocker mutlock(&theFeature->featMutex());
 
     //still match features with no tags and no parent, i.e. "lost" trackpoints
     if ( (theFeature->layer()->isTrack()) && M_PREFS->getDisableStyleForTracks() ) return blankPainters();
 
     if ( (theFeature->layer()->isTrack()) || theFeature->sizeParents() ) {
-        if (CHECK_NODE(theFeature) && !STATIC_CAST_NODE(theFeature)->isPOI()) return blankPainters();
+        if (isPlainNode) return blankPainters();
         if (!theFeature->tagSize()) return blankPainters();
     }
 
-    PossiblePainters.clear();
+    QList<const FeaturePainter*> PossiblePainters;
     QList<const FeaturePainter*> DefaultPainters;
     for (int i=0; i<theFeature->layer()->getDocument()->getPaintersSize(); ++i)
     {
@@ -591,8 +634,15 @@ void FeaturePrivate::updatePossiblePainters()
     }
     if (!PossiblePainters.size())
         PossiblePainters = DefaultPainters;
+    if (!PossiblePainters.size())
+        return blankPainters();
+
+    // The cache is kept once allocated, it may still be read from another thread
+    if (!Painters)
+        Painters = new FeaturePainterCache;
+    Painters->PossiblePainters = PossiblePainters;
+    Painters->PixelPerMForPainter = -1;
     PossiblePaintersUpToDate = true;
-    HasPainter = (PossiblePainters.size() > 0);
 }
 
 void FeaturePrivate::updatePainters(qreal PixelPerM)
@@ -600,39 +650,44 @@ void FeaturePrivate::updatePainters(qreal PixelPerM)
     if (!PossiblePaintersUpToDate)
         updatePossiblePainters();
 
-    QMutexLocker mutlock(&theFeature->featMutex);
-    CurrentPainter = NULL;
-    PixelPerMForPainter = PixelPerM;
-    for (int i=0; i<PossiblePainters.size(); ++i)
-        if (PossiblePainters[i]->matchesZoom(PixelPerM))
+    QMutexLocker mutlock(&theFeature->featMutex());
+    if (!Painters)
+        return;
+    Painters->CurrentPainter = NULL;
+    Painters->PixelPerMForPainter = PixelPerM;
+    for (int i=0; i<Painters->PossiblePainters.size(); ++i)
+        if (Painters->PossiblePainters[i]->matchesZoom(PixelPerM))
         {
-            CurrentPainter = PossiblePainters[i];
+            Painters->CurrentPainter = Painters->PossiblePainters[i];
             return;
         }
 }
 
 void FeaturePrivate::blankPainters()
 {
-    CurrentPainter = NULL;
-    PossiblePainters.clear();
+    if (Painters) {
+        Painters->CurrentPainter = NULL;
+        Painters->PossiblePainters.clear();
+    }
     PossiblePaintersUpToDate = true;
-    HasPainter = false;
 }
 
 const FeaturePainter* Feature::getPainter(qreal PixelPerM) const
 {
-    if (p->PixelPerMForPainter != PixelPerM)
+    if (!p->PossiblePaintersUpToDate || (p->Painters && p->Painters->PixelPerMForPainter != PixelPerM))
         p->updatePainters(PixelPerM);
-    return p->CurrentPainter;
+    return p->Painters ? p->Painters->CurrentPainter : NULL;
 }
 
 const FeaturePainter* Feature::getCurrentPainter() const
 {
-    if (p->CurrentPainter)
-        return p->CurrentPainter;
+    if (!p->Painters)
+        return NULL;
+    if (p->Painters->CurrentPainter)
+        return p->Painters->CurrentPainter;
     else {
-        if (p->PossiblePainters.size())
-            return p->PossiblePainters[0];
+        if (p->Painters->PossiblePainters.size())
+            return p->Painters->PossiblePainters[0];
         else return NULL;
     }
 }
@@ -642,22 +697,23 @@ bool Feature::hasPainter() const
     if (!p->PossiblePaintersUpToDate)
         p->updatePossiblePainters();
 
-    return p->HasPainter;
+    return p->Painters && p->Painters->PossiblePainters.size();
 }
 
 bool Feature::hasPainter(qreal PixelPerM) const
 {
     if (!layer())
         return false;
-    if (p->PixelPerMForPainter != PixelPerM)
-        p->updatePainters(PixelPerM);
-    return (p->CurrentPainter != NULL);
+    return getPainter(PixelPerM) != NULL;
 }
 
 void Feature::setParentFeature(Feature* F)
 {
     if (std::find(p->Parents.begin(),p->Parents.end(),F) == p->Parents.end())
         p->Parents.push_back(F);
+    // parent() selectors
+    invalidateFilters();
+    invalidateMeta();
 }
 
 void Feature::unsetParentFeature(Feature* F)
@@ -666,32 +722,48 @@ void Feature::unsetParentFeature(Feature* F)
         if (p->Parents[i] == F)
         {
             p->Parents.erase(p->Parents.begin()+i);
+            invalidateFilters();
+            invalidateMeta();
             return;
         }
 }
 
 void Feature::updateFilters()
 {
-    p->FilterLayers.clear();
-
     Layer* L = layer();
-    if (!L)
+    Document* D = L ? L->getDocument() : NULL;
+    if (!D) {
+        p->FilterMask = 0;
+        p->FilterRevision = -1;
         return;
+    }
 
-    Document* D = L->getDocument();
-    if (!D)
+    FilterEngine* E = D->filterEngine();
+    if (p->FilterRevision == E->revision())
         return;
+    p->FilterMask = E->match(this);
+    p->FilterRevision = E->revision();
+}
 
-    for (int i=0; i<D->layerSize(); ++i) {
-        if (D->getLayer(i)->classType() == Layer::FilterLayerType) {
-            FilterLayer* Fl = dynamic_cast<FilterLayer*>(D->getLayer(i));
-            if (!Fl->isEnabled() || !Fl->selector())
-                continue;
-            if (Fl->selector()->matches(this, 0) != TagSelect_NoMatch)
-                p->FilterLayers << Fl;
-        }
-    }
-    invalidateMeta();
+void Feature::invalidateFilters()
+{
+    p->FilterRevision = -1;
+}
+
+quint64 Feature::filterMask() const
+{
+    return p->FilterMask;
+}
+
+int Feature::filterRevision() const
+{
+    return p->FilterRevision;
+}
+
+void Feature::setFilterMask(quint64 aMask, int aRevision)
+{
+    p->FilterMask = aMask;
+    p->FilterRevision = aRevision;
 }
 
 void Feature::updateMeta()
@@ -702,42 +774,26 @@ void Feature::updateMeta()
     if (!L)
         return;
 
-    if (!L->isVisible())
-        p->Visible = false;
-    else {
-        p->Visible = true;
-        foreach(FilterLayer* Fl, p->FilterLayers) {
-            if (!Fl->isVisible()) {
-                p->Visible = false;
-                break;
-            }
-        }
-    }
+    FilterEngine* E = L->getDocument() ? L->getDocument()->filterEngine() : NULL;
+    quint64 mask = E ? (p->FilterMask & E->enabledMask()) : 0;
+
+    p->Visible = L->isVisible() && !(mask && (mask & E->hiddenMask()));
 
     if (L->getAlpha() != 1.0)
         p->Alpha = L->getAlpha();
     else {
         p->Alpha = 1.0;
-        foreach(FilterLayer* Fl, p->FilterLayers) {
-            if (Fl->getAlpha() != 1) {
-                p->Alpha = Fl->getAlpha();
-                break;
+        if (mask) {
+            foreach(FilterLayer* Fl, E->filters()) {
+                if ((mask & E->bit(Fl)) && Fl->getAlpha() != 1) {
+                    p->Alpha = Fl->getAlpha();
+                    break;
+                }
             }
         }
     }
 
-    if (L->isReadonly())
-        ReadOnly = true;
-    else {
-        ReadOnly = false;
-        foreach(FilterLayer* Fl, p->FilterLayers) {
-            if (Fl->isReadonly()) {
-                ReadOnly = true;
-                break;
-            }
-
-        }
-    }
+    ReadOnly = L->isReadonly() || (mask && (mask & E->readonlyMask()));
 }
 
 int Feature::sizeParents() const
@@ -755,10 +811,24 @@ const IFeature* Feature::getParent(int i) const
     return p->Parents[i];
 }
 
-void Feature::notifyChanges()
+int Feature::newNotificationId()
 {
     static int Id = 0;
-    notifyParents(++Id);
+    return ++Id;
+}
+
+bool Feature::deferChanges()
+{
+    if (!p->parentLayer || !p->parentLayer->getDocument())
+        return false;
+    return p->parentLayer->getDocument()->deferChange(this);
+}
+
+void Feature::notifyChanges()
+{
+    if (deferChanges())
+        return;
+    notifyParents(newNotificationId());
 }
 
 void Feature::notifyParents(int Id)
@@ -1094,10 +1164,32 @@ QString Feature::toMainHtml(QString type, QString systemtype)
 
 void Feature::getLock()
 {
-	featMutex.lock();
+	featMutex().lock();
 }
 
 void Feature::releaseLock()
 {
-	featMutex.unlock();
+	featMutex().unlock();
+}
+
+/* Plain features (nodes) never lock another feature while holding their
+   lock, so they can share a small set of locks without a lock order
+   inversion. The locks are recursive as two nodes of one stripe may be
+   handled within the same call. */
+class FeatureLock : public QMutex
+{
+public:
+    FeatureLock() : QMutex(QMutex::Recursive) {}
+};
+
+QMutex& Feature::featMutex() const
+{
+    static FeatureLock StripedLocks[FEATURE_LOCK_STRIPES];
+    quintptr k = quintptr(this) / sizeof(void*);
+    return StripedLocks[(k ^ (k >> 7)) % FEATURE_LOCK_STRIPES];
+}
+
+qint64 Feature::memoryUsage() const
+{
+    return sizeof(Feature) + p->memoryUsage();
 }
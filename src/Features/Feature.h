@@ -308,6 +308,9 @@ public:
     virtual void partChanged(Feature* F, int ChangeId) = 0;
     void notifyChanges();
     void notifyParents(int Id);
+    static int newNotificationId();
+    /// Hand the change over to the edit transaction of the document, if any.
+    bool deferChanges();
 
     static void fromXML(QXmlStreamReader& stream, Feature* F);
     virtual void toXML(QXmlStreamWriter& stream, bool strict, QString changetsetid = QString());
@@ -323,6 +326,12 @@ public:
     virtual void updateMeta();
     virtual void updateFilters();
     virtual void invalidateMeta();
+    /// The tags or parents changed, the filters have to be evaluated again
+    void invalidateFilters();
+    /// Bits of the matching filter layers, see FilterEngine
+    quint64 filterMask() const;
+    int filterRevision() const;
+    void setFilterMask(quint64 aMask, int aRevision);
 
     virtual bool deleteChildren(Document* , CommandList* ) { return true; }
 
@@ -338,6 +347,9 @@ public:
     void getLock();
     void releaseLock();
 
+    /// Estimated size in memory of the feature, with what it owns
+    virtual qint64 memoryUsage() const;
+
 private:
     FeaturePrivate* p;
 
@@ -346,12 +358,12 @@ protected:
     bool ReadOnly; // 1
     bool MetaUpToDate;
     IFeature::FId newId(IFeature::FeatureType type) const;
-    QMutex featMutex;
+    /// Lock of the feature data. It is shared with other plain features;
+    /// features that lock their members while holding it have their own.
+    virtual QMutex& featMutex() const;
 
     bool tagsToXML(QXmlStreamWriter& stream, bool strict);
     static void tagsFromXML(Document* d, Feature* f, QXmlStreamReader& stream);
-
-    QPainterPath thePath;
 };
 
 Q_DECLARE_METATYPE( Feature * );
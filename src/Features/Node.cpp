@@ -59,6 +59,8 @@ void Node::setPosition(const Coord& aCoord)
 {
     BBox = CoordBox(aCoord, aCoord);
     ProjectionRevision = 0;
+    if (deferChanges())
+        return;
     g_backend.sync(this);
 
     notifyChanges();
@@ -276,7 +278,20 @@ void Node::partChanged(Feature*, int)
 
 void Node::updateMeta()
 {
-    QMutexLocker mutlock(&featMutex);
+    if (MetaUpToDate)
+        return;
+
+    // The parents are asked before locking: the node lock is a striped one,
+    // no other feature may be locked while holding it
+    int prtReadonly=0, prtWritable=0;
+    for (int i=0; i<sizeParents(); ++i) {
+        if (getParent(i)->isReadonly())
+            ++prtReadonly;
+        else
+            ++prtWritable;
+    }
+
+    QMutexLocker mutlock(&featMutex());
     if (MetaUpToDate)
         return;
 
@@ -292,14 +307,6 @@ void Node::updateMeta()
     }
 
     if (!IsPOI && !IsWaypoint) {
-        int i=0;
-        int prtReadonly=0, prtWritable=0;
-        for (; i<sizeParents(); ++i) {
-            if (getParent(i)->isReadonly())
-                ++prtReadonly;
-            else
-                ++prtWritable;
-        }
         if (!ReadOnly) {
             if (prtReadonly && !prtWritable)
                 setReadonly(true);
@@ -383,6 +390,11 @@ QString Node::toHtml()
     return Feature::toMainHtml(QApplication::translate("MapFeature", "Node"), "node").arg(D);
 }
 
+qint64 Node::memoryUsage() const
+{
+    return Feature::memoryUsage() + sizeof(Node) - sizeof(Feature);
+}
+
 bool Node::toGPX(QXmlStreamWriter& stream, QProgressDialog * progress, QString element, bool forExport)
 {
     bool OK = true;
@@ -650,6 +662,11 @@ QString TrackNode::toHtml()
     return Feature::toMainHtml(QApplication::translate("MapFeature", "Node"), "node").arg(D);
 }
 
+qint64 TrackNode::memoryUsage() const
+{
+    return Node::memoryUsage() + sizeof(TrackNode) - sizeof(Node);
+}
+
 /*********************************/
 
 PhotoNode::PhotoNode(const Coord& aCoord)
@@ -687,10 +704,18 @@ QPixmap PhotoNode::photo() const
         return QPixmap();
 }
 
-void PhotoNode::setPhoto(QPixmap thePhoto)
+void PhotoNode::setPhoto(const QImage& theThumbnail)
 {
     delete Photo;
-    Photo = new QPixmap(thePhoto.scaled(M_PREFS->getMaxGeoPicWidth(), M_PREFS->getMaxGeoPicWidth(), Qt::KeepAspectRatio));
+    Photo = NULL;
+    if (theThumbnail.isNull())
+        return;
+
+    int w = M_PREFS->getMaxGeoPicWidth();
+    if (theThumbnail.width() > w || theThumbnail.height() > w)
+        Photo = new QPixmap(QPixmap::fromImage(theThumbnail.scaled(w, w, Qt::KeepAspectRatio)));
+    else
+        Photo = new QPixmap(QPixmap::fromImage(theThumbnail));
 }
 
 void PhotoNode::drawTouchup(QPainter& thePainter , MapView* theView)
@@ -700,18 +725,19 @@ void PhotoNode::drawTouchup(QPainter& thePainter , MapView* theView)
     thePainter.setPen(QPen(QColor(0, 0, 0), 2));
     QRect box(me - QPoint(5, 3), QSize(10, 6));
     thePainter.drawRect(box);
-    if (theView->renderOptions().options.testFlag(RendererOptions::PhotosVisible) && theView->pixelPerM() > M_PREFS->getRegionalZoom()) {
+    if (Photo && theView->renderOptions().options.testFlag(RendererOptions::PhotosVisible) && theView->pixelPerM() > M_PREFS->getRegionalZoom()) {
         qreal rt = qBound(0.2, (double)theView->pixelPerM(), 1.0);
+        qreal phRt = 1. * Photo->width() / Photo->height();
         QPoint phPt;
 
         if (photoLocationBR) {
             phPt = me + QPoint(10*rt, 10*rt);
         } else {
-            qreal rt = qBound(0.2, (double)theView->pixelPerM(), 1.0);
-            qreal phRt = 1. * Photo->width() / Photo->height();
             phPt = me - QPoint(10*rt, 10*rt) - QPoint(M_PREFS->getMaxGeoPicWidth()*rt, M_PREFS->getMaxGeoPicWidth()*rt/phRt);
         }
-        thePainter.drawPixmap(phPt, Photo->scaledToWidth(M_PREFS->getMaxGeoPicWidth()*rt));
+        // Scaled while painting, no pixmap is made for every zoom level
+        QSize phSize(M_PREFS->getMaxGeoPicWidth()*rt, M_PREFS->getMaxGeoPicWidth()*rt/phRt);
+        thePainter.drawPixmap(QRect(phPt, phSize), *Photo);
     }
 #endif
     Node::drawTouchup(thePainter, theView);
@@ -724,7 +750,7 @@ void PhotoNode::drawHover(QPainter& thePainter, MapView* theView)
     Feature::drawHover(thePainter, theView);
 
     /* and then the image */
-    if (TEST_RFLAGS(RendererOptions::PhotosVisible) && theView->pixelPerM() > M_PREFS->getRegionalZoom()) {
+    if (Photo && TEST_RFLAGS(RendererOptions::PhotosVisible) && theView->pixelPerM() > M_PREFS->getRegionalZoom()) {
         QPoint me(theView->toView(this));
 
         qreal rt = qBound(0.2, (double)theView->pixelPerM(), 1.0);
@@ -745,7 +771,7 @@ qreal PhotoNode::pixelDistance(const QPointF& Target, qreal ClearDistance, const
 {
 #ifdef GEOIMAGE
     QPoint me = theView->toView(const_cast<PhotoNode*>(this));
-    if (TEST_RFLAGS(RendererOptions::PhotosVisible) && theView->pixelPerM() > M_PREFS->getRegionalZoom()) {
+    if (Photo && TEST_RFLAGS(RendererOptions::PhotosVisible) && theView->pixelPerM() > M_PREFS->getRegionalZoom()) {
         qreal rt = qBound(0.2, (double)theView->pixelPerM(), 1.0);
         qreal phRt = 1. * Photo->width() / Photo->height();
         QPoint phPt;
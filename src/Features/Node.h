@@ -27,11 +27,11 @@ public:
     Node(const Node& other);
     virtual ~Node();
 
+    // The small members come first, they fit in the tail padding of Feature
     quint16 ProjectionRevision;
-    QPointF Projected;
-
     bool IsWaypoint;
     bool IsPOI;
+    QPointF Projected;
 
 public:
     virtual QString getClass() const {return "Node";}
@@ -82,6 +82,7 @@ public:
     bool toGPX(QXmlStreamWriter& stream, QProgressDialog * progress, QString element, bool forExport=false);
 
     QString toHtml();
+    virtual qint64 memoryUsage() const;
 };
 
 class TrackNode : public Node
@@ -110,13 +111,14 @@ public:
     static TrackNode* fromGPX(Document* d, Layer* L, QXmlStreamReader& stream);
 
     virtual QString toHtml();
+    virtual qint64 memoryUsage() const;
 
 private:
 #ifdef FRISIUS_BUILD
     uint Time;
 #endif
-    qreal Elevation;
-    qreal Speed;
+    float Elevation;
+    float Speed;
 };
 
 class PhotoNode : public TrackNode
@@ -136,8 +138,10 @@ public:
 #endif
     virtual qreal pixelDistance(const QPointF& Target, qreal ClearEndDistance, const QList<Feature*>& NoSnap, MapView* theView) const;
 
+    /// The thumbnail shown next to the node; the photo itself is only
+    /// loaded when it is viewed
     QPixmap photo() const;
-    void setPhoto(QPixmap thePhoto);
+    void setPhoto(const QImage& theThumbnail);
 
 protected:
     QPixmap* Photo;
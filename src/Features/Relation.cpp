@@ -1,6 +1,7 @@
 #include "Features.h"
 #include "MapView.h"
 #include "MapRenderer.h"
+#include "RenderProfiler.h"
 #include "MainWindow.h"
 #include "DocumentCommands.h"
 #include "RelationCommands.h"
@@ -63,6 +64,7 @@ class RelationPrivate
         bool BBoxUpToDate;
 
         RenderPriority theRenderPriority;
+        QMutex Mutex;
 
         qreal Width;
     };
@@ -424,7 +426,7 @@ void Relation::buildPath(Projection const &theProjection)
 //    QPainterPath clipPath;
 //    clipPath.addRect(cr);
 
-    QMutexLocker mutlock(&featMutex);
+    QMutexLocker mutlock(&featMutex());
     p->theBoundingPath = QPainterPath();
 
     if (!p->Members.size())
@@ -444,6 +446,7 @@ void Relation::buildPath(Projection const &theProjection)
 //    p->theBoundingPath = p->theBoundingPath.intersected(clipPath);
 
     if (!p->PathUpToDate || p->ProjectionRevision != theProjection.projectionRevision()) {
+        ProfileScope theProfileScope(RenderProfiler::BuildPath);
         p->thePath = QPainterPath();
 
         Way* outerWay = NULL;
@@ -546,7 +549,7 @@ const RenderPriority& Relation::renderPriority()
 
 void Relation::updateMeta()
 {
-    QMutexLocker mutlock(&featMutex);
+    QMutexLocker mutlock(&featMutex());
     if (MetaUpToDate)
         return;
 
@@ -712,6 +715,18 @@ QString Relation::toHtml()
     return Feature::toMainHtml(QApplication::translate("MapFeature", "Relation"),"relation").arg(D);
 }
 
+qint64 Relation::memoryUsage() const
+{
+    return Feature::memoryUsage() + sizeof(Relation) - sizeof(Feature) + sizeof(RelationPrivate)
+            + p->Members.size() * sizeof(QPair<QString, MapFeaturePtr>)
+            + (p->thePath.elementCount() + p->theBoundingPath.elementCount()) * sizeof(QPainterPath::Element);
+}
+
+QMutex& Relation::featMutex() const
+{
+    return p->Mutex;
+}
+
 qreal Relation::widthOf()
 {
     if (MetaUpToDate == false)
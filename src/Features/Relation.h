@@ -60,9 +60,13 @@ public:
     static Relation* fromXML(Document* d, Layer* L, QXmlStreamReader& stream);
 
     virtual QString toHtml();
+    virtual qint64 memoryUsage() const;
 
     qreal widthOf();
 
+protected:
+    virtual QMutex& featMutex() const;
+
 private:
     RelationPrivate* p;
 };
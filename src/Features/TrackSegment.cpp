@@ -6,6 +6,7 @@
 #include "MapView.h"
 #include "MapRenderer.h"
 #include "Node.h"
+#include "Document.h"
 #include "LineF.h"
 
 #include <QtGui/QPainter>
@@ -13,20 +14,60 @@
 
 #include <algorithm>
 #include <QList>
+#include <QSet>
 
 #define TEST_RFLAGS(x) theView->renderOptions().options.testFlag(x)
 
+/// Track points are stored column-wise. A point only gets a TrackNode (in
+/// Nodes) when it has to be handled as a feature, e.g. when it is selected;
+/// the node is then authoritative over the columns for that point.
 class TrackSegmentPrivate
 {
     public:
         TrackSegmentPrivate()
-        : Distance(0)
+        : Distance(0), BBoxUpToDate(true), BlocksUpToDate(true), ClassesUpToDate(true), ProjectedRevision(-1)
         {
         }
 
-        QList<TrackNode*> Nodes;
+        void insert(int Idx, const Coord& C, uint aTime, qreal anElevation, qreal aSpeed, TrackNode* N)
+        {
+            Lon.insert(Idx, C.x());
+            Lat.insert(Idx, C.y());
+            Time.insert(Idx, aTime);
+            Elevation.insert(Idx, anElevation);
+            Speed.insert(Idx, aSpeed);
+            Nodes.insert(Idx, N);
+        }
+
+        void erase(int Idx)
+        {
+            Lon.remove(Idx);
+            Lat.remove(Idx);
+            Time.remove(Idx);
+            Elevation.remove(Idx);
+            Speed.remove(Idx);
+            Nodes.remove(Idx);
+        }
+
+        QVector<double> Lon;
+        QVector<double> Lat;
+        QVector<uint> Time;
+        QVector<float> Elevation;
+        QVector<float> Speed;
+        QVector<TrackNode*> Nodes;
+
         qreal Distance;
         CoordBox BBox;
+        bool BBoxUpToDate;
+        QVector<CoordBox> Blocks;
+        bool BlocksUpToDate;
+        /// Pen class of the line ending at each point (see lineClass)
+        QVector<quint16> Classes;
+        bool ClassesUpToDate;
+        /// Projected points, valid for ProjectedRevision of the projection
+        QVector<QPointF> Projected;
+        int ProjectedRevision;
+        QMutex Mutex;
 };
 
 TrackSegment::TrackSegment(void)
@@ -50,20 +91,71 @@ TrackSegment::~TrackSegment(void)
     delete p;
 }
 
+static bool pointTimeLessThan(const TrackPoint& a, const TrackPoint& b)
+{
+    return a.Time < b.Time;
+}
+
 void TrackSegment::sortByTime()
 {
-    for (int i=0; i<p->Nodes.size(); ++i)
-    {
-        for (int j=i+1; j<p->Nodes.size(); ++j)
-        {
-            if (p->Nodes[i]->time() > p->Nodes[j]->time())
-            {
-                QDateTime dt(p->Nodes[i]->time());
-                p->Nodes[i]->setTime(p->Nodes[j]->time());
-                p->Nodes[j]->setTime(dt);
-            }
+    // Whole points are moved, points with the same time keep their order
+    TrackPoints thePoints = points();
+    std::stable_sort(thePoints.begin(), thePoints.end(), pointTimeLessThan);
+    setPoints(thePoints);
+}
+
+TrackPoints TrackSegment::points() const
+{
+    TrackPoints thePoints(size());
+    for (int i=0; i<size(); ++i) {
+        TrackPoint& Pt = thePoints[i];
+        Pt.Node = p->Nodes[i];
+        if (Pt.Node) {
+            Pt.Position = Pt.Node->position();
+            Pt.Time = Pt.Node->time().toTime_t();
+            Pt.Elevation = Pt.Node->elevation();
+            Pt.Speed = Pt.Node->speed();
+        } else {
+            Pt.Position = Coord(p->Lon[i], p->Lat[i]);
+            Pt.Time = p->Time[i];
+            Pt.Elevation = p->Elevation[i];
+            Pt.Speed = p->Speed[i];
         }
     }
+    return thePoints;
+}
+
+void TrackSegment::setPoints(const TrackPoints& thePoints)
+{
+    QSet<TrackNode*> Kept;
+    foreach (const TrackPoint& Pt, thePoints)
+        if (Pt.Node)
+            Kept.insert(Pt.Node);
+    foreach (TrackNode* N, p->Nodes)
+        if (N && !Kept.contains(N))
+            N->unsetParentFeature(this);
+
+    int n = thePoints.size();
+    p->Lon.resize(n);
+    p->Lat.resize(n);
+    p->Time.resize(n);
+    p->Elevation.resize(n);
+    p->Speed.resize(n);
+    p->Nodes.resize(n);
+    for (int i=0; i<n; ++i) {
+        const TrackPoint& Pt = thePoints[i];
+        p->Lon[i] = Pt.Position.x();
+        p->Lat[i] = Pt.Position.y();
+        p->Time[i] = Pt.Time;
+        p->Elevation[i] = Pt.Elevation;
+        p->Speed[i] = Pt.Speed;
+        p->Nodes[i] = Pt.Node;
+        if (Pt.Node)
+            Pt.Node->setParentFeature(this);
+    }
+
+    invalidateBlocks();
+    g_backend.sync(this);
 }
 
 QString TrackSegment::description() const
@@ -73,15 +165,47 @@ QString TrackSegment::description() const
 
 void TrackSegment::add(TrackNode* aPoint)
 {
-    p->Nodes.push_back(aPoint);
+    p->insert(size(), aPoint->position(), aPoint->time().toTime_t(), aPoint->elevation(), aPoint->speed(), aPoint);
     aPoint->setParentFeature(this);
+    invalidateBlocks();
     g_backend.sync(this);
 }
 
 void TrackSegment::add(TrackNode* Pt, int Idx)
 {
-    p->Nodes.push_back(Pt);
-    std::rotate(p->Nodes.begin()+Idx,p->Nodes.end()-1,p->Nodes.end());
+    p->insert(Idx, Pt->position(), Pt->time().toTime_t(), Pt->elevation(), Pt->speed(), Pt);
+    invalidateBlocks();
+    g_backend.sync(this);
+}
+
+void TrackSegment::addPoint(const Coord& aCoord, uint aTime, qreal anElevation, qreal aSpeed)
+{
+    if (layer() && layer()->getDocument())
+        layer()->getDocument()->changedOutsideHistory();
+    {
+        QMutexLocker mutlock(&featMutex());
+        p->insert(size(), aCoord, aTime, anElevation, aSpeed, NULL);
+
+        // Appending only grows the bounding box and the last block
+        if (p->BBoxUpToDate) {
+            if (p->BBox.isNull())
+                p->BBox = CoordBox(aCoord, aCoord);
+            else
+                p->BBox.merge(aCoord);
+        }
+        if (p->BlocksUpToDate) {
+            int b = (size()-1) / BlockSize;
+            if (b == p->Blocks.size()) {
+                p->Blocks.append(CoordBox(aCoord, aCoord));
+                if (b)
+                    p->Blocks[b].merge(pointPosition(size()-2));
+            } else
+                p->Blocks[b].merge(aCoord);
+        }
+        p->ClassesUpToDate = false;
+        p->ProjectedRevision = -1;
+        MetaUpToDate = false;
+    }
     g_backend.sync(this);
 }
 
@@ -96,8 +220,10 @@ int TrackSegment::find(Feature* Pt) const
 void TrackSegment::remove(int idx)
 {
     Node* Pt = p->Nodes[idx];
-    p->Nodes.erase(p->Nodes.begin()+idx);
-    Pt->unsetParentFeature(this);
+    p->erase(idx);
+    if (Pt)
+        Pt->unsetParentFeature(this);
+    invalidateBlocks();
     g_backend.sync(this);
 }
 
@@ -115,11 +241,26 @@ int TrackSegment::size() const
 
 Feature* TrackSegment::get(int i)
 {
-    return p->Nodes[i];
+    return getNode(i);
 }
 
+/* Materialises the point as a TrackNode of the segment layer on first use */
 TrackNode* TrackSegment::getNode(int i)
 {
+    if (!p->Nodes[i]) {
+        TrackNode* N = g_backend.allocTrackNode(layer(), pointPosition(i));
+        N->setLastUpdated(Feature::Log);
+        N->setTime(p->Time[i]);
+        N->setElevation(p->Elevation[i]);
+        N->setSpeed(p->Speed[i]);
+        p->Nodes[i] = N;
+        if (layer()) {
+            layer()->add(N);
+            if (layer()->getDocument())
+                layer()->getDocument()->changedOutsideHistory();
+        }
+        N->setParentFeature(this);
+    }
     return p->Nodes[i];
 }
 
@@ -133,105 +274,345 @@ bool TrackSegment::isNull() const
     return (p->Nodes.size() == 0);
 }
 
-void TrackSegment::drawDirectionMarkers(QPainter &P, QPen &pen, const QPointF & FromF, const QPointF & ToF)
+Coord TrackSegment::pointPosition(int idx) const
+{
+    if (p->Nodes[idx])
+        return p->Nodes[idx]->position();
+    return Coord(p->Lon[idx], p->Lat[idx]);
+}
+
+QDateTime TrackSegment::pointTime(int idx) const
+{
+    if (p->Nodes[idx])
+        return p->Nodes[idx]->time();
+    return QDateTime::fromTime_t(p->Time[idx]);
+}
+
+qreal TrackSegment::pointElevation(int idx) const
+{
+    if (p->Nodes[idx])
+        return p->Nodes[idx]->elevation();
+    return p->Elevation[idx];
+}
+
+qreal TrackSegment::pointSpeed(int idx) const
+{
+    if (p->Nodes[idx])
+        return p->Nodes[idx]->speed();
+    return p->Speed[idx];
+}
+
+bool TrackSegment::isMaterialised(int idx) const
+{
+    return p->Nodes[idx] != NULL;
+}
+
+void TrackSegment::invalidateBlocks()
+{
+    p->BBoxUpToDate = false;
+    p->BlocksUpToDate = false;
+    p->ClassesUpToDate = false;
+    p->ProjectedRevision = -1;
+    MetaUpToDate = false;
+}
+
+/* Called with featMutex() held */
+void TrackSegment::buildBlocks() const
+{
+    p->Blocks.clear();
+    for (int i=0; i<size(); ++i) {
+        Coord C = pointPosition(i);
+        if (i % BlockSize == 0) {
+            p->Blocks.append(CoordBox(C, C));
+            if (i)
+                p->Blocks.last().merge(pointPosition(i-1));
+        } else
+            p->Blocks.last().merge(C);
+    }
+    p->BlocksUpToDate = true;
+}
+
+QVector<CoordBox> TrackSegment::blockBoxes() const
+{
+    QMutexLocker mutlock(&featMutex());
+    if (!p->BlocksUpToDate)
+        buildBlocks();
+    return p->Blocks;
+}
+
+int TrackSegment::pointNear(const QPointF& Target, qreal maxDistance, MapView* theView) const
+{
+    int Best = -1;
+    qreal BestDistance = maxDistance;
+
+    const QVector<CoordBox> theBlocks = blockBoxes();
+    for (int b=0; b<theBlocks.size(); ++b) {
+        QRectF R = QRectF(theView->toView(theBlocks[b].topLeft()), theView->toView(theBlocks[b].bottomRight())).normalized();
+        if (!R.adjusted(-maxDistance, -maxDistance, maxDistance, maxDistance).contains(Target))
+            continue;
+        int last = qMin(size(), (b+1)*BlockSize);
+        for (int i=b*BlockSize; i<last; ++i) {
+            qreal D = ::distance(Target, theView->toView(pointPosition(i)));
+            if (D < BestDistance) {
+                BestDistance = D;
+                Best = i;
+            }
+        }
+    }
+    return Best;
+}
+
+/* Same as Node::drawHover for an untagged track point */
+void TrackSegment::drawPointHover(QPainter& P, MapView* theView, int idx) const
+{
+    QPen TP(M_PREFS->getHoverColor(), M_PREFS->getHoverWidth() / 2, Qt::SolidLine);
+    QPoint me(theView->toView(pointPosition(idx)));
+    QRect R(me-QPoint(3,3),QSize(6,6));
+
+    P.setPen(TP);
+    P.drawRect(R);
+    R.adjust(-7, -7, 7, 7);
+    P.drawEllipse(R);
+}
+
+/* Same as Node::isSelectable for an untagged track point of the segment */
+bool TrackSegment::arePointsSelectable(qreal PixelPerM, RendererOptions options) const
+{
+    if (!layer() || layer()->isReadonly())
+        return false;
+
+    bool Draw = false;
+    if (options.options.testFlag(RendererOptions::NodesVisible) || !options.options.testFlag(RendererOptions::TrackSegmentVisible)) {
+        Draw = (PixelPerM * M_PREFS->getNodeSize() >= 1);
+        // Do not draw GPX nodes when simple GPX track appearance is enabled
+        if (M_PREFS->getSimpleGpxTrack() && layer()->isTrack())
+            Draw = false;
+        if (!Draw && !options.options.testFlag(RendererOptions::TrackSegmentVisible))
+            Draw = true;
+    }
+    return Draw;
+}
+
+/* Draws the points that have no TrackNode, as Node::drawSimple would draw
+   an untagged track point */
+void TrackSegment::drawSimple(QPainter &P, MapView *theView)
+{
+    if (!arePointsSelectable(theView->pixelPerM(), theView->renderOptions()))
+        return;
+
+    qreal WW = theView->nodeWidth();
+    if (WW < 1)
+        return;
+
+    const QVector<CoordBox> theBlocks = blockBoxes();
+    for (int b=0; b<theBlocks.size(); ++b) {
+        if (!theView->viewport().intersects(theBlocks[b]))
+            continue;
+        int last = qMin(size(), (b+1)*BlockSize);
+        for (int i=b*BlockSize; i<last; ++i) {
+            if (p->Nodes[i])
+                continue;
+            QPoint Pp(theView->toView(Coord(p->Lon[i], p->Lat[i])));
+            P.fillRect(QRect(Pp.x()-WW/2, Pp.y()-WW/2, WW, WW), QColor(0,0,0,128));
+        }
+    }
+}
+
+/* Pen class of a track line: the slope is binned into the color level and
+   direction, the speed into the width factor */
+static quint16 lineClass(qreal distance, qreal dElevation, qreal speed)
+{
+    qreal slope = dElevation / (distance * 10.0);
+    int dir = 0;
+    int level = 0;
+    if (slope > 2.0) {
+        dir = 1;
+        level = int(qMin(slope, (qreal)20.0)*79.0 / 20.0) / 8;
+    } else if (slope < -2.0) {
+        dir = 2;
+        level = int(-qMax(slope, (qreal)-20.0)*79.0 / 20.0) / 8;
+    }
+    int speedBin = 0;
+    if (speed > 10.0)
+        speedBin = qRound((qMin(1.0+speed*0.02, 5.0) - 1.0) * 4);
+    return quint16((dir << 12) | (level << 8) | speedBin);
+}
+
+static QPen linePen(quint16 aClass, int width, bool Simple)
+{
+    QPen pen;
+    if (Simple) {
+        pen.setWidthF(width);
+        pen.setColor(M_PREFS->getGpxTrackColor());
+        return pen;
+    }
+
+    // Encode speed in width of path ...
+    pen.setWidthF((1.0 + (aClass & 0xff) / 4.0) * width);
+
+    // ... and slope in the color
+    int dir = aClass >> 12;
+    int c = 48 + ((aClass >> 8) & 0xf) * 8 + 4;
+    int green = (dir == 1) ? c : 0;
+    int red = (dir == 2) ? c : 0;
+    pen.setColor(QColor(128 + red, 128 + green, 128));
+    pen.setStyle(Qt::DotLine);
+    return pen;
+}
+
+static void addDirectionMarkers(QVector<QLineF>& theMarkers, const QPointF& FromF, const QPointF& ToF, bool Simple)
 {
     if (::distance(FromF,ToF) <= 30.0)
         return;
 
     const qreal DistFromCenter=10.0;
-    const qreal theWidth = !M_PREFS->getSimpleGpxTrack() ? 5.0 : 8.0;
+    const qreal theWidth = !Simple ? 5.0 : 8.0;
     const qreal A = angle(FromF-ToF);
 
     QPointF T(DistFromCenter*cos(A), DistFromCenter*sin(A));
     QPointF V1(theWidth*cos(A+M_PI/6),theWidth*sin(A+M_PI/6));
     QPointF V2(theWidth*cos(A-M_PI/6),theWidth*sin(A-M_PI/6));
 
-    pen.setStyle(Qt::SolidLine);
-    P.setPen(pen);
-
     QPointF H(FromF+ToF);
     H /= 2.0;
-    P.drawLine(H-T,H-T+V1);
-    P.drawLine(H-T,H-T+V2);
+    theMarkers << QLineF(H-T,H-T+V1) << QLineF(H-T,H-T+V2);
 }
 
-void TrackSegment::drawSimple(QPainter &P, MapView *theView)
+QVector<quint16> TrackSegment::lineClasses() const
 {
-    Q_UNUSED(P)
-    Q_UNUSED(theView)
+    QMutexLocker mutlock(&featMutex());
+    if (!p->ClassesUpToDate) {
+        p->Classes.resize(size());
+        if (size())
+            p->Classes[0] = 0;
+        Coord Last = size() ? pointPosition(0) : Coord();
+        for (int i=1; i<size(); ++i) {
+            Coord C = pointPosition(i);
+            p->Classes[i] = lineClass(Last.distanceFrom(C), pointElevation(i) - pointElevation(i-1), pointSpeed(i));
+            Last = C;
+        }
+        p->ClassesUpToDate = true;
+    }
+    return p->Classes;
 }
 
-void TrackSegment::drawTouchup(QPainter &P, MapView* theView)
+QVector<QPointF> TrackSegment::projectedPoints(const Projection& theProjection) const
 {
-    QPen pen;
+    QMutexLocker mutlock(&featMutex());
+    if (p->ProjectedRevision != theProjection.projectionRevision()) {
+        QVector<qreal> x(size()), y(size());
+        for (int i=0; i<size(); ++i) {
+            Coord C = pointPosition(i);
+            x[i] = C.x();
+            y[i] = C.y();
+        }
+        theProjection.projectBatch(size(), x.data(), y.data());
+        p->Projected.resize(size());
+        for (int i=0; i<size(); ++i)
+            p->Projected[i] = QPointF(x[i], y[i]);
+        p->ProjectedRevision = theProjection.projectionRevision();
+    }
+    return p->Projected;
+}
+
+/// Consecutive lines of the same pen, drawn as one polyline
+struct TrackRun
+{
+    quint16 Class;
+    QPolygonF Points;
+    QPointF Pending;
+    bool HasPending;
+    QVector<QLineF> Markers;
+};
 
+static void flushRun(QPainter& P, TrackRun& Run, int width, bool Simple)
+{
+    if (Run.HasPending)
+        Run.Points << Run.Pending;
+    Run.HasPending = false;
+    if (Run.Points.size() < 2) {
+        Run.Points.clear();
+        Run.Markers.clear();
+        return;
+    }
+
+    QPen pen = linePen(Run.Class, width, Simple);
+    P.setPen(pen);
+    P.drawPolyline(Run.Points);
+    if (Run.Markers.size()) {
+        pen.setStyle(Qt::SolidLine);
+        P.setPen(pen);
+        P.drawLines(Run.Markers);
+    }
+    Run.Points.clear();
+    Run.Markers.clear();
+}
+
+/* The pen of each line is cached as a class and the projected points per
+   projection, so that a frame only maps the visible blocks to the view and
+   draws one polyline per run of lines of the same class. Lines shorter
+   than MinLength pixels are merged with the next one. */
+void TrackSegment::drawTouchup(QPainter &P, MapView* theView)
+{
     if (!TEST_RFLAGS(RendererOptions::TrackSegmentVisible))
         return;
+    if (size() < 2)
+        return;
 
-    for (int i=1; i<p->Nodes.size(); ++i)
+    const qreal MinLength = 2.0;
+    bool Simple = M_PREFS->getSimpleGpxTrack();
+    int width = M_PREFS->getGpxTrackWidth();
+    // Dynamic track line width adaption to zoom level
+    if (theView->pixelPerM() > 2)
+        width++;
+    else if (theView->pixelPerM() < 1)
+        width--;
+
+    const QVector<CoordBox> theBlocks = blockBoxes();
+    const QVector<quint16> theClasses = lineClasses();
+    const QVector<QPointF> thePoints = projectedPoints(theView->projection());
+    const QTransform& theTransform = theView->transform();
+    const CoordBox& Viewport = theView->viewport();
+
+    TrackRun Run;
+    Run.Class = 0;
+    Run.HasPending = false;
+    QPointF Last;
+
+    // Blocks outside of the viewport are skipped as a whole
+    for (int i=1; i<size(); ++i)
     {
-        if (!theView->viewport().contains(p->Nodes[i-1]->position()) && !theView->viewport().contains(p->Nodes[i]->position()))
+        if ((i == 1 || i % BlockSize == 0) && !Viewport.intersects(theBlocks[i / BlockSize])) {
+            flushRun(P, Run, width, Simple);
+            i = (i / BlockSize + 1) * BlockSize - 1;
             continue;
+        }
 
-        QPointF FromF = theView->toView(p->Nodes[i-1]);
-        QPointF ToF = theView->toView(p->Nodes[i]);
-
-        if (!M_PREFS->getSimpleGpxTrack())
-        {
-            qreal distance = p->Nodes[i-1]->position().distanceFrom(p->Nodes[i]->position());
-            qreal slope = (p->Nodes[i]->elevation() - p->Nodes[i-1]->elevation()) / (distance * 10.0);
-            qreal speed = p->Nodes[i]->speed();
-
-            int width = M_PREFS->getGpxTrackWidth();
-            // Dynamic track line width adaption to zoom level
-            if (theView->pixelPerM() > 2)
-                width++;
-            else if (theView->pixelPerM() < 1)
-                width--;
-
-            // Encode speed in width of path ...
-            qreal penWidth = 1.0;
-            if (speed > 10.0)
-                penWidth = qMin(1.0+speed*0.02, 5.0);
-
-            penWidth *= width;
-
-            // ... and slope in the color
-            int green = 0;
-            int red = 0;
-
-            if (slope > 2.0)
-            {
-                slope = qMin(slope, (qreal)20.0);
-                green = 48 + int(slope*79.0 / 20.0);
-            }
-            else if (slope < -2.0)
-            {
-                slope = qMax(slope, (qreal)-20.0);
-                red = 48 + int(-slope*79.0 / 20.0);
-            }
-
-            pen.setColor(QColor(128 + red, 128 + green, 128));
-
-            pen.setStyle(Qt::DotLine);
-            pen.setWidthF(penWidth);
+        if (!Viewport.contains(pointPosition(i-1)) && !Viewport.contains(pointPosition(i))) {
+            flushRun(P, Run, width, Simple);
+            continue;
         }
-        else
-        {
-            int width = M_PREFS->getGpxTrackWidth();
-            // Dynamic track line width adaption to zoom level
-            if (theView->pixelPerM() > 2)
-                width++;
-            else if (theView->pixelPerM() < 1)
-                width--;
-            pen.setWidthF(width);
-            pen.setColor(M_PREFS->getGpxTrackColor());
+
+        quint16 Class = Simple ? 0 : theClasses[i];
+        if (Run.Points.isEmpty() || Class != Run.Class) {
+            flushRun(P, Run, width, Simple);
+            Run.Class = Class;
+            Last = theTransform.map(thePoints[i-1]);
+            Run.Points << Last;
         }
-        P.setPen(pen);
 
-        P.drawLine(FromF,ToF);
-        drawDirectionMarkers(P, pen, FromF, ToF);
+        QPointF ToF = theTransform.map(thePoints[i]);
+        if (::distance(Last, ToF) < MinLength) {
+            Run.Pending = ToF;
+            Run.HasPending = true;
+            continue;
+        }
+        Run.Points << ToF;
+        Run.HasPending = false;
+        addDirectionMarkers(Run.Markers, Last, ToF, Simple);
+        Last = ToF;
     }
+    flushRun(P, Run, width, Simple);
 }
 
 bool TrackSegment::notEverythingDownloaded()
@@ -257,13 +638,19 @@ void TrackSegment::drawChildrenSpecial(QPainter&, QPen&, MapView*, int)
 
 const CoordBox& TrackSegment::boundingBox(bool) const
 {
-    if (p->Nodes.size())
-    {
-        p->BBox = CoordBox(p->Nodes[0]->position(),p->Nodes[0]->position());
-        for (int i=1; i<p->Nodes.size(); ++i)
-            p->BBox.merge(p->Nodes[i]->position());
-    } else
+    QMutexLocker mutlock(&featMutex());
+    if (!p->BBoxUpToDate) {
+        if (!p->BlocksUpToDate)
+            buildBlocks();
         p->BBox = CoordBox();
+        for (int b=0; b<p->Blocks.size(); ++b) {
+            if (b)
+                p->BBox.merge(p->Blocks[b]);
+            else
+                p->BBox = p->Blocks[b];
+        }
+        p->BBoxUpToDate = true;
+    }
     return p->BBox;
 }
 
@@ -311,11 +698,14 @@ void TrackSegment::cascadedRemoveIfUsing(Document* theDocument, Feature* aFeatur
 
 void TrackSegment::partChanged(Feature*, int)
 {
+    // A materialised point was moved
+    invalidateBlocks();
+    g_backend.sync(this);
 }
 
 void TrackSegment::updateMeta()
 {
-    QMutexLocker mutlock(&featMutex);
+    QMutexLocker mutlock(&featMutex());
     if (MetaUpToDate)
         return;
 
@@ -330,14 +720,7 @@ void TrackSegment::updateMeta()
     }
 
     for (int i=0; (i+1)<p->Nodes.size(); ++i)
-    {
-        if (p->Nodes[i] && p->Nodes[i+1]) {
-            const Coord & here = p->Nodes[i]->position();
-            const Coord & next = p->Nodes[i+1]->position();
-
-            p->Distance += next.distanceFrom(here);
-        }
-    }
+        p->Distance += pointPosition(i+1).distanceFrom(pointPosition(i));
 
 
     MetaUpToDate = true;
@@ -353,7 +736,9 @@ qreal TrackSegment::distance()
 
 int TrackSegment::duration() const
 {
-    return p->Nodes[0]->time().secsTo(p->Nodes[p->Nodes.size() - 1]->time());
+    if (!size())
+        return 0;
+    return pointTime(0).secsTo(pointTime(size() - 1));
 }
 
 
@@ -367,7 +752,20 @@ bool TrackSegment::toGPX(QXmlStreamWriter& stream, QProgressDialog * progress, b
         stream.writeAttribute("xml:id", xmlId());
 
     for (int i=0; i<size(); ++i) {
-        dynamic_cast <Node*> (get(i))->toGPX(stream, progress, "trkpt", forExport);
+        if (p->Nodes[i]) {
+            p->Nodes[i]->toGPX(stream, progress, "trkpt", forExport);
+            continue;
+        }
+        // Columnar points have no id, and are read back as such
+        stream.writeStartElement("trkpt");
+        stream.writeAttribute("lon", COORD2STRING(p->Lon[i]));
+        stream.writeAttribute("lat", COORD2STRING(p->Lat[i]));
+        stream.writeTextElement("time", pointTime(i).toString(Qt::ISODate)+"Z");
+        if (p->Elevation[i])
+            stream.writeTextElement("ele", QString::number(p->Elevation[i],'f',6));
+        if (p->Speed[i])
+            stream.writeTextElement("speed", QString::number(p->Speed[i],'f',6));
+        stream.writeEndElement();
     }
     stream.writeEndElement();
 
@@ -382,6 +780,36 @@ bool TrackSegment::toXML(QXmlStreamWriter& stream, QProgressDialog * progress, b
     return toGPX(stream, progress, false);
 }
 
+static void readPoint(TrackSegment* ts, QXmlStreamReader& stream)
+{
+    qreal Lat = stream.attributes().value("lat").toString().toDouble();
+    qreal Lon = stream.attributes().value("lon").toString().toDouble();
+
+    QDateTime time = QDateTime::currentDateTime();
+    qreal Elevation = 0.0;
+    qreal Speed = 0.0;
+    stream.readNext();
+    while(!stream.atEnd() && !stream.isEndElement()) {
+        if (stream.name() == "time") {
+            stream.readNext();
+            time = QDateTime::fromString(stream.text().toString().left(19), Qt::ISODate);
+            stream.readNext();
+        } else if (stream.name() == "ele") {
+            stream.readNext();
+            Elevation = stream.text().toString().toFloat();
+            stream.readNext();
+        } else if (stream.name() == "speed") {
+            stream.readNext();
+            Speed = stream.text().toString().toFloat();
+            stream.readNext();
+        } else if (stream.isStartElement())
+            stream.skipCurrentElement();
+
+        stream.readNext();
+    }
+    ts->addPoint(Coord(Lon,Lat), time.toTime_t(), Elevation, Speed);
+}
+
 TrackSegment* TrackSegment::fromGPX(Document* d, Layer* L, QXmlStreamReader& stream, QProgressDialog * progress)
 {
     TrackSegment* ts = g_backend.allocSegment(L);
@@ -393,8 +821,12 @@ TrackSegment* TrackSegment::fromGPX(Document* d, Layer* L, QXmlStreamReader& str
     stream.readNext();
     while(!stream.atEnd() && !stream.isEndElement()) {
         if (stream.name() == "trkpt") {
-            TrackNode* N = TrackNode::fromGPX(d, L, stream);
-            ts->add(N);
+            // Points saved with an id have been materialised, they may be referred to
+            if (stream.attributes().hasAttribute("id") || stream.attributes().hasAttribute("xml:id")) {
+                TrackNode* N = TrackNode::fromGPX(d, L, stream);
+                ts->add(N);
+            } else
+                readPoint(ts, stream);
             progress->setValue(stream.characterOffset());
         }
 
@@ -407,6 +839,20 @@ TrackSegment* TrackSegment::fromGPX(Document* d, Layer* L, QXmlStreamReader& str
     return ts;
 }
 
+qint64 TrackSegment::memoryUsage() const
+{
+    // The TrackNodes of materialised points are counted as features of their own
+    qint64 Bytes = Feature::memoryUsage() + sizeof(TrackSegment) - sizeof(Feature) + sizeof(TrackSegmentPrivate);
+    Bytes += size() * (2*sizeof(double) + sizeof(uint) + 2*sizeof(float) + sizeof(TrackNode*));
+    Bytes += p->Blocks.size() * sizeof(CoordBox);
+    return Bytes;
+}
+
+QMutex& TrackSegment::featMutex() const
+{
+    return p->Mutex;
+}
+
 TrackSegment* TrackSegment::fromXML(Document* d, Layer* L, QXmlStreamReader& stream, QProgressDialog * progress)
 {
     return TrackSegment::fromGPX(d, L, stream, progress);
@@ -1,13 +1,29 @@
 #ifndef MERKATOR_TRACKSEGMENT_H_
 #define MERKATOR_TRACKSEGMENT_H_
 
+#include "MerkaartorPreferences.h"
 #include "Feature.h"
 
+#include <QVector>
+
 class TrackSegmentPrivate;
 class TrackNode;
+class Projection;
 
 class QProgressDialog;
 
+/// A point of a segment, as copied out of (or into) its columns
+struct TrackPoint
+{
+    Coord Position;
+    uint Time;
+    float Elevation;
+    float Speed;
+    /// The point's TrackNode, if it is materialised
+    TrackNode* Node;
+};
+typedef QVector<TrackPoint> TrackPoints;
+
 class TrackSegment : public Feature
 {
     friend class MemoryBackend;
@@ -18,7 +34,11 @@ protected:
     TrackSegment(const TrackSegment& other);
 
 private:
-    void drawDirectionMarkers(QPainter & P, QPen & pen, const QPointF & FromF, const QPointF & ToF);
+    void invalidateBlocks();
+    void buildBlocks() const;
+    /// Rebuilt under featMutex(), render threads get a (shared) copy
+    QVector<quint16> lineClasses() const;
+    QVector<QPointF> projectedPoints(const Projection& theProjection) const;
 
 public:
     virtual QString getClass() const {return "TrackSegment";}
@@ -39,15 +59,41 @@ public:
 
     void add(TrackNode* aPoint);
     void add(TrackNode* Pt, int Idx);
+    /// Appends a point to the segment columns, without allocating a TrackNode for it
+    void addPoint(const Coord& aCoord, uint aTime, qreal anElevation=0.0, qreal aSpeed=0.0);
     virtual int find(Feature* Pt) const;
     virtual void remove(int idx);
     virtual void remove(Feature* F);
     virtual Feature* get(int idx);
     virtual int size() const;
     TrackNode* getNode(int idx);
+    /// The point's TrackNode, or NULL if the point is not materialised
     virtual const Feature* get(int Idx) const;
     virtual bool isNull() const;
 
+    /// Point attributes, read without materialising the point as a TrackNode
+    Coord pointPosition(int idx) const;
+    QDateTime pointTime(int idx) const;
+    qreal pointElevation(int idx) const;
+    qreal pointSpeed(int idx) const;
+    bool isMaterialised(int idx) const;
+
+    /// Bounding boxes of consecutive blocks of BlockSize points, each also
+    /// covering the last point of the previous block
+    QVector<CoordBox> blockBoxes() const;
+    static const int BlockSize = 256;
+    /// Whether the points without a TrackNode are drawn and can be snapped to
+    bool arePointsSelectable(qreal PixelPerM, RendererOptions options) const;
+    /// Index of the point closest to Target (in view pixels), or -1 if none is within maxDistance
+    int pointNear(const QPointF& Target, qreal maxDistance, MapView* theView) const;
+    /// Draws the hover marker of a point as for its TrackNode, without materialising it
+    void drawPointHover(QPainter& P, MapView* theView, int idx) const;
+
+    /// All points of the segment; materialised points are read from their node
+    TrackPoints points() const;
+    /// Replaces all points of the segment. Nodes that are left out are detached from it.
+    void setPoints(const TrackPoints& thePoints);
+
     void sortByTime();
     virtual void partChanged(Feature* F, int ChangeId);
 
@@ -60,6 +106,10 @@ public:
     static TrackSegment* fromXML(Document* d, Layer* L, QXmlStreamReader& stream, QProgressDialog * progress);
 
     virtual QString toHtml() {return QString();}
+    virtual qint64 memoryUsage() const;
+
+protected:
+    virtual QMutex& featMutex() const;
 
 private:
     TrackSegmentPrivate* p;
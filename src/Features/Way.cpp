@@ -9,6 +9,7 @@
 #include "Painting.h"
 #include "MapView.h"
 #include "MapRenderer.h"
+#include "RenderProfiler.h"
 #include "LineF.h"
 #include "MDiscardableDialog.h"
 #include "Utils.h"
@@ -20,6 +21,7 @@
 
 #include <algorithm>
 #include <QList>
+#include <QHash>
 
 #define TEST_RFLAGS(x) theView->renderOptions().options.testFlag(x)
 
@@ -38,7 +40,9 @@ class WayPrivate
         Way* theWay;
 
         QList<Node*> Nodes;
-        QList<Node*> virtualNodes;
+        // Virtual midpoints are computed on the fly; a Node is only
+        // materialised (keyed by segment) once the user picks one.
+        QHash<int, Node*> virtualNodes;
 
         bool BBoxUpToDate;
 
@@ -54,11 +58,13 @@ class WayPrivate
         QColor SimpleColor;
 
         RenderPriority theRenderPriority; // 10 (24)
+        QMutex Mutex;
 
         void CalculateWidth();
         void doUpdateVirtuals();
         void removeVirtuals();
-        void addVirtuals();
+        Coord virtualPosition(int segment) const;
+        Node* materialiseVirtual(int segment);
 };
 
 #define DEFAULTWIDTH 6
@@ -102,39 +108,41 @@ void WayPrivate::CalculateWidth()
 
 void WayPrivate::removeVirtuals()
 {
-    while (virtualNodes.size()) {
-        virtualNodes[0]->unsetParentFeature(theWay);
-        g_backend.deallocVirtualNode(virtualNodes[0]);
-//        if (virtualNodes[0]->layer())
-//            virtualNodes[0]->layer()->deleteFeature(virtualNodes[0]);
-//		delete p->virtualNodes[0];
-        virtualNodes.erase(virtualNodes.begin());
+    foreach (Node* v, virtualNodes) {
+        v->unsetParentFeature(theWay);
+        g_backend.deallocVirtualNode(v);
     }
+    virtualNodes.clear();
 }
 
-void WayPrivate::addVirtuals()
+Coord WayPrivate::virtualPosition(int segment) const
 {
-    for (int i=1; i<Nodes.size(); ++i) {
-        QLineF l(Nodes[i-1]->position(), Nodes[i]->position());
-        l.setLength(l.length()/2);
-        Node* v = g_backend.allocVirtualNode(l.p2());
+    const Coord& a = Nodes[segment]->position();
+    const Coord& b = Nodes[segment+1]->position();
+    return Coord((a.x() + b.x()) / 2, (a.y() + b.y()) / 2);
+}
+
+Node* WayPrivate::materialiseVirtual(int segment)
+{
+    doUpdateVirtuals();
+
+    Node* v = virtualNodes.value(segment);
+    if (!v) {
+        v = g_backend.allocVirtualNode(virtualPosition(segment));
         v->setVirtual(true);
         v->setParentFeature(theWay);
-//        theWay->layer()->add(v);
-        virtualNodes.push_back(v);
+        virtualNodes.insert(segment, v);
     }
+    return v;
 }
 
 void WayPrivate::doUpdateVirtuals()
 {
-//    Q_ASSERT(!(theWay->layer()->isIndexingBlocked()));
-
     if (VirtualsUptodate)
         return;
 
+    // Materialised virtuals belong to the old geometry
     removeVirtuals();
-    if (theWay->canAddVirtualNodes())
-        addVirtuals();
 
     VirtualsUptodate = true;
 }
@@ -232,7 +240,7 @@ void Way::add(Node* Pt)
 
 void Way::add(Node* Pt, int Idx)
 {
-    QMutexLocker mutlock(&featMutex);
+    QMutexLocker mutlock(&featMutex());
     p->Nodes.insert(p->Nodes.begin() + Idx, Pt);
 //	p->Nodes.push_back(Pt);
 //	std::rotate(p->Nodes.begin()+Idx,p->Nodes.end()-1,p->Nodes.end());
@@ -257,15 +265,18 @@ int Way::find(Feature* Pt) const
 
 int Way::findVirtual(Feature* Pt) const
 {
-    for (int i=0; i<p->virtualNodes.size(); ++i)
-        if (p->virtualNodes[i] == Pt)
-            return i;
-    return p->virtualNodes.size();
+    QHashIterator<int, Node*> it(p->virtualNodes);
+    while (it.hasNext()) {
+        it.next();
+        if (it.value() == Pt)
+            return it.key();
+    }
+    return qMax(p->Nodes.size()-1, 0);
 }
 
 void Way::remove(int idx)
 {
-    QMutexLocker mutlock(&featMutex);
+    QMutexLocker mutlock(&featMutex());
     Node* Pt = p->Nodes[idx];
     // only remove as parent if the node is only included once
     p->Nodes.erase(p->Nodes.begin()+idx);
@@ -308,9 +319,11 @@ const QList<NodePtr>& Way::getNodes() const
     return p->Nodes;
 }
 
-const QList<NodePtr>& Way::getVirtuals() const
+Node* Way::getVirtual(int segment)
 {
-    return p->virtualNodes;
+    if (segment < 0 || segment >= p->Nodes.size()-1)
+        return NULL;
+    return p->materialiseVirtual(segment);
 }
 
 
@@ -362,6 +375,15 @@ void Way::drawSimple(QPainter &P, MapView *theView)
 {
     QBrush theBrush(Qt::NoBrush);
     QPen thePen(Qt::NoPen);
+    simpleStyle(thePen, theBrush);
+
+    P.setBrush(theBrush);
+    P.setPen(thePen);
+    P.drawPath(theView->transform().map(p->thePath));
+}
+
+void Way::simpleStyle(QPen& thePen, QBrush& theBrush)
+{
     if (!M_PREFS->getUseStyledWireframe() || !hasPainter()) {
 //        if (p->Area > 0.0) {
 //            theBrush = QBrush(QColor(240, 240, 240, 127));
@@ -382,15 +404,11 @@ void Way::drawSimple(QPainter &P, MapView *theView)
             else
                 thePen = QPen(p->SimpleColor,(qreal)p->SimpleWidth/LANEWIDTH);
     }
-
-    P.setBrush(theBrush);
-    P.setPen(thePen);
-    P.drawPath(theView->transform().map(p->thePath));
 }
 
 void Way::updateMeta()
 {
-    QMutexLocker mutlock(&featMutex);
+    QMutexLocker mutlock(&featMutex());
     if (MetaUpToDate)
         return;
 
@@ -489,12 +507,16 @@ void Way::drawTouchup(QPainter& P, MapView* theView)
     bool Draw = (theWidth >= 1);
     if (!Draw || !theView->renderOptions().options.testFlag(RendererOptions::VirtualNodesVisible) || !theView->renderOptions().options.testFlag(RendererOptions::NodesVisible) || isReadonly())
         return;
+    if (!canAddVirtualNodes())
+        return;
 
     theWidth /= 2;
     P.setPen(QColor(0,0,0));
-    foreach (NodePtr N, p->virtualNodes) {
-        if (theView->viewport().contains(N->position())) {
-            QPoint p =  theView->toView(N);
+    const CoordBox& vp = theView->viewport();
+    for (int i=0; i<p->Nodes.size()-1; ++i) {
+        Coord C = p->virtualPosition(i);
+        if (vp.contains(C)) {
+            QPoint p =  theView->toView(C);
             P.drawLine(p+QPoint(-theWidth, -theWidth), p+QPoint(theWidth, theWidth));
             P.drawLine(p+QPoint(theWidth, -theWidth), p+QPoint(-theWidth, theWidth));
         }
@@ -592,16 +614,15 @@ Node* Way::pixelDistanceNode(const QPointF& Target, qreal ClearEndDistance, MapV
             }
         }
     }
-    if (!NoSelectVirtuals && M_PREFS->getVirtualNodesVisible()) {
-        for (int i=0; i<p->virtualNodes.size(); ++i)
+    if (!NoSelectVirtuals && M_PREFS->getVirtualNodesVisible() && canAddVirtualNodes()) {
+        for (int i=0; i<p->Nodes.size()-1; ++i)
         {
-            if (p->virtualNodes.at(i)) {
-                p->virtualNodes.at(i)->buildPath(theView->projection());
-                qreal D = ::distance(Target,theView->toView(p->virtualNodes.at(i)));
-                if (D < ClearEndDistance && D < Best) {
-                    Best = D;
-                    return p->virtualNodes.at(i);
-                }
+            qreal D = ::distance(Target,theView->toView(p->virtualPosition(i)));
+            if (D < ClearEndDistance && D < Best) {
+                // Only now does the midpoint need to become a Node
+                Node* v = p->materialiseVirtual(i);
+                v->buildPath(theView->projection());
+                return v;
             }
         }
     }
@@ -664,10 +685,11 @@ void Way::rebuildPath(const Projection &theProjection)
 
 void Way::buildPath(const Projection &theProjection)
 {
-    QMutexLocker mutlock(&featMutex);
+    QMutexLocker mutlock(&featMutex());
     if (p->PathUpToDate && p->ProjectionRevision == theProjection.projectionRevision())
         return;
     else {
+        ProfileScope theProfileScope(RenderProfiler::BuildPath);
         p->thePath = QPainterPath();
         if (p->Nodes.size() < 2) {
             p->PathUpToDate = true;
@@ -685,9 +707,8 @@ void Way::buildPath(const Projection &theProjection)
                 }
             }
         }
-        for (int i=0; i<p->virtualNodes.size(); ++i) {
-            p->virtualNodes[i]->buildPath(theProjection);
-        }
+        foreach (Node* v, p->virtualNodes)
+            v->buildPath(theProjection);
         p->ProjectionRevision = theProjection.projectionRevision();
         p->PathUpToDate = true;
     }
@@ -924,6 +945,17 @@ QString Way::toHtml()
     return Feature::toMainHtml(type, "way").arg(D);
 }
 
+qint64 Way::memoryUsage() const
+{
+    return Feature::memoryUsage() + sizeof(Way) - sizeof(Feature) + sizeof(WayPrivate)
+            + p->Nodes.size() * sizeof(Node*) + p->thePath.elementCount() * sizeof(QPainterPath::Element);
+}
+
+QMutex& Way::featMutex() const
+{
+    return p->Mutex;
+}
+
 bool Way::isExtrimity(Node* node)
 {
     if (p->Nodes[0] == node)
@@ -1010,7 +1042,7 @@ int Way::createJunction(Document* theDocument, CommandList* theList, Way* R1, Wa
     return numInter;
 }
 
-bool Way::canAddVirtualNodes()
+bool Way::canAddVirtualNodes() const
 {
     if (M_PREFS->getUseVirtualNodes() && layer() && !ReadOnly && !isDeleted())
         return true;
@@ -29,6 +29,8 @@ public:
 
     virtual const CoordBox& boundingBox(bool update=true) const;
     virtual void drawSimple(QPainter& P, MapView* theView);
+    /// Pen and brush of the wireframe (simple) rendering
+    void simpleStyle(QPen& thePen, QBrush& theBrush);
     virtual void drawTouchup(QPainter& P, MapView* theView);
 
     virtual void drawSpecial(QPainter& P, QPen& Pen, MapView* theView);
@@ -56,7 +58,7 @@ public:
     Node* getNode(int idx);
     const Node* getNode(int idx) const;
     const QList<NodePtr>& getNodes() const;
-    const QList<NodePtr>& getVirtuals() const;
+    Node* getVirtual(int segment);
 
     int segmentCount();
     QLineF getSegment(int i);
@@ -86,6 +88,7 @@ public:
     static Way* fromXML(Document* d, Layer* L, QXmlStreamReader& stream);
 
     virtual QString toHtml();
+    virtual qint64 memoryUsage() const;
 
     bool isExtrimity(Node* node);
     static Way * GetSingleParentRoad(Feature * mapFeature);
@@ -94,7 +97,8 @@ public:
     static int createJunction(Document* theDocument, CommandList* theList, Way* R1, Way* R2, bool doIt);
 
 protected:
-    bool canAddVirtualNodes();
+    virtual QMutex& featMutex() const;
+    bool canAddVirtualNodes() const;
     WayPrivate* p;
 };
 
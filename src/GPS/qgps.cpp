@@ -68,7 +68,9 @@ void QGPS::startGps()
 {
     if (gpsDevice) {
         if (isVisible())
-            connect(gpsDevice, SIGNAL(updateStatus()), this, SLOT(updateGpsStatus()));
+            connect(gpsDevice, SIGNAL(updateStatus()), this, SLOT(updateGpsStatus()), Qt::UniqueConnection);
+        // A status reported while nobody listened is still marked pending
+        gpsDevice->statusRead();
         gpsDevice->startDevice();
     }
 }
@@ -98,6 +100,9 @@ void QGPS::resetGpsStatus()
 
 void QGPS::updateGpsStatus()
 {
+    // Status changes coming in from now on are signalled again
+    gpsDevice->statusRead();
+
     QString latCardinal, longCardinal, varCardinal;
 
     if(gpsDevice->latCardinal() == QGPSDevice::CardinalNorth)
@@ -195,8 +200,12 @@ void QGPS::showEvent ( QShowEvent * anEvent )
 {
     QWidget::showEvent(anEvent);
 
-    if (gpsDevice)
-        connect(gpsDevice, SIGNAL(updateStatus()), this, SLOT(updateGpsStatus()));
+    if (gpsDevice) {
+        connect(gpsDevice, SIGNAL(updateStatus()), this, SLOT(updateGpsStatus()), Qt::UniqueConnection);
+        // Catch up with what changed while hidden; this also clears the
+        // pending flag of a status reported while nobody listened
+        updateGpsStatus();
+    }
 }
 
 void QGPS::hideEvent ( QHideEvent * anEvent )
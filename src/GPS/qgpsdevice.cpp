@@ -27,6 +27,7 @@
 #include <QMessageBox>
 #include <QTcpSocket>
 #include <QTimer>
+#include <QSocketNotifier>
 #include <QHostAddress>
 
 #include "qgpsdevice.h"
@@ -34,6 +35,7 @@
 #include "qextserialport.h"
 #endif
 #include <math.h>
+#include <string.h>
 
 #ifdef USE_GPSD_LIB
     #include <cerrno>
@@ -42,6 +44,156 @@
 
 #include "MerkaartorPreferences.h"
 
+/* NMEA FRAMING */
+
+NmeaFramer::NmeaFramer()
+    : Head(0), Tail(0), Length(0), InSentence(false)
+{
+}
+
+void NmeaFramer::clear()
+{
+    Head = Tail = 0;
+    Length = 0;
+    InSentence = false;
+}
+
+void NmeaFramer::write(const char* aData, int aLength)
+{
+    for (int i=0; i<aLength; ++i) {
+        Ring[Head % RingSize] = aData[i];
+        ++Head;
+    }
+    // safety valve
+    if (Head - Tail > RingSize)
+        Tail = Head - RingSize;
+    if (Head > (1 << 30)) {
+        Head -= Tail - Tail % RingSize;
+        Tail %= RingSize;
+    }
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* Checks and strips the "*hh" checksum. Sentences without one are accepted,
+   some receivers leave it out. */
+static bool checkSentence(char* aSentence, int aLength)
+{
+    char* star = (char*)memchr(aSentence, '*', aLength);
+    if (!star)
+        return true;
+    if (star + 2 >= aSentence + aLength)
+        return false;
+    int hi = hexValue(star[1]), lo = hexValue(star[2]);
+    if (hi < 0 || lo < 0)
+        return false;
+    quint8 sum = 0;
+    for (char* c = aSentence + 1; c < star; ++c)
+        sum ^= quint8(*c);
+    *star = '\0';
+    return sum == ((hi << 4) | lo);
+}
+
+bool NmeaFramer::next(char*& aSentence)
+{
+    while (Tail != Head) {
+        char c = Ring[Tail % RingSize];
+        ++Tail;
+        if (c == '$') {
+            Sentence[0] = c;
+            Length = 1;
+            InSentence = true;
+        } else if (!InSentence) {
+            continue;
+        } else if (c == 0x0a || c == 0x0d) {
+            InSentence = false;
+            Sentence[Length] = '\0';
+            if (checkSentence(Sentence, Length)) {
+                aSentence = Sentence;
+                return true;
+            }
+        } else if (Length == MaxSentence) {
+            // Too long for NMEA, this is line noise
+            InSentence = false;
+        } else if (quint8(c) >= 0x20 && quint8(c) < 0x7f) {
+            Sentence[Length++] = c;
+        }
+    }
+    return false;
+}
+
+NmeaFields::NmeaFields(char* aSentence)
+    : Count(0)
+{
+    Field[Count++] = aSentence;
+    for (char* c = aSentence; *c; ++c)
+        if (*c == ',') {
+            *c = '\0';
+            if (Count < MaxFields)
+                Field[Count++] = c + 1;
+        }
+}
+
+/* Field parsing without allocation, and independent of the C locale */
+
+static int nmeaDigits(const char* s, int n)
+{
+    int v = 0;
+    for (int i=0; i<n && s[i] >= '0' && s[i] <= '9'; ++i)
+        v = v*10 + (s[i] - '0');
+    return v;
+}
+
+static qreal nmeaReal(const char* s)
+{
+    bool neg = (*s == '-');
+    if (*s == '-' || *s == '+')
+        ++s;
+    qreal v = 0;
+    for (; *s >= '0' && *s <= '9'; ++s)
+        v = v*10 + (*s - '0');
+    if (*s == '.') {
+        qreal f = 0.1;
+        for (++s; *s >= '0' && *s <= '9'; ++s, f /= 10)
+            v += (*s - '0') * f;
+    }
+    return neg ? -v : v;
+}
+
+static int nmeaInt(const char* s)
+{
+    return int(nmeaReal(s));
+}
+
+/* (d)ddmm.mmmm to degrees */
+static qreal nmeaCoord(const char* s, int degreeDigits, bool positive)
+{
+    if (int(strlen(s)) < degreeDigits)
+        return 0.;
+    qreal v = nmeaDigits(s, degreeDigits) + nmeaReal(s + degreeDigits) / 60.0;
+    return positive ? v : -v;
+}
+
+static QGPSDevice::CardinalDirection nmeaCardinal(const char* s)
+{
+    switch (s[0]) {
+    case 'N': return QGPSDevice::CardinalNorth;
+    case 'S': return QGPSDevice::CardinalSouth;
+    case 'E': return QGPSDevice::CardinalEast;
+    case 'W': return QGPSDevice::CardinalWest;
+    }
+    return QGPSDevice::CardinalNone;
+}
+
 /* GPSSLOTFORWARDER */
 
 GPSSlotForwarder::GPSSlotForwarder(QGPSDevice* aTarget)
@@ -64,11 +216,6 @@ void GPSSlotForwarder::onStop()
     Target->onStop();
 }
 
-void GPSSlotForwarder::checkDataAvailable()
-{
-    Target->checkDataAvailable();
-}
-
 /**
  * QGPSDevice::QGPSDevice()
  *
@@ -79,7 +226,7 @@ void GPSSlotForwarder::checkDataAvailable()
  */
 
 QGPSDevice::QGPSDevice()
-    :LogFile(0)
+    :LogFile(0), StatusPending(0)
 {
     mutex = new QMutex(QMutex::Recursive);
 
@@ -152,6 +299,68 @@ void QGPSDevice::satInfo(int index, int &elev, int &azim, int &snr)
     mutex->unlock();
 }
 
+/**
+ * QGPSDevice::takePositions()
+ *
+ * Fixes are queued by the device thread and taken by the gui thread in
+ * batches, so that every fix can be recorded while the display is only
+ * updated once per batch.
+ */
+
+QList<GpsPosition> QGPSDevice::takePositions()
+{
+    QMutexLocker lock(mutex);
+    QList<GpsPosition> thePositions;
+    thePositions.swap(Positions);
+    return thePositions;
+}
+
+void QGPSDevice::reportPosition()
+{
+    GpsPosition Pos;
+    Pos.Latitude = latitude();
+    Pos.Longitude = longitude();
+    Pos.Time = dateTime();
+    Pos.Altitude = altitude();
+    Pos.Speed = speed();
+    Pos.Heading = heading();
+
+    mutex->lock();
+    bool wasEmpty = Positions.isEmpty();
+    Positions.append(Pos);
+    mutex->unlock();
+
+    if (wasEmpty)
+        emit positionsAvailable();
+}
+
+void QGPSDevice::statusRead()
+{
+    StatusPending.fetchAndStoreOrdered(0);
+}
+
+void QGPSDevice::reportStatus()
+{
+    if (StatusPending.testAndSetOrdered(0, 1))
+        emit updateStatus();
+}
+
+/**
+ * QGPSDevice::ingest()
+ *
+ * Logs raw data from the GPS and parses the full sentences in it.
+ */
+
+void QGPSDevice::ingest(const char* aData, int aLength)
+{
+    if (LogFile)
+        LogFile->write(aData, aLength);
+    Framer.write(aData, aLength);
+    char* aSentence;
+    while (Framer.next(aSentence))
+        parseNMEA(aSentence);
+}
+
 /**
  * QGPSDevice::run()
  *
@@ -199,159 +408,67 @@ void QGPSDevice::satInfo(int index, int &elev, int &azim, int &snr)
  *                          the $ and ending with the checksum
  */
 
-void QGPSDevice::parseNMEA(const QByteArray& bufferString)
+void QGPSDevice::parseNMEA(char* aSentence)
 {
-    if (bufferString.length() < 6) return;
-    if(bufferString[3] == 'G' && bufferString[4] == 'G' && bufferString[5] == 'A')
-    {
-        //strcpy(nmeastr_gga, bufferString);
-        parseGGA(bufferString.data());
-    }
-    else if(bufferString[3] == 'G' && bufferString[4] == 'L' && bufferString[5] == 'L')
-    {
-        //strcpy(nmeastr_gga, bufferString);
-        parseGLL(bufferString.data());
-    }
-    else if(bufferString[3] == 'G' && bufferString[4] == 'S' && bufferString[5] == 'V')
-    {
-        //strcpy(nmeastr_gsv, bufferString);
-        parseGSV(bufferString.data());
-    }
-    else if(bufferString[3] == 'G' && bufferString[4] == 'S' && bufferString[5] == 'A')
-    {
-        //strcpy(nmeastr_gsa, bufferString);
-        parseGSA(bufferString.data());
-    }
-    else if(bufferString[3] == 'R' && bufferString[4] == 'M' && bufferString[5] == 'C')
+    NmeaFields tokens(aSentence);
+    const char* type = tokens[0];
+    if (strlen(type) < 6)
+        return;
+    type += 3;
+
+    QMutexLocker lock(mutex);
+    if (!strcmp(type, "GGA"))
+        parseGGA(tokens);
+    else if (!strcmp(type, "GLL"))
+        parseGLL(tokens);
+    else if (!strcmp(type, "GSV"))
+        parseGSV(tokens);
+    else if (!strcmp(type, "GSA"))
+        parseGSA(tokens);
+    else if (!strcmp(type, "RMC"))
     {
-        //strcpy(nmeastr_rmc, bufferString);
-        if (parseRMC(bufferString.data()))
+        if (parseRMC(tokens))
             if (fixStatus() == QGPSDevice::StatusActive && (fixType() == QGPSDevice::Fix3D || fixType() == QGPSDevice::FixUnavailable))
-                emit updatePosition(latitude(), longitude(), dateTime(), altitude(), speed(), heading());
+                reportPosition();
     }
-    emit updateStatus();
+    reportStatus();
 }
 
-bool QGPSDevice::parseGGA(const char *ggaString)
+bool QGPSDevice::parseGGA(const NmeaFields& tokens)
 {
-    mutex->lock();
+    QMutexLocker lock(mutex);
 
-    QString line(ggaString);
-    if (line.count('$') > 1)
+    if (tokens.size() < 10)
         return false;
 
-    QStringList tokens = line.split(",");
-
-    qreal lat = tokens[2].left(2).toDouble();
-    qreal latmin = tokens[2].mid(2).toDouble();
-    lat += latmin / 60.0;
-    if (tokens[3] != "N")
-        lat = -lat;
-    //cur_latitude = lat;
-
-    if (!tokens[3].isEmpty())
-    {
-        if (tokens[3].at(0) == 'N')
-            setLatCardinal(CardinalNorth);
-        else if (tokens[3].at(0) == 'S')
-            setLatCardinal(CardinalSouth);
-        else
-            setLatCardinal(CardinalNone);
-    }
-
-
-    qreal lon = tokens[4].left(3).toDouble();
-    qreal lonmin = tokens[4].mid(3).toDouble();
-    lon += lonmin / 60.0;
-    if (tokens[5] != "E")
-        lon = -lon;
-    //cur_longitude = lon;
-
-    if (!tokens[5].isEmpty())
-    {
-        if (tokens[5].at(0) == 'E')
-            setLatCardinal(CardinalEast);
-        else if (tokens[5].at(0) == 'W')
-            setLatCardinal(CardinalWest);
-        else
-            setLatCardinal(CardinalNone);
-    }
-
-    int fix = tokens[6].toInt();
-    setFixQuality(fix);
-
-    int numSat = tokens[7].toInt();
-    setNumSatellites(numSat);
+    setLatCardinal(nmeaCardinal(tokens[3]));
+    setLongCardinal(nmeaCardinal(tokens[5]));
 
-    qreal dilut = tokens[8].toFloat();
-    setDillution(dilut);
-
-    qreal altitude = tokens[9].toFloat();
-    setAltitude(altitude);
-
-    mutex->unlock();
+    setFixQuality(nmeaInt(tokens[6]));
+    setNumSatellites(nmeaInt(tokens[7]));
+    setDillution(nmeaReal(tokens[8]));
+    setAltitude(nmeaReal(tokens[9]));
 
     return true;
 } // parseGGA()
 
-bool QGPSDevice::parseGLL(const char *ggaString)
+bool QGPSDevice::parseGLL(const NmeaFields& tokens)
 {
-    mutex->lock();
+    QMutexLocker lock(mutex);
 
-    QString line(ggaString);
-    if (line.count('$') > 1)
+    if (tokens.size() < 7)
         return false;
 
-    QStringList tokens = line.split(",");
-
-    qreal lat = tokens[1].left(2).toDouble();
-    qreal latmin = tokens[1].mid(2).toDouble();
-    lat += latmin / 60.0;
-    if (tokens[2] != "N")
-        lat = -lat;
-    //cur_latitude = lat;
-
-    if (!tokens[2].isEmpty())
-    {
-        if (tokens[2].at(0) == 'N')
-            setLatCardinal(CardinalNorth);
-        else if (tokens[2].at(0) == 'S')
-            setLatCardinal(CardinalSouth);
-        else
-            setLatCardinal(CardinalNone);
-    }
-
-    qreal lon = tokens[3].left(3).toDouble();
-    qreal lonmin = tokens[3].mid(3).toDouble();
-    lon += lonmin / 60.0;
-    if (tokens[4] != "E")
-        lon = -lon;
-    //cur_longitude = lon;
+    setLatCardinal(nmeaCardinal(tokens[2]));
+    setLongCardinal(nmeaCardinal(tokens[4]));
 
-    if (!tokens[4].isEmpty())
-    {
-        if (tokens[4].at(0) == 'E')
-            setLatCardinal(CardinalEast);
-        else if (tokens[4].at(0) == 'W')
-            setLatCardinal(CardinalWest);
-        else
-            setLatCardinal(CardinalNone);
-    }
-
-
-    if (tokens[6] == "A")
-    {
+    if (tokens[6][0] == 'A')
         setFixStatus(StatusActive);
-    }
     else
-    {
         setFixStatus(StatusVoid);
-    }
-
-    mutex->unlock();
 
     return true;
-} // parseGGA()
+} // parseGLL()
 
 /**
  * QGPSDevice::parseGSA()
@@ -383,23 +500,19 @@ bool QGPSDevice::parseGLL(const char *ggaString)
  * @param char  The full NMEA GPGSA string, from $ to checksum
  */
 
-bool QGPSDevice::parseGSA(const char *gsaString)
+bool QGPSDevice::parseGSA(const NmeaFields& tokens)
 {
-    mutex->lock();
+    QMutexLocker lock(mutex);
 
-    QString line(gsaString);
-    if (line.count('$') > 1)
+    if (tokens.size() < 3)
         return false;
 
-    QStringList tokens = line.split(",");
-
-    QString autoSelectFix = tokens[1];
-    if(autoSelectFix == "A")
+    if (tokens[1][0] == 'A')
         setFixMode(FixAuto);
     else
         setFixMode(FixManual);
 
-    int fix = tokens[2].toInt();
+    int fix = nmeaInt(tokens[2]);
     if(fix == 1)
         setFixType(FixInvalid);
     else if(fix == 2)
@@ -408,11 +521,9 @@ bool QGPSDevice::parseGSA(const char *gsaString)
         setFixType(Fix3D);
 
     for(int index = 0; index < 12; index ++) {
-        activeSats[index] = tokens[index+3].toInt();
+        activeSats[index] = nmeaInt(tokens[index+3]);
     }
 
-    mutex->unlock();
-
     return true;
 } // parseGSA()
 
@@ -445,27 +556,27 @@ bool QGPSDevice::parseGSA(const char *gsaString)
  * @param char  Full RMC string, from $ to checksum
  */
 
-bool QGPSDevice::parseRMC(const char *rmcString)
+bool QGPSDevice::parseRMC(const NmeaFields& tokens)
 {
-    mutex->lock();
+    QMutexLocker lock(mutex);
 
-    // Fix time
-
-    QString line(rmcString);
-    if (line.count('$') > 1)
+    if (tokens.size() < 10)
         return false;
 
-    QStringList tokens = line.split(",");
-
-    QString strDate = tokens[9] + tokens[1];
-    cur_datetime = QDateTime::fromString(strDate, "ddMMyyHHmmss.zzz");
+    // Fix time (UTC)
 
-    if (cur_datetime.date().year() < 1970)
-        cur_datetime = cur_datetime.addYears(100);
+    const char* t = tokens[1];
+    const char* d = tokens[9];
+    if (strlen(t) >= 6 && strlen(d) >= 6) {
+        int year = nmeaDigits(d+4, 2);
+        QDate date(year < 70 ? 2000 + year : 1900 + year, nmeaDigits(d+2, 2), nmeaDigits(d, 2));
+        QTime time(nmeaDigits(t, 2), nmeaDigits(t+2, 2), nmeaDigits(t+4, 2), t[6] == '.' ? int(nmeaReal(t+6) * 1000) : 0);
+        cur_datetime = QDateTime(date, time, Qt::UTC);
+    }
 
     // Fix status
 
-    if (tokens[2] == "A")
+    if (tokens[2][0] == 'A')
     {
         setFixStatus(StatusActive);
     }
@@ -474,68 +585,25 @@ bool QGPSDevice::parseRMC(const char *rmcString)
         setFixStatus(StatusVoid);
     }
 
-    // Latitude
+    // Position
 
-    qreal lat = tokens[3].left(2).toDouble();
-    qreal latmin = tokens[3].mid(2).toDouble();
-    lat += latmin / 60.0;
-    if (tokens[4] != "N")
-        lat = -lat;
-    cur_latitude = lat;
+    cur_latitude = nmeaCoord(tokens[3], 2, tokens[4][0] == 'N');
+    setLatCardinal(nmeaCardinal(tokens[4]));
+    cur_longitude = nmeaCoord(tokens[5], 3, tokens[6][0] == 'E');
+    setLongCardinal(nmeaCardinal(tokens[6]));
 
-    if (!tokens[4].isEmpty())
-    {
-        if (tokens[4].at(0) == 'N')
-            setLatCardinal(CardinalNorth);
-        else if (tokens[4].at(0) == 'S')
-            setLatCardinal(CardinalSouth);
-        else
-            setLatCardinal(CardinalNone);
-    }
-
-    qreal lon = tokens[5].left(3).toDouble();
-    qreal lonmin = tokens[5].mid(3).toDouble();
-    lon += lonmin / 60.0;
-    if (tokens[6] != "E")
-        lon = -lon;
-    cur_longitude = lon;
-
-    if (!tokens[6].isEmpty())
-    {
-        if (tokens[6].at(0) == 'E')
-            setLatCardinal(CardinalEast);
-        else if (tokens[6].at(0) == 'W')
-            setLatCardinal(CardinalWest);
-        else
-            setLatCardinal(CardinalNone);
-    }
+    // Ground speed in km/h, to 0.1
 
-    // Ground speed in km/h
-
-    qreal speed = QString::number(tokens[7].toDouble() * 1.852, 'f', 1).toDouble();
-    setSpeed(speed);
+    setSpeed(qRound(nmeaReal(tokens[7]) * 18.52) / 10.0);
 
     // Heading
 
-    qreal heading = tokens[8].toDouble();
-    setHeading(heading);
+    setHeading(nmeaReal(tokens[8]));
 
     // Magnetic variation
 
-    qreal magvar = tokens[10].toDouble();
-    setVariation(magvar);
-
-    if (!tokens[11].isEmpty())
-    {
-        if (tokens[11].at(0) == 'E')
-            setVarCardinal(CardinalEast);
-        else if (tokens[11].at(0) == 'W')
-            setVarCardinal(CardinalWest);
-        else
-            setVarCardinal(CardinalNone);
-    }
-
-    mutex->unlock();
+    setVariation(nmeaReal(tokens[10]));
+    setVarCardinal(nmeaCardinal(tokens[11]));
 
     return true;
 } // parseRMC()
@@ -570,44 +638,19 @@ bool QGPSDevice::parseRMC(const char *rmcString)
  *  *75         -   Checksum
  */
 
-bool QGPSDevice::parseGSV(const char *gsvString)
+bool QGPSDevice::parseGSV(const NmeaFields& tokens)
 {
-    mutex->lock();
-
-    int totalSentences;
-    int currentSentence;
-    int totalSatellites;
-    int prn, elev, azim, snr;
-
-    QString line(gsvString);
-    if (line.count('$') > 1)
-        return false;
-
-    QStringList tokens = line.split(",");
-
-    totalSentences = tokens[1].toInt();
-    currentSentence = tokens[2].toInt();
-    totalSatellites = tokens[3].toInt();
-
-    qDebug() << "Parsing GSV string " << gsvString;
-    qDebug() << " --> sentence " << currentSentence << " of " << totalSentences << ", " << totalSatellites << " total satellites in view";
+    QMutexLocker lock(mutex);
 
     for(int i = 0; (i < 4) && ((i*4)+4+3 < tokens.size()); i ++) {
-        prn = tokens[(i*4)+4].toInt();
-        elev = tokens[(i*4)+4+1].toInt();
-        azim = tokens[(i*4)+4+2].toInt();
-        if (tokens[(i*4)+4+3].contains('*')) {
-            QStringList tok2 = tokens[(i*4)+4+3].split("*");
-            snr = tok2[0].toInt();
-        } else
-            snr = tokens[(i*4)+4+3].toInt();
-        satArray[prn][0] = elev;
-        satArray[prn][1] = azim;
-        satArray[prn][2] = snr;
+        int prn = nmeaInt(tokens[(i*4)+4]);
+        if (prn < 0 || prn >= 50)
+            continue;
+        satArray[prn][0] = nmeaInt(tokens[(i*4)+4+1]);
+        satArray[prn][1] = nmeaInt(tokens[(i*4)+4+2]);
+        satArray[prn][2] = nmeaInt(tokens[(i*4)+4+3]);
     }
 
-    mutex->unlock();
-
     return true;
 }
 
@@ -732,58 +775,29 @@ void QGPSComDevice::run()
 {
     GPSSlotForwarder Forward(this);
 
-    QTimer *timer = new QTimer(this);
-    connect(timer, SIGNAL(timeout()), &Forward, SLOT(checkDataAvailable()));
-    timer->start(150);
+#ifdef _TTY_POSIX_
+    // Woken up as soon as data comes in, so that full-rate receivers are
+    // not held back by a polling interval
+    QSocketNotifier Notifier(port->handle(), QSocketNotifier::Read);
+    connect(&Notifier, SIGNAL(activated(int)), &Forward, SLOT(onDataAvailable()));
+#else
+    QTimer Timer;
+    connect(&Timer, SIGNAL(timeout()), &Forward, SLOT(onDataAvailable()));
+    Timer.start(20);
+#endif
 
-//	connect(port,SIGNAL(readyRead()),&Forward,SLOT(onDataAvailable()));
     connect(this,SIGNAL(doStopDevice()),&Forward,SLOT(onStop()));
     exec();
     closeDevice();
 }
 
-void QGPSComDevice::checkDataAvailable() {
-    if (port->bytesAvailable() > 0)
-        onDataAvailable();
-}
-
 void QGPSComDevice::onDataAvailable()
 {
-    QByteArray ba(port->readAll());
-    // filter out unwanted characters
-    for (int i=ba.count(); i; --i)
-        if(ba[i-1] == '\0' ||
-            (!isalnum((quint8)ba[i-1]) &&
-             !isspace((quint8)ba[i-1]) &&
-             !ispunct((quint8)ba[i-1])))
-        {
-            ba.remove(i-1,1);
-        }
-    if (LogFile)
-        LogFile->write(ba);
-    Buffer.append(ba);
-    if (Buffer.length() > 4096)
-        // safety valve
-        Buffer.remove(0,Buffer.length()-4096);
-    while (Buffer.count())
-    {
-        // look for begin of sentence marker
-        int i = Buffer.indexOf('$');
-        if (i<0)
-        {
-            Buffer.clear();
-            return;
-        }
-        Buffer.remove(0,i);
-        // look for end of sentence marker
-        for (i=0; i<Buffer.count(); ++i)
-            if ( (Buffer[i] == (char)(0x0a)) || (Buffer[i] == (char)(0x0d)) )
-                break;
-        if (i == Buffer.count())
-            return;
-        parseNMEA(Buffer.mid(0,i-2));
-        Buffer.remove(0,i);
-    }
+    // Only what is there is read, a read on the port may otherwise wait for its timeout
+    char Chunk[1024];
+    qint64 n;
+    while (port->bytesAvailable() > 0 && (n = port->read(Chunk, qMin(port->bytesAvailable(), qint64(sizeof(Chunk))))) > 0)
+        ingest(Chunk, int(n));
 }
 #endif
 
@@ -854,63 +868,11 @@ void QGPSFileDevice::run()
 
 void QGPSFileDevice::onDataAvailable()
 {
-
-    int  index = 0;
-    char bufferChar;
-    char bufferString[100];
-
-    while (theFile->read(&bufferChar, 1) && bufferChar != '$') {}
-    if(bufferChar == '$')
-    {
-        index = 0;
-        bufferString[index] = bufferChar;
-
-        do
-        {
-            theFile->read(&bufferChar, 1);
-            if(bufferChar != '\0' && (isalnum(bufferChar) || isspace(bufferChar) || ispunct(bufferChar)))
-            {
-                index ++;
-                bufferString[index] = bufferChar;
-            }
-        } while(bufferChar != 0x0a && bufferChar != 0x0d);
-
-        bufferString[index + 1] = '\0';
-
-        mutex->lock();
-
-        if(bufferString[3] == 'G' && bufferString[4] == 'G' && bufferString[5] == 'A')
-        {
-            //strcpy(nmeastr_gga, bufferString);
-            parseGGA(bufferString);
-        }
-        else if(bufferString[3] == 'G' && bufferString[4] == 'L' && bufferString[5] == 'L')
-        {
-            //strcpy(nmeastr_gga, bufferString);
-            parseGLL(bufferString);
-        }
-        else if(bufferString[3] == 'G' && bufferString[4] == 'S' && bufferString[5] == 'V')
-        {
-            //strcpy(nmeastr_gsv, bufferString);
-            parseGSV(bufferString);
-        }
-        else if(bufferString[3] == 'G' && bufferString[4] == 'S' && bufferString[5] == 'A')
-        {
-            //strcpy(nmeastr_gsa, bufferString);
-            parseGSA(bufferString);
-        }
-        else if(bufferString[3] == 'R' && bufferString[4] == 'M' && bufferString[5] == 'C')
-        {
-            //strcpy(nmeastr_rmc, bufferString);
-            if (parseRMC(bufferString))
-                if (fixStatus() == QGPSDevice::StatusActive && (fixType() == QGPSDevice::Fix3D || fixType() == QGPSDevice::FixUnavailable))
-                    emit updatePosition(latitude(), longitude(), dateTime(), altitude(), speed(), heading());
-        }
-
-        mutex->unlock();
-
-        emit updateStatus();
-    }
+    // One line per tick, to replay at about the rate it was logged
+    char Line[256];
+    qint64 n = theFile->readLine(Line, sizeof(Line));
+    if (n > 0)
+        ingest(Line, int(n));
 }
 
 #ifndef _MOBILE
@@ -1054,10 +1016,7 @@ void QGPSDDevice::onDataAvailable()
         setHeading(Heading);
     if (gpsdata->fix.time)
         cur_datetime = QDateTime::fromTime_t(gpsdata->fix.time);
-    emit updatePosition(gpsdata->fix.latitude,
-                        gpsdata->fix.longitude,
-                        cur_datetime,
-                        cur_altitude, cur_speed, cur_heading);
+    reportPosition();
 
 #if GPSD_API_MAJOR_VERSION > 3
     int num_sat = gpsdata->satellites_visible;
@@ -1082,7 +1041,7 @@ void QGPSDDevice::onDataAvailable()
     }
     setNumSatellites(num_sat);
 
-    emit updateStatus();
+    reportStatus();
 }
 
 void QGPSDDevice::onLinkReady()
@@ -1145,41 +1104,10 @@ void QGPSDDevice::run()
 
 void QGPSDDevice::onDataAvailable()
 {
-    QByteArray ba(Server->readAll());
-    // filter out unwanted characters
-    for (int i=ba.count(); i; --i)
-        if(ba[i-1] == '\0' ||
-            (!isalnum((quint8)ba[i-1]) &&
-             !isspace((quint8)ba[i-1]) &&
-             !ispunct((quint8)ba[i-1])))
-        {
-            ba.remove(i-1,1);
-        }
-    if (LogFile)
-        LogFile->write(ba);
-    Buffer.append(ba);
-    if (Buffer.length() > 4096)
-        // safety valve
-        Buffer.remove(0,Buffer.length()-4096);
-    while (Buffer.count())
-    {
-        // look for begin of sentence marker
-        int i = Buffer.indexOf('$');
-        if (i<0)
-        {
-            Buffer.clear();
-            return;
-        }
-        Buffer.remove(0,i);
-        // look for end of sentence marker
-        for (i=0; i<Buffer.count(); ++i)
-            if ( (Buffer[i] == (char)(0x0a)) || (Buffer[i] == (char)(0x0d)) )
-                break;
-        if (i == Buffer.count())
-            return;
-        parseNMEA(Buffer.mid(0,i-2));
-        Buffer.remove(0,i);
-    }
+    char Chunk[1024];
+    qint64 n;
+    while ((n = Server->read(Chunk, sizeof(Chunk))) > 0)
+        ingest(Chunk, int(n));
 }
 
 void QGPSDDevice::parse(const QString& s)
@@ -1215,7 +1143,7 @@ void QGPSDDevice::parseY(const QString& s)
         }
     }
     setNumSatellites(Sats.size());
-    emit updateStatus();
+    reportStatus();
 }
 
 void QGPSDDevice::parseO(const QString& s)
@@ -1238,14 +1166,12 @@ void QGPSDDevice::parseO(const QString& s)
     qreal Heading = 0;
     if (Args.count() > 7)
         Heading = Args[7].toDouble();
-    emit updatePosition(Args[3].toDouble(),
-        Args[4].toDouble(),
-        QDateTime::currentDateTime(),
-        Alt, Speed, Heading);
+    cur_datetime = QDateTime::currentDateTime();
     setHeading(Heading);
     setAltitude(Alt);
     setSpeed(Speed);
-    emit updateStatus();
+    reportPosition();
+    reportStatus();
 
 }
 
@@ -1349,8 +1275,8 @@ void QGPSMobileDevice::onPositionUpdated(const QGeoPositionInfo &update)
         setFixType(Fix2D);
     }
 
-    emit updatePosition(latitude(), longitude(), dateTime(), altitude(), speed(), heading());
-    emit updateStatus();
+    reportPosition();
+    reportStatus();
 }
 
 //int QGPSMobileDevice::getUpdateInterval() const
@@ -1371,20 +1297,20 @@ void QGPSMobileDevice::on_satellitesInViewUpdated(QList<QGeoSatelliteInfo> satLi
 {
     qDebug() << "Sat updated";
     m_List = satList;
-    emit updateStatus();
+    reportStatus();
 }
 
 void QGPSMobileDevice::on_satellitesInUseUpdated(QList<QGeoSatelliteInfo> satList)
 {
     m_UseList = satList;
-    emit updateStatus();
+    reportStatus();
 }
 
 void QGPSMobileDevice::on_satRequestTimeout()
 {
     m_List.clear();
     m_UseList.clear();
-    emit updateStatus();
+    reportStatus();
 }
 
 void QGPSMobileDevice::satInfo(int index, int &elev, int &azim, int &snr)
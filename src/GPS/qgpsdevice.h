@@ -25,12 +25,68 @@
 #include <QThread>
 #include <QDateTime>
 #include <QFile>
+#include <QList>
+#include <QAtomicInt>
 
 class QString;
 class QMutex;
 class QextSerialPort;
 class QFile;
 
+/// Frames NMEA sentences out of a raw byte stream. Incoming bytes are kept
+/// in a fixed ring buffer; sentences are assembled in a fixed line buffer,
+/// checked against their checksum and handed out in place.
+class NmeaFramer
+{
+public:
+    NmeaFramer();
+
+    /// Appends raw bytes; the oldest ones are dropped if the ring is full
+    void write(const char* aData, int aLength);
+    /// Next complete and valid sentence (without checksum), or false if there is none yet.
+    /// The sentence stays valid until the next call.
+    bool next(char*& aSentence);
+    void clear();
+
+private:
+    enum { RingSize = 4096, MaxSentence = 127 };
+
+    char Ring[RingSize];
+    int Head;
+    int Tail;
+    char Sentence[MaxSentence+1];
+    int Length;
+    bool InSentence;
+};
+
+/// The comma separated fields of a sentence, split in place
+class NmeaFields
+{
+public:
+    NmeaFields(char* aSentence);
+
+    int size() const { return Count; }
+    /// Field i, or an empty string if the sentence is shorter
+    const char* operator[](int i) const { return i < Count ? Field[i] : ""; }
+
+private:
+    enum { MaxFields = 32 };
+
+    const char* Field[MaxFields];
+    int Count;
+};
+
+/// A position fix, as queued for the gui thread
+struct GpsPosition
+{
+    qreal Latitude;
+    qreal Longitude;
+    QDateTime Time;
+    qreal Altitude;
+    qreal Speed;
+    qreal Heading;
+};
+
 class QGPSDevice;
 // We want these slots to be executed within the thread represented by
 // QGPSDDevice. Since that class itself lives in the main thread, we need
@@ -48,7 +104,6 @@ public slots:
     void onLinkReady();
     void onDataAvailable();
     void onStop();
-    void checkDataAvailable();
 
 private:
     QGPSDevice* Target;
@@ -121,6 +176,11 @@ public:
     bool isActiveSat(int prn);
     void satInfo(int index, int &elev, int &azim, int &snr);
 
+    /// Fixes received since the last call, oldest first
+    QList<GpsPosition> takePositions();
+    /// To be called by the receiver of updateStatus() before it reads the status
+    void statusRead();
+
     // some convinience functions
 
     int latDegrees();
@@ -138,14 +198,15 @@ public slots:
 
 signals:
 
-    void  updatePosition(qreal latitude, qreal longitude, QDateTime time, qreal altitude, qreal speed, qreal heading);
+    /// Fixes have been queued; not emitted again until they are taken
+    void  positionsAvailable();
+    /// The status has changed; not emitted again until it is read
     void  updateStatus();
     void doStopDevice();
 
 
 protected:
 
-    virtual void checkDataAvailable() {};
     virtual void run() = 0;
 
     int     fd;
@@ -198,12 +259,22 @@ protected:
     FixStatus cur_fixStatus;
 
     QFile* LogFile;
-    void parseNMEA(const QByteArray& array);
-    bool parseGGA(const char *ggaString = 0);
-    bool parseGLL(const char *ggaString = 0);
-    bool parseGSA(const char *gsaString = 0);
-    bool parseGSV(const char *gsvString = 0);
-    bool parseRMC(const char *gsvString = 0);
+    NmeaFramer Framer;
+    /// Logs and parses raw NMEA data
+    void ingest(const char* aData, int aLength);
+    void parseNMEA(char* aSentence);
+    bool parseGGA(const NmeaFields& tokens);
+    bool parseGLL(const NmeaFields& tokens);
+    bool parseGSA(const NmeaFields& tokens);
+    bool parseGSV(const NmeaFields& tokens);
+    bool parseRMC(const NmeaFields& tokens);
+
+    /// Queues the current fix for the gui thread
+    void reportPosition();
+    void reportStatus();
+
+    QList<GpsPosition> Positions;
+    QAtomicInt StatusPending;
 
 private:
     virtual void onLinkReady() = 0;
@@ -231,12 +302,8 @@ private:
     virtual void onStop();
 
     QextSerialPort *port;
-    QByteArray Buffer;
 
     virtual void run();
-
-protected:
-    virtual void checkDataAvailable();
 };
 #endif
 
@@ -318,7 +385,6 @@ private:
     void parseO(const QString& s);
     void parseY(const QString& s);
     QTcpSocket* Server;
-    QByteArray Buffer;
 
     friend class GPSSlotForwarder;
 };
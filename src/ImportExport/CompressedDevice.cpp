@@ -0,0 +1,188 @@
+#include "CompressedDevice.h"
+
+#include <QDebug>
+
+#include "zlib.h"
+#ifdef USE_BZIP2
+#include "bzlib.h"
+#endif
+
+#define COMPRESS_CHUNK 65536
+
+class CompressedDevicePrivate
+{
+    public:
+        CompressedDevicePrivate(QIODevice* aTarget, CompressedDevice::Compression aCompression)
+            : theTarget(aTarget), theCompression(aCompression), Initialized(false)
+        {
+            Out.resize(COMPRESS_CHUNK);
+        }
+
+        bool init();
+        bool deflate(const char* data, qint64 size, bool finish);
+        void end();
+
+        QIODevice* theTarget;
+        CompressedDevice::Compression theCompression;
+        bool Initialized;
+        QByteArray Out;
+
+        z_stream zs;
+#ifdef USE_BZIP2
+        bz_stream bzs;
+#endif
+};
+
+bool CompressedDevicePrivate::init()
+{
+    switch (theCompression) {
+    case CompressedDevice::Gzip:
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        // 15 bits window + 16 for a gzip header instead of a zlib one
+        Initialized = (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        break;
+    case CompressedDevice::Bzip2:
+#ifdef USE_BZIP2
+        bzs.bzalloc = NULL;
+        bzs.bzfree = NULL;
+        bzs.opaque = NULL;
+        Initialized = (BZ2_bzCompressInit(&bzs, 9, 0, 0) == BZ_OK);
+#endif
+        break;
+    default:
+        Initialized = true;
+        break;
+    }
+    return Initialized;
+}
+
+bool CompressedDevicePrivate::deflate(const char* data, qint64 size, bool finish)
+{
+    switch (theCompression) {
+    case CompressedDevice::Gzip: {
+        zs.next_in = (Bytef*)data;
+        zs.avail_in = size;
+        int ret;
+        do {
+            zs.next_out = (Bytef*)Out.data();
+            zs.avail_out = Out.size();
+            ret = ::deflate(&zs, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR)
+                return false;
+            int have = Out.size() - zs.avail_out;
+            if (have && theTarget->write(Out.constData(), have) != have)
+                return false;
+        } while (zs.avail_out == 0 || (finish && ret != Z_STREAM_END));
+        return true;
+    }
+#ifdef USE_BZIP2
+    case CompressedDevice::Bzip2: {
+        bzs.next_in = (char*)data;
+        bzs.avail_in = size;
+        int ret;
+        do {
+            bzs.next_out = Out.data();
+            bzs.avail_out = Out.size();
+            ret = BZ2_bzCompress(&bzs, finish ? BZ_FINISH : BZ_RUN);
+            if (ret < 0)
+                return false;
+            int have = Out.size() - bzs.avail_out;
+            if (have && theTarget->write(Out.constData(), have) != have)
+                return false;
+        } while (bzs.avail_out == 0 || (finish && ret != BZ_STREAM_END));
+        return true;
+    }
+#endif
+    default:
+        return (theTarget->write(data, size) == size);
+    }
+}
+
+void CompressedDevicePrivate::end()
+{
+    if (!Initialized)
+        return;
+
+    deflate(NULL, 0, true);
+    if (theCompression == CompressedDevice::Gzip)
+        deflateEnd(&zs);
+#ifdef USE_BZIP2
+    else if (theCompression == CompressedDevice::Bzip2)
+        BZ2_bzCompressEnd(&bzs);
+#endif
+    Initialized = false;
+}
+
+/**************************/
+
+CompressedDevice::CompressedDevice(QIODevice* aTarget, Compression aCompression)
+    : QIODevice()
+{
+    p = new CompressedDevicePrivate(aTarget, aCompression);
+}
+
+CompressedDevice::~CompressedDevice()
+{
+    if (isOpen())
+        close();
+    delete p;
+}
+
+CompressedDevice::Compression CompressedDevice::compressionFor(const QString& aFilename)
+{
+    if (aFilename.endsWith(".gz", Qt::CaseInsensitive))
+        return Gzip;
+    if (aFilename.endsWith(".bz2", Qt::CaseInsensitive))
+        return Bzip2;
+    return None;
+}
+
+bool CompressedDevice::isSupported(Compression aCompression)
+{
+#ifndef USE_BZIP2
+    if (aCompression == Bzip2)
+        return false;
+#endif
+    Q_UNUSED(aCompression);
+    return true;
+}
+
+bool CompressedDevice::open(OpenMode mode)
+{
+    if ((mode & QIODevice::ReadOnly) || !isSupported(p->theCompression)) {
+        setErrorString("Unsupported mode");
+        return false;
+    }
+    if (!p->theTarget->isOpen() && !p->theTarget->open(QIODevice::WriteOnly))
+        return false;
+    if (!p->init()) {
+        qDebug() << "CompressedDevice: cannot initialise compressor";
+        return false;
+    }
+    return QIODevice::open(mode & ~QIODevice::Text);
+}
+
+void CompressedDevice::close()
+{
+    p->end();
+    QIODevice::close();
+}
+
+bool CompressedDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 CompressedDevice::readData(char* /*data*/, qint64 /*maxSize*/)
+{
+    return -1;
+}
+
+qint64 CompressedDevice::writeData(const char* data, qint64 maxSize)
+{
+    if (!p->deflate(data, maxSize, false))
+        return -1;
+    return maxSize;
+}
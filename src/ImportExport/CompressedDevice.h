@@ -0,0 +1,36 @@
+#ifndef MERKAARTOR_COMPRESSEDDEVICE_H_
+#define MERKAARTOR_COMPRESSEDDEVICE_H_
+
+#include <QIODevice>
+#include <QByteArray>
+
+class CompressedDevicePrivate;
+
+/// Write-only device compressing everything written to it into another
+/// device, so that exports can be streamed straight into .gz/.bz2 files.
+/// bzip2 is only available when built with BZIP2=1.
+class CompressedDevice : public QIODevice
+{
+    public:
+        typedef enum { None, Gzip, Bzip2 } Compression;
+
+        CompressedDevice(QIODevice* aTarget, Compression aCompression);
+        virtual ~CompressedDevice();
+
+        /// Compression implied by a file name (".gz", ".bz2").
+        static Compression compressionFor(const QString& aFilename);
+        static bool isSupported(Compression aCompression);
+
+        virtual bool open(OpenMode mode);
+        virtual void close();
+        virtual bool isSequential() const;
+
+    protected:
+        virtual qint64 readData(char* data, qint64 maxSize);
+        virtual qint64 writeData(const char* data, qint64 maxSize);
+
+    private:
+        CompressedDevicePrivate* p;
+};
+
+#endif
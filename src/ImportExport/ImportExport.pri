@@ -4,6 +4,7 @@ DEPENDPATH += $$MERKAARTOR_SRC_DIR/ImportExport
 #Header files
 HEADERS += \
     ExportOSM.h \
+    CompressedDevice.h \
     ImportGPX.h \
     ImportNGT.h \
     ImportOSM.h \
@@ -18,6 +19,7 @@ HEADERS += \
 #Source files
 SOURCES += \
     ExportOSM.cpp \
+    CompressedDevice.cpp \
     ImportGPX.cpp \
     ImportOSM.cpp \
     ImportNGT.cpp \
@@ -32,6 +34,11 @@ FORMS += \
     ExportDialog.ui \
     ImportCSVDialog.ui
 
+contains(BZIP2, 1) {
+    DEFINES += USE_BZIP2
+    LIBS += -lbz2
+}
+
 isEmpty(MOBILE) {
   HEADERS += \
       ImportExportGdal.h
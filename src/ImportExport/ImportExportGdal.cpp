@@ -26,6 +26,10 @@
 #include <gdal_priv.h>
 
 #include <QDir>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThread>
+#include <QtConcurrentMap>
 
 
 bool parseContainer(QDomElement& e, Layer* aLayer);
@@ -320,6 +324,427 @@ Feature* ImportExportGdal::parseGeometry(Layer* aLayer, OGRGeometry *poGeometry)
     }
 }
 
+/***************/
+
+// PARALLEL IMPORT
+//
+// Worker threads each open their own handle on the dataset, read a range
+// of features of one layer into flat buffers, reproject them in one batch
+// and resolve the vertices to shared ids. Features are then created on the
+// gui thread, in the order of the source.
+
+#define GDAL_CHUNK_SIZE 20000
+#define GDAL_VERTEX_SHARD_BITS 6
+#define GDAL_VERTEX_SHARDS (1 << GDAL_VERTEX_SHARD_BITS)
+#define GDAL_VERTEX_INDEX_BITS (32 - GDAL_VERTEX_SHARD_BITS)
+
+#ifdef GDAL2
+typedef GDALDataset GdalSource;
+#else
+typedef OGRDataSource GdalSource;
+#endif
+
+static GdalSource* openSource(const QString& aPath)
+{
+#ifdef GDAL2
+    return (GDALDataset *) GDALOpenEx( aPath.toUtf8().constData(), GDAL_OF_VECTOR | GDAL_OF_READONLY, NULL, NULL, NULL );
+#else
+    return OGRSFDriverRegistrar::Open( aPath.toUtf8().constData(), FALSE );
+#endif
+}
+
+struct GdalVertex
+{
+    double X, Y;
+
+    bool operator==(const GdalVertex& o) const
+    {
+        return X == o.X && Y == o.Y;
+    }
+};
+
+static uint qHash(const GdalVertex& v)
+{
+    // +0. folds -0. onto 0., which compare equal
+    double x = v.X + 0., y = v.Y + 0.;
+    quint64 kx, ky;
+    memcpy(&kx, &x, sizeof(kx));
+    memcpy(&ky, &y, sizeof(ky));
+    return qHash(kx) ^ (qHash(ky) * 31);
+}
+
+/* Vertices shared by all workers. A vertex id is its shard in the top bits
+   and its index in the shard below; ids are unsigned so that the top bit
+   can be used. */
+class GdalVertexTable
+{
+public:
+    struct Shard
+    {
+        QMutex Lock;
+        QHash<GdalVertex, quint32> Index;
+        QVector<GdalVertex> Vertices;
+    };
+
+    quint32 idFor(const GdalVertex& v)
+    {
+        uint h = qHash(v);
+        quint32 s = (h ^ (h >> 16)) % GDAL_VERTEX_SHARDS;
+        Shard& S = Shards[s];
+        QMutexLocker locker(&S.Lock);
+        QHash<GdalVertex, quint32>::const_iterator it = S.Index.constFind(v);
+        if (it != S.Index.constEnd())
+            return it.value();
+        quint32 id = (s << GDAL_VERTEX_INDEX_BITS) | quint32(S.Vertices.size());
+        S.Index.insert(v, id);
+        S.Vertices.append(v);
+        return id;
+    }
+
+    const GdalVertex& vertex(quint32 id) const
+    {
+        return Shards[(id >> GDAL_VERTEX_INDEX_BITS) & (GDAL_VERTEX_SHARDS-1)].Vertices[id & ((1u << GDAL_VERTEX_INDEX_BITS) - 1)];
+    }
+
+    Shard Shards[GDAL_VERTEX_SHARDS];
+};
+
+/* Geometry of a feature as a flat list of parts:
+   'P' a point (First is the vertex), 'W' a way (Count vertices from First),
+   'A' a polygon of Count rings, 'C' a collection of Count geometries. */
+struct GdalPart
+{
+    char Kind;
+    int First;
+    int Count;
+};
+
+struct GdalFeature
+{
+    int FirstPart;
+    int FirstTag;
+    int NumTags;
+};
+
+struct GdalTask
+{
+    int Layer;
+    int Start;
+    int Count;
+};
+
+struct GdalChunk
+{
+    QVector<GdalFeature> Features;
+    QVector<GdalPart> Parts;
+    QVector<quint32> VertexIds;
+    QList<QPair<QString, QString> > Tags;
+};
+
+class GdalChunkReader
+{
+public:
+    typedef GdalChunk result_type;
+
+    GdalChunkReader(const QString& aPath, const QString& aPrj, GdalVertexTable* aTable, QAtomicInt* aCanceled)
+        : Path(aPath), Prj(aPrj), Table(aTable), Canceled(aCanceled)
+    {
+    }
+
+    GdalChunk operator()(const GdalTask& aTask) const
+    {
+        GdalChunk theChunk;
+        if (Canceled->load())
+            return theChunk;
+
+        GdalSource* poDS = openSource(Path);
+        if (!poDS)
+            return theChunk;
+        OGRLayer* poLayer = poDS->GetLayer(aTask.Layer);
+
+        OGRSpatialReference wgs84srs, theSrs;
+        wgs84srs.SetWellKnownGeogCS("WGS84");
+        theSrs.importFromProj4(Prj.toLatin1().data());
+        OGRCoordinateTransformation* toWGS84 = OGRCreateCoordinateTransformation(&theSrs, &wgs84srs);
+
+        QVector<double> X, Y;
+        if (toWGS84 && poLayer) {
+            if (aTask.Start)
+                poLayer->SetNextByIndex(aTask.Start);
+            OGRFeature* poFeature;
+            for (int i=0; (aTask.Count < 0 || i < aTask.Count) && (poFeature = poLayer->GetNextFeature()) != NULL; ++i) {
+                if (OGRGeometry* poGeometry = poFeature->GetGeometryRef()) {
+                    GdalFeature F;
+                    F.FirstPart = theChunk.Parts.size();
+                    F.FirstTag = theChunk.Tags.size();
+                    readGeometry(poGeometry, theChunk, X, Y);
+                    for (int j=0; j<poFeature->GetFieldCount(); ++j)
+                        theChunk.Tags << qMakePair(QString::fromUtf8(poFeature->GetFieldDefnRef(j)->GetNameRef()),
+                                                   QString::fromUtf8(poFeature->GetFieldAsString(j)));
+                    F.NumTags = theChunk.Tags.size() - F.FirstTag;
+                    theChunk.Features << F;
+                }
+                OGRFeature::DestroyFeature(poFeature);
+                if (Canceled->load())
+                    break;
+            }
+
+            // One reprojection call for the whole chunk
+            if (X.size())
+                toWGS84->Transform(X.size(), X.data(), Y.data());
+            theChunk.VertexIds.resize(X.size());
+            for (int i=0; i<X.size(); ++i) {
+                GdalVertex v = { X[i], Y[i] };
+                theChunk.VertexIds[i] = Table->idFor(v);
+            }
+        }
+
+        delete toWGS84;
+        GDALClose( (GDALDatasetH) poDS );
+        return theChunk;
+    }
+
+private:
+    static void readGeometry(OGRGeometry* poGeometry, GdalChunk& theChunk, QVector<double>& X, QVector<double>& Y)
+    {
+        OGRwkbGeometryType type = wkbFlatten(poGeometry->getGeometryType());
+        GdalPart P;
+        P.First = X.size();
+        P.Count = 0;
+
+        switch(type) {
+        case wkbPoint: {
+            OGRPoint *p = (OGRPoint*)(poGeometry);
+            P.Kind = 'P';
+            X << p->getX();
+            Y << p->getY();
+            theChunk.Parts << P;
+            break;
+        }
+        case wkbLineString:
+            P.Kind = 'W';
+            P.Count = readPoints((OGRLineString*)poGeometry, X, Y);
+            theChunk.Parts << P;
+            break;
+
+        case wkbPolygon: {
+            OGRPolygon *poPoly = (OGRPolygon*)poGeometry;
+            P.Kind = 'A';
+            P.Count = 1 + poPoly->getNumInteriorRings();
+            theChunk.Parts << P;
+            for (int i=0; i<P.Count; ++i) {
+                GdalPart R;
+                R.Kind = 'W';
+                R.First = X.size();
+                R.Count = readPoints(i ? poPoly->getInteriorRing(i-1) : poPoly->getExteriorRing(), X, Y);
+                theChunk.Parts << R;
+            }
+            break;
+        }
+        case wkbMultiPolygon:
+        case wkbMultiLineString:
+        case wkbMultiPoint: {
+            OGRGeometryCollection  *poCol = (OGRGeometryCollection*) poGeometry;
+            P.Kind = 'C';
+            P.Count = poCol->getNumGeometries();
+            theChunk.Parts << P;
+            for (int i=0; i<P.Count; ++i)
+                readGeometry(poCol->getGeometryRef(i), theChunk, X, Y);
+            break;
+        }
+        default:
+            qWarning("SHP: Unrecognised Geometry type %d, ignored", type);
+            P.Kind = 'C';
+            theChunk.Parts << P;
+        }
+    }
+
+    static int readPoints(OGRLineString* poLine, QVector<double>& X, QVector<double>& Y)
+    {
+        if (!poLine)
+            return 0;
+        int numNode = poLine->getNumPoints();
+        for (int i=0; i<numNode; ++i) {
+            X << poLine->getX(i);
+            Y << poLine->getY(i);
+        }
+        return numNode;
+    }
+
+    QString Path;
+    QString Prj;
+    GdalVertexTable* Table;
+    QAtomicInt* Canceled;
+};
+
+/* Creates the features of a chunk, the same way parseGeometry does */
+class GdalMaterialiser
+{
+public:
+    GdalMaterialiser(Layer* aLayer, const GdalVertexTable& aTable)
+        : theLayer(aLayer), Table(aTable)
+    {
+    }
+
+    Feature* feature(const GdalChunk& theChunk, int& part)
+    {
+        const GdalPart& P = theChunk.Parts[part++];
+        switch (P.Kind) {
+        case 'P':
+            return nodeFor(theChunk.VertexIds[P.First]);
+
+        case 'W':
+            return way(theChunk, P);
+
+        case 'A': {
+            Way* outer = way(theChunk, theChunk.Parts[part++]);
+            Relation* rel = NULL;
+            for (int i=1; i<P.Count; ++i) {
+                const GdalPart& R = theChunk.Parts[part++];
+                if (!outer)
+                    continue;
+                if (!rel) {
+                    rel = g_backend.allocRelation(theLayer);
+                    theLayer->add(rel);
+                    rel->setTag("type", "multipolygon");
+                    rel->add("outer", outer);
+                }
+                if (Way* inner = way(theChunk, R))
+                    rel->add("inner", inner);
+            }
+            if (rel)
+                return rel;
+            return outer;
+        }
+
+        case 'C': {
+            if (!P.Count)
+                return NULL;
+            Relation* R = g_backend.allocRelation(theLayer);
+            theLayer->add(R);
+            for (int i=0; i<P.Count; ++i)
+                if (Feature* F = feature(theChunk, part))
+                    R->add("", F);
+            return R;
+        }
+        }
+        return NULL;
+    }
+
+private:
+    Node* nodeFor(quint32 id)
+    {
+        Node*& N = Nodes[id];
+        if (!N) {
+            const GdalVertex& v = Table.vertex(id);
+            N = g_backend.allocNode(theLayer, Coord(v.X, v.Y));
+            theLayer->add(N);
+        }
+        return N;
+    }
+
+    Way* way(const GdalChunk& theChunk, const GdalPart& P)
+    {
+        if (!P.Count)
+            return NULL;
+        Way* w = g_backend.allocWay(theLayer);
+        theLayer->add(w);
+        for (int i=0; i<P.Count; ++i)
+            w->add(nodeFor(theChunk.VertexIds[P.First + i]));
+        return w;
+    }
+
+    Layer* theLayer;
+    const GdalVertexTable& Table;
+    QHash<quint32, Node*> Nodes;
+};
+
+#ifndef GDAL2
+#define GDALDataset OGRDataSource
+#endif
+bool ImportExportGdal::importParallel(GDALDataset* poDS, Layer* aLayer, const QString& sPrj, QProgressDialog& progress)
+#undef GDALDataset
+{
+    // Layers without fast random access are read by a single task
+    QList<GdalTask> theTasks;
+    for (int l=0; l<poDS->GetLayerCount(); ++l) {
+        OGRLayer* poLayer = poDS->GetLayer(l);
+        int sz = poLayer->GetFeatureCount(TRUE);
+        if (sz > GDAL_CHUNK_SIZE && poLayer->TestCapability(OLCFastSetNextByIndex)) {
+            for (int start=0; start<sz; start+=GDAL_CHUNK_SIZE) {
+                GdalTask T = { l, start, qMin(GDAL_CHUNK_SIZE, sz - start) };
+                theTasks << T;
+            }
+        } else {
+            GdalTask T = { l, 0, -1 };
+            theTasks << T;
+        }
+    }
+
+    GdalVertexTable* theTable = new GdalVertexTable;
+    QAtomicInt Canceled(0);
+    QFuture<GdalChunk> theFuture = QtConcurrent::mapped(theTasks, GdalChunkReader(SourcePath, sPrj, theTable, &Canceled));
+
+    progress.setLabelText(QApplication::tr("Reading..."));
+    progress.setRange(0, theTasks.size());
+    while (!theFuture.isFinished()) {
+        progress.setValue(theFuture.progressValue());
+        qApp->processEvents(QEventLoop::AllEvents, 100);
+        if (progress.wasCanceled())
+            Canceled.store(1);
+        QThread::msleep(20);
+    }
+    if (progress.wasCanceled()) {
+        delete theTable;
+        return false;
+    }
+
+    int totFeatures = 0;
+    for (int i=0; i<theTasks.size(); ++i)
+        totFeatures += theFuture.resultAt(i).Features.size();
+    progress.setRange(0, totFeatures);
+
+    int totimported = 0;
+    GdalMaterialiser theMaterialiser(aLayer, *theTable);
+    for (int c=0; c<theTasks.size() && !progress.wasCanceled(); ++c) {
+        const GdalChunk theChunk = theFuture.resultAt(c);
+        foreach (const GdalFeature& G, theChunk.Features) {
+            int part = G.FirstPart;
+            Feature* F = theMaterialiser.feature(theChunk, part);
+            if (F) {
+                for (int i=G.FirstTag; i<G.FirstTag + G.NumTags; ++i) {
+                    QString k = theChunk.Tags[i].first;
+                    const QString& v = theChunk.Tags[i].second;
+                    if (k == "osm_id") {
+                        F->setId(IFeature::FId(F->getType(), (qint64)v.toDouble()));
+#ifndef FRISIUS_BUILD
+                    } else if (k == "osm_version") {
+                        F->setVersionNumber(v.toInt());
+                    } else if (k == "osm_timestamp") {
+                        F->setTime(QDateTime::fromTime_t(v.toUInt()));
+#endif
+                    } else {
+                        if (!g_Merk_NoGuardedTagsImport) {
+                            k.prepend("_");
+                            k.append("_");
+                        }
+                        F->setTag(k, v);
+                    }
+                }
+            }
+            if (!(++totimported % 1000)) {
+                progress.setLabelText(QApplication::tr("Imported: %1").arg(totimported));
+                progress.setValue(totimported);
+                qApp->processEvents();
+            }
+        }
+        qDebug() << "Chunk #" << c << " Features#: " << theChunk.Features.size();
+    }
+
+    delete theTable;
+    return !progress.wasCanceled();
+}
+
 // import the  input
 
 #ifndef GDAL2
@@ -407,6 +832,15 @@ bool ImportExportGdal::importGDALDataset(GDALDataset* poDS, Layer* aLayer, bool
     progress.setRange(0, 0);
     progress.show();
 
+    if (!SourcePath.isEmpty() && QThread::idealThreadCount() > 1) {
+        bool ok = importParallel(poDS, aLayer, sPrj, progress);
+#ifndef _MOBILE
+        QApplication::restoreOverrideCursor();
+#endif
+        delete toWGS84;
+        return ok;
+    }
+
     int totimported = 0;
     OGRFeature *poFeature;
     for (int l=0; l<poDS->GetLayerCount() && !progress.wasCanceled(); ++l) {
@@ -498,6 +932,7 @@ bool ImportExportGdal::import(Layer* aLayer)
         return false;
     }
 
+    SourcePath = FileName;
     importGDALDataset(poDS, aLayer, M_PREFS->getGdalConfirmProjection());
 
     GDALClose( (GDALDatasetH) poDS );
@@ -525,6 +960,7 @@ bool ImportExportGdal::import(Layer* aLayer, const QByteArray& ba, bool confirmP
         qDebug( "GDAL Open failed.\n" );
         return false;
     }
+    SourcePath = "/vsimem/temp";
     importGDALDataset(poDS, aLayer, confirmProjection);
 
     GDALClose( (GDALDatasetH) poDS );
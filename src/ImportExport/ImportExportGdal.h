@@ -29,6 +29,7 @@ class OGRGeometry;
 class OGRLineString;
 class OGRPoint;
 class OGRCoordinateTransformation;
+class QProgressDialog;
 
 
 /**
@@ -64,10 +65,13 @@ protected:
 #define GDALDataset OGRDataSource
 #endif
     bool importGDALDataset(GDALDataset *poDs, Layer *aLayer, bool confirmProjection);
+    bool importParallel(GDALDataset *poDs, Layer *aLayer, const QString& sPrj, QProgressDialog& progress);
 #undef GDALDataset
 
 private:
     QHash<OGRPoint, Node*> pointHash;
+    // Path the workers of the parallel import reopen the dataset from
+    QString SourcePath;
 };
 
 #endif
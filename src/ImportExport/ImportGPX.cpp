@@ -11,164 +11,235 @@
 #include <QDateTime>
 #include <QFile>
 #include <QMessageBox>
-#include <QDomDocument>
+#include <QXmlStreamReader>
 #include <QProgressDialog>
 
+/// Progress is reported by byte offset in the input (in kB, so that files
+/// over 2GB still fit), and only every few points.
+class GpxProgress
+{
+    public:
+        GpxProgress(QProgressDialog& aDlg, QIODevice& aFile)
+            : dlg(aDlg), File(aFile), count(0)
+        {
+            if (!File.isSequential())
+                dlg.setMaximum(File.size() / 1024);
+        }
+
+        void step()
+        {
+            if (++count % 256)
+                return;
+            if (!File.isSequential())
+                dlg.setValue(File.pos() / 1024);
+            else
+                dlg.setValue(0);
+        }
+
+        bool wasCanceled() const
+        {
+            return dlg.wasCanceled();
+        }
+
+        QProgressDialog& dlg;
+        QIODevice& File;
+        int count;
+};
 
-static TrackNode* importTrkPt(const QDomElement& Root, Document* /* theDocument */, Layer* theLayer)
+/// On-the-fly decimation: track points closer than MinDistance (km) to the
+/// last kept point of their segment are never allocated.
+class GpxDecimator
 {
-    qreal Lat = Root.attribute("lat").toDouble();
-    qreal Lon = Root.attribute("lon").toDouble();
+    public:
+        GpxDecimator()
+            : MinDistance(M_PREFS->getGpxMinDistance() / 1000.), HasLast(false)
+        {
+        }
 
-    TrackNode* Pt = g_backend.allocTrackNode(theLayer, Coord(Lon,Lat));
-    Pt->setLastUpdated(Feature::Log);
-    if (Root.hasAttribute("xml:id"))
-        Pt->setId(IFeature::FId(IFeature::Point, Root.attribute("xml:id").toLongLong()));
+        bool keep(const Coord& C)
+        {
+            if (MinDistance <= 0.)
+                return true;
+            if (HasLast && C.distanceFrom(Last) < MinDistance)
+                return false;
+            Last = C;
+            HasLast = true;
+            return true;
+        }
 
-    theLayer->add(Pt);
+        void reset()
+        {
+            HasLast = false;
+        }
 
-    if (Root.tagName() == "wpt")
-        Pt->setTag("_waypoint_", "yes");
+        qreal MinDistance;
+        Coord Last;
+        bool HasLast;
+};
 
-    for(QDomNode n = Root.firstChild(); !n.isNull(); n = n.nextSibling())
+/// A trkpt/rtept/wpt as read from the file. Plain track points (without a
+/// name, comment, description or id) only go into the segment columns.
+struct GpxPoint
+{
+    GpxPoint()
+        : Elevation(0.0), Speed(0.0), Time(QDateTime::currentDateTime().toTime_t()), HasId(false), Special(false), Id(0)
     {
-        QDomElement t = n.toElement();
+    }
 
-        if (t.isNull())
-            continue;
+    bool isPlain() const
+    {
+        return !HasId && Name.isNull() && Description.isNull() && Comment.isNull();
+    }
+
+    Coord Position;
+    qreal Elevation;
+    qreal Speed;
+    uint Time;
+    QString Name;
+    QString Description;
+    QString Comment;
+    bool HasId;
+    bool Special;
+    qint64 Id;
+};
+
+static void readTrkPt(QXmlStreamReader& stream, GpxPoint& Pt)
+{
+    if (stream.attributes().hasAttribute("xml:id")) {
+        Pt.HasId = true;
+        Pt.Id = stream.attributes().value("xml:id").toString().toLongLong();
+    }
 
-        if (t.tagName() == "time")
+    while (stream.readNextStartElement())
+    {
+        if (stream.name() == "time")
         {
-            QString Value;
-            for (QDomNode s = t.firstChild(); !s.isNull(); s = s.nextSibling())
-            {
-                QDomText ss = s.toText();
-                if (!ss.isNull())
-                    Value += ss.data();
-            }
+            QString Value = stream.readElementText();
             if (!Value.isEmpty())
             {
                 QDateTime dt(QDateTime::fromString(Value.left(19), Qt::ISODate));
                 dt.setTimeSpec(Qt::UTC);
-                Pt->setTime(dt);
+                Pt.Time = dt.toTime_t();
             }
         }
-        else if (t.tagName() == "ele")
+        else if (stream.name() == "ele")
         {
-            Pt->setElevation( t.text().toDouble() );
+            Pt.Elevation = stream.readElementText().toDouble();
         }
-        else if (t.tagName() == "speed")
+        else if (stream.name() == "speed")
         {
-            Pt->setSpeed( t.text().toDouble() );
+            Pt.Speed = stream.readElementText().toDouble();
         }
-        else if (t.tagName() == "name")
+        else if (stream.name() == "name")
         {
-            Pt->setTag("name", t.text());
+            Pt.Name = stream.readElementText();
         }
-        else if (t.tagName() == "desc")
+        else if (stream.name() == "desc")
         {
-            Pt->setTag("_description_", t.text());
+            Pt.Description = stream.readElementText();
         }
-        else if (t.tagName() == "cmt")
+        else if (stream.name() == "cmt")
         {
-            Pt->setTag("_comment_", t.text());
+            Pt.Comment = stream.readElementText();
         }
-        else if (t.tagName() == "extensions") // for OpenStreetBugs
+        else if (stream.name() == "extensions") // for OpenStreetBugs
         {
-            QDomNodeList li = t.elementsByTagName("id");
-            if (li.size()) {
-                QString id = li.at(0).toElement().text();
-                Pt->setId(IFeature::FId(IFeature::Point | IFeature::Special, id.toLongLong()));
-                Pt->setTag("_special_", "yes"); // Assumed to be OpenstreetBugs as they don't use their own namesoace
-                Pt->setSpecial(true);
+            while (stream.readNextStartElement()) {
+                if (stream.name() == "id") {
+                    Pt.Id = stream.readElementText().toLongLong();
+                    Pt.HasId = true;
+                    Pt.Special = true;
+                } else
+                    stream.skipCurrentElement();
             }
         }
+        else
+            stream.skipCurrentElement();
     }
-
-    return Pt;
 }
 
-
-static void importTrkSeg(const QDomElement& Root, Document* theDocument, Layer* theLayer, bool MakeSegment, QProgressDialog & progress)
+static TrackNode* makeTrackNode(const GpxPoint& Gp, Layer* theLayer, bool isWaypoint)
 {
-    TrackSegment* S = g_backend.allocSegment(theLayer);
-    theLayer->add(S);
-
-    if (Root.hasAttribute("xml:id"))
-        S->setId(IFeature::FId(IFeature::GpxSegment, Root.attribute("xml:id").toLongLong()));
-
-    Node* lastPoint = NULL;
-
-    for(QDomNode n = Root.firstChild(); !n.isNull(); n = n.nextSibling())
-    {
-        QDomElement t = n.toElement();
-        if (t.isNull() || t.tagName() != "trkpt")
-            continue;
-
-        progress.setValue(progress.value()+1);
-        if (progress.wasCanceled())
-            return;
+    TrackNode* Pt = g_backend.allocTrackNode(theLayer, Gp.Position);
+    Pt->setLastUpdated(Feature::Log);
+    if (Gp.Special) {
+        Pt->setId(IFeature::FId(IFeature::Point | IFeature::Special, Gp.Id));
+        Pt->setTag("_special_", "yes"); // Assumed to be OpenstreetBugs as they don't use their own namesoace
+        Pt->setSpecial(true);
+    } else if (Gp.HasId)
+        Pt->setId(IFeature::FId(IFeature::Point, Gp.Id));
 
-        TrackNode* Pt = importTrkPt(t,theDocument, theLayer);
+    theLayer->add(Pt);
 
-        if (MakeSegment == false)
-            continue;
+    if (isWaypoint)
+        Pt->setTag("_waypoint_", "yes");
 
-        if (lastPoint)
-        {
-            qreal kilometer = Pt->position().distanceFrom( lastPoint->position() );
+    Pt->setTime(Gp.Time);
+    Pt->setElevation(Gp.Elevation);
+    Pt->setSpeed(Gp.Speed);
+    if (!Gp.Name.isNull())
+        Pt->setTag("name", Gp.Name);
+    if (!Gp.Description.isNull())
+        Pt->setTag("_description_", Gp.Description);
+    if (!Gp.Comment.isNull())
+        Pt->setTag("_comment_", Gp.Comment);
 
-            if (M_PREFS->getMaxDistNodes() != 0.0 && kilometer > M_PREFS->getMaxDistNodes())
-            {
-                if (!S->size())
-                    g_backend.deallocFeature(theLayer, S);
+    return Pt;
+}
 
-                S = g_backend.allocSegment(theLayer);
-                theLayer->add(S);
-            }
-        }
+static TrackNode* importTrkPt(QXmlStreamReader& stream, Document* /* theDocument */, Layer* theLayer, GpxDecimator* decimator)
+{
+    GpxPoint Gp;
+    Gp.Position = Coord(stream.attributes().value("lon").toString().toDouble(), stream.attributes().value("lat").toString().toDouble());
 
-        S->add(Pt);
-        lastPoint = Pt;
+    if (decimator && !decimator->keep(Gp.Position)) {
+        stream.skipCurrentElement();
+        return NULL;
     }
 
-    if (!S->size())
-        g_backend.deallocFeature(theLayer, S);
+    bool isWaypoint = (stream.name() == "wpt");
+    readTrkPt(stream, Gp);
+    return makeTrackNode(Gp, theLayer, isWaypoint);
 }
 
-static void importRte(const QDomElement& Root, Document* theDocument, Layer* theLayer, bool MakeSegment, QProgressDialog & progress)
+/// Reads the points of a trkseg or rte, splitting the segment where two
+/// consecutive points are further apart than MaxDistNodes. Plain points are
+/// stored in the segment columns, without a TrackNode of their own.
+static void importPoints(QXmlStreamReader& stream, const QString& pointTag, Document* theDocument, Layer* theLayer, bool MakeSegment, GpxProgress& progress)
 {
     TrackSegment* S = g_backend.allocSegment(theLayer);
     theLayer->add(S);
 
-    if (Root.hasAttribute("xml:id"))
-        S->setId(IFeature::FId(IFeature::GpxSegment, Root.attribute("xml:id").toLongLong()));
+    if (stream.attributes().hasAttribute("xml:id"))
+        S->setId(IFeature::FId(IFeature::GpxSegment, stream.attributes().value("xml:id").toString().toLongLong()));
 
-    TrackNode* lastPoint = NULL;
+    Coord lastPoint;
+    bool hasLast = false;
+    GpxDecimator decimator;
 
-    for(QDomNode n = Root.firstChild(); !n.isNull(); n = n.nextSibling())
+    while (stream.readNextStartElement())
     {
-        QDomElement t = n.toElement();
-        if (!t.isNull() && t.tagName() == "name") {
-            theLayer->setName(t.text());
-        } else
-        if (!t.isNull() && t.tagName() == "desc") {
-            theLayer->setDescription(t.text());
-        } else
-        if (!t.isNull() && t.tagName() == "rtept") {
-
-            progress.setValue(progress.value()+1);
+        if (stream.name() == pointTag) {
+            progress.step();
             if (progress.wasCanceled())
                 return;
 
-            TrackNode* Pt = importTrkPt(t,theDocument, theLayer);
+            if (MakeSegment == false) {
+                importTrkPt(stream, theDocument, theLayer, &decimator);
+                continue;
+            }
 
-            if (MakeSegment == false)
+            GpxPoint Gp;
+            Gp.Position = Coord(stream.attributes().value("lon").toString().toDouble(), stream.attributes().value("lat").toString().toDouble());
+            if (!decimator.keep(Gp.Position)) {
+                stream.skipCurrentElement();
                 continue;
+            }
+            readTrkPt(stream, Gp);
 
-            if (lastPoint)
+            if (hasLast)
             {
-                qreal kilometer = Pt->position().distanceFrom( lastPoint->position() );
+                qreal kilometer = Gp.Position.distanceFrom( lastPoint );
 
                 if (M_PREFS->getMaxDistNodes() != 0.0 && kilometer > M_PREFS->getMaxDistNodes())
                 {
@@ -176,49 +247,59 @@ static void importRte(const QDomElement& Root, Document* theDocument, Layer* the
                         g_backend.deallocFeature(theLayer, S);
 
                     S = g_backend.allocSegment(theLayer);
+                    theLayer->add(S);
                 }
             }
-            S->add(Pt);
-            lastPoint = Pt;
-        }
+
+            if (Gp.isPlain())
+                S->addPoint(Gp.Position, Gp.Time, Gp.Elevation, Gp.Speed);
+            else
+                S->add(makeTrackNode(Gp, theLayer, false));
+            lastPoint = Gp.Position;
+            hasLast = true;
+        } else if (pointTag == "rtept" && stream.name() == "name") {
+            theLayer->setName(stream.readElementText());
+        } else if (pointTag == "rtept" && stream.name() == "desc") {
+            theLayer->setDescription(stream.readElementText());
+        } else
+            stream.skipCurrentElement();
     }
 
     if (!S->size())
         g_backend.deallocFeature(theLayer, S);
 }
 
-static void importTrk(const QDomElement& Root, Document* theDocument, Layer* theLayer, bool MakeSegment, QProgressDialog & progress)
+static void importTrk(QXmlStreamReader& stream, Document* theDocument, Layer* theLayer, bool MakeSegment, GpxProgress& progress)
 {
-    for(QDomNode n = Root.firstChild(); !n.isNull(); n = n.nextSibling())
+    while (stream.readNextStartElement())
     {
-        QDomElement t = n.toElement();
-        if (!t.isNull() && t.tagName() == "trkseg") {
-            importTrkSeg(t,theDocument, theLayer, MakeSegment, progress);
+        if (stream.name() == "trkseg") {
+            importPoints(stream, "trkpt", theDocument, theLayer, MakeSegment, progress);
             if (progress.wasCanceled())
                 return;
         } else
-        if (!t.isNull() && t.tagName() == "name") {
-            theLayer->setName(t.text());
+        if (stream.name() == "name") {
+            theLayer->setName(stream.readElementText());
         } else
-        if (!t.isNull() && t.tagName() == "desc") {
-            theLayer->setDescription(t.text());
-        }
+        if (stream.name() == "desc") {
+            theLayer->setDescription(stream.readElementText());
+        } else
+            stream.skipCurrentElement();
     }
 }
 
-static void importGPX(const QDomElement& Root, Document* theDocument, QList<TrackLayer*>& theTracklayers, bool MakeSegment, QProgressDialog & progress)
+static void importGPX(QXmlStreamReader& stream, Document* theDocument, QList<TrackLayer*>& theTracklayers, bool MakeSegment, GpxProgress& progress)
 {
-    for(QDomNode n = Root.firstChild(); !n.isNull(); n = n.nextSibling())
+    while (stream.readNextStartElement())
     {
-        QDomElement t = n.toElement();
-        if (t.isNull())
-            continue;
-
-        if (t.tagName() == "trk")
+        if (stream.name() == "trk" || stream.name() == "rte")
         {
             TrackLayer* newLayer = new TrackLayer();
             theDocument->add(newLayer);
-            importTrk(t,theDocument, newLayer, MakeSegment, progress);
+            if (stream.name() == "trk")
+                importTrk(stream, theDocument, newLayer, MakeSegment, progress);
+            else
+                importPoints(stream, "rtept", theDocument, newLayer, MakeSegment, progress);
             if (!newLayer->size()) {
                 theDocument->remove(newLayer);
                 delete newLayer;
@@ -226,23 +307,14 @@ static void importGPX(const QDomElement& Root, Document* theDocument, QList<Trac
                 theTracklayers.append(newLayer);
             }
         }
-        else if (t.tagName() == "rte")
+        else if (stream.name() == "wpt" && theTracklayers.size())
         {
-            TrackLayer* newLayer = new TrackLayer();
-            theDocument->add(newLayer);
-            importRte(t,theDocument, newLayer, MakeSegment, progress);
-            if (!newLayer->size()) {
-                theDocument->remove(newLayer);
-                delete newLayer;
-            } else {
-                theTracklayers.append(newLayer);
-            }
-        }
-        else if (t.tagName() == "wpt")
-        {
-            importTrkPt(t,theDocument, theTracklayers[0]);
-            progress.setValue(progress.value()+1);
+            importTrkPt(stream, theDocument, theTracklayers[0], NULL);
+            progress.step();
         }
+        else
+            stream.skipCurrentElement();
+
         if (progress.wasCanceled())
             return;
     }
@@ -250,39 +322,42 @@ static void importGPX(const QDomElement& Root, Document* theDocument, QList<Trac
 
 bool importGPX(QWidget* aParent, QIODevice& File, Document* theDocument, QList<TrackLayer*>& theTracklayers, bool MakeSegment)
 {
-    // TODO remove debug messageboxes
-    QDomDocument DomDoc;
-    QString ErrorStr;
-    int ErrorLine;
-    int ErrorColumn;
-    if (!DomDoc.setContent(&File, true, &ErrorStr, &ErrorLine,&ErrorColumn))
-    {
-        File.close();
-        QMessageBox::warning(aParent,"Parse error",
-            QString("Parse error at line %1, column %2:\n%3")
-                                  .arg(ErrorLine)
-                                  .arg(ErrorColumn)
-                                  .arg(ErrorStr));
+    if (!File.isOpen() && !File.open(QIODevice::ReadOnly))
         return false;
-    }
-    QDomElement root = DomDoc.documentElement();
-    if (root.tagName() != "gpx")
+
+    QXmlStreamReader stream(&File);
+    if (!stream.readNextStartElement() || stream.name() != "gpx")
     {
-        QMessageBox::information(aParent, "Parse error","Root is not a gpx node");
+        if (stream.hasError())
+            QMessageBox::warning(aParent,"Parse error",
+                QString("Parse error at line %1, column %2:\n%3")
+                                      .arg(stream.lineNumber())
+                                      .arg(stream.columnNumber())
+                                      .arg(stream.errorString()));
+        else
+            QMessageBox::information(aParent, "Parse error","Root is not a gpx node");
         return false;
     }
 
-    QProgressDialog progress("Importing GPX...", "Cancel", 0, 0);
-    progress.setWindowModality(Qt::WindowModal);
-    progress.setMaximum(progress.maximum() + DomDoc.elementsByTagName("trkpt").count());
-    progress.setMaximum(progress.maximum() + DomDoc.elementsByTagName("wpt").count());
+    QProgressDialog dlg("Importing GPX...", "Cancel", 0, 0);
+    dlg.setWindowModality(Qt::WindowModal);
+    GpxProgress progress(dlg, File);
 
-    importGPX(root, theDocument, theTracklayers, MakeSegment, progress);
+    importGPX(stream, theDocument, theTracklayers, MakeSegment, progress);
 
-    progress.setValue(progress.maximum());
+    dlg.setValue(dlg.maximum());
     if (progress.wasCanceled())
         return false;
 
+    // What was read before the error has been kept, as the rest of the
+    // file may well be a truncated log
+    if (stream.hasError() && stream.error() != QXmlStreamReader::PrematureEndOfDocumentError)
+        QMessageBox::warning(aParent,"Parse error",
+            QString("Parse error at line %1, column %2:\n%3")
+                                  .arg(stream.lineNumber())
+                                  .arg(stream.columnNumber())
+                                  .arg(stream.errorString()));
+
     return true;
 }
 
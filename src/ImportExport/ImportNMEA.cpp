@@ -92,11 +92,8 @@ bool ImportNMEA::import(Layer* aLayer)
             }
         } else
         if (command == "RMC") {
-            if (goodFix && goodFix3D) {
-                TrackNode* p = importRMC(line);
-                if (p)
-                    TS->add(p);
-            }
+            if (goodFix && goodFix3D)
+                importRMC(line, TS);
         } else
         {/* Not handled */}
     }
@@ -181,18 +178,18 @@ bool ImportNMEA::importGLL (QString line)
     return true;
 }
 
-TrackNode* ImportNMEA::importRMC (QString line)
+bool ImportNMEA::importRMC (QString line, TrackSegment* TS)
 {
     if (line.count('$') > 1)
-        return NULL;
+        return false;
 
     QStringList tokens = line.split(",");
     if (tokens.size() < 10)
-        return NULL;
+        return false;
 
     //int time = tokens[1];
     if (tokens[2] != "A")
-        return NULL;
+        return false;
 
     qreal lat = tokens[3].left(2).toDouble();
     qreal latmin = tokens[3].mid(2).toDouble();
@@ -212,19 +209,14 @@ TrackNode* ImportNMEA::importRMC (QString line)
     if (!date.isValid()) date = QDateTime::fromString(strDate, "ddMMyyHHmmss.z");
     if (!date.isValid()) date = QDateTime::fromString(strDate, "ddMMyyHHmmss");
     if (!date.isValid()) {
-        return NULL;
+        return false;
     }
 
     if (date.date().year() < 1970)
         date = date.addYears(100);
     //date.setTimeSpec(Qt::UTC);
 
-    TrackNode* Pt = g_backend.allocTrackNode(theLayer, Coord(lon,lat));
-    theLayer->add(Pt);
-    Pt->setLastUpdated(Feature::Log);
-    Pt->setElevation(curAltitude);
-    Pt->setSpeed(speed);
-    Pt->setTime(date);
+    TS->addPoint(Coord(lon,lat), date.toTime_t(), curAltitude, speed);
 
-    return Pt;
+    return true;
 }
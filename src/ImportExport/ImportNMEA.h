@@ -36,7 +36,7 @@ private:
     bool importGSV (QString line);
     bool importGGA (QString line);
     bool importGLL (QString line);
-    TrackNode* importRMC (QString line);
+    bool importRMC (QString line, TrackSegment* TS);
 
     qreal curAltitude;
 
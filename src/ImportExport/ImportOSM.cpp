@@ -443,65 +443,11 @@ static bool deleteIncompleteRelations(QWidget* /*aParent*/, Document* /*theDocum
     return true;
 }
 
-bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer* theLayer, Downloader* theDownloader)
+bool finishImportOSM(QWidget* aParent, Document* theDocument, Layer* theLayer, Layer* conflictLayer, Downloader* theDownloader,
+                     const QSet<Way*>& touchedWays, const QSet<Relation*>& touchedRelations, bool WasCanceled)
 {
-    QDomDocument DomDoc;
-    QString ErrorStr;
-    /* int ErrorLine; */
-    /* int ErrorColumn; */
-
-    QProgressDialog* dlg = NULL;
-    QProgressBar* Bar = NULL;
-    QLabel* Lbl = NULL;
-    IProgressWindow* aProgressWindow = dynamic_cast<IProgressWindow*>(aParent);
-    if (aProgressWindow) {
-        dlg = aProgressWindow->getProgressDialog();
-        if (dlg) {
-            dlg->setWindowTitle(QApplication::translate("Downloader", "Parsing..."));
-
-            Bar = aProgressWindow->getProgressBar();
-            Bar->setTextVisible(false);
-
-            Lbl = aProgressWindow->getProgressLabel();
-            Lbl->setText(QApplication::translate("Downloader","Parsing XML"));
-
-            dlg->show();
-        }
-    }
-
-    if (theDownloader)
-        theDownloader->setAnimator(dlg,Lbl,Bar,false);
-    Layer* conflictLayer = new DrawingLayer(QApplication::translate("Downloader","Conflicts from %1").arg(theLayer->name()));
-    theDocument->add(conflictLayer);
-
-    OSMHandler theHandler(theDocument,theLayer,conflictLayer);
-
-    QXmlSimpleReader xmlReader;
-    xmlReader.setContentHandler(&theHandler);
-    QXmlInputSource source;
-    QByteArray buf(File.read(10240));
-    source.setData(buf);
-    xmlReader.parse(&source,true);
-    if (Bar) {
-        Bar->setMaximum(File.size());
-        Bar->setValue(Bar->value()+buf.size());
-    }
-
-    while (!File.atEnd())
-    {
-        QByteArray buf(File.read(20480));
-        source.setData(buf);
-        xmlReader.parseContinue();
-        if (Bar)
-            Bar->setValue(Bar->value()+buf.size());
-        qApp->processEvents();
-        if (dlg && dlg->wasCanceled())
-            break;
-    }
-
-    bool WasCanceled = false;
-    if (dlg)
-        WasCanceled = dlg->wasCanceled();
+    // The downloaded features were merged without going through the history
+    theDocument->changedOutsideHistory();
     if (!WasCanceled && M_PREFS->getResolveRelations())
         WasCanceled = !resolveNotYetDownloaded(aParent,theDocument,theLayer,theDownloader);
     if (!WasCanceled && M_PREFS->getDeleteIncompleteRelations())
@@ -521,7 +467,7 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
 //                Bar->setMaximum(theHandler.touchedWays.size());
 //                Bar->setValue(0);
 //            }
-//            foreach (Way* w, theHandler.touchedWays) {
+//            foreach (Way* w, touchedWays) {
 //                w->updateVirtuals();
 //                if (Bar)
 //                    Bar->setValue(Bar->value()+1);
@@ -531,11 +477,11 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
 
         // Check for empty Roads/Relations and update virtual nodes
         QList<Feature*> EmptyFeature;
-        foreach (Way* w, theHandler.touchedWays) {
+        foreach (Way* w, touchedWays) {
             if (!w->size())
                 EmptyFeature.push_back(w);
         }
-        foreach (Relation* r, theHandler.touchedRelations) {
+        foreach (Relation* r, touchedRelations) {
             if (!r->size())
                 EmptyFeature.push_back(r);
         }
@@ -576,6 +522,70 @@ bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer*
     return true;
 }
 
+bool importOSM(QWidget* aParent, QIODevice& File, Document* theDocument, Layer* theLayer, Downloader* theDownloader)
+{
+    QDomDocument DomDoc;
+    QString ErrorStr;
+    /* int ErrorLine; */
+    /* int ErrorColumn; */
+
+    QProgressDialog* dlg = NULL;
+    QProgressBar* Bar = NULL;
+    QLabel* Lbl = NULL;
+    IProgressWindow* aProgressWindow = dynamic_cast<IProgressWindow*>(aParent);
+    if (aProgressWindow) {
+        dlg = aProgressWindow->getProgressDialog();
+        if (dlg) {
+            dlg->setWindowTitle(QApplication::translate("Downloader", "Parsing..."));
+
+            Bar = aProgressWindow->getProgressBar();
+            Bar->setTextVisible(false);
+
+            Lbl = aProgressWindow->getProgressLabel();
+            Lbl->setText(QApplication::translate("Downloader","Parsing XML"));
+
+            dlg->show();
+        }
+    }
+
+    if (theDownloader)
+        theDownloader->setAnimator(dlg,Lbl,Bar,false);
+    Layer* conflictLayer = new DrawingLayer(QApplication::translate("Downloader","Conflicts from %1").arg(theLayer->name()));
+    theDocument->add(conflictLayer);
+
+    OSMHandler theHandler(theDocument,theLayer,conflictLayer);
+
+    QXmlSimpleReader xmlReader;
+    xmlReader.setContentHandler(&theHandler);
+    QXmlInputSource source;
+    QByteArray buf(File.read(10240));
+    source.setData(buf);
+    xmlReader.parse(&source,true);
+    if (Bar) {
+        Bar->setMaximum(File.size());
+        Bar->setValue(Bar->value()+buf.size());
+    }
+
+    while (!File.atEnd())
+    {
+        QByteArray buf(File.read(20480));
+        source.setData(buf);
+        xmlReader.parseContinue();
+        if (Bar)
+            Bar->setValue(Bar->value()+buf.size());
+        qApp->processEvents();
+        if (dlg && dlg->wasCanceled())
+            break;
+    }
+
+    bool WasCanceled = false;
+    if (dlg)
+        WasCanceled = dlg->wasCanceled();
+
+    return finishImportOSM(aParent, theDocument, theLayer, conflictLayer, theDownloader,
+                           theHandler.touchedWays, theHandler.touchedRelations, WasCanceled);
+}
+
 bool importOSM(QWidget* aParent, const QString& aFilename, Document* theDocument, Layer* theLayer)
 {
     QFile File(aFilename);
@@ -44,6 +44,10 @@ public:
 };
 
 bool importOSM(QWidget* aParent, const QString& aFilename, Document* theDocument, Layer* theLayer);
+/// Post-parse step shared by all OSM imports: resolves/deletes incomplete
+/// relations, offers to remove empty features and reports conflicts.
+bool finishImportOSM(QWidget* aParent, Document* theDocument, Layer* theLayer, Layer* conflictLayer, Downloader* theDownloader,
+                     const QSet<Way*>& touchedWays, const QSet<Relation*>& touchedRelations, bool WasCanceled);
 bool importOSM(QWidget* aParent, QByteArray& Content, Document* theDocument, Layer* theLayer, Downloader* theDownloader);
 
 #endif
@@ -7,6 +7,7 @@
 #include "Node.h"
 #include "PropertiesDock.h"
 #include "Utils.h"
+#include "SnapIndex.h"
 #include "Global.h"
 
 #include "EditInteraction.h"
@@ -220,73 +221,84 @@ void FeatureSnapInteraction::updateSnap(QMouseEvent* event)
 
     /* Beware: Prev shall not be dereferenced after clearLastSnap! */
     Feature* Prev = lastSnap();
+    TrackSegment* PrevSegment = LastSnapSegment;
+    int PrevPoint = LastSnapPoint;
     clearLastSnap();
 
     Feature* ReadOnlySnap = 0;
     if (!SnapActive) return;
     //QTime Start(QTime::currentTime());
-    CoordBox HotZone(XY_TO_COORD(event->pos()-QPoint(M_PREFS->getMaxGeoPicWidth()+5,M_PREFS->getMaxGeoPicWidth()+5)),XY_TO_COORD(event->pos()+QPoint(M_PREFS->getMaxGeoPicWidth()+5,M_PREFS->getMaxGeoPicWidth()+5)));
     CoordBox HotZoneSnap(XY_TO_COORD(event->pos()-QPoint(15,15)),XY_TO_COORD(event->pos()+QPoint(15,15)));
     SnapList.clear();
     qreal BestDistance = 5;
     qreal BestReadonlyDistance = 5;
     bool areNodesSelectable = (/*theMain->view()->nodeWidth() >= 1 && */M_PREFS->getTrackPointsVisible());
 
+    /* Only the few features of the screen cells around the mouse are tested */
+    QList < Feature* > ret = view()->snapIndex()->find(QRect(event->pos()-QPoint(15,15), event->pos()+QPoint(15,15)));
     Way* R;
     Node* N;
-    for (int j=0; j<document()->layerSize(); ++j) {
-        QList < Feature* > ret = g_backend.indexFind(document()->getLayer(j), HotZone);
-        foreach(Feature* F, ret) {
-            if (F)
-            {
-                if (F->isHidden())
-                    continue;
-                if (NoSnap.contains(F))
-                    continue;
-                if (F->notEverythingDownloaded())
-                    continue;
-                if ((R = CAST_WAY(F))) {
-                    if ( NoRoads || NoSelectRoads)
-                        continue;
-
-                    if (HotZoneSnap.contains(R->boundingBox()))
+    foreach(Feature* F, ret) {
+        if (F->isHidden())
+            continue;
+        if (NoSnap.contains(F))
+            continue;
+        if (F->notEverythingDownloaded())
+            continue;
+        if (CHECK_SEGMENT(F)) {
+            // Track points without a node of their own are snapped to by index
+            TrackSegment* S = STATIC_CAST_SEGMENT(F);
+            if (NoSelectPoints || !areNodesSelectable || !S->arePointsSelectable(view()->pixelPerM(), view()->renderOptions()))
+                continue;
+            int idx = S->pointNear(event->pos(), BestDistance, view());
+            if (idx == -1 || S->isMaterialised(idx))
+                continue;
+            BestDistance = QLineF(event->pos(), view()->toView(S->pointPosition(idx))).length();
+            setLastSnapPoint(S, idx);
+            continue;
+        }
+        if (CHECK_WAY(F)) {
+            R = STATIC_CAST_WAY(F);
+            if ( NoRoads || NoSelectRoads)
+                continue;
+
+            if (HotZoneSnap.contains(R->boundingBox()))
+                SnapList.push_back(F);
+            else {
+                QPointF lastPoint = R->getNode(0)->position();
+                QPointF aP;
+                for (int j=1; j<R->size(); ++j) {
+                    aP = R->getNode(j)->position();
+                    QLineF l(lastPoint, aP);
+                    QPointF a, b;
+                    if (Utils::QRectInterstects(HotZoneSnap, l, a, b)) {
                         SnapList.push_back(F);
-                    else {
-                        QPointF lastPoint = R->getNode(0)->position();
-                        QPointF aP;
-                        for (int j=1; j<R->size(); ++j) {
-                            aP = R->getNode(j)->position();
-                            QLineF l(lastPoint, aP);
-                            QPointF a, b;
-                            if (Utils::QRectInterstects(HotZoneSnap, l, a, b)) {
-                                SnapList.push_back(F);
-                                break;
-                            }
-                            lastPoint = aP;
-                        }
+                        break;
                     }
-                }
-                if ((N = CAST_NODE(F))) {
-                    if (NoSelectPoints)
-                        continue;
-                    if (!N->isSelectable(theMain->view()->pixelPerM(), theMain->view()->renderOptions()))
-                        continue;
-                    if (HotZoneSnap.contains(N->boundingBox()))
-                        SnapList.push_back(F);
-                }
-
-                qreal Distance = F->pixelDistance(event->pos(), CLEAR_DISTANCE, NoSnap, view());
-                if (Distance < BestDistance && !F->isReadonly())
-                {
-                    BestDistance = Distance;
-                    setLastSnap( F );
-                } else if (Distance < BestReadonlyDistance && F->isReadonly())
-                {
-                    BestReadonlyDistance = Distance;
-                    ReadOnlySnap = F;
+                    lastPoint = aP;
                 }
             }
         }
+        if (CHECK_NODE(F)) {
+            N = STATIC_CAST_NODE(F);
+            if (NoSelectPoints)
+                continue;
+            if (!N->isSelectable(theMain->view()->pixelPerM(), theMain->view()->renderOptions()))
+                continue;
+            if (HotZoneSnap.contains(N->boundingBox()))
+                SnapList.push_back(F);
+        }
+
+        qreal Distance = F->pixelDistance(event->pos(), CLEAR_DISTANCE, NoSnap, view());
+        if (Distance < BestDistance && !F->isReadonly())
+        {
+            BestDistance = Distance;
+            setLastSnap( F );
+        } else if (Distance < BestReadonlyDistance && F->isReadonly())
+        {
+            BestReadonlyDistance = Distance;
+            ReadOnlySnap = F;
+        }
     }
     if (areNodesSelectable) {
         R = CAST_WAY(lastSnap());
@@ -297,25 +309,22 @@ void FeatureSnapInteraction::updateSnap(QMouseEvent* event)
         }
     }
 
-    if (Prev != lastSnap()) {
+    if (Prev != lastSnap() || PrevSegment != LastSnapSegment || PrevPoint != LastSnapPoint) {
         curStackSnap = SnapList.indexOf(lastSnap());
         view()->update();
     }
 
-    if (M_PREFS->getMapTooltip()) {
-        if (lastSnap())
-            view()->setToolTip(lastSnap()->toHtml());
-        else
-            view()->setToolTip("");
-    }
-    if (M_PREFS->getInfoOnHover() && main() && theMain->info() && theMain->info()->isVisible()) {
-        if (lastSnap()) {
-            theMain->info()->setHoverHtml(lastSnap()->toHtml());
-        } else
-            if (ReadOnlySnap)
-                theMain->info()->setHoverHtml(ReadOnlySnap->toHtml());
+    /* The tooltip html is built on demand by the view. The info dock only
+       follows when the hovered feature changes. */
+    Feature* Hover = lastSnap() ? lastSnap() : ReadOnlySnap;
+    if (Hover != LastHover) {
+        LastHover = Hover;
+        if (M_PREFS->getInfoOnHover() && main() && theMain->info() && theMain->info()->isVisible()) {
+            if (Hover)
+                theMain->info()->setHoverHtml(Hover->toHtml());
             else
                 theMain->info()->unsetHoverHtml();
+        }
     }
 
     emit featureSnap(lastSnap());
@@ -325,7 +334,7 @@ void FeatureSnapInteraction::updateSnap(QMouseEvent* event)
 /***************/
 
 FeatureSnapInteraction::FeatureSnapInteraction(MainWindow* aMain)
-        : Interaction(aMain), LastSnap(0)
+        : Interaction(aMain), LastSnap(0), LastSnapSegment(0), LastSnapPoint(-1), LastHover(0)
 {
 //    handCursor = QCursor(QPixmap(":/Icons/grab.png"));
 //    grabCursor = QCursor(QPixmap(":/Icons/grabbing.png"));
@@ -358,17 +367,19 @@ void FeatureSnapInteraction::paintEvent(QPaintEvent* anEvent, QPainter& thePaint
         theMain->properties()->highlighted(i)->drawHighlight(thePainter, view());
     }
 
-    if (lastSnap()) {
+    if (lastSnap())
         lastSnap()->drawHover(thePainter, view());
-        view()->setToolTip(lastSnap()->toHtml());
-    } else {
-        view()->setToolTip("");
-    }
+    else if (LastSnapSegment)
+        LastSnapSegment->drawPointHover(thePainter, view(), LastSnapPoint);
 #endif
 }
 
 void FeatureSnapInteraction::mousePressEvent(QMouseEvent * event)
 {
+    // A clicked track point becomes a feature that can be selected and edited
+    if (event->button() == Qt::LeftButton && LastSnapSegment && LastSnapPoint < LastSnapSegment->size())
+        setLastSnap(LastSnapSegment->getNode(LastSnapPoint));
+
     if (event->button() == Qt::LeftButton)
         snapMousePressEvent(event,lastSnap());
     if (!(M_PREFS->getMouseSingleButton() && lastSnap()))
@@ -454,16 +465,28 @@ void FeatureSnapInteraction::clearSnap()
 
 void FeatureSnapInteraction::clearLastSnap()
 {
-    if (LastSnap) {
+    if (LastSnap || LastSnapSegment) {
         LastSnap = 0;
+        LastSnapSegment = 0;
+        LastSnapPoint = -1;
         g_backend.resumeDeletes();
     }
 }
 
 void FeatureSnapInteraction::setLastSnap(Feature *f)
 {
-    if (!LastSnap) g_backend.delayDeletes();
+    if (!LastSnap && !LastSnapSegment) g_backend.delayDeletes();
     LastSnap = f;
+    LastSnapSegment = 0;
+    LastSnapPoint = -1;
+}
+
+void FeatureSnapInteraction::setLastSnapPoint(TrackSegment* S, int idx)
+{
+    if (!LastSnap && !LastSnapSegment) g_backend.delayDeletes();
+    LastSnap = 0;
+    LastSnapSegment = S;
+    LastSnapPoint = idx;
 }
 
 Feature* FeatureSnapInteraction::lastSnap()
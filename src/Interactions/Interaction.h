@@ -110,6 +110,9 @@ public:
     void updateSnap(QMouseEvent* event);
 
     void setLastSnap(Feature *f);
+    /// Snaps to a track point that has no TrackNode; the node is only
+    /// created when the point is clicked
+    void setLastSnapPoint(TrackSegment* S, int idx);
     void clearLastSnap();
     Feature* lastSnap();
 
@@ -123,6 +126,11 @@ public:
 protected:
     Feature* LastSnap;
 private:
+    /* Hovered track point without a TrackNode, set instead of LastSnap */
+    TrackSegment* LastSnapSegment;
+    int LastSnapPoint;
+    /* Feature shown in the info dock, only compared, never dereferenced */
+    Feature* LastHover;
     QCursor handCursor;
     QCursor grabCursor;
     QCursor defaultCursor;
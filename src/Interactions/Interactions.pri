@@ -10,6 +10,7 @@ HEADERS += \
     CreateSingleWayInteraction.h \
     EditInteraction.h \
     Interaction.h \
+    SnapIndex.h \
     MoveNodeInteraction.h \
     RotateInteraction.h \
     ScaleInteraction.h \
@@ -26,6 +27,7 @@ SOURCES += \
     CreatePolygonInteraction.cpp \
     EditInteraction.cpp \
     Interaction.cpp \
+    SnapIndex.cpp \
     MoveNodeInteraction.cpp \
     RotateInteraction.cpp \
     ScaleInteraction.cpp \
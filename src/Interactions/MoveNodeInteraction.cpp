@@ -159,27 +159,18 @@ void MoveNodeInteraction::snapMouseReleaseEvent(QMouseEvent * event, Feature* Cl
                 theList->setFeature(Moving[0]);
             }
         }
-        QSet<Way*> WaysToUpdate;
-        for (int i=0; i<Moving.size(); ++i)
         {
-            Moving[i]->setPosition(OriginalPosition[i]);
-            if (Moving[i]->layer()->isTrack())
-                theList->add(new MoveNodeCommand(Moving[i],OriginalPosition[i]+Diff, Moving[i]->layer()));
-            else
-                theList->add(new MoveNodeCommand(Moving[i],OriginalPosition[i]+Diff, document()->getDirtyOrOriginLayer(Moving[i]->layer())));
-            for (int j=0; j<Moving[i]->sizeParents(); ++j) {
-                if (Way* aRoad = CAST_WAY(Moving[i]->getParent(j)))
-                    WaysToUpdate << aRoad;
-                else {
-                    Feature* f = CAST_FEATURE(Moving[i]->getParent(j));
-                    if (f)
-                        g_backend.sync(f);
-                }
+            // The parents of the moved nodes are re-indexed once, on commit
+            EditTransaction transaction(document());
+            for (int i=0; i<Moving.size(); ++i)
+            {
+                Moving[i]->setPosition(OriginalPosition[i]);
+                if (Moving[i]->layer()->isTrack())
+                    theList->add(new MoveNodeCommand(Moving[i],OriginalPosition[i]+Diff, Moving[i]->layer()));
+                else
+                    theList->add(new MoveNodeCommand(Moving[i],OriginalPosition[i]+Diff, document()->getDirtyOrOriginLayer(Moving[i]->layer())));
             }
         }
-        foreach (Way* w, WaysToUpdate) {
-            g_backend.sync(w);
-        }
 
         // If moving a single node (not a track node), see if it got dropped onto another node
         if (Moving.size() == 1 && !Moving[0]->layer()->isTrack())
@@ -253,29 +244,32 @@ void MoveNodeInteraction::snapMouseMoveEvent(QMouseEvent* event, Feature* Closer
         HasMoved = true;
         view()->setInteracting(true);
         Coord Diff = calculateNewPosition(event,Closer,NULL)-StartDragPosition;
-        for (int i=0; i<Moving.size(); ++i) {
-            if (Moving[i]->isVirtual()) {
-                Virtual = true;
-                Node* v = Moving[i];
-                Way* aRoad = CAST_WAY(v->getParent(0));
-                theList->setDescription(MainWindow::tr("Create node in Road: %1").arg(aRoad->id().numId));
-                theList->setFeature(aRoad);
-                int SnapIdx = aRoad->findVirtual(v)+1;
-                Node* N = g_backend.allocNode(main()->document()->getDirtyOrOriginLayer(aRoad->layer()), *v);
-                N->setVirtual(false);
-                N->setPosition(OriginalPosition[i]+Diff);
+        {
+            EditTransaction transaction(document());
+            for (int i=0; i<Moving.size(); ++i) {
+                if (Moving[i]->isVirtual()) {
+                    Virtual = true;
+                    Node* v = Moving[i];
+                    Way* aRoad = CAST_WAY(v->getParent(0));
+                    theList->setDescription(MainWindow::tr("Create node in Road: %1").arg(aRoad->id().numId));
+                    theList->setFeature(aRoad);
+                    int SnapIdx = aRoad->findVirtual(v)+1;
+                    Node* N = g_backend.allocNode(main()->document()->getDirtyOrOriginLayer(aRoad->layer()), *v);
+                    N->setVirtual(false);
+                    N->setPosition(OriginalPosition[i]+Diff);
 
-                if (theMain->properties()->isSelected(v)) {
-                    theMain->properties()->toggleSelection(v);
-                    theMain->properties()->toggleSelection(N);
-                }
-                theList->add(new AddFeatureCommand(main()->document()->getDirtyOrOriginLayer(aRoad->layer()),N,true));
-                theList->add(new WayAddNodeCommand(aRoad,N,SnapIdx,main()->document()->getDirtyOrOriginLayer(aRoad->layer())));
+                    if (theMain->properties()->isSelected(v)) {
+                        theMain->properties()->toggleSelection(v);
+                        theMain->properties()->toggleSelection(N);
+                    }
+                    theList->add(new AddFeatureCommand(main()->document()->getDirtyOrOriginLayer(aRoad->layer()),N,true));
+                    theList->add(new WayAddNodeCommand(aRoad,N,SnapIdx,main()->document()->getDirtyOrOriginLayer(aRoad->layer())));
 
-                Moving[i] = N;
-                LastSnap = N;
-            } else {
-                Moving[i]->setPosition(OriginalPosition[i]+Diff);
+                    Moving[i] = N;
+                    LastSnap = N;
+                } else {
+                    Moving[i]->setPosition(OriginalPosition[i]+Diff);
+                }
             }
         }
         view()->invalidate(true, true, false);
@@ -137,15 +137,18 @@ void RotateInteraction::snapMouseReleaseEvent(QMouseEvent * anEvent, Feature* /*
     {
         CommandList* theList;
         theList = new CommandList(MainWindow::tr("Rotate Feature").arg(Rotating[0]->id().numId), Rotating[0]);
-        for (int i=0; i<Rotating.size(); ++i)
         {
-            if (NodeOrigin && Rotating[i] == OriginNode)
-                continue;
-            Rotating[i]->setPosition(OriginalPosition[i]);
-            if (Rotating[i]->layer()->isTrack())
-                theList->add(new MoveNodeCommand(Rotating[i],rotatePosition(OriginalPosition[i], Angle), Rotating[i]->layer()));
-            else
-                theList->add(new MoveNodeCommand(Rotating[i],rotatePosition(OriginalPosition[i], Angle), document()->getDirtyOrOriginLayer(Rotating[i]->layer())));
+            EditTransaction transaction(document());
+            for (int i=0; i<Rotating.size(); ++i)
+            {
+                if (NodeOrigin && Rotating[i] == OriginNode)
+                    continue;
+                Rotating[i]->setPosition(OriginalPosition[i]);
+                if (Rotating[i]->layer()->isTrack())
+                    theList->add(new MoveNodeCommand(Rotating[i],rotatePosition(OriginalPosition[i], Angle), Rotating[i]->layer()));
+                else
+                    theList->add(new MoveNodeCommand(Rotating[i],rotatePosition(OriginalPosition[i], Angle), document()->getDirtyOrOriginLayer(Rotating[i]->layer())));
+            }
         }
 
 
@@ -164,10 +167,13 @@ void RotateInteraction::snapMouseMoveEvent(QMouseEvent* anEvent, Feature* /*Clos
     if (Rotating.size() && !panning())
     {
         Angle = calculateNewAngle(anEvent);
-        for (int i=0; i<Rotating.size(); ++i) {
-            if (NodeOrigin && Rotating[i] == OriginNode)
-                continue;
-            Rotating[i]->setPosition(rotatePosition(OriginalPosition[i], Angle));
+        {
+            EditTransaction transaction(document());
+            for (int i=0; i<Rotating.size(); ++i) {
+                if (NodeOrigin && Rotating[i] == OriginNode)
+                    continue;
+                Rotating[i]->setPosition(rotatePosition(OriginalPosition[i], Angle));
+            }
         }
         view()->invalidate(true, true, false);
     }
@@ -137,15 +137,18 @@ void ScaleInteraction::snapMouseReleaseEvent(QMouseEvent * anEvent, Feature* /*C
     {
         CommandList* theList;
         theList = new CommandList(MainWindow::tr("Scale Feature").arg(Scaling[0]->id().numId), Scaling[0]);
-        for (int i=0; i<Scaling.size(); ++i)
         {
-            if (NodeOrigin && Scaling[i] == OriginNode)
-                continue;
-            Scaling[i]->setPosition(OriginalPosition[i]);
-            if (Scaling[i]->layer()->isTrack())
-                theList->add(new MoveNodeCommand(Scaling[i],scalePosition(OriginalPosition[i], Radius), Scaling[i]->layer()));
-            else
-                theList->add(new MoveNodeCommand(Scaling[i],scalePosition(OriginalPosition[i], Radius), document()->getDirtyOrOriginLayer(Scaling[i]->layer())));
+            EditTransaction transaction(document());
+            for (int i=0; i<Scaling.size(); ++i)
+            {
+                if (NodeOrigin && Scaling[i] == OriginNode)
+                    continue;
+                Scaling[i]->setPosition(OriginalPosition[i]);
+                if (Scaling[i]->layer()->isTrack())
+                    theList->add(new MoveNodeCommand(Scaling[i],scalePosition(OriginalPosition[i], Radius), Scaling[i]->layer()));
+                else
+                    theList->add(new MoveNodeCommand(Scaling[i],scalePosition(OriginalPosition[i], Radius), document()->getDirtyOrOriginLayer(Scaling[i]->layer())));
+            }
         }
 
 
@@ -164,10 +167,13 @@ void ScaleInteraction::snapMouseMoveEvent(QMouseEvent* anEvent, Feature* /*Close
     if (Scaling.size() && !panning())
     {
         Radius = distance(ScaleCenter,anEvent->pos()) / distance(ScaleCenter, COORD_TO_XY(StartDragPosition));
-        for (int i=0; i<Scaling.size(); ++i) {
-            if (NodeOrigin && Scaling[i] == OriginNode)
-                continue;
-            Scaling[i]->setPosition(scalePosition(OriginalPosition[i], Radius));
+        {
+            EditTransaction transaction(document());
+            for (int i=0; i<Scaling.size(); ++i) {
+                if (NodeOrigin && Scaling[i] == OriginNode)
+                    continue;
+                Scaling[i]->setPosition(scalePosition(OriginalPosition[i], Radius));
+            }
         }
         view()->invalidate(true, true, false);
     }
@@ -0,0 +1,241 @@
+#include "SnapIndex.h"
+
+#include "MapView.h"
+#include "Document.h"
+#include "Layer.h"
+#include "Features.h"
+#include "MemoryBackend.h"
+#include "MerkaartorPreferences.h"
+
+#include <QLineF>
+#include <QtCore/qmath.h>
+
+#include <algorithm>
+
+#define CELL_SIZE 32
+#define SAMPLE_STEP (CELL_SIZE/2)
+
+static inline quint32 cellKey(int cx, int cy)
+{
+    return (quint32(quint16(cx)) << 16) | quint32(quint16(cy));
+}
+
+static inline int cellOf(int v)
+{
+    return v >= 0 ? v / CELL_SIZE : (v - CELL_SIZE + 1) / CELL_SIZE;
+}
+
+/* Liang-Barsky clipping of the segment a-b to r */
+static bool clipLine(const QRectF& r, QPointF& a, QPointF& b)
+{
+    qreal t0 = 0., t1 = 1.;
+    qreal dx = b.x() - a.x(), dy = b.y() - a.y();
+    qreal P[4] = { -dx, dx, -dy, dy };
+    qreal Q[4] = { a.x() - r.left(), r.right() - a.x(), a.y() - r.top(), r.bottom() - a.y() };
+
+    for (int i=0; i<4; ++i) {
+        if (P[i] == 0.) {
+            if (Q[i] < 0.)
+                return false;
+            continue;
+        }
+        qreal t = Q[i] / P[i];
+        if (P[i] < 0.) {
+            if (t > t1)
+                return false;
+            if (t > t0)
+                t0 = t;
+        } else {
+            if (t < t0)
+                return false;
+            if (t < t1)
+                t1 = t;
+        }
+    }
+    QPointF o(a);
+    a = o + t0*QPointF(dx, dy);
+    b = o + t1*QPointF(dx, dy);
+    return true;
+}
+
+SnapIndex::SnapIndex(MapView* aView)
+    : theView(aView), UpToDate(false), BuiltDocument(0), BuiltMark(0)
+{
+}
+
+SnapIndex::~SnapIndex()
+{
+}
+
+void SnapIndex::invalidate()
+{
+    UpToDate = false;
+}
+
+QList<Feature*> SnapIndex::find(const QRect& aRect)
+{
+    update();
+
+    QList<Feature*> theResult;
+    QSet<Feature*> Seen;
+    for (int cx=cellOf(aRect.left()); cx<=cellOf(aRect.right()); ++cx)
+        for (int cy=cellOf(aRect.top()); cy<=cellOf(aRect.bottom()); ++cy) {
+            QHash<quint32, QList<Feature*> >::const_iterator it = Cells.constFind(cellKey(cx, cy));
+            if (it == Cells.constEnd())
+                continue;
+            foreach (Feature* F, it.value())
+                if (!Seen.contains(F)) {
+                    Seen.insert(F);
+                    theResult.append(F);
+                }
+        }
+    return theResult;
+}
+
+void SnapIndex::update()
+{
+    Document* theDocument = theView->document();
+    QList<ILayer*> theLayers;
+    if (theDocument)
+        for (int i=0; i<theDocument->layerSize(); ++i)
+            theLayers << theDocument->getLayer(i);
+
+    if (!UpToDate || theDocument != BuiltDocument || theLayers != BuiltLayers
+            || theView->rect() != BuiltRect || theView->transform() != BuiltTransform) {
+        BuiltDocument = theDocument;
+        BuiltLayers = theLayers;
+        build();
+        return;
+    }
+
+    QList<Feature*> Changed;
+    if (!g_backend.changesSince(BuiltMark, Changed) || Changed.size() > FeatureCells.size() + 1024) {
+        build();
+        return;
+    }
+    foreach (Feature* F, Changed) {
+        remove(F);
+        // Deallocated features may already be gone, don't touch them
+        if (g_backend.isAllocated(F) && g_backend.isIndexable(F) && BuiltLayerSet.contains(F->layer()))
+            insert(F);
+    }
+    BuiltMark = g_backend.changeMark();
+}
+
+void SnapIndex::build()
+{
+    Cells.clear();
+    FeatureCells.clear();
+
+    BuiltRect = theView->rect();
+    BuiltTransform = theView->transform();
+    BuiltLayerSet = BuiltLayers.toSet();
+    BuiltMark = g_backend.changeMark();
+    UpToDate = true;
+
+    // Photos are snapped on their thumbnail, which lies next to the node
+    int Pad = M_PREFS->getMaxGeoPicWidth() + 10 + Margin;
+    BuiltArea = BuiltRect.adjusted(-Pad, -Pad, Pad, Pad);
+
+    CoordBox HotZone(theView->fromView(BuiltArea.topLeft()), theView->fromView(BuiltArea.bottomRight()));
+    HotZone.merge(theView->fromView(BuiltArea.topRight()));
+    HotZone.merge(theView->fromView(BuiltArea.bottomLeft()));
+
+    foreach (ILayer* L, BuiltLayers) {
+        QList<Feature*> ret = g_backend.indexFind(L, HotZone);
+        foreach (Feature* F, ret)
+            if (F)
+                insert(F);
+    }
+}
+
+void SnapIndex::insert(Feature* F)
+{
+    QVector<quint32> theCells;
+
+    if (CHECK_WAY(F)) {
+        Way* R = STATIC_CAST_WAY(F);
+        if (!R->size())
+            return;
+        QPointF last = theView->toView(R->getNode(0));
+        addArea(theCells, QRect(last.toPoint(), QSize(1, 1)));
+        for (int i=1; i<R->size(); ++i) {
+            QPointF cur = theView->toView(R->getNode(i));
+            addLine(theCells, last, cur);
+            last = cur;
+        }
+    } else if (CHECK_NODE(F)) {
+        QPoint me = theView->toView(STATIC_CAST_NODE(F));
+        int Pad = Margin;
+        if (dynamic_cast<PhotoNode*>(F))
+            Pad += M_PREFS->getMaxGeoPicWidth() + 10;
+        addArea(theCells, QRect(me, QSize(1, 1)).adjusted(-Pad, -Pad, Pad, Pad));
+    } else if (CHECK_SEGMENT(F)) {
+        // Track points are found through the point blocks of their segment
+        const QVector<CoordBox> theBlocks = STATIC_CAST_SEGMENT(F)->blockBoxes();
+        foreach (const CoordBox& bb, theBlocks) {
+            QRect r = QRectF(theView->toView(bb.topLeft()), theView->toView(bb.bottomRight())).normalized().toAlignedRect();
+            addArea(theCells, r.adjusted(-Margin, -Margin, Margin, Margin));
+        }
+    } else if (CHECK_RELATION(F)) {
+        // Relations are snapped on the outline of their bounding box
+        CoordBox bb = F->boundingBox();
+        QPointF tl = theView->toView(bb.topLeft()), tr = theView->toView(bb.topRight());
+        QPointF bl = theView->toView(bb.bottomLeft()), br = theView->toView(bb.bottomRight());
+        addLine(theCells, tl, tr);
+        addLine(theCells, tr, br);
+        addLine(theCells, br, bl);
+        addLine(theCells, bl, tl);
+    } else
+        return;
+
+    if (theCells.isEmpty())
+        return;
+
+    std::sort(theCells.begin(), theCells.end());
+    theCells.erase(std::unique(theCells.begin(), theCells.end()), theCells.end());
+    foreach (quint32 k, theCells)
+        Cells[k].append(F);
+    FeatureCells[F] = theCells;
+}
+
+void SnapIndex::remove(Feature* F)
+{
+    QHash<Feature*, QVector<quint32> >::iterator it = FeatureCells.find(F);
+    if (it == FeatureCells.end())
+        return;
+    foreach (quint32 k, it.value()) {
+        QHash<quint32, QList<Feature*> >::iterator c = Cells.find(k);
+        if (c == Cells.end())
+            continue;
+        c.value().removeOne(F);
+        if (c.value().isEmpty())
+            Cells.erase(c);
+    }
+    FeatureCells.erase(it);
+}
+
+void SnapIndex::addArea(QVector<quint32>& cells, const QRect& r)
+{
+    QRect a = r.intersected(BuiltArea);
+    if (a.isEmpty())
+        return;
+    for (int cx=cellOf(a.left()); cx<=cellOf(a.right()); ++cx)
+        for (int cy=cellOf(a.top()); cy<=cellOf(a.bottom()); ++cy)
+            cells.append(cellKey(cx, cy));
+}
+
+void SnapIndex::addLine(QVector<quint32>& cells, QPointF a, QPointF b)
+{
+    if (!clipLine(BuiltArea, a, b))
+        return;
+
+    // Every point of the segment is within SAMPLE_STEP/2 of a sample
+    int Pad = Margin + SAMPLE_STEP/2 + 1;
+    QPointF d = b - a;
+    int Steps = qMax(1, qCeil(QLineF(a, b).length() / SAMPLE_STEP));
+    for (int i=0; i<=Steps; ++i) {
+        QPoint s = (a + d * (qreal(i) / Steps)).toPoint();
+        addArea(cells, QRect(s, QSize(1, 1)).adjusted(-Pad, -Pad, Pad, Pad));
+    }
+}
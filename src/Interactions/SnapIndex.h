@@ -0,0 +1,57 @@
+#ifndef MERKAARTOR_SNAPINDEX_H_
+#define MERKAARTOR_SNAPINDEX_H_
+
+#include <QHash>
+#include <QList>
+#include <QRect>
+#include <QSet>
+#include <QTransform>
+#include <QVector>
+
+class MapView;
+class Document;
+class Feature;
+class ILayer;
+
+/// Screen-space grid over the features of the view, used to find the snap
+/// candidates under the mouse without walking the backend index on every move.
+/// The grid is rebuilt when the view transform, size or document layers change,
+/// and otherwise catches up with the backend change log.
+class SnapIndex
+{
+    public:
+        SnapIndex(MapView* aView);
+        ~SnapIndex();
+
+        /// Candidates whose screen geometry may come within Margin pixels of
+        /// any point of aRect. The caller still has to test them exactly.
+        QList<Feature*> find(const QRect& aRect);
+        void invalidate();
+
+        /// Maximum distance (in pixels) a candidate is guaranteed to be found at
+        static const int Margin = 16;
+
+    private:
+        void update();
+        void build();
+        void insert(Feature* F);
+        void remove(Feature* F);
+        void addArea(QVector<quint32>& cells, const QRect& r);
+        void addLine(QVector<quint32>& cells, QPointF a, QPointF b);
+
+        MapView* theView;
+
+        QHash<quint32, QList<Feature*> > Cells;
+        QHash<Feature*, QVector<quint32> > FeatureCells;
+
+        bool UpToDate;
+        QTransform BuiltTransform;
+        QRect BuiltRect;
+        QRect BuiltArea;
+        Document* BuiltDocument;
+        QList<ILayer*> BuiltLayers;
+        QSet<ILayer*> BuiltLayerSet;
+        int BuiltMark;
+};
+
+#endif
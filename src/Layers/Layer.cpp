@@ -3,6 +3,7 @@
 #include "Features.h"
 
 #include "Document.h"
+#include "FilterEngine.h"
 #include "LayerWidget.h"
 
 #include "DocumentCommands.h"
@@ -78,12 +79,8 @@ const QString& Layer::description() const
     return p->Description;
 }
 
-void Layer::setVisible(bool b) {
-    p->Visible = b;
-    if (theWidget) {
-        theWidget->setLayerVisible(p->Visible, false);
-    }
-
+void Layer::invalidateFeaturesMeta()
+{
     if (p->theDocument) {
         FeatureIterator it(p->theDocument);
         for(;!it.isEnd(); ++it) {
@@ -92,6 +89,15 @@ void Layer::setVisible(bool b) {
     }
 }
 
+void Layer::setVisible(bool b) {
+    p->Visible = b;
+    if (theWidget) {
+        theWidget->setLayerVisible(p->Visible, false);
+    }
+
+    invalidateFeaturesMeta();
+}
+
 bool Layer::isVisible() const
 {
     return p->Visible;
@@ -113,12 +119,7 @@ void Layer::setEnabled(bool b) {
         theWidget->getAssociatedMenu()->menuAction()->setVisible(b);
     }
 
-    if (p->theDocument) {
-        FeatureIterator it(p->theDocument);
-        for(;!it.isEnd(); ++it) {
-            it.get()->invalidateMeta();
-        }
-    }
+    invalidateFeaturesMeta();
 }
 
 bool Layer::isEnabled() const
@@ -129,12 +130,7 @@ bool Layer::isEnabled() const
 void Layer::setReadonly(bool b) {
     p->Readonly = b;
 
-    if (p->theDocument) {
-        FeatureIterator it(p->theDocument);
-        for(;!it.isEnd(); ++it) {
-            it.get()->invalidateMeta();
-        }
-    }
+    invalidateFeaturesMeta();
 }
 
 bool Layer::isReadonly() const
@@ -186,6 +182,8 @@ void Layer::deleteFeature(Feature* aFeature)
 
 void Layer::clear()
 {
+    if (p->theDocument)
+        p->theDocument->changedOutsideHistory();
     while (p->Features.count())
     {
         remove(p->Features[0]);
@@ -193,6 +191,8 @@ void Layer::clear()
 }
 
 void Layer::deleteAll() {
+    if (p->theDocument)
+        p->theDocument->changedOutsideHistory();
     while (p->Features.count())
     {
         deleteFeature(p->Features[0]);
@@ -298,12 +298,7 @@ void Layer::setAlpha(const qreal a)
 {
     p->alpha = a;
 
-    if (p->theDocument) {
-        FeatureIterator it(p->theDocument);
-        for(;!it.isEnd(); ++it) {
-            it.get()->invalidateMeta();
-        }
-    }
+    invalidateFeaturesMeta();
 }
 
 qreal Layer::getAlpha() const
@@ -414,6 +409,21 @@ QString Layer::toMainHtml()
     + desc;
     S += "<hr/>";
     S += "<i>"+QApplication::translate("Layer", "Size")+": </i>" + QApplication::translate("Layer", "%n features")+"<br/>";
+
+    // Memory accounting, nodes being what most of it goes to
+    qint64 Bytes = 0, NodeBytes = 0;
+    int Nodes = 0;
+    for (int i=0; i<p->Features.size(); ++i) {
+        qint64 b = p->Features.at(i)->memoryUsage();
+        Bytes += b;
+        if (CHECK_NODE(p->Features.at(i))) {
+            NodeBytes += b;
+            ++Nodes;
+        }
+    }
+    S += "<i>"+QApplication::translate("Layer", "Memory")+": </i>" + QLocale().toString(Bytes / 1024) + " kB<br/>";
+    if (Nodes)
+        S += "<i>"+QApplication::translate("Layer", "Memory per node")+": </i>" + QLocale().toString(NodeBytes / Nodes) + " B<br/>";
     S += "%1";
     S += "</body></html>";
 
@@ -653,25 +663,25 @@ void TrackLayer::extractLayer()
 
             PL.clear();
 
-            P = g_backend.allocTrackNode(extL, S->getNode(0)->position() );
-            P->setTime(S->getNode(0)->time());
-            P->setElevation(S->getNode(0)->elevation());
-            P->setSpeed(S->getNode(0)->speed());
+            P = g_backend.allocTrackNode(extL, S->pointPosition(0) );
+            P->setTime(S->pointTime(0));
+            P->setElevation(S->pointElevation(0));
+            P->setSpeed(S->pointSpeed(0));
             PL.append(P);
             int startP = 0;
 
-            P = g_backend.allocTrackNode(extL, S->getNode(1)->position() );
-            P->setTime(S->getNode(1)->time());
-            P->setElevation(S->getNode(1)->elevation());
-            P->setSpeed(S->getNode(1)->speed());
+            P = g_backend.allocTrackNode(extL, S->pointPosition(1) );
+            P->setTime(S->pointTime(1));
+            P->setElevation(S->pointElevation(1));
+            P->setSpeed(S->pointSpeed(1));
             PL.append(P);
             int endP = 1;
 
             for (int j=2; j < S->size(); j++) {
-                P = g_backend.allocTrackNode(extL, S->getNode(j)->position() );
-                P->setTime(S->getNode(j)->time());
-                P->setElevation(S->getNode(j)->elevation());
-                P->setSpeed(S->getNode(j)->speed());
+                P = g_backend.allocTrackNode(extL, S->pointPosition(j) );
+                P->setTime(S->pointTime(j));
+                P->setElevation(S->pointElevation(j));
+                P->setSpeed(S->pointSpeed(j));
                 PL.append(P);
                 endP = PL.size()-1;
 
@@ -943,10 +953,15 @@ void FilterLayer::setFilter(const QString& aFilter)
     delete theSelector;
     theSelector = TagSelector::parse(theSelectorString);
 
-    FeatureIterator it(p->theDocument);
-    for(;!it.isEnd(); ++it) {
-        it.get()->updateFilters();
-    }
+    if (p->theDocument)
+        p->theDocument->filterEngine()->recompute(this);
+}
+
+void FilterLayer::invalidateFeaturesMeta()
+{
+    // Only the features matching the filter are affected
+    if (p->theDocument)
+        p->theDocument->filterEngine()->invalidateMembers(this);
 }
 
 bool FilterLayer::toXML(QXmlStreamWriter& stream, bool asTemplate, QProgressDialog * progress)
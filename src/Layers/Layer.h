@@ -134,6 +134,9 @@ public:
     virtual bool isTrack() const {return false;}
 
 protected:
+    /// The visibility, lock or opacity of the layer changed
+    virtual void invalidateFeaturesMeta();
+
     LayerPrivate* p;
     LayerWidget* theWidget;
     mutable QString Id;
@@ -282,6 +285,8 @@ public:
     virtual TagSelector* selector() { return theSelector; }
 
 protected:
+    virtual void invalidateFeaturesMeta();
+
     QString theSelectorString;
     TagSelector* theSelector;
 
@@ -7,6 +7,8 @@
 #include "Document.h"
 #include "Layer.h"
 #include "MerkaartorPreferences.h"
+#include "Command.h"
+#include "TrackManipulations.h"
 
 #include "IMapAdapterFactory.h"
 #include "IMapAdapter.h"
@@ -565,6 +567,16 @@ void TrackLayerWidget::initActions()
     associatedMenu->addAction(actExtract);
     connect(actExtract, SIGNAL(triggered(bool)), this, SLOT(extractLayer(bool)));
 
+    QMenu* processMenu = new QMenu(tr("Process tracks"), ctxMenu);
+    processMenu->addAction(tr("Sort by time"), this, SLOT(sortTracks()));
+    processMenu->addAction(tr("Split at gaps..."), this, SLOT(splitTracks()));
+    processMenu->addAction(tr("Remove outliers..."), this, SLOT(removeTrackOutliers()));
+    processMenu->addAction(tr("Simplify..."), this, SLOT(simplifyTracks()));
+    processMenu->addAction(tr("Resample..."), this, SLOT(resampleTracks()));
+    processMenu->setEnabled(!theLayer->isReadonly());
+    ctxMenu->addMenu(processMenu);
+    associatedMenu->addMenu(processMenu);
+
     actZoom = new QAction(tr("Zoom"), ctxMenu);
     ctxMenu->addAction(actZoom);
     associatedMenu->addAction(actZoom);
@@ -590,6 +602,76 @@ void TrackLayerWidget::extractLayer(bool)
     emit (layerChanged(this, false));
 }
 
+void TrackLayerWidget::processTracks(const TrackProcessing& theProcessing, const QString& aDescription)
+{
+    Document* theDocument = theLayer->getDocument();
+    if (!theDocument)
+        return;
+
+    QList<TrackSegment*> theSegments;
+    for (int i=0; i<theLayer->size(); ++i)
+        if (TrackSegment* S = CAST_SEGMENT(theLayer->get(i)))
+            theSegments << S;
+
+    QApplication::setOverrideCursor(Qt::BusyCursor);
+    CommandList* theList = new CommandList(aDescription, NULL);
+    ::processTracks(theDocument, theList, theSegments, theProcessing);
+    QApplication::restoreOverrideCursor();
+
+    if (theList->empty())
+        delete theList;
+    else {
+        theDocument->addHistory(theList);
+        emit (layerChanged(this, false));
+    }
+}
+
+void TrackLayerWidget::sortTracks()
+{
+    processTracks(TrackProcessing(TrackSortByTime), tr("Sort tracks by time"));
+}
+
+void TrackLayerWidget::splitTracks()
+{
+    TrackProcessing theProcessing(TrackSplitOnGaps);
+    bool ok;
+    theProcessing.MaxGapTime = QInputDialog::getDouble(this, tr("Split at gaps"), tr("Maximum time between points (s, 0 to ignore):"), theProcessing.MaxGapTime, 0, 86400, 0, &ok);
+    if (!ok)
+        return;
+    theProcessing.MaxGapDistance = M_PREFS->getMaxDistNodes();
+    processTracks(theProcessing, tr("Split tracks at gaps"));
+}
+
+void TrackLayerWidget::removeTrackOutliers()
+{
+    TrackProcessing theProcessing(TrackRemoveOutliers);
+    bool ok;
+    theProcessing.MaxSpeed = QInputDialog::getDouble(this, tr("Remove outliers"), tr("Maximum speed (km/h):"), theProcessing.MaxSpeed, 1, 100000, 0, &ok);
+    if (!ok)
+        return;
+    processTracks(theProcessing, tr("Remove track outliers"));
+}
+
+void TrackLayerWidget::simplifyTracks()
+{
+    TrackProcessing theProcessing(TrackSimplify);
+    bool ok;
+    theProcessing.Tolerance = QInputDialog::getDouble(this, tr("Simplify tracks"), tr("Maximum error (m):"), theProcessing.Tolerance, 0.1, 10000, 1, &ok);
+    if (!ok)
+        return;
+    processTracks(theProcessing, tr("Simplify tracks"));
+}
+
+void TrackLayerWidget::resampleTracks()
+{
+    TrackProcessing theProcessing(TrackResample);
+    bool ok;
+    theProcessing.Interval = QInputDialog::getDouble(this, tr("Resample tracks"), tr("Time between points (s):"), theProcessing.Interval, 1, 86400, 0, &ok);
+    if (!ok)
+        return;
+    processTracks(theProcessing, tr("Resample tracks"));
+}
+
 // SpecialLayerWidget
 
 SpecialLayerWidget::SpecialLayerWidget(SpecialLayer* aLayer, QWidget* aParent)
@@ -707,6 +789,7 @@ void FilterLayerWidget::mouseDoubleClickEvent(QMouseEvent */*event*/)
         setName(ui->edName->text());
         Fl->setName(ui->edName->text());
         Fl->setFilter(ui->edFilter->text());
+        emit(layerChanged(this, false));
     }
     delete ui;
 }
@@ -12,6 +12,7 @@
 
 class MainWindow;
 class Layer;
+struct TrackProcessing;
 
 class LayerWidget : public QPushButton
 {
@@ -105,6 +106,14 @@ class TrackLayerWidget : public LayerWidget
 
     private slots:
         void extractLayer(bool);
+        void sortTracks();
+        void splitTracks();
+        void removeTrackOutliers();
+        void simplifyTracks();
+        void resampleTracks();
+
+    private:
+        void processTracks(const TrackProcessing& theProcessing, const QString& aDescription);
 };
 
 class SpecialLayerWidget : public LayerWidget
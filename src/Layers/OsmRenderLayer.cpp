@@ -5,6 +5,7 @@
 #include "Document.h"
 #include "MapRenderer.h"
 #include "MerkaartorPreferences.h"
+#include "RenderProfiler.h"
 
 #if QT_VERSION >= 0x050000
 #include <QtConcurrent>
@@ -82,6 +83,7 @@ public:
         p->theDocument->lockPainters();
 
         TILE_TYPE tile = theTile;
+        ProfileScope theProfileScope(tile);
 
         QPointF projTL((TILE_X(tile)*p->tileSizeCoordW)+p->tileOriginCoord.x(), (TILE_Y(tile)*p->tileSizeCoordH)+p->tileOriginCoord.y());
         QPointF projBR(((TILE_X(tile)+1)*p->tileSizeCoordW)+p->tileOriginCoord.x(), ((TILE_Y(tile)+1)*p->tileSizeCoordH)+p->tileOriginCoord.y());
@@ -135,6 +137,7 @@ OsmRenderLayer::OsmRenderLayer(QObject *parent)
     , theDocument(0)
     , tiles(new TileContainer(this))
 {
+    connect(&(renderGatheringWatcher), SIGNAL(finished()), SLOT(gatheringFinished()));
     connect(&(renderGatheringWatcher), SIGNAL(finished()), SIGNAL(renderingDone()));
 }
 
@@ -201,6 +204,8 @@ void OsmRenderLayer::forceRedraw(const Projection& aProjection, const QTransform
     }
 
     if (tilesToRender.size()) {
+        if (RenderProfiler::isEnabled())
+            RenderProfiler::instance()->beginFrame();
         renderGathering = QtConcurrent::map(tilesToRender, RenderTile(this));
         renderGatheringWatcher.setFuture(renderGathering);
     }
@@ -237,6 +242,8 @@ void OsmRenderLayer::pan(QPoint delta)
     tileLock.unlock();
 
     if (tilesToRender.size()) {
+        if (RenderProfiler::isEnabled())
+            RenderProfiler::instance()->beginFrame();
         renderGathering = QtConcurrent::map(tilesToRender, RenderTile(this));
         renderGatheringWatcher.setFuture(renderGathering);
     }
@@ -261,6 +268,12 @@ void OsmRenderLayer::drawImage(QPainter *P)
     tileLock.unlock();
 }
 
+void OsmRenderLayer::gatheringFinished()
+{
+    if (RenderProfiler::isEnabled())
+        RenderProfiler::instance()->endFrame();
+}
+
 bool OsmRenderLayer::isRenderingDone()
 {
     return renderGathering.isFinished();
@@ -42,6 +42,9 @@ public:
 signals:
     void renderingDone();
 
+private slots:
+    void gatheringFinished();
+
 protected:
     Document* theDocument;
 
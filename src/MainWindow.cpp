@@ -8,12 +8,15 @@
 #include "DirtyDock.h"
 #include "StyleDock.h"
 #include "FeaturesDock.h"
+#include "ProfilerDock.h"
 #include "Command.h"
+#include "CommandJournal.h"
 #include "DocumentCommands.h"
 #include "FeatureCommands.h"
 #include "RelationCommands.h"
 #include "ImportExportOSC.h"
 #include "ExportGPX.h"
+#include "CompressedDevice.h"
 #include "ImportExportKML.h"
 #ifdef USE_PROTOBUF
 #include "ImportExportPBF.h"
@@ -139,6 +142,7 @@ class MainWindowPrivate
         QString defStyle;
         StyleDock* theStyle;
         FeaturesDock* theFeats;
+        ProfilerDock* theProfiler;
         QString title;
         QActionGroup* projActgrp;
         QTcpServer* theListeningServer;
@@ -277,6 +281,9 @@ MainWindow::MainWindow(QWidget *parent)
     connect(this, SIGNAL(content_changed()), p->theFeats, SLOT(on_Viewport_changed()), Qt::QueuedConnection);
     connect(this, SIGNAL(content_changed()), p->theProperties, SLOT(adjustSelection()), Qt::QueuedConnection);
 
+    p->theProfiler = new ProfilerDock(this);
+    connect(p->theProfiler, SIGNAL(visibilityChanged(bool)), this, SLOT(updateWindowMenu(bool)));
+
     theGPS = new QGPS(this);
     connect(theGPS, SIGNAL(visibilityChanged(bool)), this, SLOT(updateWindowMenu(bool)));
 
@@ -290,6 +297,9 @@ MainWindow::MainWindow(QWidget *parent)
     connect(theLayers, SIGNAL(layersChanged(bool)), this, SLOT(adjustLayers(bool)));
     connect(theLayers, SIGNAL(layersCleared()), this, SIGNAL(content_changed()));
     connect(theLayers, SIGNAL(layersClosed()), this, SIGNAL(content_changed()));
+    // Hiding or closing a layer and editing a filter don't show in the change log
+    connect(theLayers, SIGNAL(layersChanged(bool)), p->theFeats, SLOT(invalidateMembers()));
+    connect(theLayers, SIGNAL(layersClosed()), p->theFeats, SLOT(invalidateMembers()));
     connect(theLayers, SIGNAL(layersProjection(const QString&)), this, SLOT(projectionSet(const QString&)));
 
     connect (M_PREFS, SIGNAL(bookmarkChanged()), this, SLOT(updateBookmarksMenu()));
@@ -384,6 +394,10 @@ MainWindow::MainWindow(QWidget *parent)
     theGPS->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
     addDockWidget(Qt::RightDockWidgetArea, theGPS);
 
+    p->theProfiler->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
+    addDockWidget(Qt::RightDockWidgetArea, p->theProfiler);
+    p->theProfiler->setVisible(false);
+
 #else
     p->theProperties->setVisible(false);
     theInfo->setVisible(false);
@@ -391,6 +405,7 @@ MainWindow::MainWindow(QWidget *parent)
     theDirty->setVisible(false);
     theFeats->setVisible(false);
     theGPS->setVisible(false);
+    p->theProfiler->setVisible(false);
 
     toolBar->setVisible(false);
     mobileToolBar->setVisible(true);
@@ -893,8 +908,10 @@ bool MainWindow::eventFilter(QObject */* watched */, QEvent *event)
             QHelpEvent *helpEvent = static_cast<QHelpEvent *>(event);
             //Coord p = p->theProjection.inverse(helpEvent->pos());
             if (M_PREFS->getMapTooltip()) {
-                if (!toolTip().isEmpty())
-                    QToolTip::showText(helpEvent->globalPos(), toolTip());
+                // The hover html is only built when the tooltip is shown
+                FeatureSnapInteraction* I = dynamic_cast<FeatureSnapInteraction*>(theView->interaction());
+                if (I && I->lastSnap())
+                    QToolTip::showText(helpEvent->globalPos(), I->lastSnap()->toHtml(), theView);
                 else
                     QToolTip::hideText();
             }
@@ -1616,12 +1633,18 @@ void MainWindow::importAction( bool useGdal ) {
     theDocument->history().setActions(ui->editUndoAction, ui->editRedoAction, ui->fileUploadAction);
 }
 
-static bool mayDiscardUnsavedChanges(QWidget* aWidget)
+static bool mayDiscardUnsavedChanges(QWidget* aWidget, Document* aDocument)
 {
-    return QMessageBox::question(aWidget, MainWindow::tr("Unsaved changes"),
-                                 MainWindow::tr("The current map contains unsaved changes that will be lost when starting a new one.\n"
-                                                "Do you want to cancel starting a new map or continue and discard the old changes?"),
-                                 QMessageBox::Discard | QMessageBox::Cancel, QMessageBox::Cancel) == QMessageBox::Discard;
+    if (QMessageBox::question(aWidget, MainWindow::tr("Unsaved changes"),
+                              MainWindow::tr("The current map contains unsaved changes that will be lost when starting a new one.\n"
+                                             "Do you want to cancel starting a new map or continue and discard the old changes?"),
+                              QMessageBox::Discard | QMessageBox::Cancel, QMessageBox::Cancel) != QMessageBox::Discard)
+        return false;
+
+    // Don't let the journal bring the discarded changes back
+    if (aDocument && aDocument->journal())
+        aDocument->journal()->discardUnsaved();
+    return true;
 }
 
 static bool mayDiscardStyleChanges(QWidget* aWidget)
@@ -1977,7 +2000,7 @@ void MainWindow::loadUrl(const QUrl& theUrl)
 
 void MainWindow::on_fileOpenAction_triggered()
 {
-    if (hasUnsavedChanges() && !mayDiscardUnsavedChanges(this))
+    if (hasUnsavedChanges() && !mayDiscardUnsavedChanges(this, theDocument))
         return;
 
     QString fileName = QFileDialog::getOpenFileName(this, tr("Open file"), QString(), p->FILTER_OPEN_NATIVE );
@@ -2330,7 +2353,7 @@ void MainWindow::on_fileNewAction_triggered()
     if (theDocument)
         saveTemplateDocument(TEMPLATE_DOCUMENT);
 
-    if (!theDocument || !hasUnsavedChanges() || mayDiscardUnsavedChanges(this)) {
+    if (!theDocument || !hasUnsavedChanges() || mayDiscardUnsavedChanges(this, theDocument)) {
         p->theFeats->invalidate();
         SAFE_DELETE(theDocument);
         theView->setDocument(NULL);
@@ -2518,8 +2541,10 @@ void MainWindow::on_featureSelectChildrenAction_triggered()
     QList<Feature*> theFeatures;
     foreach (Feature* F, p->theProperties->selection()) {
         theFeatures << F;
+        // Points of a track segment are only selectable once they have a node
         for (int i=0; i<F->size(); ++i)
-            theFeatures << F->get(i);
+            if (!CHECK_SEGMENT(F) || STATIC_CAST_SEGMENT(F)->isMaterialised(i))
+                theFeatures << F->get(i);
     }
     p->theProperties->setSelection(theFeatures);
     p->theProperties->checkMenuStatus();
@@ -3161,7 +3186,14 @@ void MainWindow::on_fileSaveAsTemplateAction_triggered()
 void MainWindow::on_fileSaveAction_triggered()
 {
     if (!currentProjectFile.isEmpty()) {
-        saveDocument(currentProjectFile);
+        CommandJournal* theJournal = theDocument->journal();
+        if (theJournal && theJournal->snapshotFile() == currentProjectFile
+                && !theJournal->isBroken() && !theJournal->needsCompaction()) {
+            // The edits are already in the journal, only mark the save point
+            theJournal->recordSave();
+            p->latSaveDirtyLevel = theDocument->getDirtySize();
+        } else
+            saveDocument(currentProjectFile);
     } else {
         on_fileSaveAsAction_triggered();
     }
@@ -3208,6 +3240,17 @@ void MainWindow::saveDocument(const QString& fn)
     currentProjectFile = fn;
 
     p->latSaveDirtyLevel = theDocument->getDirtySize();
+
+    // A full snapshot is the compaction of the journal
+    if (M_PREFS->getUseJournal()) {
+        CommandJournal* theJournal = theDocument->journal();
+        if (!theJournal || theJournal->snapshotFile() != fn) {
+            theJournal = new CommandJournal(theDocument, fn);
+            theDocument->setJournal(theJournal);
+        }
+        if (!theJournal->reset())
+            theDocument->setJournal(NULL);
+    }
 }
 
 void MainWindow::saveTemplateDocument(const QString& fn)
@@ -3300,10 +3343,14 @@ void MainWindow::loadDocument(QString fn)
                 this, SLOT(onImagereceived(ImageMapLayer*)), Qt::QueuedConnection);
         connect(theDocument, SIGNAL(loadingFinished(ImageMapLayer*)),
                 this, SLOT(onLoadingfinished(ImageMapLayer*)), Qt::QueuedConnection);
+        bool recovered = false;
+        if (M_PREFS->getUseJournal())
+            recovered = replayJournal(fn);
         theDirty->updateList();
         currentProjectFile = fn;
         setWindowTitle(QString("%1 - %2").arg(theDocument->title()).arg(p->title));
-        p->latSaveDirtyLevel = theDocument->getDirtySize();
+        // Recovered changes are not in the file yet
+        p->latSaveDirtyLevel = recovered ? -1 : theDocument->getDirtySize();
         theView->resumeRendering();
     }
 
@@ -3313,6 +3360,41 @@ void MainWindow::loadDocument(QString fn)
     emit content_changed();
 }
 
+bool MainWindow::replayJournal(const QString& fn)
+{
+    CommandJournal* theJournal = new CommandJournal(theDocument, fn);
+
+    int saved, unsaved;
+    bool withUnsaved = false;
+    if (theJournal->load(saved, unsaved)) {
+        // Past a download, an import or a layer change, the journal can't tell what was done
+        QString lost;
+        if (theJournal->isBroken())
+            lost = tr("The changes made after a download, an import or a layer change can't be recovered.") + "\n";
+        if (unsaved)
+            withUnsaved = (QMessageBox::question(this, tr("Unsaved changes"),
+                                                 tr("%1 contains %n change(s) that were never saved, probably because of a crash.\n", "", unsaved).arg(QFileInfo(fn).fileName())
+                                                 + lost + tr("Do you want to recover them?"),
+                                                 QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes) == QMessageBox::Yes);
+        else if (!lost.isEmpty())
+            QMessageBox::warning(this, tr("Unsaved changes"),
+                                 tr("%1 was changed after it was last saved, probably before a crash.\n").arg(QFileInfo(fn).fileName()) + lost);
+
+        QProgressDialog progress(tr("Replaying journal..."), tr("Cancel"), 0, 0, this);
+        progress.setWindowModality(Qt::WindowModal);
+        theJournal->replay(withUnsaved, &progress);
+        progress.reset();
+        theDocument->history().updateActions();
+    }
+
+    if (theJournal->open())
+        theDocument->setJournal(theJournal);
+    else
+        delete theJournal;
+
+    return withUnsaved;
+}
+
 void MainWindow::loadTemplateDocument(QString fn)
 {
     Document* newDoc = NULL;
@@ -3337,12 +3419,24 @@ void MainWindow::on_exportOSMAction_triggered()
         return;
 
     QString path;
-    if (getPathToSave(tr("Export OSM"), "osm", tr("OSM Files (*.osm)") + "\n" + tr("All Files (*)"), &path)) {
+    QString filters = tr("OSM Files (*.osm)") + "\n" + tr("Compressed OSM Files (*.osm.gz)");
+    if (CompressedDevice::isSupported(CompressedDevice::Bzip2))
+        filters += "\n" + tr("Compressed OSM Files (*.osm.bz2)");
+    if (getPathToSave(tr("Export OSM"), "osm", filters + "\n" + tr("All Files (*)"), &path)) {
         QFile file(path);
-        if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        CompressedDevice::Compression compression = CompressedDevice::compressionFor(path);
+        if (!file.open(compression == CompressedDevice::None ? QIODevice::WriteOnly | QIODevice::Text : QIODevice::WriteOnly))
             return;
 
-        theDocument->exportOSM(this, &file, theFeatures);
+        if (compression == CompressedDevice::None) {
+            theDocument->exportOSM(this, &file, theFeatures);
+        } else {
+            CompressedDevice compressed(&file, compression);
+            if (compressed.open(QIODevice::WriteOnly)) {
+                theDocument->exportOSM(this, &compressed, theFeatures);
+                compressed.close();
+            }
+        }
         file.close();
     }
     deleteProgressDialog();
@@ -3570,7 +3664,7 @@ void MainWindow::on_editSelectAction_triggered()
 
 void MainWindow::closeEvent(QCloseEvent * event)
 {
-    if (hasUnsavedChanges() && !mayDiscardUnsavedChanges(this)) {
+    if (hasUnsavedChanges() && !mayDiscardUnsavedChanges(this, theDocument)) {
         event->ignore();
         return;
     }
@@ -3735,6 +3829,7 @@ void MainWindow::updateWindowMenu(bool)
     ui->windowInfoAction->setChecked(theInfo->isVisible());
     ui->windowDirtyAction->setChecked(theDirty->isVisible());
     ui->windowFeatsAction->setChecked(p->theFeats->isVisible());
+    ui->windowProfilerAction->setChecked(p->theProfiler->isVisible());
     ui->windowGPSAction->setChecked(theGPS->isVisible());
 #ifdef GEOIMAGE
     ui->windowGeoimageAction->setChecked(theGeoImage->isVisible());
@@ -3833,7 +3928,7 @@ void MainWindow::bookmarkTriggered(QAction* anAction)
 
 void MainWindow::recentOpenTriggered(QAction* anAction)
 {
-    if (hasUnsavedChanges() && !mayDiscardUnsavedChanges(this))
+    if (hasUnsavedChanges() && !mayDiscardUnsavedChanges(this, theDocument))
         return;
 
     QString fileName(anAction->text());
@@ -3922,6 +4017,12 @@ void MainWindow::on_windowFeatsAction_triggered()
     ui->windowFeatsAction->setChecked(p->theFeats->isVisible());
 }
 
+void MainWindow::on_windowProfilerAction_triggered()
+{
+    p->theProfiler->setVisible(!p->theProfiler->isVisible());
+    ui->windowProfilerAction->setChecked(p->theProfiler->isVisible());
+}
+
 void MainWindow::on_windowToolbarAction_triggered()
 {
     foreach (QObject* child, children()) {
@@ -3967,6 +4068,7 @@ void MainWindow::on_windowHideAllAction_triggered()
     p->theProperties->setVisible(false);
     theGPS->setVisible(false);
     p->theStyle->setVisible(false);
+    p->theProfiler->setVisible(false);
 #ifdef GEOIMAGE
     theGeoImage->setVisible(false);
 #endif
@@ -3994,8 +4096,7 @@ void MainWindow::on_gpsConnectAction_triggered()
     QGPSS60Device* aGps = new QGPSS60Device();
 #endif
     if (aGps->openDevice()) {
-        connect(aGps, SIGNAL(updatePosition(float, float, QDateTime, float, float, float)),
-            this, SLOT(updateGpsPosition(float, float, QDateTime, float, float, float)));
+        connect(aGps, SIGNAL(positionsAvailable()), this, SLOT(updateGpsPosition()));
 
         ui->gpsConnectAction->setEnabled(false);
         ui->gpsReplayAction->setEnabled(false);
@@ -4024,8 +4125,7 @@ void MainWindow::on_gpsReplayAction_triggered()
 
     QGPSFileDevice* aGps = new QGPSFileDevice(fileName);
     if (aGps->openDevice()) {
-        connect(aGps, SIGNAL(updatePosition(qreal, qreal, QDateTime, qreal, qreal, qreal)),
-            this, SLOT(updateGpsPosition(qreal, qreal, QDateTime, qreal, qreal, qreal)));
+        connect(aGps, SIGNAL(positionsAvailable()), this, SLOT(updateGpsPosition()));
 
         ui->gpsConnectAction->setEnabled(false);
         ui->gpsReplayAction->setEnabled(false);
@@ -4049,35 +4149,36 @@ void MainWindow::on_gpsDisconnectAction_triggered()
     ui->gpsRecordAction->setChecked(false);
     ui->gpsPauseAction->setChecked(false);
 
-    disconnect(theGPS->getGpsDevice(), SIGNAL(updatePosition(float, float, QDateTime, float, float, float)),
-        this, SLOT(updateGpsPosition(float, float, QDateTime, float, float, float)));
+    disconnect(theGPS->getGpsDevice(), SIGNAL(positionsAvailable()), this, SLOT(updateGpsPosition()));
     theGPS->stopGps();
     theGPS->resetGpsStatus();
 }
 
-void MainWindow::updateGpsPosition(qreal latitude, qreal longitude, QDateTime time, qreal altitude, qreal speed, qreal heading)
+/* Takes all the fixes queued by the GPS device: every fix is recorded, the
+   view is only updated once for the batch */
+void MainWindow::updateGpsPosition()
 {
-    Q_UNUSED(heading)
-    if (theGPS->getGpsDevice()) {
-        Coord gpsCoord(longitude,latitude);
-        if (M_PREFS->getGpsMapCenter()) {
-            CoordBox vp = theView->viewport();
-            qreal lonDiff = vp.lonDiff();
-            qreal latDiff = vp.latDiff();
-            QRectF vpr = vp.adjusted(lonDiff / 4, -latDiff / 4, -lonDiff / 4, latDiff / 4);
-            if (!vpr.contains(gpsCoord)) {
-                theView->setCenter(gpsCoord, theView->rect());
-                theView->invalidate(false, false, true);
-            }
-        }
+    QGPSDevice* aGps = theGPS->getGpsDevice();
+    if (!aGps)
+        return;
+    QList<GpsPosition> thePositions = aGps->takePositions();
+    if (thePositions.isEmpty())
+        return;
+
+    if (ui->gpsRecordAction->isChecked() && !ui->gpsPauseAction->isChecked()) {
+        foreach (const GpsPosition& Pos, thePositions)
+            curGpsTrackSegment->addPoint(Coord(Pos.Longitude, Pos.Latitude), Pos.Time.toTime_t(), Pos.Altitude, Pos.Speed);
+    }
 
-        if (ui->gpsRecordAction->isChecked() && !ui->gpsPauseAction->isChecked()) {
-            TrackNode* pt = g_backend.allocTrackNode(gpsRecLayer, gpsCoord);
-            pt->setTime(time);
-            pt->setElevation(altitude);
-            pt->setSpeed(speed);
-            gpsRecLayer->add(pt);
-            curGpsTrackSegment->add(pt);
+    if (M_PREFS->getGpsMapCenter()) {
+        Coord gpsCoord(thePositions.last().Longitude, thePositions.last().Latitude);
+        CoordBox vp = theView->viewport();
+        qreal lonDiff = vp.lonDiff();
+        qreal latDiff = vp.latDiff();
+        QRectF vpr = vp.adjusted(lonDiff / 4, -latDiff / 4, -lonDiff / 4, latDiff / 4);
+        if (!vpr.contains(gpsCoord)) {
+            theView->setCenter(gpsCoord, theView->rect());
+            theView->invalidate(false, false, true);
         }
     }
     theView->update();
@@ -4307,7 +4408,8 @@ void MainWindow::syncOSM(const QString& aWeb, const QString& aUser, const QStrin
             p->latSaveDirtyLevel = theDocument->getDirtySize();
 
             if (!currentProjectFile.isEmpty()) {
-                if (M_PREFS->getAutoSaveDoc()) {
+                // Uploading renumbers features, the journal can't describe that
+                if (M_PREFS->getAutoSaveDoc() || theDocument->journal()) {
                     saveDocument(currentProjectFile);
                 } else {
                     if (QMessageBox::warning(this,tr("Unsaved changes"),
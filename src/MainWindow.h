@@ -179,6 +179,7 @@ public slots:
     virtual void on_windowInfoAction_triggered();
     virtual void on_windowDirtyAction_triggered();
     virtual void on_windowFeatsAction_triggered();
+    virtual void on_windowProfilerAction_triggered();
     virtual void on_windowToolbarAction_triggered();
     virtual void on_windowGPSAction_triggered();
 #ifdef GEOIMAGE
@@ -252,7 +253,7 @@ public slots:
     void projectionTriggered(QAction* anAction);
 #endif
     void styleTriggered(QAction* anAction);
-    void updateGpsPosition(qreal latitude, qreal longitude, QDateTime time, qreal altitude, qreal speed, qreal heading);
+    void updateGpsPosition();
     void applyStyles(QString NewStyle);
     void applyPainters(GlobalPainter* theGlobalPainter, QList<Painter>* thePainters);
 
@@ -263,6 +264,7 @@ public:
     void loadTemplateDocument(QString fn);
     void saveDocument(const QString& fn);
     void saveTemplateDocument(const QString& fn);
+    bool replayJournal(const QString& fn);
     void downloadFeatures(const QList<Feature*>& aDownloadList);
 
     void createProgressDialog();
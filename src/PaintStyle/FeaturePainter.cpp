@@ -268,7 +268,7 @@ void FeaturePainter::drawBackground(Way* R, QPainter* thePainter, MapRenderer* t
                     }
                     aPath.lineTo(l1.p2());
                 }
-                thePainter->drawPath(aPath);
+                theRenderer->thePaths.add(thePainter, aPath);
                 thePainter->setPen(Qt::NoPen);
             } else {
                 QPen thePen(BackgroundColor,WW);
@@ -298,7 +298,7 @@ void FeaturePainter::drawBackground(Way* R, QPainter* thePainter, MapRenderer* t
     }
 
     R->getLock();
-    thePainter->drawPath(theRenderer->theTransform.map(R->getPath()));
+    theRenderer->thePaths.add(thePainter, theRenderer->theTransform.map(R->getPath()));
     R->releaseLock();
 }
 
@@ -352,7 +352,7 @@ void FeaturePainter::drawBackground(Relation* R, QPainter* thePainter, MapRender
                     }
                     aPath.lineTo(l1.p2());
                 }
-                thePainter->drawPath(aPath);
+                theRenderer->thePaths.add(thePainter, aPath);
                 thePainter->setPen(Qt::NoPen);
             } else {
                 QPen thePen(BackgroundColor,WW);
@@ -380,7 +380,7 @@ void FeaturePainter::drawBackground(Relation* R, QPainter* thePainter, MapRender
     }
 
     R->getLock();
-    thePainter->drawPath(theRenderer->theTransform.map(R->getPath()));
+    theRenderer->thePaths.add(thePainter, theRenderer->theTransform.map(R->getPath()));
     R->releaseLock();
 }
 
@@ -426,7 +426,7 @@ void FeaturePainter::drawForeground(Way* R, QPainter* thePainter, MapRenderer* t
     thePainter->setBrush(Qt::NoBrush);
 
     R->getLock();
-    thePainter->drawPath(theRenderer->theTransform.map(R->getPath()));
+    theRenderer->thePaths.add(thePainter, theRenderer->theTransform.map(R->getPath()));
     R->releaseLock();
 }
 
@@ -457,7 +457,7 @@ void FeaturePainter::drawForeground(Relation* R, QPainter* thePainter, MapRender
     thePainter->setBrush(Qt::NoBrush);
 
     R->getLock();
-    thePainter->drawPath(theRenderer->theTransform.map(R->getPath()));
+    theRenderer->thePaths.add(thePainter, theRenderer->theTransform.map(R->getPath()));
     R->releaseLock();
 }
 
@@ -471,13 +471,14 @@ void FeaturePainter::drawTouchup(Node* Pt, QPainter* thePainter, MapRenderer* th
             qreal PixelPerM = theRenderer->thePixelPerM;
             qreal WW = PixelPerM*IconScale+IconOffset;
 
-            QImage* pm = getSVGImageFromFile(IconName,int(WW));
+            // Node symbols are drawn in batches once the stage is done
+            const QImage* pm = theRenderer->theSymbols.icon(this, IconName, int(WW));
             if (pm && !pm->isNull()) {
                 IconOK = true;
                 QPointF C(theRenderer->theTransform.map(Pt->projected()));
                 // cbro-20090109: Don't draw the dot if there is an icon
                 // thePainter->fillRect(QRect(C-QPoint(2,2),QSize(4,4)),QColor(0,0,0,128));
-                thePainter->drawImage( int(C.x()-pm->width()/2), int(C.y()-pm->height()/2) , *pm);
+                theRenderer->theSymbols.addIcon(Pt, pm, C, thePainter->opacity());
             }
         }
         if (!IconOK)
@@ -492,16 +493,17 @@ void FeaturePainter::drawTouchup(Node* Pt, QPainter* thePainter, MapRenderer* th
             QPointF P(theRenderer->toView(Pt));
             qreal WW = theRenderer->NodeWidth;
             if (WW >= 1) {
+                qreal alpha = thePainter->opacity();
                 if (Pt->layer()->classGroups() & Layer::Special) {
                     QRect R2(P.x()-WW*4/3/2, P.y()-WW*4/3/2, WW*4/3, WW*4/3);
-                    thePainter->fillRect(R2,QColor(255,0,255,192));
+                    theRenderer->theSymbols.addSquare(R2, QColor(255,0,255,192), alpha, true);
                 } else if (Pt->isWaypoint()) {
                     QRect R2(P.x()-WW*4/3/2, P.y()-WW*4/3/2, WW*4/3, WW*4/3);
-                    thePainter->fillRect(R2,QColor(255,0,0,192));
+                    theRenderer->theSymbols.addSquare(R2, QColor(255,0,0,192), alpha, true);
                 }
 
                 QRect R(P.x()-WW/2, P.y()-WW/2, WW, WW);
-                thePainter->fillRect(R,theColor);
+                theRenderer->theSymbols.addSquare(R, theColor, alpha);
             }
         }
     }
@@ -525,7 +527,7 @@ void FeaturePainter::drawTouchup(Way* R, QPainter* thePainter, MapRenderer* theR
                 thePen.setDashPattern(Pattern);
             }
             R->getLock();
-            thePainter->strokePath(theRenderer->theTransform.map(R->getPath()),thePen);
+            theRenderer->thePaths.addStroke(thePainter, theRenderer->theTransform.map(R->getPath()), thePen);
             R->releaseLock();
         }
     }
@@ -540,7 +542,7 @@ void FeaturePainter::drawTouchup(Way* R, QPainter* thePainter, MapRenderer* theR
                 R->getLock();
                 QPointF C(theRenderer->theTransform.map(R->getPath().boundingRect().center()));
                 R->releaseLock();
-                thePainter->drawImage( int(C.x()-pm->width()/2), int(C.y()-pm->height()/2) , *pm);
+                theRenderer->theSymbols.addIcon(NULL, pm, C, thePainter->opacity());
             }
         }
     }
@@ -555,12 +557,11 @@ void FeaturePainter::drawTouchup(Way* R, QPainter* thePainter, MapRenderer* theR
             qreal DistFromCenter = 2*(theWidth+4);
             if (theWidth > 0)
             {
+                QPen thePen(TrafficDirectionMarksColor, 2);
                 if ( theRenderer->theOptions.arrowOptions == RendererOptions::ArrowsAlways )
-                    thePainter->setPen(QPen(QColor(255,0,0), 2));
-                else
-                    thePainter->setPen(QPen(TrafficDirectionMarksColor, 2));
-
+                    thePen = QPen(QColor(255,0,0), 2);
 
+                QPainterPath Arrows;
                 for (int i=1; i<R->size(); ++i)
                 {
                     QPointF FromF(theRenderer->theTransform.map(R->getNode(i-1)->projected()));
@@ -577,24 +578,25 @@ void FeaturePainter::drawTouchup(Way* R, QPainter* thePainter, MapRenderer* theR
                         QPoint V2(qRound(theWidth*cos(A-M_PI/6)),qRound(theWidth*sin(A-M_PI/6)));
                         if ( (TT == Feature::OtherWay) || (TT == Feature::BothWays) )
                         {
-                            thePainter->drawLine(H+T,H+T-V1);
-                            thePainter->drawLine(H+T,H+T-V2);
+                            Arrows.moveTo(H+T); Arrows.lineTo(H+T-V1);
+                            Arrows.moveTo(H+T); Arrows.lineTo(H+T-V2);
                         }
                         if ( (TT == Feature::OneWay) || (TT == Feature::BothWays) )
                         {
-                            thePainter->drawLine(H-T,H-T+V1);
-                            thePainter->drawLine(H-T,H-T+V2);
+                            Arrows.moveTo(H-T); Arrows.lineTo(H-T+V1);
+                            Arrows.moveTo(H-T); Arrows.lineTo(H-T+V2);
                         }
                         else
                         {
                             if ( theRenderer->theOptions.arrowOptions == RendererOptions::ArrowsAlways )
                             {
-                                thePainter->drawLine(H-T,H-T+V1);
-                                thePainter->drawLine(H-T,H-T+V2);
+                                Arrows.moveTo(H-T); Arrows.lineTo(H-T+V1);
+                                Arrows.moveTo(H-T); Arrows.lineTo(H-T+V2);
                             }
                         }
                     }
                 }
+                theRenderer->thePaths.addStroke(thePainter, Arrows, thePen);
             }
         }
     }
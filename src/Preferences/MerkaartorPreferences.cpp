@@ -1028,9 +1028,13 @@ void MerkaartorPreferences::setOsmPassword(const QString & theValue)
 }
 
 M_PARAM_IMPLEMENT_DOUBLE(MaxDistNodes, data, 0.0);
+M_PARAM_IMPLEMENT_DOUBLE(GpxMinDistance, data, 0.0);
 
 M_PARAM_IMPLEMENT_BOOL(AutoSaveDoc, data, false);
 M_PARAM_IMPLEMENT_BOOL(AutoExtractTracks, data, false);
+M_PARAM_IMPLEMENT_BOOL(UseJournal, data, true);
+M_PARAM_IMPLEMENT_INT(JournalCompactionSize, data, 32);
+M_PARAM_IMPLEMENT_INT(UndoHistoryLimit, data, 200000);
 
 M_PARAM_IMPLEMENT_INT(DirectionalArrowsVisible, visual, 1);
 
@@ -1244,6 +1248,8 @@ M_PARAM_IMPLEMENT_BOOL(GpsSyncTime, gps, false)
 
 M_PARAM_IMPLEMENT_BOOL(ResolveRelations, downloadosm, false)
 M_PARAM_IMPLEMENT_BOOL(DeleteIncompleteRelations, downloadosm, false)
+M_PARAM_IMPLEMENT_DOUBLE(DownloadTileSize, downloadosm, 0.1)
+M_PARAM_IMPLEMENT_INT(DownloadConnections, downloadosm, 4)
 
 M_PARAM_IMPLEMENT_BOOL(MapTooltip, visual, false)
 M_PARAM_IMPLEMENT_BOOL(InfoOnHover, visual, true)
@@ -1272,6 +1278,7 @@ M_PARAM_IMPLEMENT_BOOL(SelectModeCreation, Mouse, false)
 
 // Geotag
 M_PARAM_IMPLEMENT_INT(MaxGeoPicWidth, geotag, 160)
+M_PARAM_IMPLEMENT_STRING(GeoPicCacheDir, geotag, HOMEDIR + "/GeoPicCache")
 
 /* Custom Style */
 M_PARAM_IMPLEMENT_BOOL(MerkaartorStyle, visual, false)
@@ -1281,6 +1288,7 @@ M_PARAM_IMPLEMENT_STRING(MerkaartorStyleString, visual, "skulpture")
 M_PARAM_IMPLEMENT_BOOL(OfflineMode, Network, false)
 M_PARAM_IMPLEMENT_BOOL(LocalServer, Network, false)
 M_PARAM_IMPLEMENT_INT(NetworkTimeout, Network, 10000)
+M_PARAM_IMPLEMENT_INT(UploadChunkSize, Network, 1000)
 
 /* Proxy */
 
@@ -255,9 +255,13 @@ public:
     QString getOsmPassword() const;
 
     M_PARAM_DECLARE_DOUBLE(MaxDistNodes)
+    M_PARAM_DECLARE_DOUBLE(GpxMinDistance)
 
     M_PARAM_DECLARE_BOOL(AutoSaveDoc)
     M_PARAM_DECLARE_BOOL(AutoExtractTracks)
+    M_PARAM_DECLARE_BOOL(UseJournal)
+    M_PARAM_DECLARE_INT(JournalCompactionSize)
+    M_PARAM_DECLARE_INT(UndoHistoryLimit)
 
     /* Export Type */
     void setExportType(ExportType theValue);
@@ -344,6 +348,8 @@ public:
 
     M_PARAM_DECLARE_BOOL(ResolveRelations)
     M_PARAM_DECLARE_BOOL(DeleteIncompleteRelations)
+    M_PARAM_DECLARE_DOUBLE(DownloadTileSize)
+    M_PARAM_DECLARE_INT(DownloadConnections)
 
     M_PARAM_DECLARE_BOOL(TranslateTags)
 
@@ -361,6 +367,7 @@ public:
 
     // Geotag
     M_PARAM_DECLARE_INT(MaxGeoPicWidth)
+    M_PARAM_DECLARE_STRING(GeoPicCacheDir)
 
     /* Custom Style */
     M_PARAM_DECLARE_BOOL(MerkaartorStyle)
@@ -370,6 +377,7 @@ public:
     M_PARAM_DECLARE_BOOL(OfflineMode)
     M_PARAM_DECLARE_BOOL(LocalServer)
     M_PARAM_DECLARE_INT(NetworkTimeout)
+    M_PARAM_DECLARE_INT(UploadChunkSize)
 
     /* Proxy */
     QNetworkProxy getProxy(const QUrl & requestUrl);
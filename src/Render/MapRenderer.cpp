@@ -17,6 +17,10 @@
 #include "MasPaintStyle.h"
 #include "ImageMapLayer.h"
 #include "LineF.h"
+#include "RenderProfiler.h"
+#include "SvgCache.h"
+
+#include <QtCore/qmath.h>
 
 #define TEST_RFLAGS(x) theOptions.options.testFlag(x)
 #define TEST_RENDERER_RFLAGS(x) r->theOptions.options.testFlag(x)
@@ -45,7 +49,7 @@ void BackgroundStyleLayer::draw(Way* R)
 
         r->thePainter->setPen(thePen);
         R->getLock();
-        r->thePainter->drawPath(r->theTransform.map(R->getPath()));
+        r->thePaths.add(r->thePainter, r->theTransform.map(R->getPath()));
         R->releaseLock();
     }
 }
@@ -109,6 +113,7 @@ void TouchupStyleLayer::draw(Way* R)
                 qreal DistFromCenter = 2*(theWidth+4);
                 if (theWidth > 0)
                 {
+                    QPainterPath Blue, Red;
                     for (int i=1; i<R->size(); ++i)
                     {
                         QPointF FromF(r->toView(R->getNode(i-1)));
@@ -123,27 +128,26 @@ void TouchupStyleLayer::draw(Way* R)
                             QPointF V2(theWidth*cos(A-M_PI/6),theWidth*sin(A-M_PI/6));
                             if ( (TT == Feature::OtherWay) || (TT == Feature::BothWays) )
                             {
-                                r->thePainter->setPen(QPen(QColor(0,0,255), 2));
-                                r->thePainter->drawLine(H+T,H+T-V1);
-                                r->thePainter->drawLine(H+T,H+T-V2);
+                                Blue.moveTo(H+T); Blue.lineTo(H+T-V1);
+                                Blue.moveTo(H+T); Blue.lineTo(H+T-V2);
                             }
                             if ( (TT == Feature::OneWay) || (TT == Feature::BothWays) )
                             {
-                                r->thePainter->setPen(QPen(QColor(0,0,255), 2));
-                                r->thePainter->drawLine(H-T,H-T+V1);
-                                r->thePainter->drawLine(H-T,H-T+V2);
+                                Blue.moveTo(H-T); Blue.lineTo(H-T+V1);
+                                Blue.moveTo(H-T); Blue.lineTo(H-T+V2);
                             }
                             else
                             {
                                 if ( r->theOptions.arrowOptions == RendererOptions::ArrowsAlways )
                                 {
-                                    r->thePainter->setPen(QPen(QColor(255,0,0), 2));
-                                    r->thePainter->drawLine(H-T,H-T+V1);
-                                    r->thePainter->drawLine(H-T,H-T+V2);
+                                    Red.moveTo(H-T); Red.lineTo(H-T+V1);
+                                    Red.moveTo(H-T); Red.lineTo(H-T+V2);
                                 }
                             }
                         }
                     }
+                    r->thePaths.addStroke(r->thePainter, Blue, QPen(QColor(0,0,255), 2));
+                    r->thePaths.addStroke(r->thePainter, Red, QPen(QColor(255,0,0), 2));
                 }
             }
         }
@@ -170,16 +174,17 @@ void TouchupStyleLayer::draw(Node* Pt)
                     theColor = r->theGlobalPainter.NodesColor;
                 }
                 QPointF P(r->toView(Pt));
+                qreal alpha = r->thePainter->opacity();
                 if (Pt->layer() && (Pt->layer()->classGroups() & Layer::Special)) {
                     QRect R2(P.x()-(WW+4)/2, P.y()-(WW+4)/2, WW+4, WW+4);
-                    r->thePainter->fillRect(R2,QColor(255,0,255,192));
+                    r->theSymbols.addSquare(R2, QColor(255,0,255,192), alpha, true);
                 } else if (Pt->isWaypoint()) {
                     QRect R2(P.x()-(WW+4)/2, P.y()-(WW+4)/2, WW+4, WW+4);
-                    r->thePainter->fillRect(R2,QColor(255,0,0,192));
+                    r->theSymbols.addSquare(R2, QColor(255,0,0,192), alpha, true);
                 }
 
                 QRect R(P.x()-WW/2, P.y()-WW/2, WW, WW);
-                r->thePainter->fillRect(R,theColor);
+                r->theSymbols.addSquare(R, theColor, alpha);
             }
         }
     }
@@ -203,6 +208,195 @@ void LabelStyleLayer::draw(Node* Pt)
         paintsel->drawLabel(Pt,r->thePainter,r);
 }
 
+/*** PathBatch ***/
+
+uint qHash(const PathState& aState)
+{
+    // Equal states hash equal, the rest is sorted out by operator==
+    return qHash(aState.Pen.color().rgba()) ^ (qHash(aState.Brush.color().rgba()) << 1)
+            ^ ((uint)aState.Pen.style() << 4) ^ ((uint)aState.Brush.style() << 8)
+            ^ qHash((int)(aState.Pen.widthF() * 16));
+}
+
+PathBatch::PathBatch()
+    : FeatureGroup(0)
+{
+}
+
+void PathBatch::nextFeature()
+{
+    FeatureGroup = 0;
+}
+
+void PathBatch::add(QPainter* P, const QPainterPath& aPath)
+{
+    add(aPath, P->pen(), P->brush(), P->opacity());
+}
+
+void PathBatch::addStroke(QPainter* P, const QPainterPath& aPath, const QPen& aPen)
+{
+    add(aPath, aPen, QBrush(Qt::NoBrush), P->opacity());
+}
+
+void PathBatch::add(const QPainterPath& aPath, const QPen& aPen, const QBrush& aBrush, qreal anOpacity)
+{
+    if (aPath.isEmpty())
+        return;
+
+    PathState S;
+    S.Pen = aPen;
+    S.Brush = aBrush;
+    S.Opacity = anOpacity;
+
+    // An earlier group would draw this path before the previous one of its
+    // feature (e.g. a fill before its own casing)
+    QHash<PathState, int>::const_iterator it = Index.constFind(S);
+    int g;
+    if (it != Index.constEnd() && it.value() >= FeatureGroup) {
+        g = it.value();
+    } else {
+        PathGroup G;
+        G.State = S;
+        // Only opaque strokes look the same drawn as one path: filled
+        // paths would cancel out where they overlap, translucent ones
+        // would no longer blend over each other
+        G.Merged = aBrush.style() == Qt::NoBrush && aPen.style() != Qt::NoPen
+                && aPen.brush().style() == Qt::SolidPattern && aPen.color().alpha() == 255
+                && anOpacity == 1.;
+        Groups.append(G);
+        g = Groups.size()-1;
+        Index.insert(S, g);
+    }
+    FeatureGroup = g;
+
+    PathGroup& G = Groups[g];
+    if (G.Merged && !G.Paths.isEmpty())
+        G.Paths.last().addPath(aPath);
+    else
+        G.Paths.append(aPath);
+}
+
+void PathBatch::flush(QPainter* P)
+{
+    if (Groups.isEmpty())
+        return;
+
+    int DrawCalls = 0;
+    P->save();
+    foreach (const PathGroup& G, Groups) {
+        P->setPen(G.State.Pen);
+        P->setBrush(G.State.Brush);
+        P->setOpacity(G.State.Opacity);
+        foreach (const QPainterPath& Path, G.Paths)
+            P->drawPath(Path);
+        DrawCalls += G.Paths.size();
+    }
+    P->restore();
+    RenderProfiler::count(RenderProfiler::DrawCalls, DrawCalls);
+
+    Groups.clear();
+    Index.clear();
+    FeatureGroup = 0;
+}
+
+/*** SymbolBatch ***/
+
+SymbolBatch::SymbolBatch()
+    : CullScale(0.)
+{
+}
+
+void SymbolBatch::clear(qreal aCullScale)
+{
+    CullScale = aCullScale;
+    Icons.clear();
+    IconPositions.clear();
+    Culled.clear();
+    UnderSquares.clear();
+    Squares.clear();
+}
+
+const QImage* SymbolBatch::icon(const FeaturePainter* aPainter, const QString& aName, int aSize)
+{
+    QHash<const FeaturePainter*, const QImage*>::const_iterator it = Icons.constFind(aPainter);
+    if (it != Icons.constEnd())
+        return it.value();
+    const QImage* theIcon = getSVGImageFromFile(aName, aSize);
+    Icons.insert(aPainter, theIcon);
+    return theIcon;
+}
+
+void SymbolBatch::addIcon(Node* N, const QImage* anIcon, const QPointF& C, qreal anOpacity)
+{
+    IconKey Key(anIcon, qRound(anOpacity*255));
+    QPoint TopLeft(int(C.x()-anIcon->width()/2), int(C.y()-anIcon->height()/2));
+    if (CullScale <= 0. || !N) {
+        IconPositions[Key].append(TopLeft);
+        return;
+    }
+
+    // The cells are laid out in projected coordinates and the lowest node
+    // of a cell is kept, so that neighbouring tiles agree on what is shown
+    int Size = qMax(anIcon->width(), anIcon->height());
+    qreal CellSize = Size * CullScale;
+    int cx = qFloor(N->projected().x() / CellSize);
+    int cy = qFloor(N->projected().y() / CellSize);
+    quint64 Cell = (quint64(Size & 0xff) << 56) | (quint64(cx & 0xfffffff) << 28) | quint64(cy & 0xfffffff);
+    QHash<quint64, CulledIcon>::iterator it = Culled.find(Cell);
+    if (it != Culled.end() && quintptr(it.value().N) < quintptr(N))
+        return;
+    CulledIcon I = { N, Key, TopLeft };
+    Culled.insert(Cell, I);
+}
+
+void SymbolBatch::addSquare(const QRect& R, const QColor& aColor, qreal anOpacity, bool Under)
+{
+    SquareKey Key(aColor.rgba(), qRound(anOpacity*255));
+    if (Under)
+        UnderSquares[Key].append(R);
+    else
+        Squares[Key].append(R);
+}
+
+void SymbolBatch::drawSquares(QPainter* P, const QMap<SquareKey, QVector<QRect> >& theSquares)
+{
+    QMap<SquareKey, QVector<QRect> >::const_iterator it;
+    for (it = theSquares.constBegin(); it != theSquares.constEnd(); ++it) {
+        P->setOpacity(it.key().second / 255.);
+        P->setBrush(QColor::fromRgba(it.key().first));
+        P->drawRects(it.value());
+    }
+    RenderProfiler::count(RenderProfiler::DrawCalls, theSquares.size());
+}
+
+void SymbolBatch::draw(QPainter* P)
+{
+    QHash<quint64, CulledIcon>::const_iterator c;
+    for (c = Culled.constBegin(); c != Culled.constEnd(); ++c)
+        IconPositions[c.value().Key].append(c.value().TopLeft);
+    Culled.clear();
+
+    if (IconPositions.isEmpty() && UnderSquares.isEmpty() && Squares.isEmpty())
+        return;
+
+    P->save();
+    // Squares are filled like fillRect did, without antialiasing
+    P->setRenderHint(QPainter::Antialiasing, false);
+    P->setPen(Qt::NoPen);
+    drawSquares(P, UnderSquares);
+    drawSquares(P, Squares);
+
+    QMap<IconKey, QVector<QPoint> >::const_iterator it;
+    for (it = IconPositions.constBegin(); it != IconPositions.constEnd(); ++it) {
+        P->setOpacity(it.key().second / 255.);
+        const QImage& theIcon = *it.key().first;
+        foreach (const QPoint& Pt, it.value())
+            P->drawImage(Pt, theIcon);
+        RenderProfiler::count(RenderProfiler::DrawCalls, it.value().size());
+    }
+    P->restore();
+}
+
 /*** MapRenderer ***/
 
 MapRenderer::MapRenderer()
@@ -252,6 +446,7 @@ void MapRenderer::render(
 
     theOptions = options;
     theGlobalPainter = M_STYLE->getGlobalPainter();
+    theSymbols.clear(thePixelPerM < M_PREFS->getLocalZoom() ? 1. / ScaleLon : 0.);
     if (theGlobalPainter.DrawNodes) {
         NodeWidth = thePixelPerM*theGlobalPainter.NodesProportional+theGlobalPainter.NodesFixed;
     } else {
@@ -282,7 +477,9 @@ void MapRenderer::render(
         {
             if (bgLayerVisible)
             {
+                ProfileScope theProfileScope(RenderProfiler::Background);
                 for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+                    thePaths.nextFeature();
                     qreal alpha = (*it)->getAlpha();
                     if ((*it)->isReadonly() && !TEST_RFLAGS(RendererOptions::ForPrinting))
                         alpha /= 2.0;
@@ -305,6 +502,7 @@ void MapRenderer::render(
                         P->restore();
                     }
                 }
+                thePaths.flush(P);
             }
             ++itm;
         }
@@ -313,7 +511,9 @@ void MapRenderer::render(
         {
             if (fgLayerVisible)
             {
+                ProfileScope theProfileScope(RenderProfiler::Foreground);
                 for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+                    thePaths.nextFeature();
                     qreal alpha = (*it)->getAlpha();
                     if ((*it)->isReadonly() && !TEST_RFLAGS(RendererOptions::ForPrinting))
                         alpha /= 2.0;
@@ -336,14 +536,17 @@ void MapRenderer::render(
                         P->restore();
                     }
                 }
+                thePaths.flush(P);
             }
             ++itm;
         }
     }
     if (tchpLayerVisible)
     {
+        ProfileScope theProfileScope(RenderProfiler::Touchup);
         for (itm = theFeatures.constBegin() ;itm != theFeatures.constEnd(); ++itm) {
             for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
+                thePaths.nextFeature();
                 qreal alpha = (*it)->getAlpha();
                 if ((*it)->isReadonly() && !TEST_RFLAGS(RendererOptions::ForPrinting))
                     alpha /= 2.0;
@@ -366,11 +569,14 @@ void MapRenderer::render(
                     P->restore();
                 }
             }
+            thePaths.flush(P);
         }
+        theSymbols.draw(P);
     }
 
     if (lblLayerVisible)
     {
+        ProfileScope theProfileScope(RenderProfiler::Labels);
         for (itm = theFeatures.constBegin() ;itm != theFeatures.constEnd(); ++itm) {
             for (it = itm.value().constBegin(); it != itm.value().constEnd(); ++it) {
                 P->save();
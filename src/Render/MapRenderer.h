@@ -15,8 +15,12 @@
 #include "FeaturePainter.h"
 
 #include <QPainter>
+#include <QPainterPath>
 #include <QTransform>
 #include <QList>
+#include <QHash>
+#include <QMap>
+#include <QVector>
 
 #include "Feature.h"
 #include "IRenderer.h"
@@ -82,6 +86,97 @@ public:
     virtual void draw(Relation* R);
 };
 
+/// Pen, brush and opacity a path is drawn with
+struct PathState
+{
+    QPen Pen;
+    QBrush Brush;
+    qreal Opacity;
+
+    bool operator==(const PathState& other) const
+    {
+        return Opacity == other.Opacity && Pen == other.Pen && Brush == other.Brush;
+    }
+};
+uint qHash(const PathState& aState);
+
+/// Paths of a render stage. Features record their path with the pen, brush
+/// and opacity it is to be drawn with; flush() then replays the paths of
+/// each state together, in the order the states were first seen. The paths
+/// of one feature are never reordered: a path only joins a group that is
+/// drawn after the previous path of its feature, otherwise it starts a new
+/// one. Opaque strokes of the same state are merged into one path and one
+/// draw call.
+class PathBatch
+{
+public:
+    PathBatch();
+
+    /// The following paths belong to another feature
+    void nextFeature();
+    /// Records aPath with the current pen, brush and opacity of P
+    void add(QPainter* P, const QPainterPath& aPath);
+    /// Records aPath as strokePath would draw it
+    void addStroke(QPainter* P, const QPainterPath& aPath, const QPen& aPen);
+    void flush(QPainter* P);
+
+private:
+    struct PathGroup
+    {
+        PathState State;
+        bool Merged;
+        QList<QPainterPath> Paths;
+    };
+
+    void add(const QPainterPath& aPath, const QPen& aPen, const QBrush& aBrush, qreal anOpacity);
+
+    QList<PathGroup> Groups;
+    /// Latest group of each state
+    QHash<PathState, int> Index;
+    /// Group of the previous path of the current feature
+    int FeatureGroup;
+};
+
+/// Point symbols of the touchup stage. Nodes are not painted one by one:
+/// their icons and squares are collected while the features are walked and
+/// drawn at the end of the stage, grouped by symbol and opacity, so that
+/// the painter state is only set once per group. Below LocalZoom, only one
+/// icon is kept per cell of its own size.
+class SymbolBatch
+{
+public:
+    SymbolBatch();
+
+    void clear(qreal aCullScale);
+    /// Icon of a painter at the size of this render, looked up once
+    const QImage* icon(const FeaturePainter* aPainter, const QString& aName, int aSize);
+    /// Icons without a node, such as those of areas, are never culled
+    void addIcon(Node* N, const QImage* anIcon, const QPointF& C, qreal anOpacity);
+    /// Under squares mark special and waypoint nodes, they go below the others
+    void addSquare(const QRect& R, const QColor& aColor, qreal anOpacity, bool Under=false);
+    void draw(QPainter* P);
+
+private:
+    typedef QPair<const QImage*, int> IconKey;
+    typedef QPair<QRgb, int> SquareKey;
+    struct CulledIcon
+    {
+        Node* N;
+        IconKey Key;
+        QPoint TopLeft;
+    };
+
+    void drawSquares(QPainter* P, const QMap<SquareKey, QVector<QRect> >& theSquares);
+
+    /// Projected meters per pixel, 0 if the icons are not culled
+    qreal CullScale;
+    QHash<const FeaturePainter*, const QImage*> Icons;
+    QMap<IconKey, QVector<QPoint> > IconPositions;
+    QHash<quint64, CulledIcon> Culled;
+    QMap<SquareKey, QVector<QRect> > UnderSquares;
+    QMap<SquareKey, QVector<QRect> > Squares;
+};
+
 class MapRenderer
 {
 public:
@@ -111,6 +206,8 @@ public:
     QPainter* thePainter;
     RendererOptions theOptions;
     GlobalPainter theGlobalPainter;
+    PathBatch thePaths;
+    SymbolBatch theSymbols;
 
     QPoint toView(Node *aPt) const;
 
@@ -4,12 +4,16 @@ DEPENDPATH += $$MERKAARTOR_SRC_DIR/Render
 # Header files
 HEADERS += \
     FeaturePainter.h \
-    MapRenderer.h
+    MapRenderer.h \
+    RenderProfiler.h \
+    WireframeCache.h
 
 # Source files
 SOURCES += \
     FeaturePainter.cpp \
-    MapRenderer.cpp
+    MapRenderer.cpp \
+    RenderProfiler.cpp \
+    WireframeCache.cpp
 
 isEmpty(MOBILE) {
   QT += svg
@@ -0,0 +1,341 @@
+#include "RenderProfiler.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+#define MAX_TRACE_EVENTS (1 << 20)
+
+/* Fine grained sections (paths, painter matching) run for every feature,
+   they are only summed up and not kept as trace events */
+static const struct
+{
+    const char* Name;
+    bool Timed;
+    bool Traced;
+} Metrics[RenderProfiler::MetricCount] = {
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Frame"), true, true },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Tile"), true, true },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Feature query"), true, true },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Path building"), true, false },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Painter matching"), true, false },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Background"), true, true },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Foreground"), true, true },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Touchup"), true, true },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Labels"), true, true },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Features queried"), false, false },
+    { QT_TRANSLATE_NOOP("RenderProfiler", "Draw calls"), false, false }
+};
+
+struct TraceEvent
+{
+    RenderProfiler::Metric Metric;
+    qint64 Start;
+    qint64 Duration;
+    /// Tile and its figures, for tile events
+    QPoint Tile;
+    qint64 Features;
+    qint64 Paths;
+    qint64 DrawCalls;
+};
+
+/* Profile data of a thread. Totals and Events are taken by the gui thread
+   under Lock; the tile being rendered is only seen by the thread itself. */
+struct ProfileThread
+{
+    ProfileThread()
+        : Id(0), InTile(false)
+    {
+    }
+
+    int Id;
+    QString Name;
+    QMutex Lock;
+    RenderProfiler::Stats Totals;
+    QVector<TraceEvent> Events;
+
+    bool InTile;
+    QPoint Tile;
+    RenderProfiler::Stats TileTotals;
+};
+
+static thread_local ProfileThread* theThread = NULL;
+static QElapsedTimer theClock;
+
+/**************************/
+
+RenderProfiler::Stats::Stats()
+{
+    for (int i=0; i<MetricCount; ++i) {
+        Count[i] = 0;
+        Time[i] = 0;
+    }
+}
+
+void RenderProfiler::Stats::add(const Stats& other)
+{
+    for (int i=0; i<MetricCount; ++i) {
+        Count[i] += other.Count[i];
+        Time[i] += other.Time[i];
+    }
+}
+
+RenderProfiler::FrameProfile::FrameProfile()
+    : Number(0), Start(0), Duration(0)
+{
+}
+
+/**************************/
+
+QAtomicInt RenderProfiler::Enabled(0);
+RenderProfiler* RenderProfiler::m_instance = 0;
+
+RenderProfiler::RenderProfiler()
+    : InFrame(false), FrameNumber(0), EventCount(0)
+{
+    theClock.start();
+}
+
+RenderProfiler* RenderProfiler::instance()
+{
+    if (!m_instance)
+        m_instance = new RenderProfiler;
+
+    return m_instance;
+}
+
+qint64 RenderProfiler::now()
+{
+    return theClock.nsecsElapsed() / 1000;
+}
+
+QString RenderProfiler::metricName(Metric m)
+{
+    return QCoreApplication::translate("RenderProfiler", Metrics[m].Name);
+}
+
+bool RenderProfiler::isTimed(Metric m)
+{
+    return Metrics[m].Timed;
+}
+
+void RenderProfiler::setEnabled(bool b)
+{
+    if (b == isEnabled())
+        return;
+    if (!b)
+        endFrame();
+    Enabled.store(b);
+}
+
+ProfileThread* RenderProfiler::currentThread()
+{
+    if (!theThread) {
+        ProfileThread* T = new ProfileThread;
+        QMutexLocker locker(&Lock);
+        T->Id = Threads.size() + 1;
+        if (QThread::currentThread() == QCoreApplication::instance()->thread())
+            T->Name = "GUI";
+        else
+            T->Name = QString("Render %1").arg(T->Id);
+        Threads << T;
+        theThread = T;
+    }
+    return theThread;
+}
+
+void RenderProfiler::addEvent(ProfileThread* T, Metric m, qint64 aStart, qint64 aDuration)
+{
+    if (EventCount.fetchAndAddRelaxed(1) >= MAX_TRACE_EVENTS)
+        return;
+
+    TraceEvent E;
+    E.Metric = m;
+    E.Start = aStart;
+    E.Duration = aDuration;
+    E.Features = E.Paths = E.DrawCalls = 0;
+    if (m == Tile) {
+        E.Tile = T->Tile;
+        E.Features = T->TileTotals.Count[FeaturesQueried];
+        E.Paths = T->TileTotals.Count[BuildPath];
+        E.DrawCalls = T->TileTotals.Count[DrawCalls];
+    }
+    T->Events.append(E);
+}
+
+void RenderProfiler::beginFrame()
+{
+    if (!isEnabled())
+        return;
+    endFrame();
+
+    QMutexLocker locker(&Lock);
+    // Whatever was done between frames is not part of this one
+    foreach (ProfileThread* T, Threads) {
+        QMutexLocker threadLocker(&T->Lock);
+        T->Totals = Stats();
+    }
+    InFrame = true;
+    Current = FrameProfile();
+    Current.Number = ++FrameNumber;
+    Current.Start = now();
+}
+
+void RenderProfiler::endFrame()
+{
+    ProfileThread* Gui = currentThread();
+
+    QMutexLocker locker(&Lock);
+    if (!InFrame)
+        return;
+    InFrame = false;
+
+    Current.Duration = now() - Current.Start;
+    foreach (ProfileThread* T, Threads) {
+        QMutexLocker threadLocker(&T->Lock);
+        Current.Totals.add(T->Totals);
+        T->Totals = Stats();
+    }
+    Current.Totals.Count[Frame] = 1;
+    Current.Totals.Time[Frame] = Current.Duration;
+    {
+        QMutexLocker threadLocker(&Gui->Lock);
+        addEvent(Gui, Frame, Current.Start, Current.Duration);
+    }
+
+    Last = Current;
+    Current.Tiles.clear();
+    Frames << Current;
+    locker.unlock();
+
+    emit frameFinished();
+}
+
+qint64 RenderProfiler::beginTile(const QPoint& aTile)
+{
+    ProfileThread* T = currentThread();
+    T->InTile = true;
+    T->Tile = aTile;
+    T->TileTotals = Stats();
+    return now();
+}
+
+void RenderProfiler::endTile(qint64 aStart)
+{
+    qint64 Duration = now() - aStart;
+    ProfileThread* T = currentThread();
+    T->InTile = false;
+
+    TileProfile P;
+    P.Tile = T->Tile;
+    P.Thread = T->Id;
+    P.Start = aStart;
+    P.Duration = Duration;
+    P.Totals = T->TileTotals;
+    P.Totals.Count[Tile] = 1;
+    P.Totals.Time[Tile] = Duration;
+    {
+        QMutexLocker threadLocker(&T->Lock);
+        T->Totals.Count[Tile]++;
+        T->Totals.Time[Tile] += Duration;
+        addEvent(T, Tile, aStart, Duration);
+    }
+
+    QMutexLocker locker(&Lock);
+    if (InFrame)
+        Current.Tiles << P;
+}
+
+void RenderProfiler::addTime(Metric m, qint64 aStart)
+{
+    qint64 Duration = now() - aStart;
+    ProfileThread* T = currentThread();
+    if (T->InTile) {
+        T->TileTotals.Count[m]++;
+        T->TileTotals.Time[m] += Duration;
+    }
+
+    QMutexLocker threadLocker(&T->Lock);
+    T->Totals.Count[m]++;
+    T->Totals.Time[m] += Duration;
+    if (Metrics[m].Traced)
+        addEvent(T, m, aStart, Duration);
+}
+
+void RenderProfiler::addCount(Metric m, qint64 n)
+{
+    ProfileThread* T = currentThread();
+    if (T->InTile)
+        T->TileTotals.Count[m] += n;
+
+    QMutexLocker threadLocker(&T->Lock);
+    T->Totals.Count[m] += n;
+}
+
+RenderProfiler::FrameProfile RenderProfiler::lastFrame() const
+{
+    QMutexLocker locker(&Lock);
+    return Last;
+}
+
+int RenderProfiler::eventCount() const
+{
+    return qMin(int(EventCount.load()), MAX_TRACE_EVENTS);
+}
+
+int RenderProfiler::droppedEvents() const
+{
+    return qMax(int(EventCount.load()) - MAX_TRACE_EVENTS, 0);
+}
+
+void RenderProfiler::clear()
+{
+    QMutexLocker locker(&Lock);
+    foreach (ProfileThread* T, Threads) {
+        QMutexLocker threadLocker(&T->Lock);
+        T->Events.clear();
+    }
+    Frames.clear();
+    Last = FrameProfile();
+    EventCount.store(0);
+}
+
+bool RenderProfiler::writeTrace(QIODevice* aDevice) const
+{
+    QTextStream out(aDevice);
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Rendering\"}}";
+
+    QMutexLocker locker(&Lock);
+    foreach (ProfileThread* T, Threads) {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << T->Id
+            << ",\"args\":{\"name\":\"" << T->Name << "\"}}";
+
+        QMutexLocker threadLocker(&T->Lock);
+        foreach (const TraceEvent& E, T->Events) {
+            out << ",\n{\"name\":\"" << Metrics[E.Metric].Name << "\",\"cat\":\"render\",\"ph\":\"X\",\"pid\":1,\"tid\":" << T->Id
+                << ",\"ts\":" << E.Start << ",\"dur\":" << E.Duration;
+            if (E.Metric == Tile)
+                out << ",\"args\":{\"x\":" << E.Tile.x() << ",\"y\":" << E.Tile.y()
+                    << ",\"features\":" << E.Features << ",\"paths\":" << E.Paths
+                    << ",\"drawCalls\":" << E.DrawCalls << "}";
+            out << "}";
+        }
+    }
+
+    // The totals of each frame as counters, drawn as graphs along the events
+    foreach (const FrameProfile& F, Frames) {
+        out << ",\n{\"name\":\"Frame totals\",\"ph\":\"C\",\"pid\":1,\"ts\":" << F.Start
+            << ",\"args\":{\"tiles\":" << F.Totals.Count[Tile]
+            << ",\"features\":" << F.Totals.Count[FeaturesQueried]
+            << ",\"paths\":" << F.Totals.Count[BuildPath]
+            << ",\"drawCalls\":" << F.Totals.Count[DrawCalls] << "}}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    out.flush();
+    return out.status() == QTextStream::Ok;
+}
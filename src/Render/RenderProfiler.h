@@ -0,0 +1,160 @@
+#ifndef RENDERPROFILER_H
+#define RENDERPROFILER_H
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPoint>
+#include <QString>
+
+class QIODevice;
+struct ProfileThread;
+
+/// Where the time of a redraw goes. The hot paths of rendering are timed
+/// with a ProfileScope and counted with RenderProfiler::count(); while the
+/// profiler is off, both only test a flag. The figures are kept per tile
+/// and per frame, a frame being all the tiles of one redraw of the map.
+/// The coarse sections are also kept as events, which can be saved as a
+/// Chrome trace (chrome://tracing, Perfetto).
+class RenderProfiler : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Metric
+    {
+        Frame,
+        Tile,
+        FeatureQuery,
+        BuildPath,
+        PainterMatch,
+        Background,
+        Foreground,
+        Touchup,
+        Labels,
+        FeaturesQueried,
+        DrawCalls,
+        MetricCount
+    };
+
+    /// Count and time (us) of each metric. Sections nest, so times are
+    /// inclusive: a path built while querying counts for both.
+    struct Stats
+    {
+        Stats();
+        void add(const Stats& other);
+
+        qint64 Count[MetricCount];
+        qint64 Time[MetricCount];
+    };
+
+    struct TileProfile
+    {
+        QPoint Tile;
+        int Thread;
+        qint64 Start;
+        qint64 Duration;
+        Stats Totals;
+    };
+
+    struct FrameProfile
+    {
+        FrameProfile();
+
+        int Number;
+        qint64 Start;
+        qint64 Duration;
+        Stats Totals;
+        QList<TileProfile> Tiles;
+    };
+
+    static RenderProfiler* instance();
+    static bool isEnabled() { return Enabled.load(); }
+    static void count(Metric m, qint64 n=1)
+    {
+        if (isEnabled())
+            instance()->addCount(m, n);
+    }
+    /// Time (us) since the profiler was created
+    static qint64 now();
+    static QString metricName(Metric m);
+    /// Counters only have a count, the other metrics are timed sections
+    static bool isTimed(Metric m);
+
+    void setEnabled(bool b);
+    /// A frame runs from a redraw request until its last tile is done. A
+    /// frame still running when the next one begins is ended first.
+    void beginFrame();
+    void endFrame();
+
+    qint64 beginTile(const QPoint& aTile);
+    void endTile(qint64 aStart);
+    void addTime(Metric m, qint64 aStart);
+    void addCount(Metric m, qint64 n);
+
+    FrameProfile lastFrame() const;
+    /// Events kept for the trace, and those dropped once it was full
+    int eventCount() const;
+    int droppedEvents() const;
+    void clear();
+    bool writeTrace(QIODevice* aDevice) const;
+
+signals:
+    /// Emitted from the gui thread when a frame has ended
+    void frameFinished();
+
+private:
+    RenderProfiler();
+
+    ProfileThread* currentThread();
+    void addEvent(ProfileThread* T, Metric m, qint64 aStart, qint64 aDuration);
+
+    static QAtomicInt Enabled;
+    static RenderProfiler* m_instance;
+
+    /// Protects the threads and frames
+    mutable QMutex Lock;
+    QList<ProfileThread*> Threads;
+    bool InFrame;
+    int FrameNumber;
+    FrameProfile Current;
+    FrameProfile Last;
+    /// Frames of the session without their tiles, for the trace counters
+    QList<FrameProfile> Frames;
+    QAtomicInt EventCount;
+};
+
+/// Times a section of rendering into the profiler, if it is on
+class ProfileScope
+{
+public:
+    explicit ProfileScope(RenderProfiler::Metric aMetric)
+        : theMetric(aMetric), Start(-1)
+    {
+        if (RenderProfiler::isEnabled())
+            Start = RenderProfiler::now();
+    }
+    /// Times a tile; what the thread does meanwhile is accounted to it
+    explicit ProfileScope(const QPoint& aTile)
+        : theMetric(RenderProfiler::Tile), Start(-1)
+    {
+        if (RenderProfiler::isEnabled())
+            Start = RenderProfiler::instance()->beginTile(aTile);
+    }
+    ~ProfileScope()
+    {
+        if (Start < 0)
+            return;
+        if (theMetric == RenderProfiler::Tile)
+            RenderProfiler::instance()->endTile(Start);
+        else
+            RenderProfiler::instance()->addTime(theMetric, Start);
+    }
+
+private:
+    RenderProfiler::Metric theMetric;
+    qint64 Start;
+};
+
+#endif // RENDERPROFILER_H
@@ -0,0 +1,149 @@
+#include "WireframeCache.h"
+
+#include "Document.h"
+#include "Layer.h"
+#include "Features.h"
+#include "MemoryBackend.h"
+#include "Projection.h"
+#include "Global.h"
+
+#include <QPainter>
+#include <QSet>
+
+namespace {
+
+struct WireBatch
+{
+    QPen Pen;
+    qreal Opacity;
+    QVector<QPointF> Pairs;
+    QList<QPolygonF> Polylines;
+};
+
+}
+
+WireframeCache::WireframeCache()
+    : ProjectionRevision(-1), BackendMark(0)
+{
+}
+
+void WireframeCache::clear()
+{
+    Buffers.clear();
+    BackendMark = g_backend.changeMark();
+}
+
+void WireframeCache::sync(Document* theDocument, const QTransform& theTransform, const Projection& theProjection)
+{
+    bool sameScale =
+        theTransform.m11() == Base.m11() && theTransform.m12() == Base.m12() &&
+        theTransform.m21() == Base.m21() && theTransform.m22() == Base.m22();
+    if (!sameScale || theProjection.projectionRevision() != ProjectionRevision) {
+        clear();
+        Base = theTransform;
+        ProjectionRevision = theProjection.projectionRevision();
+    }
+    Offset = QPointF(theTransform.dx() - Base.dx(), theTransform.dy() - Base.dy());
+
+    // Buffers of layers that went away
+    QSet<ILayer*> theLayers;
+    if (theDocument)
+        for (int i=0; i<theDocument->layerSize(); ++i)
+            theLayers.insert(theDocument->getLayer(i));
+    QHash<ILayer*, LayerBuffer>::iterator it = Buffers.begin();
+    while (it != Buffers.end()) {
+        if (!theLayers.contains(it.key()))
+            it = Buffers.erase(it);
+        else
+            ++it;
+    }
+
+    QList<Feature*> Changed;
+    if (!g_backend.changesSince(BackendMark, Changed)) {
+        clear();
+        return;
+    }
+    BackendMark = g_backend.changeMark();
+    // The feature may be gone, or have moved to another layer
+    foreach (Feature* F, Changed)
+        for (it = Buffers.begin(); it != Buffers.end(); ++it)
+            it.value().remove(F);
+}
+
+const QPolygonF& WireframeCache::polyline(Way* W, const Projection& theProjection)
+{
+    LayerBuffer& theBuffer = Buffers[W->layer()];
+    LayerBuffer::iterator it = theBuffer.find(W);
+    if (it != theBuffer.end())
+        return it.value();
+
+    // Same points as Way::buildPath
+    QPolygonF thePolyline;
+    if (W->size() > 1) {
+        thePolyline.reserve(W->size());
+        for (int i=0; i<W->size(); ++i)
+            if (!W->getNode(i)->notEverythingDownloaded())
+                thePolyline << Base.map(W->getNode(i)->projected(theProjection));
+    }
+    return theBuffer.insert(W, thePolyline).value();
+}
+
+void WireframeCache::drawWays(QPainter& P, const QList<Way*>& theWays, const Projection& theProjection)
+{
+    if (theWays.isEmpty())
+        return;
+
+    QHash<quint64, WireBatch> Batches;
+    QPen thePen;
+    QBrush theBrush;
+
+    foreach (Way* W, theWays) {
+        const QPolygonF& thePolyline = polyline(W, theProjection);
+        if (thePolyline.size() < 2)
+            continue;
+
+        thePen = QPen(Qt::NoPen);
+        theBrush = QBrush(Qt::NoBrush);
+        W->simpleStyle(thePen, theBrush);
+        qreal alpha = W->getAlpha();
+
+        // Filled areas are drawn right away, there are few of them
+        if (theBrush.style() != Qt::NoBrush) {
+            P.setOpacity(alpha);
+            P.setPen(thePen);
+            P.setBrush(theBrush);
+            P.drawPolygon(thePolyline.translated(Offset));
+            continue;
+        }
+        if (thePen.style() == Qt::NoPen)
+            continue;
+
+        quint64 key = (quint64(thePen.color().rgba()) << 32)
+                | (quint64(qRound(thePen.widthF() * 256) & 0xffffff) << 8)
+                | quint64(qRound(alpha * 255) & 0xff);
+        WireBatch& B = Batches[key];
+        if (B.Pairs.isEmpty() && B.Polylines.isEmpty()) {
+            B.Pen = thePen;
+            B.Opacity = alpha;
+        }
+        // Joins only show on wide lines
+        if (thePen.widthF() <= 1.) {
+            for (int i=1; i<thePolyline.size(); ++i)
+                B.Pairs << thePolyline[i-1] << thePolyline[i];
+        } else
+            B.Polylines << thePolyline;
+    }
+
+    P.save();
+    P.translate(Offset);
+    P.setBrush(Qt::NoBrush);
+    foreach (const WireBatch& B, Batches) {
+        P.setOpacity(B.Opacity);
+        P.setPen(B.Pen);
+        if (!B.Pairs.isEmpty())
+            P.drawLines(B.Pairs);
+        foreach (const QPolygonF& thePolyline, B.Polylines)
+            P.drawPolyline(thePolyline);
+    }
+    P.restore();
+}
@@ -0,0 +1,46 @@
+#ifndef WIREFRAMECACHE_H
+#define WIREFRAMECACHE_H
+
+#include <QHash>
+#include <QList>
+#include <QPolygonF>
+#include <QTransform>
+
+class QPainter;
+class Document;
+class ILayer;
+class Feature;
+class Way;
+class Projection;
+
+/// Screen-space polylines of the ways drawn in wireframe, kept per layer.
+/// The points are cached under the transform of the last zoom, so that a
+/// pan only shifts them by an offset. A way is only rebuilt when the
+/// backend change log says it changed, and everything is dropped when the
+/// scale, rotation or projection changes.
+class WireframeCache
+{
+public:
+    WireframeCache();
+
+    void sync(Document* theDocument, const QTransform& theTransform, const Projection& theProjection);
+    void clear();
+
+    /// Draws theWays grouped by pen, thin lines in a single drawLines call.
+    /// The ways are expected to share a RenderPriority: a call per priority
+    /// keeps the drawing order of the map.
+    void drawWays(QPainter& P, const QList<Way*>& theWays, const Projection& theProjection);
+
+private:
+    const QPolygonF& polyline(Way* W, const Projection& theProjection);
+
+    typedef QHash<Feature*, QPolygonF> LayerBuffer;
+    QHash<ILayer*, LayerBuffer> Buffers;
+
+    QTransform Base;
+    QPointF Offset;
+    int ProjectionRevision;
+    int BackendMark;
+};
+
+#endif // WIREFRAMECACHE_H
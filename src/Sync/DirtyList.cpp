@@ -49,7 +49,7 @@ bool DirtyListBuild::add(Feature* F)
     if (!F->isDirty()) return false;
     //if (F->hasOSMId()) return false;
 
-    Added.push_back(F);
+    Added.insert(F);
     return false;
 }
 
@@ -57,14 +57,11 @@ bool DirtyListBuild::update(Feature* F)
 {
     if (!F->isDirty()) return false;
 
-    for (int i=0; i<Updated.size(); ++i)
-        if (Updated[i] == F)
-        {
-            UpdateCounter[i].first++;
-            return false;
-        }
-    Updated.push_back(F);
-    UpdateCounter.push_back(qMakePair((int) 1, (int)0));
+    QHash<Feature*, QPair<int, int> >::iterator it = UpdateCounter.find(F);
+    if (it != UpdateCounter.end())
+        it.value().first++;
+    else
+        UpdateCounter.insert(F, qMakePair((int) 1, (int)0));
     return false;
 }
 
@@ -72,35 +69,34 @@ bool DirtyListBuild::erase(Feature* F)
 {
     if (!F->isDirty()) return false;
 
-    Deleted.push_back(F);
+    Deleted.insert(F);
     return false;
 }
 
 bool DirtyListBuild::willBeAdded(Feature* F) const
 {
-    return std::find(Added.begin(),Added.end(),F) != Added.end();
+    return Added.contains(F);
 }
 
 bool DirtyListBuild::willBeErased(Feature* F) const
 {
-    return std::find(Deleted.begin(),Deleted.end(),F) != Deleted.end();
+    return Deleted.contains(F);
 }
 
 bool DirtyListBuild::updateNow(Feature* F) const
 {
-    for (int i=0; i<Updated.size(); ++i)
-        if (Updated[i] == F)
-        {
-            UpdateCounter[i].second++;
-            return UpdateCounter[i].first == UpdateCounter[i].second;
-        }
-    return false;
+    QHash<Feature*, QPair<int, int> >::iterator it = UpdateCounter.find(F);
+    if (it == UpdateCounter.end())
+        return false;
+    it.value().second++;
+    return it.value().first == it.value().second;
 }
 
 void DirtyListBuild::resetUpdates()
 {
-    for (int i=0; i<UpdateCounter.size(); ++i)
-        UpdateCounter[i].second = 0;
+    QHash<Feature*, QPair<int, int> >::iterator it = UpdateCounter.begin();
+    for (; it != UpdateCounter.end(); ++it)
+        it.value().second = 0;
 }
 
 /* DIRTYLISTVISIT */
@@ -115,20 +111,23 @@ bool DirtyListVisit::runVisit()
     DeletePass = false;
     document()->history().buildDirtyList(*this);
     DeletePass = true;
-    for (int i=0; i<RelationsToDelete.uniqueKeys().size(); i++) {
-        if (!RelationsToDelete.uniqueKeys()[i]->hasOSMId())
+    QList<Relation*> Relations = RelationsToDelete.keys();
+    for (int i=0; i<Relations.size(); i++) {
+        if (!Relations[i]->hasOSMId())
             continue;
-        RelationsToDelete[RelationsToDelete.uniqueKeys()[i]] = eraseRelation(RelationsToDelete.uniqueKeys()[i]);
+        RelationsToDelete[Relations[i]] = eraseRelation(Relations[i]);
     }
-    for (int i=0; i<RoadsToDelete.uniqueKeys().size(); i++) {
-        if (!RoadsToDelete.uniqueKeys()[i]->hasOSMId())
+    QList<Way*> Roads = RoadsToDelete.keys();
+    for (int i=0; i<Roads.size(); i++) {
+        if (!Roads[i]->hasOSMId())
             continue;
-        RoadsToDelete[RoadsToDelete.uniqueKeys()[i]] = eraseRoad(RoadsToDelete.uniqueKeys()[i]);
+        RoadsToDelete[Roads[i]] = eraseRoad(Roads[i]);
     }
-    for (int i=0; i<TrackPointsToDelete.uniqueKeys().size(); i++) {
-        if (!TrackPointsToDelete.uniqueKeys()[i]->hasOSMId())
+    QList<Node*> TrackPoints = TrackPointsToDelete.keys();
+    for (int i=0; i<TrackPoints.size(); i++) {
+        if (!TrackPoints[i]->hasOSMId())
             continue;
-        TrackPointsToDelete[TrackPointsToDelete.uniqueKeys()[i]] = erasePoint(TrackPointsToDelete.uniqueKeys()[i]);
+        TrackPointsToDelete[TrackPoints[i]] = erasePoint(TrackPoints[i]);
     }
     return document()->history().buildDirtyList(*this);
 }
@@ -140,7 +139,7 @@ Document* DirtyListVisit::document()
 
 bool DirtyListVisit::notYetAdded(Feature* F)
 {
-    return std::find(AlreadyAdded.begin(),AlreadyAdded.end(),F) == AlreadyAdded.end();
+    return !AlreadyAdded.contains(F);
 }
 
 bool DirtyListVisit::add(Feature* F)
@@ -155,9 +154,9 @@ bool DirtyListVisit::add(Feature* F)
 
     if (Future.willBeErased(F))
         return EraseFromHistory;
-    for (int i=0; i<AlreadyAdded.size(); ++i)
-        if (AlreadyAdded[i] == F)
-            return EraseResponse[i];
+    QHash<Feature*, bool>::const_iterator it = AlreadyAdded.constFind(F);
+    if (it != AlreadyAdded.constEnd())
+        return it.value();
 
     bool x;
     if (Node* Pt = CAST_NODE(F))
@@ -168,8 +167,7 @@ bool DirtyListVisit::add(Feature* F)
                 x = updatePoint(Pt);
             else
                 x = addPoint(Pt);
-            AlreadyAdded.push_back(F);
-            EraseResponse.push_back(x);
+            AlreadyAdded.insert(F, x);
             return x;
         }
         else
@@ -185,8 +183,7 @@ bool DirtyListVisit::add(Feature* F)
             x = updateRoad(R);
         else
             x = addRoad(R);
-        AlreadyAdded.push_back(F);
-        EraseResponse.push_back(x);
+        AlreadyAdded.insert(F, x);
         return x;
     }
     else if (Relation* Rel = dynamic_cast<Relation*>(F))
@@ -198,8 +195,7 @@ bool DirtyListVisit::add(Feature* F)
             x = updateRelation(Rel);
         else
             x = addRelation(Rel);
-        AlreadyAdded.push_back(F);
-        EraseResponse.push_back(x);
+        AlreadyAdded.insert(F, x);
         return x;
     }
     return EraseFromHistory;
@@ -19,6 +19,8 @@ class QWidget;
 
 #include <utility>
 #include <QList>
+#include <QHash>
+#include <QSet>
 
 class DirtyList
 {
@@ -50,9 +52,8 @@ class DirtyListBuild : public DirtyList
         virtual void resetUpdates();
 
     protected:
-        QList<Feature*> Added, Deleted;
-        QList<Feature*> Updated;
-        mutable QList<QPair<int, int> > UpdateCounter;
+        QSet<Feature*> Added, Deleted;
+        mutable QHash<Feature*, QPair<int, int> > UpdateCounter;
 };
 
 class DirtyListVisit : public DirtyList
@@ -84,8 +85,7 @@ class DirtyListVisit : public DirtyList
         const DirtyListBuild& Future;
         bool EraseFromHistory;
         QList<Feature*> Updated;
-        QList<Feature*> AlreadyAdded;
-        QList<bool> EraseResponse;
+        QHash<Feature*, bool> AlreadyAdded;
         bool DeletePass;
         QMap<Node*, bool> TrackPointsToDelete;
         QMap<Way*, bool> RoadsToDelete;
@@ -25,18 +25,24 @@
 #include <QProgressDialog>
 #include <QRegExp>
 
+#include <QSet>
+
+// Server-side limit on the number of elements in a single changeset
+#define OSM_MAX_CHANGESET_ELEMENTS 10000
+
 extern int glbAdded, glbUpdated, glbDeleted;
 extern QString glbChangeSetComment;
 
 DirtyListExecutorOSC::DirtyListExecutorOSC(Document* aDoc, const DirtyListBuild& aFuture)
     : DirtyListVisit(aDoc, aFuture, false)
+    , Acknowledged(0)
     , Done(0)
     , theDownloader(0)
 {
 }
 
 DirtyListExecutorOSC::DirtyListExecutorOSC(Document* aDoc, const DirtyListBuild& aFuture, const QString& aWeb, const QString& aUser, const QString& aPwd, int aTasks)
-: DirtyListVisit(aDoc, aFuture, false), Tasks(aTasks), Done(0), Web(aWeb), User(aUser), Pwd(aPwd), theDownloader(0)
+: DirtyListVisit(aDoc, aFuture, false), Acknowledged(0), Tasks(aTasks), Done(0), Web(aWeb), User(aUser), Pwd(aPwd), theDownloader(0)
 {
     theDownloader = new Downloader(User, Pwd);
 }
@@ -107,6 +113,26 @@ QByteArray DirtyListExecutorOSC::getChanges()
     Progress->setMaximum(Tasks+2);
     Progress->show();
 
+    Changes.clear();
+    runVisit();
+    orderChanges();
+
+    startOsc();
+    writeChanges(0, Changes.size());
+    endOsc();
+
+    SAFE_DELETE(Progress)
+
+    return OscBuffer.buffer();
+}
+
+int DirtyListExecutorOSC::acknowledgedBatches() const
+{
+    return Acknowledged;
+}
+
+void DirtyListExecutorOSC::startOsc()
+{
     OscBuffer.buffer().clear();
     OscBuffer.open(QIODevice::WriteOnly);
 
@@ -116,15 +142,70 @@ QByteArray DirtyListExecutorOSC::getChanges()
     OscStream.writeStartElement("osmChange ");
     OscStream.writeAttribute("version", "0.3");
     OscStream.writeAttribute("generator", QString("Merkaartor %1").arg(STRINGIFY(VERSION)));
+}
 
-    runVisit();
-
-    SAFE_DELETE(Progress)
-
+void DirtyListExecutorOSC::endOsc()
+{
     OscStream.writeEndDocument();
     OscBuffer.close();
+}
 
-    return OscBuffer.buffer();
+void DirtyListExecutorOSC::orderChanges()
+{
+    // A batch can only refer to features the server already knows, so
+    // creations go first (nodes, ways, then relations, the visit having
+    // already put new relation members before their relation), then
+    // modifications, then deletions (relations, ways, then nodes).
+    QList<OscChange> Buckets[5];
+    QSet<QPair<int, Feature*> > Seen;
+    foreach (const OscChange& C, Changes) {
+        if (Seen.contains(qMakePair((int)C.action, C.feature)))
+            continue;
+        Seen.insert(qMakePair((int)C.action, C.feature));
+
+        // Already acknowledged by an earlier, interrupted upload
+        if (C.feature->isUploaded() && !C.feature->isDirty())
+            continue;
+
+        int b;
+        if (C.action == OscChange::Create) {
+            if (CHECK_NODE(C.feature))
+                b = 0;
+            else if (CHECK_WAY(C.feature))
+                b = 1;
+            else
+                b = 2;
+        } else if (C.action == OscChange::Modify)
+            b = 3;
+        else
+            b = 4;
+        Buckets[b].append(C);
+    }
+
+    Changes.clear();
+    for (int i=0; i<5; ++i)
+        Changes += Buckets[i];
+}
+
+void DirtyListExecutorOSC::writeChanges(int from, int to)
+{
+    LastAction.clear();
+    for (int i=from; i<to; ++i) {
+        switch (Changes[i].action) {
+        case OscChange::Create:
+            OscCreate(Changes[i].feature);
+            break;
+        case OscChange::Modify:
+            OscModify(Changes[i].feature);
+            break;
+        case OscChange::Delete:
+            OscDelete(Changes[i].feature);
+            break;
+        }
+    }
+    if (!LastAction.isEmpty())
+        OscStream.writeEndElement();
+    LastAction.clear();
 }
 
 bool DirtyListExecutorOSC::executeChanges(QWidget* aParent)
@@ -154,17 +235,11 @@ bool DirtyListExecutorOSC::executeChanges(QWidget* aParent)
 
     if ((ok = start()))
     {
-        OscBuffer.buffer().clear();
-        OscBuffer.open(QIODevice::WriteOnly);
-        OscStream.setDevice(&OscBuffer);
-        OscStream.writeStartDocument();
-
-        OscStream.writeStartElement("osmChange ");
-        OscStream.writeAttribute("version", "0.3");
-        OscStream.writeAttribute("generator", QString("Merkaartor %1").arg(STRINGIFY(VERSION)));
+        Changes.clear();
 
         Lbl->setText(QApplication::translate("Downloader","Preparing changes"));
         if ((ok = runVisit())) {
+            orderChanges();
             Lbl->setText(QApplication::translate("Downloader","Waiting for server response"));
             ok = stop();
         }
@@ -202,116 +277,130 @@ bool DirtyListExecutorOSC::start()
     return true;
 }
 
-bool DirtyListExecutorOSC::stop()
+bool DirtyListExecutorOSC::applyDiffResult(const QString& DataOut)
 {
-    QString DataIn, DataOut;
-    QString errFeat;
+    QDomDocument resDoc;
+    if (!resDoc.setContent(DataOut))
+        return false;
 
-    OscStream.writeEndDocument();
-    OscBuffer.close();
-    qDebug() << OscBuffer.buffer();
-    QString URL = theDownloader->getURLToUploadDiff(ChangeSetId);
-    switch (sendRequest("POST", URL, QString::fromUtf8(OscBuffer.buffer().data()), DataOut)) {
-    case 200: {
-        QDomDocument resDoc;
-        if (resDoc.setContent(DataOut)) {
-
-            QDomNodeList nl = resDoc.elementsByTagName("diffResult");
-            if (nl.size()) {
-                QDomElement resRoot = nl.at(0).toElement();
-                QDomElement c = resRoot.firstChildElement();
-                while (!c.isNull()) {
-                    IFeature::FeatureType aType = IFeature::FeatureType::Uninitialized;
-                    if (c.tagName() == "node")
-                        aType = IFeature::Point;
-                    else if (c.tagName() == "way")
-                        aType = IFeature::LineString;
-                    else if (c.tagName() == "relation")
-                        aType = IFeature::OsmRelation;
-                    else {
-                        qDebug() << "Unknown element found in response.";
-                    }
-
-                    Feature* F = theDocument->getFeature(IFeature::FId(aType, c.attribute("old_id").toLongLong()));
-                    if (F) {
-                        F->setId(IFeature::FId(aType, c.attribute("new_id").toLongLong()));
-                        F->setVersionNumber(c.attribute("new_version").toInt());
-                        F->setLastUpdated(Feature::OSMServer);
-                        F->setUser("me");
-                        F->setTime(QDateTime::currentDateTime());
-
-                        if (!g_Merk_Frisius) {
-                            F->layer()->remove(F);
-                            document()->getUploadedLayer()->add(F);
-                        }
-                        F->setUploaded(true);
-                        F->setDirtyLevel(0);
-
-                    } else
-                        qDebug() << "Feature not found in diff upload result: " << c.attribute("old_id");
-
-                    c = c.nextSiblingElement();
-                }
-                theDocument->history().cleanup();
-            }
+    QDomNodeList nl = resDoc.elementsByTagName("diffResult");
+    if (!nl.size())
+        return false;
+
+    QDomElement resRoot = nl.at(0).toElement();
+    QDomElement c = resRoot.firstChildElement();
+    while (!c.isNull()) {
+        IFeature::FeatureType aType = IFeature::FeatureType::Uninitialized;
+        if (c.tagName() == "node")
+            aType = IFeature::Point;
+        else if (c.tagName() == "way")
+            aType = IFeature::LineString;
+        else if (c.tagName() == "relation")
+            aType = IFeature::OsmRelation;
+        else {
+            qDebug() << "Unknown element found in response.";
         }
-        break;
+
+        Feature* F = theDocument->getFeature(IFeature::FId(aType, c.attribute("old_id").toLongLong()));
+        if (F) {
+            // Deletions come back without new_id/new_version
+            if (c.hasAttribute("new_id")) {
+                F->setId(IFeature::FId(aType, c.attribute("new_id").toLongLong()));
+                F->setVersionNumber(c.attribute("new_version").toInt());
+            }
+            F->setLastUpdated(Feature::OSMServer);
+            F->setUser("me");
+            F->setTime(QDateTime::currentDateTime());
+
+            if (!g_Merk_Frisius) {
+                F->layer()->remove(F);
+                document()->getUploadedLayer()->add(F);
+            }
+            F->setUploaded(true);
+            F->setDirtyLevel(0);
+
+        } else
+            qDebug() << "Feature not found in diff upload result: " << c.attribute("old_id");
+
+        c = c.nextSiblingElement();
     }
+    return true;
+}
 
-    case 409: {    // Confilct
-//            QRegExp rx(".*node.*(\\d+)", Qt::CaseInsensitive);
-//            if (rx.indexIn(DataOut) > -1) {
-//                errFeat = "node_" + rx.cap(1);
-//            } else {
-//                QRegExp rx(".*way.*(\\d+)", Qt::CaseInsensitive);
-//                if (rx.indexIn(DataOut) > -1) {
-//                    errFeat = "way_" + rx.cap(1);
-//                } else {
-//                    QRegExp rx(".*relation.*(\\d+)", Qt::CaseInsensitive);
-//                    if (rx.indexIn(DataOut) > -1) {
-//                        errFeat = "rel_" + rx.cap(1);
-//                    }
-//                }
-//            }
-//            qDebug() << errFeat;
-            break;
+bool DirtyListExecutorOSC::uploadBatch(int from, int to)
+{
+    qDebug() << QString("UPLOAD changes %1-%2 of %3").arg(from+1).arg(to).arg(Changes.size());
+
+    Progress->setLabelText(tr("Uploading changes %1-%2 of %3").arg(from+1).arg(to).arg(Changes.size()));
+    QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
+
+    // Serialised only now, so references to features created by previous
+    // batches already carry their server ids
+    startOsc();
+    writeChanges(from, to);
+    endOsc();
+
+    QString DataOut;
+    QString URL = theDownloader->getURLToUploadDiff(ChangeSetId);
+    int rCode = sendRequest("POST", URL, QString::fromUtf8(OscBuffer.buffer().data()), DataOut);
+    OscBuffer.buffer().clear();
+
+    if (rCode != 200)
+        return false;
+    return applyDiffResult(DataOut);
+}
+
+bool DirtyListExecutorOSC::stop()
+{
+    QString DataIn;
+
+    // A chunk is sent within a single changeset
+    int chunkSize = qBound(1, M_PREFS->getUploadChunkSize(), OSM_MAX_CHANGESET_ELEMENTS);
+    int inChangeset = 0;
+    bool complete = true;
+    Acknowledged = 0;
+    for (int from=0; from<Changes.size(); from+=chunkSize) {
+        int to = qMin(from+chunkSize, Changes.size());
+        if (inChangeset && inChangeset + (to-from) > OSM_MAX_CHANGESET_ELEMENTS) {
+            closeChangeset(DataIn);
+            if (!start()) {
+                complete = false;
+                break;
+            }
+            inChangeset = 0;
         }
-    case 410: {    // Gone
-//            QRegExp rx(".*node.*(\\d+)", Qt::CaseInsensitive);
-//            if (rx.indexIn(DataOut) > -1) {
-//                errFeat = "node_" + rx.cap(1);
-//            } else {
-//                QRegExp rx(".*way.*(\\d+)", Qt::CaseInsensitive);
-//                if (rx.indexIn(DataOut) > -1) {
-//                    errFeat = "way_" + rx.cap(1);
-//                } else {
-//                    QRegExp rx(".*relation.*(\\d+)", Qt::CaseInsensitive);
-//                    if (rx.indexIn(DataOut) > -1) {
-//                        errFeat = "rel_" + rx.cap(1);
-//                    }
-//                }
-//            }
-//            qDebug() << errFeat;
+        if (!uploadBatch(from, to)) {
+            complete = false;
             break;
         }
-
-    default:
-        break;
+        inChangeset += to-from;
+        ++Acknowledged;
     }
+    // After a failure, what was acknowledged stays applied; a later upload
+    // resumes with the remaining changes.
+    if (complete)
+        theDocument->history().cleanup();
+
+    // No changeset is left open if reopening one failed
+    if (!ChangeSetId.isEmpty())
+        closeChangeset(DataIn);
+
+    return complete;
+}
 
+void DirtyListExecutorOSC::closeChangeset(const QString& DataIn)
+{
     qDebug() << QString("CLOSE changeset");
 
     Progress->setLabelText(tr("CLOSE changeset"));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    URL = theDownloader->getURLToCloseChangeSet(ChangeSetId);
+    QString URL = theDownloader->getURLToCloseChangeSet(ChangeSetId);
     QUrl theUrl(Web+URL);
     theDownloader->setAnimator(NULL, NULL, NULL, false);
     if (!theDownloader->request("PUT",theUrl,DataIn)) {
         QMessageBox::warning(NULL, tr("Changeset could not be closed."), tr("An unknown error has occurred. It might already be closed, or will be closed automatically. If you want to be sure, please, check manually on the osm.org website."));
     }
-
-    return true;
 }
 
 void DirtyListExecutorOSC::OscCreate(Feature* F)
@@ -344,7 +433,7 @@ void DirtyListExecutorOSC::OscDelete(Feature* F)
         if (!LastAction.isEmpty())
             OscStream.writeEndElement();
         OscStream.writeStartElement("delete");
-        LastAction = "modify";
+        LastAction = "delete";
     }
 
     F->toXML(OscStream, Progress, true, ChangeSetId);
@@ -359,7 +448,7 @@ bool DirtyListExecutorOSC::addRelation(Relation *F)
     Progress->setLabelText(tr("ADD relation %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscCreate(F);
+    Changes.append(OscChange(OscChange::Create, F));
 
     return false;
 }
@@ -373,7 +462,7 @@ bool DirtyListExecutorOSC::addRoad(Way *F)
     Progress->setLabelText(tr("ADD road %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscCreate(F);
+    Changes.append(OscChange(OscChange::Create, F));
 
     return false;
 }
@@ -388,7 +477,7 @@ bool DirtyListExecutorOSC::addPoint(Node* F)
     Progress->setLabelText(tr("ADD trackpoint %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscCreate(F);
+    Changes.append(OscChange(OscChange::Create, F));
 
     return false;
 }
@@ -404,7 +493,7 @@ bool DirtyListExecutorOSC::updateRelation(Relation* F)
     Progress->setLabelText(tr("UPDATE relation %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscModify(F);
+    Changes.append(OscChange(OscChange::Modify, F));
 
     return false;
 }
@@ -419,7 +508,7 @@ bool DirtyListExecutorOSC::updateRoad(Way* F)
     Progress->setLabelText(tr("UPDATE road %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscModify(F);
+    Changes.append(OscChange(OscChange::Modify, F));
 
     return false;
 }
@@ -433,7 +522,7 @@ bool DirtyListExecutorOSC::updatePoint(Node* F)
     Progress->setLabelText(tr("UPDATE trackpoint %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscModify(F);
+    Changes.append(OscChange(OscChange::Modify, F));
 
     return false;
 }
@@ -447,7 +536,7 @@ bool DirtyListExecutorOSC::erasePoint(Node *F)
     Progress->setLabelText(tr("REMOVE trackpoint %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscDelete(F);
+    Changes.append(OscChange(OscChange::Delete, F));
 
     return false;
 }
@@ -461,7 +550,7 @@ bool DirtyListExecutorOSC::eraseRoad(Way *F)
     Progress->setLabelText(tr("REMOVE road %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscDelete(F);
+    Changes.append(OscChange(OscChange::Delete, F));
 
     return false;
 }
@@ -475,7 +564,7 @@ bool DirtyListExecutorOSC::eraseRelation(Relation *F)
     Progress->setLabelText(tr("REMOVE relation %1").arg(F->id().numId) + userName(F));
     QEventLoop L; L.processEvents(QEventLoop::ExcludeUserInputEvents);
 
-    OscDelete(F);
+    Changes.append(OscChange(OscChange::Delete, F));
 
     return false;
 }
@@ -20,6 +20,19 @@
 
 class Downloader;
 
+/// One element of an osmChange document, recorded during the visit and
+/// serialised only when its batch is sent.
+struct OscChange
+{
+    enum Action { Create, Modify, Delete };
+
+    OscChange() : action(Create), feature(NULL) {}
+    OscChange(Action a, Feature* F) : action(a), feature(F) {}
+
+    Action action;
+    Feature* feature;
+};
+
 class DirtyListExecutorOSC : public QObject, public DirtyListVisit
 {
     Q_OBJECT
@@ -48,11 +61,24 @@ public:
     bool executeChanges(QWidget* Parent);
     QByteArray getChanges();
 
+    /// Number of batches acknowledged by the server in the last upload.
+    int acknowledgedBatches() const;
+
 private:
     int sendRequest(const QString& Method, const QString& URL, const QString& Out, QString& Rcv);
 
+    void orderChanges();
+    void startOsc();
+    void endOsc();
+    void writeChanges(int from, int to);
+    bool uploadBatch(int from, int to);
+    bool applyDiffResult(const QString& DataOut);
+    void closeChangeset(const QString& DataIn);
+
     QXmlStreamWriter OscStream;
     QBuffer OscBuffer;
+    QList<OscChange> Changes;
+    int Acknowledged;
 
     Ui::SyncListDialog Ui;
     int Tasks, Done;
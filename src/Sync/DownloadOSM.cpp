@@ -27,6 +27,9 @@
 #include <QProgressDialog>
 #include <QStatusBar>
 #include <QInputDialog>
+#include <QNetworkReply>
+#include <QAuthenticator>
+#include <QXmlSimpleReader>
 
 /* DOWNLOADER */
 
@@ -268,6 +271,11 @@ QString Downloader::getURLToMap()
     return URL;
 }
 
+QString Downloader::getURLToMap(const CoordBox& aBox)
+{
+    return getURLToMap().arg(aBox.bottomLeft().x(), 0, 'f').arg(aBox.bottomLeft().y(), 0, 'f').arg(aBox.topRight().x(), 0, 'f').arg(aBox.topRight().y(), 0, 'f');
+}
+
 QString Downloader::getURLToTrackPoints()
 {
     QString URL = QString("/trackpoints?bbox=%1,%2,%3,%4&page=%5");
@@ -347,6 +355,258 @@ bool downloadOSM(QWidget* aParent, const QUrl& theUrl, const QString& aUser, con
     return OK;
 }
 
+/* TILED DOWNLOADER */
+
+// Tiles rejected by the API as too dense are split at most this many times
+#define MAX_TILE_SPLIT 4
+// Redirections followed for a tile before giving up on a loop
+#define MAX_TILE_REDIRECTS 5
+
+class DownloadTile
+{
+    public:
+        DownloadTile(const CoordBox& aBox, int aDepth, Document* aDoc, Layer* aLayer, Layer* aConflict)
+            : Box(aBox), Depth(aDepth), Redirects(0), Started(false), Handler(aDoc, aLayer, aConflict)
+        {
+            Reader.setContentHandler(&Handler);
+        }
+
+        CoordBox Box;
+        int Depth;
+        int Redirects;
+        bool Started;
+        OSMHandler Handler;
+        QXmlSimpleReader Reader;
+        QXmlInputSource Source;
+};
+
+TiledDownloader::TiledDownloader(const QString& aWeb, const QString& aUser, const QString& aPwd, Document* aDoc, Layer* aLayer)
+    : Web(aWeb), User(aUser), Password(aPwd), theDocument(aDoc), theLayer(aLayer), conflictLayer(0)
+    , Total(0), Done(0), Bytes(0), Error(false), AnimatorLabel(0), AnimatorBar(0)
+{
+    connect(&netManager,SIGNAL(authenticationRequired(QNetworkReply*,QAuthenticator*)), this,SLOT(on_authenticationRequired(QNetworkReply*,QAuthenticator*)));
+}
+
+TiledDownloader::~TiledDownloader()
+{
+    abortAll();
+    qDeleteAll(Finished);
+}
+
+bool TiledDownloader::needsTiling(const CoordBox& aBox)
+{
+    qreal tileSize = M_PREFS->getDownloadTileSize();
+    if (tileSize <= 0.)
+        return false;
+    return (aBox.lonDiff() > tileSize || aBox.latDiff() > tileSize);
+}
+
+void TiledDownloader::on_authenticationRequired(QNetworkReply *reply, QAuthenticator *auth)
+{
+    static QNetworkReply *lastReply = NULL;
+
+    if (lastReply != reply) {
+        lastReply = reply;
+        auth->setUser(User);
+        auth->setPassword(Password);
+    }
+}
+
+void TiledDownloader::on_Cancel_clicked()
+{
+    Error = true;
+    abortAll();
+    if (Loop.isRunning())
+        Loop.exit(QDialog::Rejected);
+}
+
+void TiledDownloader::abortAll()
+{
+    QHashIterator<QNetworkReply*, DownloadTile*> it(Running);
+    while (it.hasNext()) {
+        it.next();
+        it.key()->disconnect(this);
+        it.key()->abort();
+        it.key()->deleteLater();
+        Finished << it.value();
+    }
+    Running.clear();
+    Pending.clear();
+}
+
+void TiledDownloader::startNext()
+{
+    int connections = qMax(1, M_PREFS->getDownloadConnections());
+    while (!Error && Pending.size() && Running.size() < connections) {
+        QPair<CoordBox, int> next = Pending.takeFirst();
+        QUrl theUrl(Web+Downloader::getURLToMap(next.first));
+        get(theUrl, new DownloadTile(next.first, next.second, theDocument, theLayer, conflictLayer));
+    }
+}
+
+void TiledDownloader::get(const QUrl& theUrl, DownloadTile* T)
+{
+    qDebug() << "TiledDownloader::get: " << theUrl;
+
+    netManager.setProxy(M_PREFS->getProxy(theUrl));
+    QNetworkRequest req(theUrl);
+    req.setRawHeader(QByteArray("User-Agent"), USER_AGENT.toLatin1());
+
+    QNetworkReply* reply = netManager.get(req);
+    connect(reply, SIGNAL(readyRead()), this, SLOT(on_readyRead()));
+    connect(reply, SIGNAL(finished()), this, SLOT(on_finished()));
+    Running[reply] = T;
+}
+
+void TiledDownloader::parse(DownloadTile* T, const QByteArray& buf)
+{
+    if (buf.isEmpty())
+        return;
+
+    Bytes += buf.size();
+    T->Source.setData(buf);
+    if (!T->Started) {
+        T->Reader.parse(&T->Source, true);
+        T->Started = true;
+    } else
+        T->Reader.parseContinue();
+}
+
+void TiledDownloader::on_readyRead()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !Running.contains(reply))
+        return;
+
+    // Only a successful response is OSM data; errors are handled once finished
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200)
+        return;
+
+    parse(Running[reply], reply->readAll());
+
+    if (AnimatorLabel)
+        AnimatorLabel->setText(QApplication::translate("Downloader","Downloading tile %1 of %2 (%n kBytes)", "", Bytes/1024).arg(Done+1).arg(Total));
+}
+
+void TiledDownloader::on_finished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !Running.contains(reply))
+        return;
+
+    DownloadTile* T = Running.take(reply);
+    reply->deleteLater();
+
+    int x = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    /* Test for redirections */
+    QVariant redir = reply->attribute(QNetworkRequest::RedirectionTargetAttribute);
+    if ((x == 301 || x == 302 || x == 307) && redir.isValid() && T->Redirects < MAX_TILE_REDIRECTS) {
+        ++T->Redirects;
+        get(reply->url().resolved(redir.toUrl()), T);
+        return;
+    }
+
+    if (x == 200 && !reply->error()) {
+        parse(T, reply->readAll());
+        ++Done;
+    } else if (x == 400 && T->Depth < MAX_TILE_SPLIT) {
+        // Too many features for a single request: split in four
+        const CoordBox& B = T->Box;
+        Coord C = B.center();
+        Pending << qMakePair(CoordBox(B.bottomLeft(), C), T->Depth+1);
+        Pending << qMakePair(CoordBox(Coord(C.x(), B.bottomLeft().y()), Coord(B.topRight().x(), C.y())), T->Depth+1);
+        Pending << qMakePair(CoordBox(Coord(B.bottomLeft().x(), C.y()), Coord(C.x(), B.topRight().y())), T->Depth+1);
+        Pending << qMakePair(CoordBox(C, B.topRight()), T->Depth+1);
+        Total += 3;
+    } else {
+        qDebug() << "TiledDownloader: tile failed with code " << x << ", message " << reply->errorString();
+        if (!Error) {
+            if (x == 401)
+                ErrorMessage = QApplication::translate("Downloader","Username/password invalid");
+            else {
+                ErrorMessage = QApplication::translate("Downloader","Unexpected http status code (%1)\nServer message is '%2'").arg(x).arg(reply->errorString());
+                QString apiError = reply->rawHeader("Error");
+                if (!apiError.isEmpty())
+                    ErrorMessage += QApplication::translate("Downloader", "\nAPI message is '%1'").arg(apiError);
+            }
+        }
+        Error = true;
+        abortAll();
+    }
+    Finished << T;
+
+    if (AnimatorBar) {
+        AnimatorBar->setMaximum(Total);
+        AnimatorBar->setValue(Done);
+    }
+
+    startNext();
+    if (Running.isEmpty() && Loop.isRunning())
+        Loop.exit(Error ? QDialog::Rejected : QDialog::Accepted);
+}
+
+bool TiledDownloader::download(QWidget* aParent, const CoordBox& aBox)
+{
+    qreal tileSize = M_PREFS->getDownloadTileSize();
+    int cols = qMax(1, int(ceil(aBox.lonDiff() / tileSize)));
+    int rows = qMax(1, int(ceil(aBox.latDiff() / tileSize)));
+    qreal w = aBox.lonDiff() / cols;
+    qreal h = aBox.latDiff() / rows;
+    qreal lon0 = aBox.bottomLeft().x();
+    qreal lat0 = aBox.bottomLeft().y();
+    for (int r=0; r<rows; ++r)
+        for (int c=0; c<cols; ++c)
+            Pending << qMakePair(CoordBox(Coord(lon0 + c*w, lat0 + r*h), Coord(lon0 + (c+1)*w, lat0 + (r+1)*h)), 0);
+    Total = Pending.size();
+
+    QProgressDialog* dlg = NULL;
+    IProgressWindow* aProgressWindow = dynamic_cast<IProgressWindow*>(aParent);
+    if (aProgressWindow) {
+        dlg = aProgressWindow->getProgressDialog();
+        if (dlg) {
+            dlg->setWindowTitle(QApplication::translate("Downloader","Downloading..."));
+            dlg->setWindowFlags(dlg->windowFlags() & ~Qt::WindowContextHelpButtonHint);
+            dlg->setWindowFlags(dlg->windowFlags() | Qt::MSWindowsFixedSizeDialogHint);
+            connect(dlg,SIGNAL(canceled()),this,SLOT(on_Cancel_clicked()));
+        }
+
+        AnimatorBar = aProgressWindow->getProgressBar();
+        AnimatorBar->setTextVisible(false);
+        AnimatorBar->setMaximum(Total);
+        AnimatorBar->setValue(0);
+
+        AnimatorLabel = aProgressWindow->getProgressLabel();
+        AnimatorLabel->setText(QApplication::translate("Downloader","Downloading from OSM (connecting)"));
+
+        if (dlg)
+            dlg->show();
+    }
+
+    conflictLayer = new DrawingLayer(QApplication::translate("Downloader","Conflicts from %1").arg(theLayer->name()));
+    theDocument->add(conflictLayer);
+
+    startNext();
+    if (!Running.isEmpty())
+        Loop.exec();
+
+    if (dlg)
+        dlg->disconnect(this);
+
+    if (Error && !ErrorMessage.isEmpty())
+        QMessageBox::warning(aParent,QApplication::translate("Downloader","Download failed"), ErrorMessage);
+
+    QSet<Way*> touchedWays;
+    QSet<Relation*> touchedRelations;
+    foreach (DownloadTile* T, Finished) {
+        touchedWays += T->Handler.touchedWays;
+        touchedRelations += T->Handler.touchedRelations;
+    }
+
+    Downloader Down(User, Password);
+    return finishImportOSM(aParent, theDocument, theLayer, conflictLayer, &Down, touchedWays, touchedRelations, Error);
+}
+
 bool downloadOSM(QWidget* aParent, const QString& aWeb, const QString& aUser, const QString& aPassword, const CoordBox& aBox , Document* theDocument, Layer* theLayer)
 {
     if (checkForConflicts(theDocument))
@@ -354,9 +614,6 @@ bool downloadOSM(QWidget* aParent, const QString& aWeb, const QString& aUser, co
         QMessageBox::warning(aParent,QApplication::translate("Downloader","Unresolved conflicts"), QApplication::translate("Downloader","Please resolve existing conflicts first"));
         return false;
     }
-    Downloader Rcv(aUser, aPassword);
-    QString URL = Rcv.getURLToMap();
-
     if ((fabs(aBox.bottomLeft().x()) < 180.0 && fabs(aBox.topRight().x()) > 180.0) 
      || (fabs(aBox.bottomLeft().x()) > 180.0 && fabs(aBox.topRight().x()) < 180.0)) {
         /* Check for +-180 meridian, and split query in two if necessary */
@@ -376,8 +633,11 @@ bool downloadOSM(QWidget* aParent, const QString& aWeb, const QString& aUser, co
 
     } else {
         /* Normal code path */
-        URL = URL.arg(aBox.bottomLeft().x(), 0, 'f').arg(aBox.bottomLeft().y(), 0, 'f').arg(aBox.topRight().x(), 0, 'f').arg(aBox.topRight().y(), 0, 'f');
-        QUrl theUrl(aWeb+URL);
+        if (TiledDownloader::needsTiling(aBox)) {
+            TiledDownloader Tiled(aWeb, aUser, aPassword, theDocument, theLayer);
+            return Tiled.download(aParent, aBox);
+        }
+        QUrl theUrl(aWeb+Downloader::getURLToMap(aBox));
         return downloadOSM(aParent, theUrl, aUser, aPassword, theDocument, theLayer);
     }
 }
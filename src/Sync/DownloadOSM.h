@@ -14,14 +14,18 @@ class CoordBox;
 class Feature;
 class Layer;
 class SpecialLayer;
+class DownloadTile;
 
 #include <QtCore/QByteArray>
 #include <QtCore/QEventLoop>
 #include <QtCore/QObject>
 #include <QNetworkAccessManager>
 #include <QUrl>
+#include <QHash>
+#include <QPair>
 
 #include "IFeature.h"
+#include "Coord.h"
 
 class Downloader : public QObject
 {
@@ -37,7 +41,8 @@ class Downloader : public QObject
         const QString & resultText();
         const QString & errorText();
         const QString & locationText();
-        QString getURLToMap();
+        static QString getURLToMap();
+        static QString getURLToMap(const CoordBox& aBox);
         QString getURLToTrackPoints();
         QString getURLToFetchFull(IFeature::FId id);
         QString getURLToFetchFull(Feature* aFeature);
@@ -75,6 +80,53 @@ class Downloader : public QObject
         QTimer *AnimationTimer;
 };
 
+/// Downloads a bounding box as a grid of tiles over several concurrent
+/// connections. Each response is parsed as its bytes arrive and merged into
+/// the target layer (features shared by tiles are only created once).
+/// Tiles the API rejects as too dense are split in four and requeued.
+/// Redirections are followed as in Downloader::request().
+class TiledDownloader : public QObject
+{
+    Q_OBJECT
+
+    public:
+        TiledDownloader(const QString& aWeb, const QString& aUser, const QString& aPwd, Document* aDoc, Layer* aLayer);
+        virtual ~TiledDownloader();
+
+        bool download(QWidget* aParent, const CoordBox& aBox);
+
+        static bool needsTiling(const CoordBox& aBox);
+
+    private slots:
+        void on_readyRead();
+        void on_finished();
+        void on_authenticationRequired(QNetworkReply* reply, QAuthenticator* auth);
+        void on_Cancel_clicked();
+
+    private:
+        void startNext();
+        void get(const QUrl& theUrl, DownloadTile* T);
+        void parse(DownloadTile* T, const QByteArray& buf);
+        void abortAll();
+
+        QString Web, User, Password;
+        Document* theDocument;
+        Layer* theLayer;
+        Layer* conflictLayer;
+
+        QNetworkAccessManager netManager;
+        QList<QPair<CoordBox, int> > Pending;
+        QHash<QNetworkReply*, DownloadTile*> Running;
+        QList<DownloadTile*> Finished;
+        int Total, Done;
+        qint64 Bytes;
+        bool Error;
+        QString ErrorMessage;
+        QEventLoop Loop;
+        QLabel* AnimatorLabel;
+        QProgressBar* AnimatorBar;
+};
+
 bool downloadOSM(MainWindow* Main, const CoordBox& aBox , Document* theDocument);
 bool downloadMoreOSM(MainWindow* Main, const CoordBox& aBox , Document* theDocument);
 bool downloadFeatures(MainWindow* Main, const QList<Feature*>& aDownloadList , Document* theDocument);
@@ -1,6 +1,7 @@
 #include "SvgCache.h"
 
 #include <QtCore/QMap>
+#include <QtCore/QMutex>
 #include <QtCore/QPair>
 #include <QtGui/QPainter>
 #include <QtSvg/QSvgRenderer>
@@ -9,7 +10,11 @@
 
 QImage* getSVGImageFromFile(const QString& aName, int Size)
 {
+    // Tiles are rendered in worker threads. Entries are never removed, so
+    // the returned images stay valid after the lock is released.
+    static QMutex CacheMutex;
     static QMap<QPair<QString, int>, QImage> Cache;
+    QMutexLocker locker(&CacheMutex);
     QPair<QString, int> Key(aName,Size);
     if (!Cache.contains(Key))
     {
@@ -27,7 +32,8 @@ QImage* getSVGImageFromFile(const QString& aName, int Size)
             QImage result(aName);
             if (Size)
                 result = result.scaledToWidth(Size);
-            Cache[Key] = result;
+            // Premultiplied images are blended without conversion
+            Cache[Key] = result.convertToFormat(QImage::Format_ARGB32_Premultiplied);
         }
     }
     return &(Cache[Key]);
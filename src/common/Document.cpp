@@ -1,9 +1,12 @@
 #include "Global.h"
 
 #include "Command.h"
+#include "CommandJournal.h"
+#include "DocumentCommands.h"
 
 #include "Feature.h"
 #include "Document.h"
+#include "FilterEngine.h"
 #include "ImageMapLayer.h"
 
 #include "ImportNMEA.h"
@@ -45,18 +48,24 @@ class MapDocumentPrivate
 public:
     MapDocumentPrivate()
         : History(new CommandHistory())
+        , Journal(0)
         , dirtyLayer(0)
         , uploadedLayer(0)
         /*, trashLayer(0)*/
         , theDock(0)
         , lastDownloadLayer(0)
         , tagFilter(0), FilterRevision(0)
+        , theFilterEngine(0)
         , layerNum(0)
+        , EditDepth(0)
         , theFeaturePaintersLock( QReadWriteLock::Recursive )
     {
     };
     ~MapDocumentPrivate()
     {
+        delete theFilterEngine;
+        delete Journal;
+        History->discardSpill();
         History->cleanup();
         delete History;
         for (int i=0; i<Layers.size(); ++i) {
@@ -66,6 +75,7 @@ public:
         }
     }
     CommandHistory*	History;
+    CommandJournal* Journal;
     QList<Layer*> Layers;
     DirtyLayer*	dirtyLayer;
     UploadedLayer* uploadedLayer;
@@ -76,10 +86,15 @@ public:
 
     TagSelector* tagFilter;
     int FilterRevision;
+    FilterEngine* theFilterEngine;
     QString title;
     int layerNum;
     mutable QString Id;
 
+    int EditDepth;
+    QList<Feature*> EditChanged;
+    QSet<Feature*> EditChangedSet;
+
     QList<FeaturePainter> theFeaturePainters;
     QReadWriteLock theFeaturePaintersLock;
 };
@@ -87,6 +102,8 @@ public:
 Document::Document()
     : p(new MapDocumentPrivate)
 {
+    p->theFilterEngine = new FilterEngine(this);
+    p->History->setDocument(this);
     setFilterType(M_PREFS->getCurrentFilter());
     p->title = tr("untitled");
 
@@ -98,7 +115,9 @@ Document::Document()
 Document::Document(LayerDock* aDock)
     : p(new MapDocumentPrivate)
 {
+    p->theFilterEngine = new FilterEngine(this);
     p->theDock = aDock;
+    p->History->setDocument(this);
     setFilterType(M_PREFS->getCurrentFilter());
     p->title = tr("untitled");
 
@@ -315,6 +334,8 @@ void Document::clear()
 {
     delete p;
     p = new MapDocumentPrivate;
+    p->theFilterEngine = new FilterEngine(this);
+    p->History->setDocument(this);
     addDefaultLayers();
 }
 
@@ -322,6 +343,7 @@ void Document::setHistory(CommandHistory* h)
 {
     delete p->History;
     p->History = h;
+    p->History->setDocument(this);
     emit(historyChanged());
 }
 
@@ -338,32 +360,118 @@ const CommandHistory& Document::history() const
 void Document::addHistory(Command* aCommand)
 {
     p->History->add(aCommand);
+    if (p->Journal)
+        p->Journal->recordAdd(aCommand);
     emit(historyChanged());
 }
 
 void Document::redoHistory()
 {
+    int idx = p->History->index();
+    EditTransaction transaction(this);
     p->History->redo();
+    if (p->Journal && p->History->index() != idx)
+        p->Journal->recordRedo();
     emit(historyChanged());
 }
 
 void Document::undoHistory()
 {
+    int idx = p->History->index();
+    EditTransaction transaction(this);
     p->History->undo();
+    if (p->Journal && p->History->index() != idx)
+        p->Journal->recordUndo();
     emit(historyChanged());
 }
 
+void Document::beginEditTransaction()
+{
+    ++p->EditDepth;
+}
+
+void Document::commitEditTransaction()
+{
+    Q_ASSERT(p->EditDepth > 0);
+    if (--p->EditDepth > 0)
+        return;
+
+    QList<Feature*> Changed = p->EditChanged;
+    p->EditChanged.clear();
+    p->EditChangedSet.clear();
+    if (Changed.isEmpty())
+        return;
+
+    // One notification for the whole batch: each parent is refreshed (and
+    // re-indexed) once, whatever the number of its parts that changed.
+    int Id = Feature::newNotificationId();
+    QSet<Feature*> Notified;
+    foreach (Feature* F, Changed) {
+        if (F->layer())
+            g_backend.sync(F);
+    }
+    foreach (Feature* F, Changed) {
+        for (int i=0; i<F->sizeParents(); ++i) {
+            Feature* P = CAST_FEATURE(F->getParent(i));
+            if (P && !Notified.contains(P)) {
+                Notified.insert(P);
+                P->partChanged(F, Id);
+            }
+        }
+    }
+}
+
+bool Document::isInEditTransaction() const
+{
+    return p->EditDepth > 0;
+}
+
+bool Document::deferChange(Feature* F)
+{
+    if (!p->EditDepth)
+        return false;
+    if (!p->EditChangedSet.contains(F)) {
+        p->EditChangedSet.insert(F);
+        p->EditChanged.append(F);
+    }
+    return true;
+}
+
+void Document::setJournal(CommandJournal* aJournal)
+{
+    if (p->Journal == aJournal)
+        return;
+    delete p->Journal;
+    p->Journal = aJournal;
+}
+
+CommandJournal* Document::journal() const
+{
+    return p->Journal;
+}
+
+void Document::changedOutsideHistory()
+{
+    if (p->Journal)
+        p->Journal->recordBreak();
+}
+
 void Document::add(Layer* aLayer)
 {
+    changedOutsideHistory();
     p->Layers.push_back(aLayer);
     aLayer->setDocument(this);
     if (p->theDock)
         p->theDock->addLayer(aLayer);
+    if (FilterLayer* Fl = qobject_cast<FilterLayer*>(aLayer))
+        p->theFilterEngine->addFilter(Fl);
 }
 
 void Document::moveLayer(Layer* aLayer, int pos)
 {
     p->Layers.move(p->Layers.indexOf(aLayer), pos);
+    if (aLayer->classType() == Layer::FilterLayerType)
+        p->theFilterEngine->reorder();
 }
 
 ImageMapLayer* Document::addImageLayer(ImageMapLayer* aLayer)
@@ -399,20 +507,18 @@ FilterLayer* Document::addFilterLayer(FilterLayer *aLayer)
         theLayer = new FilterLayer(QUuid::createUuid().toString(), tr("Filter layer #%1").arg(++p->layerNum), "false");
     add(theLayer);
 
-    FeatureIterator it(this);
-    for(;!it.isEnd(); ++it) {
-        it.get()->updateFilters();
-    }
-
     return theLayer;
 }
 
 void Document::remove(Layer* aLayer)
 {
+    changedOutsideHistory();
     QList<Layer*>::iterator i = qFind(p->Layers.begin(),p->Layers.end(), aLayer);
     if (i != p->Layers.end()) {
         p->Layers.erase(i);
     }
+    if (FilterLayer* Fl = qobject_cast<FilterLayer*>(aLayer))
+        p->theFilterEngine->removeFilter(Fl);
     if (aLayer == p->lastDownloadLayer)
         p->lastDownloadLayer = NULL;
     if (p->theDock)
@@ -605,19 +711,24 @@ void Document::exportOSM(QWidget* main, QIODevice* device, QList<Feature*> aFeat
     if (dlg)
         dlg->show();
 
+    // No auto-formatting: exports can run into millions of elements
     QXmlStreamWriter stream(device);
-    stream.setAutoFormatting(true);
-    stream.setAutoFormattingIndent(2);
     stream.writeStartDocument();
 
     stream.writeStartElement("osm");
     stream.writeAttribute("version", "0.6");
     stream.writeAttribute("generator", QString("%1 %2").arg(qApp->applicationName()).arg(STRINGIFY(VERSION)));
 
-    CoordBox aCoordBox = aFeatures[0]->boundingBox(true);
-    aFeatures[0]->toXML(stream, dlg);
-    for (int i=1; i < aFeatures.size(); i++) {
-        aCoordBox.merge(aFeatures[i]->boundingBox(true));
+    CoordBox aCoordBox;
+    bool hasBox = false;
+    for (int i=0; i < aFeatures.size(); i++) {
+        // A stale cached box would make the bounds miss moved nodes
+        const CoordBox& bb = CHECK_NODE(aFeatures[i]) ? CoordBox(STATIC_CAST_NODE(aFeatures[i])->position(), STATIC_CAST_NODE(aFeatures[i])->position()) : aFeatures[i]->boundingBox(true);
+        if (!hasBox) {
+            aCoordBox = bb;
+            hasBox = true;
+        } else
+            aCoordBox.merge(bb);
         aFeatures[i]->toXML(stream, dlg);
     }
 
@@ -636,59 +747,70 @@ void Document::exportOSM(QWidget* main, QIODevice* device, QList<Feature*> aFeat
 
 QList<Feature*> Document::exportCoreOSM(QList<Feature*> aFeatures, bool forCopyPaste, QProgressDialog * progress)
 {
-    QList<Feature*> exportedFeatures;
-    QList<Feature*>::Iterator i;
+    // The closure is built with a visited set and written out in a single
+    // nodes, ways, relations pass so that references always point backwards
+    QSet<Feature*> Visited;
+    QList<Feature*> Nodes, Ways, Relations;
+    Visited.reserve(aFeatures.size()*2);
 
+    QList<Feature*>::Iterator i;
     for (i = aFeatures.begin(); i != aFeatures.end(); ++i) {
-        if (/*Node* n = */dynamic_cast<Node*>(*i)) {
-            if (!exportedFeatures.contains(*i))
-                exportedFeatures.append(*i);
-        } else {
-            if (Way* G = dynamic_cast<Way*>(*i)) {
+        if (Node* N = CAST_NODE(*i)) {
+            if (!Visited.contains(N)) {
+                Visited.insert(N);
+                Nodes.append(N);
+            }
+        } else if (Way* G = CAST_WAY(*i)) {
+            if (!Visited.contains(G)) {
+                Visited.insert(G);
                 for (int j=0; j < G->size(); j++) {
-                    if (Node* P = dynamic_cast<Node*>(G->get(j))) {
-                        if (!exportedFeatures.contains(P))
-                            exportedFeatures.append(P);
+                    Node* P = G->getNode(j);
+                    if (!Visited.contains(P)) {
+                        Visited.insert(P);
+                        Nodes.append(P);
                     }
-                    if (!exportedFeatures.contains(G))
-                        exportedFeatures.append(G);
                 }
-            } else {
-                //FIXME Not working for relation (not made of point?)
-                if (Relation* G = dynamic_cast<Relation*>(*i)) {
-                    if (!forCopyPaste) {
-                        for (int j=0; j < G->size(); j++) {
-                            if (Way* R = CAST_WAY(G->get(j))) {
-                                for (int k=0; k < R->size(); k++) {
-                                    if (Node* P = dynamic_cast<Node*>(R->get(k))) {
-                                        if (!exportedFeatures.contains(P))
-                                            exportedFeatures.append(P);
-                                    }
+                Ways.append(G);
+            }
+        } else if (Relation* G = CAST_RELATION(*i)) {
+            //FIXME Not working for relation (not made of point?)
+            if (!Visited.contains(G)) {
+                Visited.insert(G);
+                if (!forCopyPaste) {
+                    for (int j=0; j < G->size(); j++) {
+                        if (Way* R = CAST_WAY(G->get(j))) {
+                            if (Visited.contains(R))
+                                continue;
+                            Visited.insert(R);
+                            for (int k=0; k < R->size(); k++) {
+                                Node* P = R->getNode(k);
+                                if (!Visited.contains(P)) {
+                                    Visited.insert(P);
+                                    Nodes.append(P);
                                 }
-                                if (!exportedFeatures.contains(R))
-                                    exportedFeatures.append(R);
-                            } else
-                            if (Node* P = CAST_NODE(G->get(j))) {
-                                if (!exportedFeatures.contains(P))
-                                    exportedFeatures.append(P);
                             }
-
+                            Ways.append(R);
+                        } else if (Node* P = CAST_NODE(G->get(j))) {
+                            if (!Visited.contains(P)) {
+                                Visited.insert(P);
+                                Nodes.append(P);
+                            }
                         }
                     }
-                    if (!exportedFeatures.contains(G))
-                        exportedFeatures.append(G);
                 }
+                Relations.append(G);
             }
         }
         if (progress) {
-            if (progress->wasCanceled()) {
-                exportedFeatures.clear();
-                return exportedFeatures;
-            }
+            if (progress->wasCanceled())
+                return QList<Feature*>();
             progress->setValue(progress->value()+1);
         }
     }
 
+    QList<Feature*> exportedFeatures;
+    exportedFeatures.reserve(Nodes.size() + Ways.size() + Relations.size());
+    exportedFeatures << Nodes << Ways << Relations;
     return exportedFeatures;
 }
 
@@ -880,6 +1002,11 @@ int Document::filterRevision() const
     return p->FilterRevision;
 }
 
+FilterEngine* Document::filterEngine() const
+{
+    return p->theFilterEngine;
+}
+
 QString Document::title() const
 {
     return p->title;
@@ -998,6 +1125,7 @@ Document* Document::getDocumentFromXml(QDomDocument* theXmlDoc)
 QList<Feature*> Document::mergeDocument(Document* otherDoc, Layer* layer, CommandList* theList)
 {
     QList<Feature*> theFeats;
+    AddFeaturesCommand* theAdds = theList ? new AddFeaturesCommand(layer, true) : NULL;
     for (int i=0; i<otherDoc->layerSize(); ++i)
         for (int j=0; j<otherDoc->getLayer(i)->size(); ++j)
             if (!otherDoc->getLayer(i)->get(j)->isNull())
@@ -1008,7 +1136,8 @@ QList<Feature*> Document::mergeDocument(Document* otherDoc, Layer* layer, Comman
             F->resetId();
 
         // Re-link null features to the ones in the current document
-        for (int j=0; j<F->size(); ++j) {
+        // (track segments only hold points, get() would create their nodes)
+        for (int j=0; !CHECK_SEGMENT(F) && j<F->size(); ++j) {
             Feature* C = F->get(j);
             if (C->isNull()) {
                 if (Feature* CC = getFeature(C->id())) {
@@ -1026,12 +1155,18 @@ QList<Feature*> Document::mergeDocument(Document* otherDoc, Layer* layer, Comman
             }
         }
         F->layer()->remove(F);
-        if (theList)
-            theList->add(new AddFeatureCommand(layer, F, true));
+        if (theAdds)
+            theAdds->add(F);
         else {
             layer->add(F);
         }
     }
+    if (theAdds) {
+        if (theAdds->size())
+            theList->add(theAdds);
+        else
+            delete theAdds;
+    }
     return theFeats;
 }
 
@@ -1170,6 +1305,7 @@ void Document::rebuildHistory()
 {
     delete p->History;
     p->History = new CommandHistory();
+    p->History->setDocument(this);
     CommandHistory* h = p->History;
 
     // Identify changes
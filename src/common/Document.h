@@ -17,6 +17,7 @@ class QMainWindow;
 
 class Command;
 class CommandHistory;
+class CommandJournal;
 class Document;
 class MapDocumentPrivate;
 class ImageMapLayer;
@@ -26,6 +27,7 @@ class DirtyLayer;
 class UploadedLayer;
 class DeletedLayer;
 class FeaturePainter;
+class FilterEngine;
 
 class Document : public QObject, public IDocument
 {
@@ -74,6 +76,19 @@ public:
     void rebuildHistory();
     void clear();
 
+    void setJournal(CommandJournal* aJournal);
+    CommandJournal* journal() const;
+    /// To be called by changes that don't go through the history
+    void changedOutsideHistory();
+
+    /// Bulk edits: between begin and commit, feature changes are only
+    /// recorded; the spatial index and the parents are brought up to date
+    /// once, when the outermost transaction is committed.
+    void beginEditTransaction();
+    void commitEditTransaction();
+    bool isInEditTransaction() const;
+    bool deferChange(Feature* F);
+
     void setDirtyLayer(DirtyLayer* aLayer);
     Layer* getDirtyLayer();
     Layer* getDirtyOrOriginLayer(Layer* aLayer = NULL);
@@ -115,6 +130,9 @@ public:
     TagSelector* getTagFilter();
     int filterRevision() const;
 
+    /// Matches of the filter layers
+    FilterEngine* filterEngine() const;
+
     QString title() const;
     void setTitle(const QString aTitle);
 
@@ -149,6 +167,24 @@ signals:
 
 };
 
+class EditTransaction
+{
+public:
+    EditTransaction(Document* aDoc)
+        : theDocument(aDoc)
+    {
+        theDocument->beginEditTransaction();
+    }
+    ~EditTransaction()
+    {
+        theDocument->commitEditTransaction();
+    }
+
+private:
+    Q_DISABLE_COPY(EditTransaction)
+    Document* theDocument;
+};
+
 class FeatureIterator
 {
 
@@ -754,14 +754,19 @@ void alignNodes(Document* theDocument, CommandList* theList, PropertiesDock* the
     const Coord p1(Nodes[0]->position());
     const Coord p2(Nodes[1]->position()-p1);
     const qreal slope = angle(p2);
+    MoveNodesCommand* theMoves = new MoveNodesCommand();
     for (int i=2; i<Nodes.size(); ++i) {
         pos=Nodes[i]->position()-p1;
         rotate(pos,-slope);
         pos.setY(0);
         rotate(pos,slope);
         pos=pos+p1;
-        theList->add(new MoveNodeCommand( Nodes[i], pos, theDocument->getDirtyOrOriginLayer(Nodes[i]->layer()) ));
+        theMoves->add(Nodes[i], pos, theDocument->getDirtyOrOriginLayer(Nodes[i]->layer()));
     }
+    if (theMoves->size())
+        theList->add(theMoves);
+    else
+        delete theMoves;
 }
 
 void bingExtract(Document* theDocument, CommandList* theList, PropertiesDock* theDock, CoordBox vp)
@@ -894,10 +899,15 @@ inserted:
     p = Nodes[0]->position();
     delta = (Nodes[Nodes.size()-1]->position() - p) / (Nodes.size()-1);
 
+    MoveNodesCommand* theMoves = new MoveNodesCommand();
     for (int i=1; i<Nodes.size()-1; ++i) {
         p = p + delta;
-        theList->add(new MoveNodeCommand( Nodes[i], p, theDocument->getDirtyOrOriginLayer(Nodes[i]->layer()) ));
+        theMoves->add(Nodes[i], p, theDocument->getDirtyOrOriginLayer(Nodes[i]->layer()));
     }
+    if (theMoves->size())
+        theList->add(theMoves);
+    else
+        delete theMoves;
 }
 
 static void mergeNodes(Document* theDocument, CommandList* theList, Node *node1, Node *node2)
@@ -1980,11 +1990,16 @@ AxisAlignResult axisAlignRoads(Document* theDocument, CommandList* theList, Prop
         return AxisAlignFail;
     }
     // Commit the changes
+    MoveNodesCommand* theMoves = new MoveNodesCommand();
     foreach (Way *theWay, theWays) {
         for (int i = 0; i < theWay->size(); ++i) {
             Node *N = theWay->getNode(i);
-            theList->add(new MoveNodeCommand(N, proj.inverse2Coord(node_pos[N]), theDocument->getDirtyOrOriginLayer(N->layer())));
+            theMoves->add(N, proj.inverse2Coord(node_pos[N]), theDocument->getDirtyOrOriginLayer(N->layer()));
         }
     }
+    if (theMoves->size())
+        theList->add(theMoves);
+    else
+        delete theMoves;
     return AxisAlignSuccess;
 }
@@ -0,0 +1,255 @@
+#include "FilterEngine.h"
+
+#include "Document.h"
+#include "Layer.h"
+#include "Feature.h"
+#include "MemoryBackend.h"
+#include "TagSelector.h"
+
+#include <QtConcurrentMap>
+#include <QVector>
+
+#define FILTER_CHUNK_SIZE 4096
+
+namespace {
+
+struct FilterChunk
+{
+    int First;
+    int Last;
+};
+
+/* Computes the new masks of a range of features. Features whose mask is
+   current only need the bit of the recomputed filter, the others are
+   evaluated against all the filters. */
+class FilterEvaluator
+{
+public:
+    typedef void result_type;
+
+    FilterEvaluator(const QList<Feature*>& aFeatures, QVector<quint64>& aMasks,
+                    const QList<TagSelector*>& aSelectors, const QList<quint64>& aBits,
+                    TagSelector* aSelector, quint64 aBit, int aRevision)
+        : theFeatures(aFeatures), theMasks(aMasks), theSelectors(aSelectors), theBits(aBits)
+        , theSelector(aSelector), theBit(aBit), theRevision(aRevision)
+    {
+    }
+
+    void operator()(const FilterChunk& aChunk) const
+    {
+        for (int i=aChunk.First; i<aChunk.Last; ++i) {
+            Feature* F = theFeatures[i];
+            quint64 mask;
+            if (F->filterRevision() == theRevision) {
+                mask = F->filterMask() & ~theBit;
+                if (theSelector && theSelector->matches(F, 0) != TagSelect_NoMatch)
+                    mask |= theBit;
+            } else {
+                mask = 0;
+                for (int j=0; j<theSelectors.size(); ++j)
+                    if (theSelectors[j]->matches(F, 0) != TagSelect_NoMatch)
+                        mask |= theBits[j];
+            }
+            theMasks[i] = mask;
+        }
+    }
+
+private:
+    const QList<Feature*>& theFeatures;
+    QVector<quint64>& theMasks;
+    const QList<TagSelector*>& theSelectors;
+    const QList<quint64>& theBits;
+    TagSelector* theSelector;
+    quint64 theBit;
+    int theRevision;
+};
+
+}
+
+FilterEngine::FilterEngine(Document* aDoc)
+    : theDocument(aDoc), UsedBits(0), Revision(0)
+    , EnabledMask(0), HiddenMask(0), ReadonlyMask(0)
+{
+}
+
+FilterEngine::~FilterEngine()
+{
+}
+
+quint64 FilterEngine::bit(FilterLayer* aFilter) const
+{
+    QHash<FilterLayer*, int>::const_iterator it = Bits.constFind(aFilter);
+    if (it == Bits.constEnd())
+        return 0;
+    return Q_UINT64_C(1) << it.value();
+}
+
+void FilterEngine::addFilter(FilterLayer* aFilter)
+{
+    if (Bits.contains(aFilter))
+        return;
+    int b = 0;
+    while (b < MaxFilters && (UsedBits & (Q_UINT64_C(1) << b)))
+        ++b;
+    if (b == MaxFilters) {
+        qWarning("FilterEngine: more than %d filter layers, %s is ignored", MaxFilters, qPrintable(aFilter->name()));
+        return;
+    }
+    UsedBits |= Q_UINT64_C(1) << b;
+    Bits.insert(aFilter, b);
+    {
+        QMutexLocker locker(&MembersLock);
+        Members[b].clear();
+    }
+    reorder();
+    recompute(aFilter);
+}
+
+void FilterEngine::removeFilter(FilterLayer* aFilter)
+{
+    QHash<FilterLayer*, int>::iterator it = Bits.find(aFilter);
+    if (it == Bits.end())
+        return;
+    int b = it.value();
+    quint64 theBit = Q_UINT64_C(1) << b;
+
+    // Features have the bit only if they are members, clearing it is enough
+    QMutexLocker locker(&MembersLock);
+    foreach (Feature* F, Members[b]) {
+        if (!g_backend.isAllocated(F))
+            continue;
+        F->setFilterMask(F->filterMask() & ~theBit, F->filterRevision());
+        F->invalidateMeta();
+    }
+    Members[b].clear();
+    Bits.erase(it);
+    UsedBits &= ~theBit;
+    Filters.removeAll(aFilter);
+    updateMasks();
+}
+
+void FilterEngine::reorder()
+{
+    Filters.clear();
+    for (int i=0; i<theDocument->layerSize(); ++i) {
+        FilterLayer* Fl = qobject_cast<FilterLayer*>(theDocument->getLayer(i));
+        if (Fl && Bits.contains(Fl))
+            Filters << Fl;
+    }
+    updateMasks();
+
+    // The first filter with an opacity wins, the members of several may change
+    foreach (FilterLayer* Fl, Filters)
+        invalidateMembers(Fl);
+}
+
+void FilterEngine::updateMasks()
+{
+    EnabledMask = HiddenMask = ReadonlyMask = 0;
+    foreach (FilterLayer* Fl, Filters) {
+        if (!Fl->isEnabled())
+            continue;
+        quint64 b = bit(Fl);
+        EnabledMask |= b;
+        if (!Fl->isVisible())
+            HiddenMask |= b;
+        if (Fl->isReadonly())
+            ReadonlyMask |= b;
+    }
+}
+
+void FilterEngine::invalidateMembers(FilterLayer* aFilter)
+{
+    updateMasks();
+    QHash<FilterLayer*, int>::const_iterator it = Bits.constFind(aFilter);
+    if (it == Bits.constEnd())
+        return;
+
+    // match() adds members from the render threads
+    QMutexLocker locker(&MembersLock);
+    QSet<Feature*>& theMembers = Members[it.value()];
+    QSet<Feature*>::iterator m = theMembers.begin();
+    while (m != theMembers.end()) {
+        // Deallocated features may already be gone, don't touch them
+        if (!g_backend.isAllocated(*m)) {
+            m = theMembers.erase(m);
+            continue;
+        }
+        (*m)->invalidateMeta();
+        ++m;
+    }
+}
+
+QList<Feature*> FilterEngine::allFeatures() const
+{
+    QList<Feature*> theFeatures;
+    for (int i=0; i<theDocument->layerSize(); ++i) {
+        Layer* L = theDocument->getLayer(i);
+        for (int j=0; j<L->size(); ++j)
+            theFeatures << L->get(j);
+    }
+    return theFeatures;
+}
+
+void FilterEngine::recompute(FilterLayer* aFilter)
+{
+    QHash<FilterLayer*, int>::const_iterator it = Bits.constFind(aFilter);
+    if (it == Bits.constEnd())
+        return;
+    int b = it.value();
+    quint64 theBit = Q_UINT64_C(1) << b;
+
+    QList<TagSelector*> theSelectors;
+    QList<quint64> theBits;
+    foreach (FilterLayer* Fl, Filters)
+        if (Fl->selector()) {
+            theSelectors << Fl->selector();
+            theBits << bit(Fl);
+        }
+
+    QList<Feature*> theFeatures = allFeatures();
+    QVector<quint64> theMasks(theFeatures.size());
+    QList<FilterChunk> theChunks;
+    for (int i=0; i<theFeatures.size(); i+=FILTER_CHUNK_SIZE) {
+        FilterChunk C = { i, qMin(i + FILTER_CHUNK_SIZE, theFeatures.size()) };
+        theChunks << C;
+    }
+
+    // The gui thread waits, as the selectors read tags it would otherwise be editing
+    QtConcurrent::blockingMap(theChunks, FilterEvaluator(theFeatures, theMasks, theSelectors, theBits, aFilter->selector(), theBit, Revision));
+
+    QMutexLocker locker(&MembersLock);
+    ++Revision;
+    Members[b].clear();
+    for (int i=0; i<theFeatures.size(); ++i) {
+        Feature* F = theFeatures[i];
+        quint64 mask = theMasks[i];
+        bool wasCurrent = (F->filterRevision() == Revision - 1);
+        quint64 old = F->filterMask();
+        F->setFilterMask(mask, Revision);
+
+        if (mask & theBit)
+            Members[b].insert(F);
+        if (!wasCurrent)
+            for (int j=0; j<MaxFilters; ++j)
+                if (j != b && (mask & (Q_UINT64_C(1) << j)))
+                    Members[j].insert(F);
+        if (!wasCurrent || old != mask)
+            F->invalidateMeta();
+    }
+}
+
+quint64 FilterEngine::match(Feature* F)
+{
+    quint64 mask = 0;
+    foreach (FilterLayer* Fl, Filters)
+        if (Fl->selector() && Fl->selector()->matches(F, 0) != TagSelect_NoMatch)
+            mask |= bit(Fl);
+
+    // Stale members are harmless, only missing ones would be
+    QMutexLocker locker(&MembersLock);
+    for (int j=0; j<MaxFilters; ++j)
+        if (mask & (Q_UINT64_C(1) << j))
+            Members[j].insert(F);
+    return mask;
+}
@@ -0,0 +1,68 @@
+#ifndef FILTERENGINE_H
+#define FILTERENGINE_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+
+class Document;
+class Feature;
+class FilterLayer;
+
+/// Tracks which features match the filter layers of a document.
+/// Every filter layer owns a bit of the per-feature filter mask, and the
+/// set of features that have it. Tag edits only re-evaluate the edited
+/// feature; a changed or added filter is evaluated over the document in
+/// parallel, for that filter alone. Showing, hiding or locking a filter
+/// then only has to touch its own members.
+class FilterEngine
+{
+public:
+    FilterEngine(Document* aDoc);
+    ~FilterEngine();
+
+    static const int MaxFilters = 64;
+
+    void addFilter(FilterLayer* aFilter);
+    void removeFilter(FilterLayer* aFilter);
+    /// The selector of aFilter changed
+    void recompute(FilterLayer* aFilter);
+    /// The visibility, lock, opacity or enabled state of aFilter changed
+    void invalidateMembers(FilterLayer* aFilter);
+    /// The filter layers were reordered
+    void reorder();
+
+    /// Evaluates F against every filter; the result is valid for revision()
+    quint64 match(Feature* F);
+    int revision() const { return Revision; }
+
+    /// Bits of the enabled filters
+    quint64 enabledMask() const { return EnabledMask; }
+    /// Bits of the enabled filters hiding their features
+    quint64 hiddenMask() const { return HiddenMask; }
+    /// Bits of the enabled filters locking their features
+    quint64 readonlyMask() const { return ReadonlyMask; }
+
+    /// Filters, in document order
+    const QList<FilterLayer*>& filters() const { return Filters; }
+    quint64 bit(FilterLayer* aFilter) const;
+
+private:
+    void updateMasks();
+    QList<Feature*> allFeatures() const;
+
+    Document* theDocument;
+    QList<FilterLayer*> Filters;
+    QHash<FilterLayer*, int> Bits;
+    quint64 UsedBits;
+    QSet<Feature*> Members[MaxFilters];
+    QMutex MembersLock;
+
+    int Revision;
+    quint64 EnabledMask;
+    quint64 HiddenMask;
+    quint64 ReadonlyMask;
+};
+
+#endif // FILTERENGINE_H
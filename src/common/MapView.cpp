@@ -12,7 +12,10 @@
 #include "IMapAdapter.h"
 #include "IMapWatermark.h"
 #include "Feature.h"
+#include "Features.h"
 #include "Interaction.h"
+#include "SnapIndex.h"
+#include "WireframeCache.h"
 #include "IPaintStyle.h"
 #include "Projection.h"
 #include "qgps.h"
@@ -34,6 +37,8 @@
 #include <QToolTip>
 #include <QMap>
 #include <QSet>
+#include <QProgressDialog>
+#include <QThread>
 #include <QtConcurrentMap>
 
 // from wikipedia
@@ -66,12 +71,19 @@ public:
     QLabel *TL, *TR, *BL, *BR;
 
     OsmRenderLayer* osmLayer;
+    SnapIndex* theSnapIndex;
+    WireframeCache theWireframeCache;
+
+    int ReprojectedRevision;
+    bool Reprojecting;
 
     MapViewPrivate()
       : PixelPerM(0.0), Viewport(WORLD_COORDBOX), theVectorRotation(0.0)
       , BackgroundOnlyPanZoom(false)
       , theDocument(0)
       , theInteraction(0)
+      , ReprojectedRevision(-1)
+      , Reprojecting(false)
     {}
 };
 
@@ -137,6 +149,8 @@ MapView::MapView(QWidget* parent) :
 
     p->osmLayer = new OsmRenderLayer(this);
     connect(p->osmLayer, SIGNAL(renderingDone()), SLOT(renderingDone()));
+
+    p->theSnapIndex = new SnapIndex(this);
 }
 
 MapView::~MapView()
@@ -144,6 +158,7 @@ MapView::~MapView()
     delete StaticBackground;
     delete StaticWireframe;
     delete StaticTouchup;
+    delete p->theSnapIndex;
     delete p;
 }
 
@@ -156,6 +171,7 @@ void MapView::setDocument(Document* aDoc)
 {
     p->theDocument = aDoc;
     p->osmLayer->setDocument(aDoc);
+    p->ReprojectedRevision = -1;
 
     setViewport(viewport(), rect());
 }
@@ -165,8 +181,18 @@ Document *MapView::document()
     return p->theDocument;
 }
 
+SnapIndex *MapView::snapIndex()
+{
+    return p->theSnapIndex;
+}
+
 void MapView::invalidate(bool updateWireframe, bool updateOsmMap, bool updateBgMap)
 {
+    if (p->Reprojecting)
+        return;
+    if (p->theDocument && p->ReprojectedRevision != p->theProjection.projectionRevision())
+        reprojectFeatures();
+
     if (updateOsmMap) {
         if (!M_PREFS->getWireframeView()) {
             if (!TEST_RFLAGS(RendererOptions::Interacting))
@@ -215,6 +241,128 @@ void MapView::invalidate(bool updateWireframe, bool updateOsmMap, bool updateBgM
     update();
 }
 
+#define REPROJECT_CHUNK_SIZE 8192
+
+namespace {
+
+/* Projects a range of nodes: their positions are gathered in contiguous
+   buffers, so that proj sees the whole range in one call */
+class NodeProjector
+{
+public:
+    typedef void result_type;
+
+    NodeProjector(const QVector<Node*>& aNodes, const Projection& aProjection)
+        : theNodes(aNodes), theProjection(aProjection)
+    {
+    }
+
+    void operator()(int aFirst) const
+    {
+        int n = qMin(REPROJECT_CHUNK_SIZE, theNodes.size() - aFirst);
+        QVector<qreal> x(n), y(n);
+        for (int i=0; i<n; ++i) {
+            Coord c = theNodes[aFirst+i]->position();
+            x[i] = c.x();
+            y[i] = c.y();
+        }
+        theProjection.projectBatch(n, x.data(), y.data());
+        for (int i=0; i<n; ++i) {
+            Node* N = theNodes[aFirst+i];
+            N->Projected = QPointF(x[i], y[i]);
+            N->ProjectionRevision = theProjection.projectionRevision();
+        }
+    }
+
+private:
+    const QVector<Node*>& theNodes;
+    const Projection& theProjection;
+};
+
+class WayPathBuilder
+{
+public:
+    typedef void result_type;
+
+    WayPathBuilder(const QVector<Way*>& aWays, const Projection& aProjection)
+        : theWays(aWays), theProjection(aProjection)
+    {
+    }
+
+    void operator()(int aFirst) const
+    {
+        int last = qMin(aFirst + REPROJECT_CHUNK_SIZE, theWays.size());
+        for (int i=aFirst; i<last; ++i)
+            theWays[i]->buildPath(theProjection);
+    }
+
+private:
+    const QVector<Way*>& theWays;
+    const Projection& theProjection;
+};
+
+}
+
+/* After a projection change, projects all the nodes and rebuilds the paths
+   of the ways in parallel, before any rendering thread gets to do it one
+   feature at a time. */
+void MapView::reprojectFeatures()
+{
+    p->ReprojectedRevision = p->theProjection.projectionRevision();
+
+    QVector<Node*> theNodes;
+    QVector<Way*> theWays;
+    QList<Relation*> theRelations;
+    for (int i=0; i<p->theDocument->layerSize(); ++i) {
+        Layer* L = p->theDocument->getLayer(i);
+        for (int j=0; j<L->size(); ++j) {
+            Feature* F = L->get(j);
+            if (CHECK_NODE(F))
+                theNodes << STATIC_CAST_NODE(F);
+            else if (CHECK_WAY(F))
+                theWays << STATIC_CAST_WAY(F);
+            else if (CHECK_RELATION(F))
+                theRelations << STATIC_CAST_RELATION(F);
+        }
+    }
+    if (!theNodes.size() && !theWays.size() && !theRelations.size())
+        return;
+
+    p->osmLayer->stopRendering();
+    p->Reprojecting = true;
+
+    QList<int> theNodeChunks, theWayChunks;
+    for (int i=0; i<theNodes.size(); i+=REPROJECT_CHUNK_SIZE)
+        theNodeChunks << i;
+    for (int i=0; i<theWays.size(); i+=REPROJECT_CHUNK_SIZE)
+        theWayChunks << i;
+
+    QProgressDialog progress(tr("Reprojecting..."), QString(), 0, theNodeChunks.size() + theWayChunks.size() + 1, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(500);
+
+    // Ways need their nodes projected first
+    QFuture<void> theFuture = QtConcurrent::map(theNodeChunks, NodeProjector(theNodes, p->theProjection));
+    while (!theFuture.isFinished()) {
+        progress.setValue(theFuture.progressValue());
+        QThread::msleep(20);
+    }
+    theFuture = QtConcurrent::map(theWayChunks, WayPathBuilder(theWays, p->theProjection));
+    while (!theFuture.isFinished()) {
+        progress.setValue(theNodeChunks.size() + theFuture.progressValue());
+        QThread::msleep(20);
+    }
+
+    // A multipolygon may rewrite the path of its outer way, two of them
+    // can share it: relations are done here
+    foreach (Relation* R, theRelations)
+        R->buildPath(p->theProjection);
+    progress.setValue(progress.maximum());
+
+    p->Reprojecting = false;
+    p->osmLayer->resumeRendering();
+}
+
 void MapView::panScreen(QPoint delta)
 {
     Coord cDelta = fromView(delta) - fromView(QPoint(0, 0));
@@ -269,7 +417,7 @@ void MapView::rotateScreen(QPoint /* center */, qreal angle)
 
 void MapView::paintEvent(QPaintEvent * anEvent)
 {
-    if (!p->theDocument)
+    if (!p->theDocument || p->Reprojecting)
         return;
 
 #ifndef NDEBUG
@@ -632,14 +780,29 @@ void MapView::updateWireframe()
             P.setRenderHint(QPainter::Antialiasing);
         else if (M_PREFS->getEditRendering() == 1)
             P.setRenderHint(QPainter::Antialiasing);
+        // Ways are drawn from the cached screen polylines, batched by pen
+        // within each priority so that the priority order is kept
+        p->theWireframeCache.sync(p->theDocument, p->theTransform, p->theProjection);
+        QList<Way*> theWays;
+        QList<Feature*> theOthers;
         for (itm = theFeatures.constBegin() ;itm != theFeatures.constEnd(); ++itm)
         {
+            theWays.clear();
+            theOthers.clear();
             for (it = itm.value().constBegin() ;it != itm.value().constEnd(); ++it)
             {
-                qreal alpha = (*it)->getAlpha();
+                if (CHECK_WAY(*it))
+                    theWays << STATIC_CAST_WAY(*it);
+                else
+                    theOthers << *it;
+            }
+            p->theWireframeCache.drawWays(P, theWays, p->theProjection);
+
+            foreach (Feature* F, theOthers) {
+                qreal alpha = F->getAlpha();
                 P.setOpacity(alpha);
 
-                (*it)->drawSimple(P, this);
+                F->drawSimple(P, this);
             }
         }
     }
@@ -16,6 +16,7 @@ class Document;
 class MapAdapter;
 class Interaction;
 class ImageMapLayer;
+class SnapIndex;
 
 class MapViewPrivate;
 
@@ -34,6 +35,7 @@ public:
     Document* document();
     Interaction* interaction();
     void setInteraction(Interaction* anInteraction);
+    SnapIndex* snapIndex();
 
     void drawFeatures(QPainter & painter);
     void drawFeaturesSync(QPainter & P);
@@ -100,6 +102,7 @@ private:
     void drawGPS(QPainter & painter);
     void updateStaticBackground();
     void updateWireframe();
+    void reprojectFeatures();
 
     MainWindow* Main;
     QPixmap* StaticBackground;
@@ -83,6 +83,39 @@ QPointF Projection::project(Node* aNode) const
     return project(aNode->position());
 }
 
+void Projection::projectBatch(int aCount, qreal* x, qreal* y) const
+{
+    if (IsMercator) {
+        for (int i=0; i<aCount; ++i) {
+            QPointF pt = mercatorProject(QPointF(x[i], y[i]));
+            x[i] = pt.x();
+            y[i] = pt.y();
+        }
+        return;
+    }
+    if (IsLatLong)
+        return;
+
+#ifndef _MOBILE
+    for (int i=0; i<aCount; ++i) {
+        x[i] = angToRad(x[i]);
+        y[i] = angToRad(y[i]);
+    }
+    // Neither a projPJ nor the default context may be used by two threads
+    // at once, each call has its own
+    projCtx ctx = pj_ctx_alloc();
+    ProjProjection src = getProjection("+proj=longlat +ellps=WGS84 +datum=WGS84", ctx);
+    ProjProjection dst = getProjection(projProj4, ctx);
+    if (src && dst)
+        projTransform(src, dst, aCount, 1, x, y, NULL);
+    if (src)
+        pj_free(src);
+    if (dst)
+        pj_free(dst);
+    pj_ctx_free(ctx);
+#endif
+}
+
 QLineF Projection::project(const QLineF & Map) const
 {
     if  (IsMercator)
@@ -207,8 +240,10 @@ bool Projection::projIsLatLong() const
 
 
 #ifndef _MOBILE
-ProjProjection Projection::getProjection(QString projString)
+ProjProjection Projection::getProjection(QString projString, projCtx aCtx)
 {
+    if (aCtx)
+        return pj_init_plus_ctx(aCtx, QString("%1 +over").arg(projString).toLatin1());
     ProjProjection theProj = pj_init_plus(QString("%1 +over").arg(projString).toLatin1());
     return theProj;
 }
@@ -35,6 +35,10 @@ public:
     bool projIsLatLong() const;
 
     QPointF project(Node* aNode) const;
+    /// Projects aCount lon/lat positions in place, with a single
+    /// transformation call. Each call uses its own PROJ context, so that
+    /// several threads may project at once.
+    void projectBatch(int aCount, qreal* x, qreal* y) const;
     QRectF toProjectedRectF(const QRectF& Viewport, const QRect& screen) const;
     CoordBox fromProjectedRectF(const QRectF& Viewport) const;
 
@@ -43,7 +47,7 @@ public:
 
 #ifndef _MOBILE
 
-    static ProjProjection getProjection(QString projString);
+    static ProjProjection getProjection(QString projString, projCtx aCtx = NULL);
     static void projTransform(ProjProjection srcdefn,
                               ProjProjection dstdefn,
                               long point_count, int point_offset, qreal *x, qreal *y, qreal *z );
@@ -0,0 +1,279 @@
+#include "TrackManipulations.h"
+
+#include "Global.h"
+#include "Document.h"
+#include "DocumentCommands.h"
+#include "TrackSegmentCommands.h"
+#include "Layer.h"
+#include "Node.h"
+
+#include <QBitArray>
+#include <QPair>
+#include <QtConcurrentMap>
+#include <QtCore/qmath.h>
+
+#include <algorithm>
+
+#define METERS_PER_DEGREE 111319.49
+
+static bool timeLessThan(const TrackPoint& a, const TrackPoint& b)
+{
+    return a.Time < b.Time;
+}
+
+TrackPoints sortTrackPoints(const TrackPoints& thePoints)
+{
+    TrackPoints theResult(thePoints);
+    std::stable_sort(theResult.begin(), theResult.end(), timeLessThan);
+    return theResult;
+}
+
+QList<TrackPoints> splitTrackPoints(const TrackPoints& thePoints, int MaxGapTime, qreal MaxGapDistance)
+{
+    QList<TrackPoints> theResult;
+    theResult << TrackPoints();
+    for (int i=0; i<thePoints.size(); ++i) {
+        if (i) {
+            const TrackPoint& a = thePoints[i-1];
+            const TrackPoint& b = thePoints[i];
+            if ((MaxGapTime > 0 && qint64(b.Time) - qint64(a.Time) > MaxGapTime)
+                    || (MaxGapDistance > 0. && a.Position.distanceFrom(b.Position) > MaxGapDistance))
+                theResult << TrackPoints();
+        }
+        theResult.last().append(thePoints[i]);
+    }
+    return theResult;
+}
+
+/* Speed (km/h) needed to go from a to b; points with the same time are
+   taken to be a second apart */
+static qreal speedBetween(const TrackPoint& a, const TrackPoint& b)
+{
+    qint64 dt = qMax(qint64(b.Time) - qint64(a.Time), qint64(1));
+    return a.Position.distanceFrom(b.Position) / dt * 3600.;
+}
+
+TrackPoints removeTrackOutliers(const TrackPoints& thePoints, qreal MaxSpeed)
+{
+    TrackPoints theResult;
+    theResult.reserve(thePoints.size());
+    for (int i=0; i<thePoints.size(); ++i) {
+        const TrackPoint& Pt = thePoints[i];
+        if (Pt.Node || theResult.isEmpty()) {
+            theResult.append(Pt);
+            continue;
+        }
+        // A point is only a spike if the next one can be reached from the
+        // last kept point; otherwise the jump is real (or the outlier was kept)
+        const TrackPoint& Last = theResult.last();
+        if (speedBetween(Last, Pt) > MaxSpeed
+                && i+1 < thePoints.size() && speedBetween(Last, thePoints[i+1]) <= MaxSpeed)
+            continue;
+        theResult.append(Pt);
+    }
+    return theResult;
+}
+
+/* Distance (m) of point i to the chord a-b. When the points are timed, this
+   is the distance to where the chord is at the time of the point, so that
+   stops and speed changes are kept too. */
+static qreal chordError(const TrackPoints& P, const QVector<qreal>& X, const QVector<qreal>& Y, int a, int b, int i)
+{
+    qreal dx = X[b] - X[a];
+    qreal dy = Y[b] - Y[a];
+    qreal t = 0.;
+    if (P[b].Time > P[a].Time)
+        t = qreal(qint64(P[i].Time) - qint64(P[a].Time)) / (P[b].Time - P[a].Time);
+    else if (dx*dx + dy*dy > 0.)
+        t = ((X[i] - X[a])*dx + (Y[i] - Y[a])*dy) / (dx*dx + dy*dy);
+    t = qBound(qreal(0.), t, qreal(1.));
+    qreal ex = X[i] - (X[a] + t*dx);
+    qreal ey = Y[i] - (Y[a] + t*dy);
+    return qSqrt(ex*ex + ey*ey);
+}
+
+TrackPoints simplifyTrackPoints(const TrackPoints& thePoints, qreal Tolerance)
+{
+    int n = thePoints.size();
+    if (n < 3)
+        return thePoints;
+
+    // Local metric coordinates, good enough over the extent of a track
+    qreal k = qCos(thePoints[0].Position.y() * M_PI / 180.);
+    QVector<qreal> X(n), Y(n);
+    for (int i=0; i<n; ++i) {
+        X[i] = thePoints[i].Position.x() * k * METERS_PER_DEGREE;
+        Y[i] = thePoints[i].Position.y() * METERS_PER_DEGREE;
+    }
+
+    // Douglas-Peucker with an explicit stack; materialised points are fixed
+    // and the ranges between them are simplified on their own
+    QBitArray Keep(n);
+    QVector<QPair<int, int> > Ranges;
+    int Start = 0;
+    Keep.setBit(0);
+    for (int i=1; i<n; ++i)
+        if (thePoints[i].Node || i == n-1) {
+            Keep.setBit(i);
+            Ranges << qMakePair(Start, i);
+            Start = i;
+        }
+
+    while (!Ranges.isEmpty()) {
+        QPair<int, int> R = Ranges.last();
+        Ranges.pop_back();
+        if (R.second - R.first < 2)
+            continue;
+
+        qreal MaxError = -1;
+        int MaxPos = 0;
+        for (int i=R.first+1; i<R.second; ++i) {
+            qreal e = chordError(thePoints, X, Y, R.first, R.second, i);
+            if (e > MaxError) {
+                MaxError = e;
+                MaxPos = i;
+            }
+        }
+        if (MaxError > Tolerance) {
+            Keep.setBit(MaxPos);
+            Ranges << qMakePair(R.first, MaxPos) << qMakePair(MaxPos, R.second);
+        }
+    }
+
+    TrackPoints theResult;
+    theResult.reserve(Keep.count(true));
+    for (int i=0; i<n; ++i)
+        if (Keep.testBit(i))
+            theResult.append(thePoints[i]);
+    return theResult;
+}
+
+static TrackPoint interpolate(const TrackPoint& a, const TrackPoint& b, uint aTime)
+{
+    qreal f = qreal(aTime - a.Time) / (b.Time - a.Time);
+    TrackPoint Pt;
+    Pt.Position = Coord(a.Position.x() + f*(b.Position.x() - a.Position.x()), a.Position.y() + f*(b.Position.y() - a.Position.y()));
+    Pt.Time = aTime;
+    Pt.Elevation = a.Elevation + f*(b.Elevation - a.Elevation);
+    Pt.Speed = a.Speed + f*(b.Speed - a.Speed);
+    Pt.Node = NULL;
+    return Pt;
+}
+
+/* Points are put every Interval seconds along the track, which has to be
+   sorted by time. The end points and materialised points are kept. */
+TrackPoints resampleTrackPoints(const TrackPoints& thePoints, int Interval)
+{
+    int n = thePoints.size();
+    if (n < 2 || Interval <= 0)
+        return thePoints;
+
+    TrackPoints theResult;
+    theResult.append(thePoints[0]);
+    uint Next = thePoints[0].Time + Interval;
+    for (int i=1; i<n; ++i) {
+        const TrackPoint& a = thePoints[i-1];
+        const TrackPoint& b = thePoints[i];
+        if (b.Time > a.Time)
+            for (; Next < b.Time; Next += Interval)
+                if (Next > a.Time)
+                    theResult.append(interpolate(a, b, Next));
+
+        if (b.Node || i == n-1) {
+            theResult.append(b);
+            Next = b.Time + Interval;
+        } else if (Next == b.Time) {
+            theResult.append(b);
+            Next += Interval;
+        }
+    }
+    return theResult;
+}
+
+namespace {
+
+struct TrackJob
+{
+    TrackSegment* Segment;
+    TrackPoints Points;
+    QList<TrackPoints> Result;
+};
+
+class TrackProcessor
+{
+public:
+    typedef TrackJob result_type;
+
+    TrackProcessor(const TrackProcessing& aProcessing)
+        : theProcessing(aProcessing)
+    {
+    }
+
+    TrackJob operator()(const TrackJob& aJob) const
+    {
+        TrackJob theJob(aJob);
+        switch (theProcessing.Operation) {
+        case TrackSortByTime:
+            theJob.Result << sortTrackPoints(aJob.Points);
+            break;
+        case TrackSplitOnGaps:
+            theJob.Result = splitTrackPoints(aJob.Points, theProcessing.MaxGapTime, theProcessing.MaxGapDistance);
+            break;
+        case TrackRemoveOutliers:
+            theJob.Result << removeTrackOutliers(aJob.Points, theProcessing.MaxSpeed);
+            break;
+        case TrackSimplify:
+            theJob.Result << simplifyTrackPoints(aJob.Points, theProcessing.Tolerance);
+            break;
+        case TrackResample:
+            theJob.Result << resampleTrackPoints(aJob.Points, theProcessing.Interval);
+            break;
+        }
+        return theJob;
+    }
+
+private:
+    TrackProcessing theProcessing;
+};
+
+}
+
+static bool samePoints(const TrackPoints& a, const TrackPoints& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (int i=0; i<a.size(); ++i)
+        if (a[i].Node != b[i].Node || a[i].Time != b[i].Time || !(a[i].Position == b[i].Position)
+                || a[i].Elevation != b[i].Elevation || a[i].Speed != b[i].Speed)
+            return false;
+    return true;
+}
+
+void processTracks(Document* theDocument, CommandList* theList, const QList<TrackSegment*>& theSegments, const TrackProcessing& theProcessing)
+{
+    // The points are copied out on the gui thread, as materialised points
+    // are read from their node
+    QList<TrackJob> theJobs;
+    foreach (TrackSegment* S, theSegments) {
+        if (S->size() < 2 || !S->layer())
+            continue;
+        TrackJob theJob;
+        theJob.Segment = S;
+        theJob.Points = S->points();
+        theJobs << theJob;
+    }
+
+    QList<TrackJob> theResults = QtConcurrent::blockingMapped(theJobs, TrackProcessor(theProcessing));
+
+    EditTransaction transaction(theDocument);
+    foreach (const TrackJob& J, theResults) {
+        Layer* L = J.Segment->layer();
+        if (!samePoints(J.Points, J.Result[0]))
+            theList->add(new TrackSegmentSetPointsCommand(J.Segment, J.Result[0], L));
+        for (int i=1; i<J.Result.size(); ++i) {
+            TrackSegment* S = g_backend.allocSegment(L);
+            theList->add(new AddFeatureCommand(L, S, false));
+            theList->add(new TrackSegmentSetPointsCommand(S, J.Result[i], L));
+        }
+    }
+}
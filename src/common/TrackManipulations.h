@@ -0,0 +1,51 @@
+#ifndef MERKAARTOR_TRACKMANIPULATIONS_H_
+#define MERKAARTOR_TRACKMANIPULATIONS_H_
+
+class CommandList;
+class Document;
+class TrackSegment;
+
+#include <QList>
+#include "TrackSegment.h"
+
+/// Whole-segment processing of GPS tracks. The algorithms work on copies of
+/// the segment points and run in parallel across segments; the result is
+/// applied through undoable commands. Materialised points (which may be
+/// tagged or referenced) are never dropped.
+enum TrackOperation
+{
+    TrackSortByTime,
+    TrackSplitOnGaps,
+    TrackRemoveOutliers,
+    TrackSimplify,
+    TrackResample
+};
+
+struct TrackProcessing
+{
+    TrackProcessing(TrackOperation anOperation)
+        : Operation(anOperation), MaxGapTime(300), MaxGapDistance(0.5), MaxSpeed(300.0), Tolerance(3.0), Interval(5)
+    {
+    }
+
+    TrackOperation Operation;
+    /// Split on gaps: maximum time (s) and distance (km) between points, 0 to ignore
+    int MaxGapTime;
+    qreal MaxGapDistance;
+    /// Outlier removal: maximum speed (km/h) to reach a point
+    qreal MaxSpeed;
+    /// Simplification: maximum error (m)
+    qreal Tolerance;
+    /// Resampling: time between points (s)
+    int Interval;
+};
+
+TrackPoints sortTrackPoints(const TrackPoints& thePoints);
+QList<TrackPoints> splitTrackPoints(const TrackPoints& thePoints, int MaxGapTime, qreal MaxGapDistance);
+TrackPoints removeTrackOutliers(const TrackPoints& thePoints, qreal MaxSpeed);
+TrackPoints simplifyTrackPoints(const TrackPoints& thePoints, qreal Tolerance);
+TrackPoints resampleTrackPoints(const TrackPoints& thePoints, int Interval);
+
+void processTracks(Document* theDocument, CommandList* theList, const QList<TrackSegment*>& theSegments, const TrackProcessing& theProcessing);
+
+#endif
@@ -5,10 +5,12 @@ DEPENDPATH += $$MERKAARTOR_SRC_DIR/common
 HEADERS += Global.h \
     Coord.h \
     Document.h \
+    FilterEngine.h \
     MapTypedef.h \
     Painting.h \
     Projection.h \
     FeatureManipulations.h \
+    TrackManipulations.h \
     MapView.h \
     TagModel.h \
     GotoDialog.h \
@@ -18,9 +20,11 @@ HEADERS += Global.h \
 SOURCES += Global.cpp \
     Coord.cpp \
     Document.cpp \
+    FilterEngine.cpp \
     Painting.cpp \
     Projection.cpp \
     FeatureManipulations.cpp \
+    TrackManipulations.cpp \
     MapView.cpp \
     TagModel.cpp \
     GotoDialog.cpp \
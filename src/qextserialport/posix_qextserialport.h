@@ -43,6 +43,9 @@ public:
     virtual void setRts(bool set=true);
     virtual ulong lineStatus();
 
+    /// File descriptor of the open port, to be watched for incoming data
+    int handle() const { return Posix_File->handle(); }
+
 protected:
     QFile* Posix_File;
     struct termios Posix_CommConfig;